@@ -203,15 +203,10 @@ struct agwpecom {
 	int			   socketscount;
 	const struct agwpesocket **sockets;
 
-	int		wrlen;
-	int		wrcursor;
-
-	int		rdneed;  // this much in rdbuf before decision
-	int		rdlen;
-	int		rdcursor;
-
-	uint8_t		wrbuf[4196];
-	uint8_t		rdbuf[4196];
+	struct ringbuf	wr;
+	struct ringbuf	rd;
+	uint8_t		wrbuf[4096];
+	uint8_t		rdbuf[4096];
 };
 
 // One agwpesocket per interface
@@ -226,7 +221,7 @@ static struct agwpecom **pecom;
 static int               pecomcount;
 
 
-static uint32_t get_le32(uint8_t *u) {
+static uint32_t get_le32(const uint8_t *u) {
 	return (u[3] << 24 |
 		u[2] << 16 |
 		u[1] <<  8 |
@@ -262,7 +257,8 @@ static struct agwpecom *agwpe_find_or_add_com(const char *hostname, const char *
 	com = calloc(1, sizeof(*com));
 	com->fd = -1;
 	com->netaddr = netresolv_add(hostname, hostport);
-	com->rdneed = sizeof(struct agwpeheader);
+	ringbuf_init(&com->wr, com->wrbuf, sizeof(com->wrbuf));
+	ringbuf_init(&com->rd, com->rdbuf, sizeof(com->rdbuf));
 	tv_timeradd_millis(&com->wait_until, &tick, 30000); // redo in 30 seconds or so
 
 	++pecomcount;
@@ -303,7 +299,7 @@ void *agwpe_addport(const char *hostname, const char *hostport, const char *agwp
 // close the AGWPE communication socket, retry its call at some point latter
 static void agwpe_reset(struct agwpecom *com, const char *why)
 {
-	com->wrlen = com->wrcursor = 0;
+	ringbuf_reset(&com->wr);
 	tv_timeradd_millis(&com->wait_until, &tick, 30000); // redo in 30 seconds or so
 
 	if (debug>1)
@@ -324,31 +320,20 @@ static void agwpe_reset(struct agwpecom *com, const char *why)
  */
 static void agwpe_flush(struct agwpecom *com)
 {
-	int i, len;
+	int i;
 
 	if (com->fd < 0) return; // nothing to do!
 
-	if ((com->wrlen == 0) || (com->wrlen > 0 && com->wrcursor >= com->wrlen)) {
-	  com->wrlen = com->wrcursor = 0;	/* already all written */
-	  return;
-	}
-
-	/* Now there is some data in between wrcursor and wrlen */
-
 #ifndef MSG_NOSIGNAL
 # define MSG_NOSIGNAL 0 /* This exists only on Linux  */
 #endif
 
-	len = com->wrlen - com->wrcursor;
-	if (len > 0) {
-	  i = send(com->fd, com->wrbuf + com->wrcursor, len, MSG_NOSIGNAL);
-	  /* No SIGPIPE if the
-	     receiver is out,
-	     or pipe is full
-	     because it is doing
-	     slow reconnection. */
-	} else
-	  i = 0;
+	i = ringbuf_send(&com->wr, com->fd, MSG_NOSIGNAL);
+	/* No SIGPIPE if the
+	   receiver is out,
+	   or pipe is full
+	   because it is doing
+	   slow reconnection. */
 	if (i < 0 && (errno == EPIPE ||
 		      errno == ECONNRESET ||
 		      errno == ECONNREFUSED ||
@@ -357,18 +342,6 @@ static void agwpe_flush(struct agwpecom *com)
 	  agwpe_reset(com,"write to remote closed socket");
 	  return;
 	}
-	if (i > 0) {		/* wrote something */
-		com->wrcursor += i;
-		len = com->wrlen - com->wrcursor;
-		if (len == 0) {
-			com->wrcursor = com->wrlen = 0;	/* wrote all ! */
-		} else {
-			/* compact the buffer a bit */
-			memcpy(com->wrbuf, com->wrbuf + com->wrcursor, len);
-			com->wrcursor = 0;
-			com->wrlen = len;
-		}
-	}
 }
 
 
@@ -376,7 +349,6 @@ void agwpe_sendto(const void *_ap, const uint8_t *axaddr, const int axaddrlen, c
 
 	struct agwpesocket *agwpe = (struct agwpesocket*)_ap;
 	struct agwpecom *com = agwpe->com;
-	int space = sizeof(com->wrbuf) - com->wrlen;
 	struct agwpeheader hdr;
 
 	if (debug) {
@@ -388,13 +360,15 @@ void agwpe_sendto(const void *_ap, const uint8_t *axaddr, const int axaddrlen, c
 	  return;
 	}
 
-	agwpe_flush(com); // write out buffered data, if any
-
-	if (space < (sizeof(struct agwpeheader) + axaddrlen + axdatalen)) {
-	  // Uh, no space at all!
-	  if (debug)
-	    printf("ERROR: No buffer space to send data to AGWPE socket");
-	  return;
+	if (ringbuf_space(&com->wr) < (sizeof(struct agwpeheader) + axaddrlen + axdatalen)) {
+	  agwpe_flush(com); // make room by writing out earlier frames
+	  if (com->fd < 0 ||
+	      ringbuf_space(&com->wr) < (sizeof(struct agwpeheader) + axaddrlen + axdatalen)) {
+	    // Uh, no space at all!
+	    if (debug)
+	      printf("ERROR: No buffer space to send data to AGWPE socket");
+	    return;
+	  }
 	}
 
 	memset(&hdr, 0, sizeof(hdr));
@@ -402,14 +376,11 @@ void agwpe_sendto(const void *_ap, const uint8_t *axaddr, const int axaddrlen, c
 	set_le32((uint8_t*)(&hdr.dataKind), 'K');
 	set_le32((uint8_t*)(&hdr.dataLength), axaddrlen + axdatalen);
 
-	memcpy(com->wrbuf + com->wrlen, &hdr, sizeof(hdr));
-	com->wrlen += sizeof(hdr);
-	memcpy(com->wrbuf + com->wrlen, axaddr, axaddrlen);
-	com->wrlen += axaddrlen;
-	memcpy(com->wrbuf + com->wrlen, axdata, axdatalen);
-	com->wrlen += axdatalen;
+	ringbuf_put(&com->wr, &hdr, sizeof(hdr));
+	ringbuf_put(&com->wr, axaddr, axaddrlen);
+	ringbuf_put(&com->wr, axdata, axdatalen);
 
-	agwpe_flush(com); // write out buffered data
+	// agwpe_prepoll() sends all frames of this poll round at once
 
 	// Account transmission
 	erlang_add(agwpe->iface->callsign, ERLANG_TX, axaddrlen+axdatalen + 10, 1);  // agwpe_sendto()
@@ -417,9 +388,17 @@ void agwpe_sendto(const void *_ap, const uint8_t *axaddr, const int axaddrlen, c
 
 
 
+/* Is the write ring backed up?  Transmit scheduler holds frames then. */
+int agwpe_txbusy(const void *_ap) {
+
+	const struct agwpesocket *agwpe = (const struct agwpesocket*)_ap;
+
+	return ringbuf_used(&agwpe->com->wr) > (int)sizeof(agwpe->com->wrbuf) / 2;
+}
+
+
 static int agwpe_controlwrite(struct agwpecom *com, const uint32_t oper) {
 
-	int space = sizeof(com->wrbuf) - com->wrlen;
 	struct agwpeheader hdr;
 
 	if (debug) {
@@ -431,9 +410,7 @@ static int agwpe_controlwrite(struct agwpecom *com, const uint32_t oper) {
 	  return -1;
 	}
 
-	agwpe_flush(com); // write out buffered data, if any
-
-	if (space < sizeof(hdr)) {
+	if (ringbuf_space(&com->wr) < sizeof(hdr)) {
 	  // No room :-(
 	  return -1;
 	}
@@ -445,18 +422,46 @@ static int agwpe_controlwrite(struct agwpecom *com, const uint32_t oper) {
 	  hexdumpfp(stdout, (const uint8_t *)&hdr, sizeof(hdr), 0);
 
 	
-	memcpy(com->wrbuf + com->wrlen, &hdr, sizeof(hdr));
-	com->wrlen += sizeof(hdr);
-
-	agwpe_flush(com); // write out buffered data
+	ringbuf_put(&com->wr, &hdr, sizeof(hdr));
 	return 0;
 }
 
 
+/*
+ *  One AGWPE connection carries all radio ports of the engine,
+ *  the frame goes to the interface of its port.  The data begins
+ *  with a KISS style command byte, and there is no FCS.
+ */
 static void agwpe_parse_raw_ax25(struct agwpecom *com,
 				 struct agwpeheader *hdr, const uint8_t *rxbuf)
 {
-#warning "WRITEME: AGWPE Raw AX.25 reception"
+	const struct agwpesocket *S = NULL;
+	const int rcvlen = hdr->dataLength;
+	int i;
+
+	for (i = 0; i < com->socketscount; ++i) {
+	  if (com->sockets[i]->portnum == (int)hdr->radioPort) {
+	    S = com->sockets[i];
+	    break;
+	  }
+	}
+	if (S == NULL) {
+	  if (debug>1)
+	    printf(".. AGWPE port %d is not configured for receiving\n",
+		   hdr->radioPort+1);
+	  return;
+	}
+	if (rcvlen < 2)
+	  return; // No AX.25 frame at all
+
+	erlang_add(S->iface->callsign, ERLANG_RX, rcvlen + 10, 1);  // agwpe_read()
+
+	// Send it to Rx-IGate, validates also AX.25 header bits,
+	// and returns non-zero only when things are OK for processing.
+	if (!ax25_to_tnc2(S->iface, S->iface->callsign, 0, rxbuf[0], rxbuf + 1, rcvlen - 1)) {
+	  rfloghex(S->iface->callsign, 'D', 1, rxbuf, rcvlen);
+	  erlang_add(S->iface->callsign, ERLANG_DROP, rcvlen + 10, 1);  /* Account one packet */
+	}
 }
 
 
@@ -513,67 +518,76 @@ static void agwpe_parsereceived(struct agwpecom *com,
 
 
 
-static void agwpe_read(struct agwpecom *com) {
+/*
+ *  agwpe_decode()  -- process all complete frames in the read ring
+ *
+ *  Returns -1 for a frame that can never fit in the ring.
+ */
+static int agwpe_decode(struct agwpecom *com) {
 
-	int rcvspace = sizeof(com->rdbuf) - com->rdlen;
-	int rcvlen;
 	struct agwpeheader hdr;
+	uint8_t tmp[sizeof(com->rdbuf)];
+	const uint8_t *p;
+	int used;
 
-	if (com->fd < 0) {
-	  // Should not happen..
-	  return;
-	}
+	while ((used = ringbuf_used(&com->rd)) >= (int)sizeof(hdr)) {
 
-	if (com->rdlen > com->rdcursor) {
-	  memcpy(com->rdbuf, com->rdbuf + com->rdcursor,
-		 com->rdlen - com->rdcursor);
-	  com->rdlen -= com->rdcursor;
-	}
-	com->rdcursor = 0;
+	  p = ringbuf_linear(&com->rd, 0, sizeof(hdr), tmp);
+	  hdr.radioPort = get_le32(p + 0);
+	  hdr.dataKind  = get_le32(p + 4);
+	  memcpy(hdr.fromCall, p + 8, 10);
+	  memcpy(hdr.toCall,   p + 18, 10);
+	  hdr.dataLength = get_le32(p + 28);
+	  hdr.userField  = get_le32(p + 32);
 
+	  if (hdr.dataLength > sizeof(com->rdbuf) - sizeof(hdr)) {
+	    // line noise or something...
+	    return -1;
+	  }
+	  if (used < (int)(sizeof(hdr) + hdr.dataLength)) {
+	    // insufficient amount received, continue with it latter
+	    break;
+	  }
 
-	rcvlen = read(com->fd, com->rdbuf + com->rdlen, rcvspace);
-	if (rcvlen > 0)
-	  com->rdlen += rcvlen;
-	if (com->rdlen < com->rdneed) {
-	  // insufficient amount received, continue with it latter
-	  return;
+	  // Process received frame, in place unless it wraps the ring
+	  p = ringbuf_linear(&com->rd, sizeof(hdr), hdr.dataLength, tmp);
+	  agwpe_parsereceived(com, &hdr, p);
+
+	  ringbuf_skip(&com->rd, sizeof(hdr) + hdr.dataLength);
 	}
+	return 0;
+}
 
-	while (com->rdlen >= com->rdneed) {
 
-	  hdr.radioPort = get_le32(com->rdbuf + 0);
-	  hdr.dataKind  = get_le32(com->rdbuf + 4);
-	  memcpy(hdr.fromCall, com->rdbuf + 8, 10);
-	  memcpy(hdr.toCall,   com->rdbuf + 18, 10);
-	  hdr.dataLength = get_le32(com->rdbuf + 28);
-	  hdr.userField  = get_le32(com->rdbuf + 32);
+static void agwpe_read(struct agwpecom *com) {
 
-	  if (com->rdneed < (sizeof(hdr) + hdr.dataLength)) {
-	    // recalculate needed data size
-	    com->rdneed = sizeof(hdr) + hdr.dataLength;
-	  }
-	  if (com->rdneed > sizeof(com->rdbuf)) {
-	    // line noise or something...
-	    agwpe_reset(com,"received junk data");
+	int i, space;
+
+	if (com->fd < 0) {
+	  // Should not happen..
+	  return;
+	}
+
+	// Read until the socket is empty, decoding as the ring fills
+	for (;;) {
+	  space = ringbuf_space(&com->rd);
+	  i = ringbuf_read(&com->rd, com->fd);
+	  if (i == 0) {
+	    agwpe_reset(com,"remote closed socket");
 	    return;
 	  }
-	  if (com->rdlen < com->rdneed) {
-	    // insufficient amount received..
-	    break;
+	  if (i < 0) {
+	    if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+	      return;
+	    agwpe_reset(com,"read error");
+	    return;
 	  }
-	  
-	  // Process received frame
-	  agwpe_parsereceived(com, &hdr, com->rdbuf + sizeof(hdr));
-
-	  com->rdcursor += sizeof(hdr) + hdr.dataLength;
-	  if (com->rdlen > com->rdcursor) {
-	    memcpy(com->rdbuf, com->rdbuf + com->rdcursor,
-		   com->rdlen - com->rdcursor);
-	    com->rdlen -= com->rdcursor;
+	  if (agwpe_decode(com) < 0) {
+	    agwpe_reset(com,"received junk data");
+	    return;
 	  }
-	  com->rdcursor = 0;
-	  com->rdneed = sizeof(hdr);
+	  if (i < space)
+	    return; // got all there was
 	}
 }
 
@@ -582,8 +596,7 @@ static void agwpe_connect(struct agwpecom *com) {
 	int i;
 
 	// Initial protocol reading parameters
-	com->rdcursor = 0;
-	com->rdneed = sizeof(struct agwpeheader);
+	ringbuf_reset(&com->rd);
 
 	// Create socket
 	if (debug>1) {
@@ -683,13 +696,20 @@ int agwpe_prepoll(struct aprxpolls *app)
           if (S->fd < 0)
             continue;
 
+          // Frames queued since the last round go out in one send
+          if (ringbuf_used(&S->wr) > 0) {
+            agwpe_flush(S);
+            if (S->fd < 0)
+              continue;
+          }
+
           // FD is open, lets mark it for poll read..
           pfd = aprxpolls_new(app);
           pfd->fd = S->fd;
           pfd->events = POLLIN | POLLPRI;
           pfd->revents = 0;
           // .. and if needed, poll write.
-          if (S->wrlen > S->wrcursor)
+          if (ringbuf_used(&S->wr) > 0)
             pfd->events |= POLLOUT;
 
           ++idx;
@@ -709,8 +729,8 @@ int agwpe_postpoll(struct aprxpolls *app)
 	struct pollfd *P;
 	for (idx = 0, P = app->polls; idx < app->pollcount; ++idx, ++P) {
 
-		if (!(P->revents & (POLLIN | POLLPRI | POLLERR | POLLHUP)))
-			continue;	/* No read event we are interested in... */
+		if (!(P->revents & (POLLIN | POLLPRI | POLLOUT | POLLERR | POLLHUP)))
+			continue;	/* No event we are interested in... */
 
 		for (i = 0; i < pecomcount; ++i) {
 			S = pecom[i];
@@ -721,11 +741,261 @@ int agwpe_postpoll(struct aprxpolls *app)
 			if (P->revents & POLLOUT)
 				agwpe_flush(S);
 
-			agwpe_read(S);
+			if (P->revents & (POLLIN | POLLPRI | POLLERR | POLLHUP))
+				agwpe_read(S);
 		}
 	}
 
 	return 0;
 }
 
+#ifdef AGWPE_STANDIN
+/*
+ * A stand-in AGW Packet Engine for testing the client above, build with:
+ *     make agwpe-standin
+ * and run:
+ *     ./agwpe-standin [frames [ports]]
+ *
+ * The stand-in listens on a loopback port, and the client connects to
+ * it with one interface per radio port.  One more radio port has no
+ * interface.  Once the client asks for raw frames with 'k', the
+ * stand-in feeds 'K' frames on all of the ports, with some 'U' monitor
+ * frames in between, in odd sized writes so that frames are split
+ * across reads and wrap the read ring.  Every frame carries its port
+ * and sequence number:  ax25_to_tnc2() below checks that the frame
+ * came to the interface of its port, in order, and sends it back with
+ * agwpe_sendto(), and the stand-in checks the port of what comes back.
+ */
+
+#include <netinet/in.h>
+
+#define STANDIN_MAXPORTS 8
+
+int debug;
+
+static struct aprx_interface standin_aif[STANDIN_MAXPORTS];
+static long standin_lastseq[STANDIN_MAXPORTS];
+static long standin_routed, standin_errors;
+
+void fd_nonblockingmode(int fd)
+{
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+}
+void hexdumpfp(FILE *fp, const uint8_t *buf, const int len, int axaddr) { }
+void erlang_add(const char *portname, ErlangMode erl, int bytes, int packets) { }
+void rfloghex(const char *portname, char direction, int discard, const uint8_t *buf, int buflen) { }
+
+struct netresolver *netresolv_add(const char *hostname, const char *port)
+{
+	static struct netresolver n;
+	struct sockaddr_in *sin = (struct sockaddr_in *)&n.sa;
+
+	n.hostname = hostname;
+	n.port     = port;
+	sin->sin_family      = AF_INET;
+	sin->sin_port        = htons(atoi(port));
+	sin->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	n.ai.ai_family   = AF_INET;
+	n.ai.ai_socktype = SOCK_STREAM;
+	n.ai.ai_protocol = IPPROTO_TCP;
+	n.ai.ai_addr     = &n.sa;
+	n.ai.ai_addrlen  = sizeof(*sin);
+	return &n;
+}
+
+/* The frame as received from the AGWPE port, check it and send it back */
+int ax25_to_tnc2(const struct aprx_interface *aif, const char *portname,
+		 const int tncid, const int cmdbyte,
+		 const uint8_t *frame, const int framelen)
+{
+	int port;
+	long seq;
+
+	if (framelen < 16 ||
+	    sscanf((const char *)frame + 16, "p%d s%ld", &port, &seq) != 2 ||
+	    port < 0 || port >= STANDIN_MAXPORTS) {
+	  printf("AGWPE STANDIN: garbled frame on %s\n", portname);
+	  ++standin_errors;
+	  return 1;
+	}
+	if (aif != &standin_aif[port]) {
+	  printf("AGWPE STANDIN: port %d frame %ld routed to %s\n",
+		 port, seq, portname);
+	  ++standin_errors;
+	}
+	if (seq <= standin_lastseq[port]) {
+	  printf("AGWPE STANDIN: port %d frame %ld after frame %ld\n",
+		 port, seq, standin_lastseq[port]);
+	  ++standin_errors;
+	}
+	standin_lastseq[port] = seq;
+	++standin_routed;
+
+	agwpe_sendto(aif->agwpe, frame, 16, (const char *)frame + 16, framelen - 16);
+	return 1;
+}
+
+static void standin_header(uint8_t *p, const int port, const int kind, const int len)
+{
+	memset(p, 0, sizeof(struct agwpeheader));
+	set_le32(p + 0,  port);
+	set_le32(p + 4,  kind);
+	set_le32(p + 28, len);
+}
+
+/* One frame of the feed:  a KISS command byte, AX.25 UI frame
+   N0TEST>APRS with the port and sequence number as its text */
+static int standin_frame(uint8_t *p, const int port, const int kind, const long seq)
+{
+	static const uint8_t addr[16] = {
+	  'A'<<1, 'P'<<1, 'R'<<1, 'S'<<1, ' '<<1, ' '<<1, 0x60,
+	  'N'<<1, '0'<<1, 'T'<<1, 'E'<<1, 'S'<<1, 'T'<<1, 0x61,
+	  0x03, 0xF0 };
+	const int hlen = sizeof(struct agwpeheader);
+	int len;
+
+	p[hlen] = 0;
+	memcpy(p + hlen + 1, addr, sizeof(addr));
+	len = 1 + sizeof(addr);
+	len += sprintf((char *)p + hlen + len, "p%d s%ld %.*s", port, seq,
+		       (int)(seq * 7 % 200),
+		       "xxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxx"
+		       "xxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxx"
+		       "xxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxx"
+		       "xxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxx");
+	standin_header(p, port, kind, len);
+	return hlen + len;
+}
+
+int main(int argc, char *argv[])
+{
+	static const int chunks[] = { 1, 35, 36, 37, 500, 4095, 4097, 9000 };
+	const int hlen = sizeof(struct agwpeheader);
+	long frames = (argc > 1) ? atol(argv[1]) : 2000;
+	int ports   = (argc > 2) ? atoi(argv[2]) : 3;
+	struct sockaddr_in sin;
+	socklen_t sinlen = sizeof(sin);
+	struct aprxpolls app = APRXPOLLS_INIT;
+	struct pollfd *pfd;
+	struct timeval deadline;
+	char portstr[16], portnum[STANDIN_MAXPORTS][8];
+	uint8_t *feed, rbuf[65536];
+	long i, feedlen = 0, feedoff = 0, expected = 0, back = 0, reads = 0;
+	int lfd, cfd = -1, rlen = 0, rawon = 0, chunk = 0, n, port, kind;
+
+	if (ports < 1 || ports > STANDIN_MAXPORTS - 1)
+	  ports = 3;
+
+	// The feed: frame i goes to port i % (ports+1), port 'ports' has
+	// no interface, and every 10th frame is a monitor frame.
+	feed = malloc(frames * 300);
+	for (i = 0; i < frames; ++i) {
+	  port = i % (ports + 1);
+	  kind = (i % 10 == 9) ? 'U' : 'K';
+	  feedlen += standin_frame(feed + feedlen, port, kind, i + 1);
+	  if (port < ports && kind == 'K')
+	    ++expected;
+	}
+
+	lfd = socket(AF_INET, SOCK_STREAM, 0);
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family      = AF_INET;
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (lfd < 0 || bind(lfd, (struct sockaddr *)&sin, sizeof(sin)) < 0 ||
+	    listen(lfd, 1) < 0 ||
+	    getsockname(lfd, (struct sockaddr *)&sin, &sinlen) < 0) {
+	  printf("AGWPE STANDIN: no listening socket: %s\n", strerror(errno));
+	  return 1;
+	}
+	sprintf(portstr, "%d", ntohs(sin.sin_port));
+
+	gettimeofday(&tick, NULL);
+	for (i = 0; i < ports; ++i) {
+	  sprintf(portnum[i], "%ld", i + 1);
+	  standin_aif[i].callsign = portnum[i];
+	  standin_aif[i].agwpe = agwpe_addport("127.0.0.1", portstr, portnum[i],
+						&standin_aif[i]);
+	}
+	pecom[0]->wait_until = tick;	// connect right away
+	tv_timeradd_seconds(&deadline, &tick, 10);
+
+	while (tv_timercmp(&tick, &deadline) < 0 &&
+	       (feedoff < feedlen || standin_routed < expected || back < expected)) {
+
+	  aprxpolls_reset(&app);
+	  tv_timeradd_millis(&app.next_timeout, &tick, 100);
+	  agwpe_prepoll(&app);
+
+	  pfd = aprxpolls_new(&app);
+	  pfd->fd = (cfd < 0) ? lfd : cfd;
+	  pfd->events = POLLIN;
+	  if (cfd >= 0 && rawon && feedoff < feedlen)
+	    pfd->events |= POLLOUT;
+
+	  poll(app.polls, app.pollcount, aprxpolls_millis(&app));
+	  gettimeofday(&tick, NULL);
+
+	  pfd = &app.polls[app.pollcount - 1];
+	  if (cfd < 0 && (pfd->revents & POLLIN)) {
+	    cfd = accept(lfd, NULL, NULL);
+	    if (cfd >= 0)
+	      fd_nonblockingmode(cfd);
+
+	  } else if (cfd >= 0 && (pfd->revents & POLLIN)) {
+	    n = read(cfd, rbuf + rlen, sizeof(rbuf) - rlen);
+	    if (n > 0) {
+	      rlen += n;
+	      ++reads;
+	    }
+	    // The client sends 'k' and 'm' requests, and 'K' frames back
+	    while (rlen >= hlen && rlen >= hlen + (int)get_le32(rbuf + 28)) {
+	      n = hlen + get_le32(rbuf + 28);
+	      kind = get_le32(rbuf + 4);
+	      if (kind == 'k') {
+		rawon = 1;
+	      } else if (kind == 'K') {
+		++back;
+		if (n < hlen + 16 ||
+		    sscanf((const char *)rbuf + hlen + 16, "p%d", &port) != 1 ||
+		    port != (int)get_le32(rbuf)) {
+		  printf("AGWPE STANDIN: frame sent back on port %d: '%.*s'\n",
+			 get_le32(rbuf), n - hlen - 16, rbuf + hlen + 16);
+		  ++standin_errors;
+		}
+	      }
+	      rlen -= n;
+	      memmove(rbuf, rbuf + n, rlen);
+	    }
+	  }
+	  if (cfd >= 0 && (pfd->revents & POLLOUT)) {
+	    n = chunks[chunk++ % (sizeof(chunks)/sizeof(chunks[0]))];
+	    if (n > feedlen - feedoff)
+	      n = feedlen - feedoff;
+	    n = write(cfd, feed + feedoff, n);
+	    if (n > 0)
+	      feedoff += n;
+	  }
+
+	  agwpe_postpoll(&app);
+	}
+
+	if (!rawon)
+	  printf("AGWPE STANDIN: no 'k' request for raw frames\n");
+	if (!rawon || standin_routed != expected || back != expected)
+	  ++standin_errors;
+
+	printf("agwpe standin: %ld frames fed on %d+1 ports, %ld of %ld routed,"
+	       " %ld sent back in %ld reads, %ld errors\n",
+	       frames, ports, standin_routed, expected, back, reads,
+	       standin_errors);
+
+	close(lfd);
+	if (cfd >= 0)
+	  close(cfd);
+	aprxpolls_free(&app);
+	free(feed);
+	return standin_errors ? 1 : 0;
+}
+#endif
+
 #endif
@@ -0,0 +1,562 @@
+/* **************************************************************** *
+ *                                                                  *
+ *  APRX -- 2nd generation APRS iGate and digi with                 *
+ *          minimal requirement of esoteric facilities or           *
+ *          libraries of any kind beyond UNIX system libc.          *
+ *                                                                  *
+ * (c) Matti Aarnio - OH2MQK,  2007-2014                            *
+ *                                                                  *
+ * **************************************************************** */
+
+/*
+ *  aprx-bench -- replay a capture file through the real receive
+ *  pipeline as fast as possible, build with:
+ *      make aprx-bench
+ *  and run:
+ *      ./aprx-bench [-f aprx.conf] [-i ifcall] [-F filter]
+ *                   [-n rounds] [-s stepmillis] capturefile
+ *
+ *  The capture is either a KISS byte stream (starts with FEND), or
+ *  text with one TNC2 monitor format packet per line.  All frames are
+ *  converted to AX.25 before timing starts.
+ *
+ *  Without -f a built-in configuration is used: one null-device
+ *  interface, and a digipeater with unlimited rate limits transmitting
+ *  back to it.  With -f the frames are fed to the first interface
+ *  with digipeater sources, or the one named with -i.  Interfaces on
+ *  real devices are never opened.
+ *
+ *  Every round replays the capture twice:
+ *
+ *   - end-to-end: ax25_to_tnc2() on each frame, which runs the whole
+ *     rx-igate, parse, filter, historydb, dupecheck and digipeater
+ *     chain down to interface_transmit_ax25();
+ *
+ *   - staged: the same steps called one stage at a time over batches
+ *     of frames, so that each stage can be timed separately.  The
+ *     parse stage parses all the way to positions, filter and
+ *     historydb stages do not parse.  The dupecheck stage uses its
+ *     own dupechecker, the digipeater stage includes the digipeater's
+ *     own dupecheck.
+ *
+ *  Tick advances by stepmillis (default 1000) for every frame, and
+ *  the timer driven housekeeping of dupecheck, digipeater and
+ *  historydb runs once per batch.  Allocations are counted with
+ *  linker wrappers of malloc(), calloc(), realloc() and cellmalloc().
+ */
+
+#include "aprx.h"
+#include <time.h>
+
+#define BENCH_BATCH 64
+
+/* linker --wrap counters */
+
+static long bench_mallocs;
+static long bench_cellmallocs;
+static long bench_txframes;
+
+extern void *__real_malloc(size_t size);
+extern void *__real_calloc(size_t nmemb, size_t size);
+extern void *__real_realloc(void *ptr, size_t size);
+extern void *__real_cellmalloc(cellarena_t *ca);
+extern void  __real_interface_transmit_ax25(const struct aprx_interface *aif, const TxPriority prio, const int64_t t_arrival, uint8_t *axaddr, const int axaddrlen, const char *axdata, const int axdatalen);
+
+void *__wrap_malloc(size_t size)
+{
+	++bench_mallocs;
+	return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size)
+{
+	++bench_mallocs;
+	return __real_calloc(nmemb, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+	++bench_mallocs;
+	return __real_realloc(ptr, size);
+}
+
+void *__wrap_cellmalloc(cellarena_t *ca)
+{
+	++bench_cellmallocs;
+	return __real_cellmalloc(ca);
+}
+
+void __wrap_interface_transmit_ax25(const struct aprx_interface *aif, const TxPriority prio, const int64_t t_arrival, uint8_t *axaddr, const int axaddrlen, const char *axdata, const int axdatalen)
+{
+	++bench_txframes;
+	__real_interface_transmit_ax25(aif, prio, t_arrival, axaddr, axaddrlen, axdata, axdatalen);
+}
+
+
+static const char bench_config[] =
+	"mycall  N0TEST-1\n"
+	"<interface>\n"
+	"  null-device  $mycall\n"
+	"  tx-ok        true\n"
+	"</interface>\n"
+	"<digipeater>\n"
+	"  transmitter  $mycall\n"
+	"  ratelimit    9999999 9999999\n"
+	"  srcratelimit 9999999 9999999\n"
+	"  <source>\n"
+	"    source     $mycall\n"
+	"    ratelimit  9999999 9999999\n"
+	"  </source>\n"
+	"</digipeater>\n";
+
+
+/* The capture, as AX.25 frames */
+
+static uint8_t *frames;
+static int     *frameoffs;	/* framecount+1 entries */
+static int      framecount;
+
+static void frame_add(const uint8_t *buf, const int len)
+{
+	static int framespace, bytespace;
+	int off = framecount ? frameoffs[framecount] : 0;
+
+	if (len < 15) return;
+	if (framecount + 2 > framespace) {
+		framespace = framespace ? framespace * 2 : 1024;
+		frameoffs  = realloc(frameoffs, framespace * sizeof(int));
+	}
+	if (off + len > bytespace) {
+		bytespace = bytespace ? bytespace * 2 : 65536;
+		if (bytespace < off + len)
+			bytespace = off + len;
+		frames = realloc(frames, bytespace);
+	}
+	if (framecount == 0)
+		frameoffs[0] = 0;
+	memcpy(frames + off, buf, len);
+	frameoffs[++framecount] = off + len;
+}
+
+/* KISS byte stream, only data frames of any port are taken */
+static void load_kiss(const uint8_t *p, const uint8_t *e)
+{
+	uint8_t buf[2100];
+	int len = 0, esc = 0;
+
+	for (; p < e; ++p) {
+		int c = *p;
+		if (c == KISS_FEND) {
+			if (len > 1 && (buf[0] & 0x0F) == 0)
+				frame_add(buf + 1, len - 1);
+			len = esc = 0;
+			continue;
+		}
+		if (c == KISS_FESC) {
+			esc = 1;
+			continue;
+		}
+		if (esc) {
+			if (c == KISS_TFEND) c = KISS_FEND;
+			else if (c == KISS_TFESC) c = KISS_FESC;
+			esc = 0;
+		}
+		if (len < (int)sizeof(buf))
+			buf[len++] = c;
+	}
+}
+
+static int load_tnc2(const char *p, const char *e)
+{
+	uint8_t ax[2100];
+	int bad = 0;
+
+	while (p < e) {
+		const char *eol = memchr(p, '\n', e - p);
+		const char *next;
+		int len;
+		if (eol == NULL) eol = e;
+		next = eol + 1;
+		while (eol > p && eol[-1] == '\r') --eol;
+		if (eol > p && *p != '#') {
+			len = ax25_from_tnc2(p, eol - p, ax, sizeof(ax));
+			if (len > 0)
+				frame_add(ax, len);
+			else
+				++bad;
+		}
+		p = next;
+	}
+	return bad;
+}
+
+static int load_capture(const char *fname)
+{
+	struct stat st;
+	char *buf;
+	int fd = open(fname, O_RDONLY, 0);
+	int bad = 0;
+
+	if (fd < 0 || fstat(fd, &st) < 0) {
+		fprintf(stderr, "aprx-bench: can not open '%s': %s\n", fname, strerror(errno));
+		exit(1);
+	}
+	buf = malloc(st.st_size + 1);
+	if (read(fd, buf, st.st_size) != st.st_size) {
+		fprintf(stderr, "aprx-bench: short read on '%s'\n", fname);
+		exit(1);
+	}
+	close(fd);
+
+	if (st.st_size > 0 && (uint8_t)buf[0] == KISS_FEND) {
+		load_kiss((uint8_t*)buf, (uint8_t*)buf + st.st_size);
+		printf("aprx-bench: %d KISS frames from %s\n", framecount, fname);
+	} else {
+		bad = load_tnc2(buf, buf + st.st_size);
+		printf("aprx-bench: %d TNC2 packets from %s, %d not convertible to AX.25\n",
+		       framecount, fname, bad);
+	}
+	free(buf);
+	return framecount;
+}
+
+
+static long long nanotime(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int stepmillis = 1000;
+
+/* What the main loop does between polls, but only for the parts
+   that have work to do without real I/O */
+static void bench_timers(int frames)
+{
+	struct aprxpolls app = APRXPOLLS_INIT;
+
+	tv_timeradd_millis(&tick, &tick, stepmillis * frames);
+
+	aprxpolls_reset(&app);
+	tv_timeradd_millis(&app.next_timeout, &tick, 30000);
+	dupecheck_prepoll(&app);
+	digipeater_prepoll(&app);
+	historydb_prepoll(&app);
+	time_reset = 0;
+
+	dupecheck_postpoll(&app);
+	digipeater_postpoll(&app);
+	historydb_postpoll(&app);
+	aprxpolls_free(&app);
+}
+
+
+enum {
+	ST_FORMAT, ST_PBUF, ST_PARSE, ST_FILTER, ST_HISTORY,
+	ST_DUPE, ST_DIGI, ST_FREE, ST_TIMERS, ST_COUNT
+};
+static const char *stagenames[ST_COUNT] = {
+	"ax25_format_to_tnc", "pbuf_new", "parse_aprs", "filter_process",
+	"historydb_insert", "dupecheck_pbuf", "digipeater_receive",
+	"pbuf_put", "timers"
+};
+
+struct benchstat {
+	long long ns;
+	long      mallocs;
+	long      cellmallocs;
+};
+static struct benchstat stages[ST_COUNT];
+static struct benchstat endtoend;
+
+struct stagemark {
+	long long ns;
+	long      mallocs, cellmallocs;
+};
+
+static void mark_start(struct stagemark *m)
+{
+	m->mallocs     = bench_mallocs;
+	m->cellmallocs = bench_cellmallocs;
+	m->ns          = nanotime();
+}
+
+static void mark_end(struct stagemark *m, struct benchstat *bs)
+{
+	bs->ns          += nanotime() - m->ns;
+	bs->mallocs     += bench_mallocs     - m->mallocs;
+	bs->cellmallocs += bench_cellmallocs - m->cellmallocs;
+}
+
+
+static void run_endtoend(const struct aprx_interface *aif)
+{
+	struct stagemark m;
+	int i, j;
+
+	for (i = 0; i < framecount; i += BENCH_BATCH) {
+		int n = framecount - i;
+		if (n > BENCH_BATCH) n = BENCH_BATCH;
+		mark_start(&m);
+		for (j = i; j < i + n; ++j) {
+			ax25_to_tnc2(aif, aif->callsign, 0, 0,
+				     frames + frameoffs[j],
+				     frameoffs[j+1] - frameoffs[j]);
+		}
+		bench_timers(n);
+		mark_end(&m, &endtoend);
+	}
+}
+
+static void run_staged(const struct aprx_interface *aif,
+		       struct digipeater_source *src,
+		       struct filter_t *filters,
+		       dupecheck_t *dupechecker)
+{
+	static char tnc2buf[BENCH_BATCH][2800];
+	int tnc2len[BENCH_BATCH], tnc2addrlen[BENCH_BATCH];
+	int axaddrlen[BENCH_BATCH], is_aprs[BENCH_BATCH], ui_pid[BENCH_BATCH];
+	int accept[BENCH_BATCH];
+	struct pbuf_t *pbs[BENCH_BATCH];
+	historydb_t *historydb = src->parent->historydb;
+	struct stagemark m;
+	int i, j, k;
+
+	for (i = 0; i < framecount; i += BENCH_BATCH) {
+		int n = framecount - i;
+		if (n > BENCH_BATCH) n = BENCH_BATCH;
+
+		mark_start(&m);
+		for (k = 0; k < n; ++k) {
+			j = i + k;
+			is_aprs[k] = 0;
+			ui_pid[k]  = 0;
+			tnc2len[k] = ax25_format_to_tnc(frames + frameoffs[j],
+							frameoffs[j+1] - frameoffs[j],
+							tnc2buf[k], sizeof(tnc2buf[k]),
+							&axaddrlen[k], &tnc2addrlen[k],
+							&is_aprs[k], &ui_pid[k]);
+		}
+		mark_end(&m, &stages[ST_FORMAT]);
+
+		mark_start(&m);
+		for (k = 0; k < n; ++k) {
+			j = i + k;
+			pbs[k] = NULL;
+			if (tnc2len[k] == 0) continue;
+			pbs[k] = pbuf_new(is_aprs[k], is_aprs[k] || ui_pid[k] >= 0,
+					  tnc2addrlen[k], tnc2buf[k], tnc2len[k],
+					  axaddrlen[k], frames + frameoffs[j],
+					  frameoffs[j+1] - frameoffs[j]);
+			if (pbs[k] != NULL)
+				pbs[k]->source_if_group = aif->ifgroup;
+		}
+		mark_end(&m, &stages[ST_PBUF]);
+
+		mark_start(&m);
+		for (k = 0; k < n; ++k) {
+			if (pbs[k] != NULL && pbs[k]->is_aprs)
+				parse_aprs_level(pbs[k], historydb, PARSE_POSITION);
+		}
+		mark_end(&m, &stages[ST_PARSE]);
+
+		mark_start(&m);
+		for (k = 0; k < n; ++k) {
+			accept[k] = (pbs[k] != NULL);
+			if (accept[k] && pbs[k]->is_aprs && filters != NULL)
+				accept[k] = filter_process(pbs[k], filters, historydb) > 0;
+		}
+		mark_end(&m, &stages[ST_FILTER]);
+
+		mark_start(&m);
+		for (k = 0; k < n; ++k) {
+			if (accept[k] && pbs[k]->is_aprs &&
+			    !(pbs[k]->packettype & T_THIRDPARTY))
+				historydb_insert_heard(historydb, pbs[k]);
+		}
+		mark_end(&m, &stages[ST_HISTORY]);
+
+		mark_start(&m);
+		for (k = 0; k < n; ++k) {
+			if (accept[k] && pbs[k]->is_aprs)
+				dupecheck_pbuf(dupechecker, pbs[k], 0);
+		}
+		mark_end(&m, &stages[ST_DUPE]);
+
+		mark_start(&m);
+		for (k = 0; k < n; ++k) {
+			if (accept[k])
+				digipeater_receive(src, pbs[k]);
+		}
+		mark_end(&m, &stages[ST_DIGI]);
+
+		mark_start(&m);
+		for (k = 0; k < n; ++k) {
+			if (pbs[k] != NULL)
+				pbuf_put(pbs[k]);
+		}
+		mark_end(&m, &stages[ST_FREE]);
+
+		mark_start(&m);
+		bench_timers(n);
+		mark_end(&m, &stages[ST_TIMERS]);
+	}
+}
+
+
+static void usage(void)
+{
+	printf("aprx-bench: [-d] [-f aprx.conf] [-i ifcall] [-F filter] [-n rounds] [-s stepmillis] capturefile\n");
+	printf("    -f aprx.conf: configuration, default is a built-in null-device digipeater\n");
+	printf("    -i ifcall:    interface the capture is received on\n");
+	printf("    -F filter:    filter for the filter stage, default is source filter\n");
+	printf("    -n rounds:    how many times the capture is replayed, default 1\n");
+	printf("    -s millis:    tick advance per frame, default 1000\n");
+	exit(64);		/* EX_USAGE */
+}
+
+int main(int argc, char *const argv[])
+{
+	const char *cfgfile = NULL;
+	const char *ifcall  = NULL;
+	const char *filterstr = NULL;
+	char tmpcfg[] = "/tmp/aprx-bench.XXXXXX";
+	struct aprx_interface *aif = NULL;
+	struct digipeater_source *src;
+	struct filter_t *filters = NULL;
+	dupecheck_t *dupechecker;
+	struct cellstatus_t cs;
+	long packets;
+	int rounds = 1;
+	int i, r;
+
+	setvbuf(stdout, NULL, _IOLBF, BUFSIZ);
+
+	while ((i = getopt(argc, argv, "df:F:i:n:s:h?")) != -1) {
+		switch (i) {
+		case 'd':
+			++debug;
+			break;
+		case 'f':
+			cfgfile = optarg;
+			break;
+		case 'F':
+			filterstr = optarg;
+			break;
+		case 'i':
+			ifcall = optarg;
+			break;
+		case 'n':
+			rounds = atoi(optarg);
+			break;
+		case 's':
+			stepmillis = atoi(optarg);
+			break;
+		default:
+			usage();
+			break;
+		}
+	}
+	if (optind >= argc || rounds < 1 || stepmillis < 0)
+		usage();
+
+	timetick();
+
+	interface_init();
+	erlang_init("NONE");
+	ttyreader_init();
+	dupecheck_init();
+#ifndef DISABLE_IGATE
+	aprsis_init();
+#endif
+	filter_init();
+	pbuf_init();
+
+	if (cfgfile == NULL) {
+		int fd = mkstemp(tmpcfg);
+		if (fd < 0 || write(fd, bench_config, sizeof(bench_config)-1) < 0) {
+			fprintf(stderr, "aprx-bench: can not write %s\n", tmpcfg);
+			exit(1);
+		}
+		close(fd);
+		i = readconfig(tmpcfg);
+		unlink(tmpcfg);
+	} else {
+		i = readconfig(cfgfile);
+	}
+	if (i) {
+		fprintf(stderr, "Seen configuration errors. Aborting!\n");
+		exit(1);
+	}
+#ifndef DISABLE_IGATE
+	historydb_init();
+#endif
+
+	if (ifcall != NULL) {
+		aif = find_interface_by_callsign(ifcall);
+	} else {
+		for (i = 0; i < all_interfaces_count; ++i) {
+			if (all_interfaces[i]->digisourcecount > 0) {
+				aif = all_interfaces[i];
+				break;
+			}
+		}
+	}
+	if (aif == NULL || aif->digisourcecount == 0) {
+		fprintf(stderr, "aprx-bench: no interface with digipeater sources to receive on\n");
+		exit(1);
+	}
+	src = aif->digisources[0];
+
+	if (filterstr != NULL) {
+		char *fs = strdup(filterstr);
+		char *p = strtok(fs, " ");
+		for (; p != NULL; p = strtok(NULL, " ")) {
+			if (filter_parse(&filters, p) < 0) {
+				fprintf(stderr, "aprx-bench: bad filter '%s'\n", p);
+				exit(1);
+			}
+		}
+	} else {
+		filters = src->src_filters;
+	}
+	dupechecker = dupecheck_new(30);
+
+	if (load_capture(argv[optind]) == 0) {
+		fprintf(stderr, "aprx-bench: nothing to replay\n");
+		exit(1);
+	}
+
+	bench_timers(0);
+	for (r = 0; r < rounds; ++r) {
+		long tx0 = bench_txframes;
+		run_endtoend(aif);
+		if (r == 0)
+			printf("aprx-bench: %d frames replayed on %s, %ld transmitted\n",
+			       framecount, aif->callsign, bench_txframes - tx0);
+		run_staged(aif, src, filters, dupechecker);
+	}
+
+	packets = (long)framecount * rounds;
+	printf("\nend-to-end: %.0f pkts/s, %.0f ns/pkt, %.2f mallocs/pkt, %.2f cellmallocs/pkt\n\n",
+	       packets * 1e9 / endtoend.ns, (double)endtoend.ns / packets,
+	       (double)endtoend.mallocs / packets,
+	       (double)endtoend.cellmallocs / packets);
+
+	printf("%-20s %10s %12s %16s\n", "stage", "ns/pkt", "mallocs/pkt", "cellmallocs/pkt");
+	for (i = 0; i < ST_COUNT; ++i) {
+		printf("%-20s %10.1f %12.2f %16.2f\n", stagenames[i],
+		       (double)stages[i].ns / packets,
+		       (double)stages[i].mallocs / packets,
+		       (double)stages[i].cellmallocs / packets);
+	}
+
+	printf("\n");
+	for (i = 0; cellstatus(i, &cs) == 0; ++i) {
+		printf("cellmalloc %-16s cellsize %5d, in use %6ld (max %6ld), blocks %d (%ld kB)\n",
+		       cs.arenaname, cs.cellsize, cs.cellsinuse, cs.cellsinuse_max,
+		       cs.blocks, cs.blockbytes / 1024);
+	}
+	return 0;
+}
@@ -10,6 +10,7 @@
 
 
 #include "aprx.h"
+#include <getopt.h>
 
 
 int time_reset;
@@ -32,6 +33,8 @@ void printtime(char *buf, int buflen)
 }
 
 
+static struct erlang_latency latency[LATENCY_STAGES];
+
 void erlang_snmp(void)
 {
 	int i;
@@ -46,19 +49,80 @@ void erlang_snmp(void)
 
 	for (i = 0; i < ErlangLinesCount; ++i) {
 		struct erlangline *E = ErlangLines[i];
+		struct erlang_rxtxbytepkt S;
+
+		erlang_snapshot(&E->seq, &S, &E->SNMP, sizeof(S));
 
 		printf("%s", E->name);
 		printf("   %ld %ld   %ld  %ld  %ld  %ld    %d\n",
-		       E->SNMP.bytes_rx, E->SNMP.packets_rx,
-		       E->SNMP.bytes_rxdrop, E->SNMP.packets_rxdrop,
-		       E->SNMP.bytes_tx, E->SNMP.packets_tx,
+		       S.bytes_rx, S.packets_rx,
+		       S.bytes_rxdrop, S.packets_rxdrop,
+		       S.bytes_tx, S.packets_tx,
 		       (int) (now.tv_sec - E->last_update));
 	}
+
+	erlang_snapshot(&ErlangHead->seq, latency, ErlangHead->latency,
+			sizeof(latency));
+	for (i = 0; i < LATENCY_STAGES; ++i) {
+		const struct erlang_latency *L = &latency[i];
+
+		printf("APRX.latency.%s   %ld %.0f  %ld %ld %ld %ld\n",
+		       latency_names[i], L->samples, L->sum_us,
+		       latency_percentile(L, 0.50),
+		       latency_percentile(L, 0.90),
+		       latency_percentile(L, 0.99), L->max_us);
+	}
+}
+
+void erlang_latencies(void)
+{
+	int i, b;
+
+	/* Latency histograms of the receive to transmit path,
+	   in microseconds since aprx start */
+
+	printf("APRX.pid     %8ld\n", (long) ErlangHead->server_pid);
+	printf("APRX.uptime  %8ld\n",
+	       (long) (time(NULL) - ErlangHead->start_time));
+
+	erlang_snapshot(&ErlangHead->seq, latency, ErlangHead->latency,
+			sizeof(latency));
+
+	printf("\n%-10s %9s %9s %9s %9s %9s %9s\n", "stage",
+	       "samples", "mean", "p50", "p90", "p99", "max");
+	for (i = 0; i < LATENCY_STAGES; ++i) {
+		const struct erlang_latency *L = &latency[i];
+
+		printf("%-10s %9ld %9.0f %9ld %9ld %9ld %9ld\n",
+		       latency_names[i], L->samples,
+		       L->samples ? L->sum_us / L->samples : 0.0,
+		       latency_percentile(L, 0.50),
+		       latency_percentile(L, 0.90),
+		       latency_percentile(L, 0.99), L->max_us);
+	}
+
+	for (i = 0; i < LATENCY_STAGES; ++i) {
+		const struct erlang_latency *L = &latency[i];
+
+		if (L->samples == 0)
+			continue;
+		printf("\n%s histogram (us)\n", latency_names[i]);
+		for (b = 0; b < LATENCY_BUCKETS; ++b) {
+			if (L->bucket[b] == 0)
+				continue;
+			printf("  %9ld .. %9ld  %8u\n",
+			       latency_bucket_low(b),
+			       latency_bucket_low(b + 1) - 1,
+			       L->bucket[b]);
+		}
+	}
 }
 
 void erlang_xml(int topmode)
 {
 	int i, j, k, t;
+	struct erlangline *E;	/* consistent copy */
+	struct erlang_rxtxbytepkt R;
 
 	/* What this outputs is not XML, but a mild approximation
 	   of the data that XML version would output.. 
@@ -72,11 +136,17 @@ void erlang_xml(int topmode)
 	       (long) (time(NULL) - ErlangHead->start_time));
 	printf("APRX.mycall  %s\n", ErlangHead->mycall);
 
+	/* the history blocks in it are page aligned */
+	if (posix_memalign((void **)&E, __alignof__(*E), sizeof(*E)) != 0) {
+		fprintf(stderr, "aprx-stat: out of memory\n");
+		exit(1);
+	}
 	for (i = 0; i < ErlangLinesCount; ++i) {
-		struct erlangline *E = ErlangLines[i];
 		char logtime[40];
 		struct tm *wallclock;
 
+		erlang_snapshot(&ErlangLines[i]->seq, E, ErlangLines[i], sizeof(*E));
+
 		printf("\nSNMP  %s", E->name);
 		printf("   %ld %ld   %ld  %ld  %ld  %ld   %d\n",
 		       E->SNMP.bytes_rx, E->SNMP.packets_rx,
@@ -93,27 +163,28 @@ void erlang_xml(int topmode)
 			--k;
 			if (k < 0)
 				k = E->e1_max - 1;
-			if (E->e1[k].update == 0)
+			erlang_history_get(E, 1, k, &R);
+			if (R.update == 0)
 				continue;
 			if (epochtime) {
 				sprintf(logtime, "%ld",
-					(long) E->e1[k].update);
+					(long) R.update);
 			} else {
-				wallclock = gmtime(&E->e1[k].update);
+				wallclock = gmtime(&R.update);
 				strftime(logtime, sizeof(logtime),
 					 "%Y-%m-%d %H:%M", wallclock);
 			}
 			printf("%s  %s", logtime, E->name);
 			printf(" %2dm  %5ld  %3ld  %5ld  %3ld  %5ld  %3ld %5.3f  %5.3f  %5.3f\n",
 			       1,
-			       E->e1[k].bytes_rx,     E->e1[k].packets_rx,
-			       E->e1[k].bytes_rxdrop, E->e1[k].packets_rxdrop,
-			       E->e1[k].bytes_tx,     E->e1[k].packets_tx,
-			       (float) E->e1[k].bytes_rx /
+			       R.bytes_rx,     R.packets_rx,
+			       R.bytes_rxdrop, R.packets_rxdrop,
+			       R.bytes_tx,     R.packets_tx,
+			       (float) R.bytes_rx /
 			       ((float) E->erlang_capa * 60.0),
-			       (float) E->e1[k].bytes_rxdrop /
+			       (float) R.bytes_rxdrop /
 			       ((float) E->erlang_capa * 60.0),
-			       (float)E->e1[k].bytes_tx/((float)E->erlang_capa*60.0)
+			       (float)R.bytes_tx/((float)E->erlang_capa*60.0)
 				);
 		}
 
@@ -127,27 +198,28 @@ void erlang_xml(int topmode)
 			--k;
 			if (k < 0)
 				k = E->e10_max - 1;
-			if (E->e10[k].update == 0)
+			erlang_history_get(E, 10, k, &R);
+			if (R.update == 0)
 				continue;
 			if (epochtime) {
 				sprintf(logtime, "%ld",
-					(long) E->e10[k].update);
+					(long) R.update);
 			} else {
-				wallclock = gmtime(&E->e10[k].update);
+				wallclock = gmtime(&R.update);
 				strftime(logtime, sizeof(logtime),
 					 "%Y-%m-%d %H:%M", wallclock);
 			}
 			printf("%s  %s", logtime, E->name);
 			printf(" %2dm  %5ld  %3ld  %5ld  %3ld  %5ld  %3ld %5.3f  %5.3f  %5.3f\n",
 			       10,
-			       E->e10[k].bytes_rx,     E->e10[k].packets_rx,
-			       E->e10[k].bytes_rxdrop, E->e10[k].packets_rxdrop,
-			       E->e10[k].bytes_tx,     E->e10[k].packets_tx,
-			       (float) E->e10[k].bytes_rx /
+			       R.bytes_rx,     R.packets_rx,
+			       R.bytes_rxdrop, R.packets_rxdrop,
+			       R.bytes_tx,     R.packets_tx,
+			       (float) R.bytes_rx /
 			       ((float) E->erlang_capa * 60.0),
-			       (float) E->e10[k].bytes_rxdrop /
+			       (float) R.bytes_rxdrop /
 			       ((float) E->erlang_capa * 60.0),
-			       (float)E->e10[k].bytes_tx/((float)E->erlang_capa*60.0)
+			       (float)R.bytes_tx/((float)E->erlang_capa*60.0)
 				);
 		}
 
@@ -161,40 +233,134 @@ void erlang_xml(int topmode)
 			--k;
 			if (k < 0)
 				k = E->e60_max - 1;
-			if (E->e60[k].update == 0)
+			erlang_history_get(E, 60, k, &R);
+			if (R.update == 0)
 				continue;
 			if (epochtime) {
 				sprintf(logtime, "%ld",
-					(long) E->e60[k].update);
+					(long) R.update);
 			} else {
-				wallclock = gmtime(&E->e60[k].update);
+				wallclock = gmtime(&R.update);
 				strftime(logtime, sizeof(logtime),
 					 "%Y-%m-%d %H:%M", wallclock);
 			}
 			printf("%s  %s", logtime, E->name);
 			printf(" %2dm  %5ld  %3ld  %5ld  %3ld  %5ld  %3ld %5.3f  %5.3f  %5.3f\n",
 			       60,
-			       E->e60[k].bytes_rx,     E->e60[k].packets_rx,
-			       E->e60[k].bytes_rxdrop, E->e60[k].packets_rxdrop,
-			       E->e60[k].bytes_tx,     E->e60[k].packets_tx,
-			       (float) E->e60[k].bytes_rx /
+			       R.bytes_rx,     R.packets_rx,
+			       R.bytes_rxdrop, R.packets_rxdrop,
+			       R.bytes_tx,     R.packets_tx,
+			       (float) R.bytes_rx /
 			       ((float) E->erlang_capa * 60.0),
-			       (float) E->e60[k].bytes_rxdrop /
+			       (float) R.bytes_rxdrop /
 			       ((float) E->erlang_capa * 60.0),
-			       (float)E->e60[k].bytes_tx/((float)E->erlang_capa*60.0)
+			       (float)R.bytes_tx/((float)E->erlang_capa*60.0)
 				);
 		}
 
 	}
-
+	free(E);
 
 	exit(0);
 }
 
 
+static void *watch_realloc(void *p, const size_t size)
+{
+	p = realloc(p, size);
+	if (p == NULL) {
+		fprintf(stderr, "aprx-stat: out of memory\n");
+		exit(1);
+	}
+	return p;
+}
+
+/*
+ *  Live view: per port rates over each interval, like top(1).
+ *  The counters are sampled from consistent snapshots, and
+ *  in between the program sleeps.
+ */
+void erlang_watch(const double interval)
+{
+	struct erlang_rxtxbytepkt *prev = NULL, *cur = NULL;
+	struct timeval t0, t1;
+	pid_t pid = ErlangHead->server_pid;
+	int i, have_prev = 0, lines = -1;
+	int tty = isatty(1);
+
+	gettimeofday(&t0, NULL);
+
+	for (;;) {
+		double dt;
+
+		// aprx adds lines for new ports, map them too
+		if (ErlangHead->linecount != ErlangLinesCount)
+			erlang_start(0);
+		if (ErlangHead == NULL) {
+			fprintf(stderr, "aprx-stat: lost the erlang file\n");
+			exit(1);
+		}
+		if (ErlangLinesCount != lines) {
+			lines = ErlangLinesCount;
+			prev  = watch_realloc(prev, (lines + 1) * sizeof(*prev));
+			cur   = watch_realloc(cur,  (lines + 1) * sizeof(*cur));
+			have_prev = 0;
+		}
+
+		gettimeofday(&t1, NULL);
+		for (i = 0; i < ErlangLinesCount; ++i)
+			erlang_snapshot(&ErlangLines[i]->seq, &cur[i],
+					&ErlangLines[i]->SNMP, sizeof(cur[i]));
+
+		// Restarted aprx zeroes the counters
+		if (ErlangHead->server_pid != pid) {
+			pid = ErlangHead->server_pid;
+			have_prev = 0;
+		}
+
+		dt = (t1.tv_sec - t0.tv_sec) + (t1.tv_usec - t0.tv_usec) / 1000000.0;
+		if (have_prev && dt > 0) {
+			char logtime[40];
+			now = t1;
+			printtime(logtime, sizeof(logtime));
+			if (tty)
+				printf("\033[H\033[2J");
+			printf("%s  %s  pid %ld  interval %.1fs\n", logtime,
+			       ErlangHead->mycall, (long)pid, dt);
+			printf("%-10s %8s %9s %8s %9s %8s %9s %6s %6s\n", "port",
+			       "rx pkt/s", "rx B/s", "dp pkt/s", "dp B/s",
+			       "tx pkt/s", "tx B/s", "rx erl", "tx erl");
+			for (i = 0; i < ErlangLinesCount; ++i) {
+				const struct erlang_rxtxbytepkt *C = &cur[i], *P = &prev[i];
+				double capa = ErlangLines[i]->erlang_capa / 60.0 * dt;
+				if (capa <= 0) capa = 1;
+				printf("%-10s %8.1f %9.0f %8.1f %9.0f %8.1f %9.0f %6.3f %6.3f\n",
+				       ErlangLines[i]->name,
+				       (C->packets_rx - P->packets_rx) / dt,
+				       (C->bytes_rx - P->bytes_rx) / dt,
+				       (C->packets_rxdrop - P->packets_rxdrop) / dt,
+				       (C->bytes_rxdrop - P->bytes_rxdrop) / dt,
+				       (C->packets_tx - P->packets_tx) / dt,
+				       (C->bytes_tx - P->bytes_tx) / dt,
+				       (C->bytes_rx - P->bytes_rx) / capa,
+				       (C->bytes_tx - P->bytes_tx) / capa);
+			}
+			if (!tty)
+				printf("\n");
+			fflush(stdout);
+		}
+
+		memcpy(prev, cur, ErlangLinesCount * sizeof(*cur));
+		have_prev = 1;
+		t0 = t1;
+		usleep((useconds_t)(interval * 1000000.0));
+	}
+}
+
+
 void usage(void)
 {
-	printf("Usage: aprx-stat [-t] [-f arpx-erlang.dat] {-S|-x|-X}\n");
+	printf("Usage: aprx-stat [-t] [-f arpx-erlang.dat] {-S|-x|-X|-L|-w [-n seconds]}\n");
 	exit(64);
 }
 
@@ -203,10 +369,18 @@ int main(int argc, char **argv)
 	int opt;
 	int mode_snmp = 0;
 	int mode_xml = 0;
+	int mode_latency = 0;
+	int mode_watch = 0;
+	double interval = 1.0;
+	static const struct option longopts[] = {
+		{ "watch",    no_argument,       NULL, 'w' },
+		{ "interval", required_argument, NULL, 'n' },
+		{ NULL, 0, NULL, 0 }
+	};
 
         gettimeofday(&now, NULL);
 
-	while ((opt = getopt(argc, argv, "f:StxX?h")) != -1) {
+	while ((opt = getopt_long(argc, argv, "f:SLn:twxX?h", longopts, NULL)) != -1) {
 		switch (opt) {
 		case 'f':
 			erlang_backingstore = optarg;
@@ -214,6 +388,17 @@ int main(int argc, char **argv)
 		case 'S':	/* SNMP */
 			++mode_snmp;
 			break;
+		case 'L':	/* latency histograms */
+			mode_latency = 1;
+			break;
+		case 'w':	/* live rates */
+			mode_watch = 1;
+			break;
+		case 'n':
+			interval = atof(optarg);
+			if (interval < 0.1)
+				interval = 0.1;
+			break;
 		case 'X':
 			mode_xml = 1;
 			break;
@@ -236,6 +421,10 @@ int main(int argc, char **argv)
 
 	if (mode_snmp) {
 		erlang_snmp();
+	} else if (mode_latency) {
+		erlang_latencies();
+	} else if (mode_watch) {
+		erlang_watch(interval);
 	} else if (mode_xml == 1) {
 		erlang_xml(0);
 	} else if (mode_xml == 2) {
@@ -28,9 +28,9 @@ int erlangout;
 const char *rflogfile;
 const char *aprxlogfile;
 const char *mycall;
-float myloc_lat;
-float myloc_coslat;
-float myloc_lon;
+int32_t myloc_lat;
+int32_t myloc_coslat;
+int32_t myloc_lon;
 const char *myloc_latstr;
 const char *myloc_lonstr;
 
@@ -44,11 +44,15 @@ const char *pidfile = VARRUN "/aprx.pid";
 
 int die_now;
 int log_aprsis;
+#ifndef APRX_BENCHMARK
+static volatile sig_atomic_t status_now;
+#endif
 
 const char *swname = "aprx";
 const char *swversion = APRXVERSION;
 
 
+#ifndef APRX_BENCHMARK	/* aprx-bench has its own main() */
 static void sig_handler(int sig)
 {
 	die_now = 1;
@@ -62,6 +66,26 @@ static void sig_handler(int sig)
         }
 }
 
+static void sig_status(int sig)
+{
+	status_now = 1;
+	signal(sig, sig_status);
+}
+
+/* SIGUSR1 -- log internal status */
+static void status_log(void)
+{
+	struct cellstatus_t cs;
+	int i;
+
+	for (i = 0; cellstatus(i, &cs) == 0; ++i) {
+		aprxlog("cellmalloc %s: cellsize %d%s, in use %ld (max %ld), free %ld, blocks %d (%ld kB), failures %ld",
+			cs.arenaname, cs.cellsize, cs.threads ? " threads" : "",
+			cs.cellsinuse, cs.cellsinuse_max, cs.freecount,
+			cs.blocks, cs.blockbytes / 1024, cs.allocfailures);
+	}
+}
+
 static void sig_child(int sig)
 {
 	int status;
@@ -84,6 +108,7 @@ static void usage(void)
 	printf("    -d:  turn debug printout on, use to verify config file!\n");
 	printf("         twice: prints also interaction with aprs-is system..\n");
 	printf("    -L:  Log also all of APRS-IS traffic on relevant log.\n");
+	printf("    -S capture:  Simulate: replay an rflog capture in simulated time, no real I/O.\n");
 	exit(64);		/* EX_USAGE */
 }
 
@@ -92,6 +117,7 @@ static void versionprint()
 	printf("aprx: %s\n", swversion);
         exit(1);
 }
+#endif
 
 void fd_nonblockingmode(int fd)
 {
@@ -104,6 +130,26 @@ void fd_nonblockingmode(int fd)
 	// return __i;
 }
 
+int64_t latency_rxstamp;
+
+/* Monotonic microseconds for latency measurements */
+int64_t latency_now(void)
+{
+	struct timeval tv;
+
+	if (simulate_active)
+		return (int64_t)tick.tv_sec * 1000000 + tick.tv_usec;
+#ifdef HAVE_CLOCK_GETTIME
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	tv.tv_sec  = ts.tv_sec;
+	tv.tv_usec = ts.tv_nsec / 1000;
+#else
+	gettimeofday(&tv, NULL);
+#endif
+	return (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
 int time_reset = 1;             // observed time jump, initially as "reset is happening!"
 static struct timeval old_tick; // monotonic
 // static struct timeval old_now;  // wall-clock
@@ -113,6 +159,8 @@ static int timetick_count;
 void timetick(void)
 {
 	++timetick_count;
+	if (simulate_active)
+		return;		// simulate.c moves the clock
         old_tick  = tick;
         //old_now = now;
 
@@ -157,11 +205,13 @@ void timetick(void)
         // if (debug>1) printf("TIMETICK %ld:%6d  %d delta=%d ms\n", tick.tv_sec, tick.tv_usec, timetick_count, delta);
 }
 
+#ifndef APRX_BENCHMARK
 int main(int argc, char *const argv[])
 {
 	int i;
 	const char *cfgfile = "/etc/aprx.conf";
 	const char *syslog_facility = "NONE";
+	const char *simcapture = NULL;
 	int foreground = 0;
         int millis;
         int can_clear_timereset;
@@ -174,7 +224,7 @@ int main(int argc, char *const argv[])
         setvbuf(stdout, NULL, _IOLBF, BUFSIZ);
         setvbuf(stderr, NULL, _IOLBF, BUFSIZ);
 
-	while ((i = getopt(argc, argv, "def:hiLl:vV?")) != -1) {
+	while ((i = getopt(argc, argv, "def:hiLl:S:vV?")) != -1) {
 		switch (i) {
 		case '?':
 		case 'h':
@@ -204,6 +254,10 @@ int main(int argc, char *const argv[])
 		case 'f':
 			cfgfile = optarg;
 			break;
+		case 'S':
+			simcapture = optarg;
+			++foreground;
+			break;
                 case 'V':
                 	versionprint();
                 	break;
@@ -212,6 +266,9 @@ int main(int argc, char *const argv[])
 		}
 	}
 
+	if (simcapture && simulate_open(simcapture))
+		exit(1);
+
 	interface_init(); // before any interface system and aprsis init !
 	erlang_init(syslog_facility);
 	ttyreader_init();
@@ -236,6 +293,15 @@ int main(int argc, char *const argv[])
 	  exit(1); // CONFIION ERRORS SEEN! ABORT!
 	}
 
+	if (simulate_active) {
+		// Leave a running aprx alone: its pidfile, statistics
+		// and log files.  Our rflog goes to STDOUT.
+		pidfile = NULL;
+		erlang_backingstore = NULL;
+		aprxlogfile = NULL;
+		rflogfile = "-";
+	}
+
 	erlang_start(1);
 #ifndef DISABLE_IGATE
 	historydb_init();
@@ -298,7 +364,7 @@ int main(int argc, char *const argv[])
 
 	}
 
-	if (1) {
+	if (pidfile) {
 		/* Open the pidfile, if you can.. */
 
 		FILE *pf = fopen(pidfile, "w");
@@ -357,18 +423,24 @@ int main(int argc, char *const argv[])
 	signal(SIGHUP,  sig_handler);
 	signal(SIGPIPE, SIG_IGN);
 	signal(SIGCHLD, sig_child);
+	signal(SIGUSR1, sig_status);
 
 	// Must be after config reading ...
-	netresolv_start();
+	if (!simulate_active) {
+		netresolv_start();
 #ifndef DISABLE_IGATE
-	aprsis_start();
+		aprsis_start();
 #endif
 #ifdef PF_AX25			/* PF_AX25 exists -- highly likely a Linux system ! */
-	netax25_start();
+		netax25_start();
 #endif
 #ifdef ENABLE_AGWPE
-	agwpe_start();
+		agwpe_start();
 #endif
+		ttyreader_start();
+		metrics_start();
+	}
+	beacon_start();
 	telemetry_start();
 #ifndef DISABLE_IGATE
 	igate_start();
@@ -387,22 +459,28 @@ int main(int argc, char *const argv[])
 		aprxpolls_reset(&app);
                 tv_timeradd_millis( &app.next_timeout, &tick, 30000 ); // 30 seconds
 
-		i = ttyreader_prepoll(&app);
-                // if (debug>3)printf("after ttyreader prepoll - timeout millis=%d\n",aprxpolls_millis(&app));
-#ifndef DISABLE_IGATE
-		i = aprsis_prepoll(&app);
-                // if (debug>3)printf("after aprsis prepoll - timeout millis=%d\n",aprxpolls_millis(&app));
-#endif
 		i = beacon_prepoll(&app);
                 // if (debug>3)printf("after beacon prepoll - timeout millis=%d\n",aprxpolls_millis(&app));
+		if (simulate_active) {
+			// Capture replaces all real I/O
+			i = simulate_prepoll(&app);
+		} else {
+			i = ttyreader_prepoll(&app);
+			// if (debug>3)printf("after ttyreader prepoll - timeout millis=%d\n",aprxpolls_millis(&app));
+#ifndef DISABLE_IGATE
+			i = aprsis_prepoll(&app);
+			// if (debug>3)printf("after aprsis prepoll - timeout millis=%d\n",aprxpolls_millis(&app));
+#endif
 #ifdef PF_AX25			/* PF_AX25 exists -- highly likely a Linux system ! */
-		i = netax25_prepoll(&app);
-                // if (debug>3)printf("after netax25 prepoll - timeout millis=%d\n",aprxpolls_millis(&app));
+			i = netax25_prepoll(&app);
+			// if (debug>3)printf("after netax25 prepoll - timeout millis=%d\n",aprxpolls_millis(&app));
 #endif
 #ifdef ENABLE_AGWPE
-		i = agwpe_prepoll(&app);
-                // if (debug>3)printf("after agwpe prepoll - timeout millis=%d\n",aprxpolls_millis(&app));
+			i = agwpe_prepoll(&app);
+			// if (debug>3)printf("after agwpe prepoll - timeout millis=%d\n",aprxpolls_millis(&app));
 #endif
+			i = metrics_prepoll(&app);
+		}
 		i = erlang_prepoll(&app);
                 // if (debug>3)printf("after erlang prepoll - timeout millis=%d\n",aprxpolls_millis(&app));
 		i = telemetry_prepoll(&app);
@@ -411,6 +489,7 @@ int main(int argc, char *const argv[])
                 // if (debug>3)printf("after dupecheck prepoll - timeout millis=%d\n",aprxpolls_millis(&app));
 		i = digipeater_prepoll(&app);
                 // if (debug>3)printf("after digipeater prepoll - timeout millis=%d\n",aprxpolls_millis(&app));
+		i = txsched_prepoll(&app);
 #ifndef DISABLE_IGATE
 		i = historydb_prepoll(&app);
                 // if (debug>3)printf("after historydb prepoll - timeout millis=%d\n",aprxpolls_millis(&app));
@@ -431,41 +510,58 @@ int main(int argc, char *const argv[])
 		// if (app.next_timeout <= now.tv_sec)
                 // app.next_timeout = now.tv_sec + 1;	// Just to be on safe side..
 
-                millis = aprxpolls_millis(&app);
-                if (millis < 10)
-                  millis = 10;
+		if (simulate_active) {
+			simulate_poll(&app); // jump to next event
+		} else {
+			millis = aprxpolls_millis(&app);
+			if (millis < 10)
+				millis = 10;
 
-		i = poll(app.polls, app.pollcount, millis);
-                timetick(); // post-poll
+			i = poll(app.polls, app.pollcount, millis);
+			timetick(); // post-poll
+		}
 
 
 		i = beacon_postpoll(&app);
-		i = ttyreader_postpoll(&app);
+		if (simulate_active) {
+			i = simulate_postpoll(&app);
+		} else {
+			i = ttyreader_postpoll(&app);
 #ifdef PF_AX25			/* PF_AX25 exists -- highly likely a Linux system ! */
-		i = netax25_postpoll(&app);
+			i = netax25_postpoll(&app);
 #endif
 #ifdef ENABLE_AGWPE
-		i = agwpe_postpoll(&app);
+			i = agwpe_postpoll(&app);
 #endif
 #ifndef DISABLE_IGATE
-		i = aprsis_postpoll(&app);
+			i = aprsis_postpoll(&app);
 #endif
+			i = metrics_postpoll(&app);
+		}
 		i = erlang_postpoll(&app);
 		i = telemetry_postpoll(&app);
 		i = dupecheck_postpoll(&app);
 		i = digipeater_postpoll(&app);
+		i = txsched_postpoll(&app);
 #ifndef DISABLE_IGATE
 		i = historydb_postpoll(&app);
 		i = dprsgw_postpoll(&app);
 #endif
 
+		if (status_now) {
+			status_now = 0;
+			status_log();
+		}
+
 	}
 	aprxpolls_free(&app); // valgrind..
 
+	if (!simulate_active) {
 #ifndef DISABLE_IGATE
-	aprsis_stop();
+		aprsis_stop();
 #endif
-	netresolv_stop();
+		netresolv_stop();
+	}
 
 	if (pidfile) {
 		unlink(pidfile);
@@ -473,6 +569,7 @@ int main(int argc, char *const argv[])
 
 	exit(0);
 }
+#endif
 
 
 void printtime(char *buf, int buflen)
@@ -481,7 +578,10 @@ void printtime(char *buf, int buflen)
 	struct tm t;
 
         // Wall lock time for printouts
-	gettimeofday(&tv, NULL);
+	if (simulate_active)
+		tv = tick; // capture time
+	else
+		gettimeofday(&tv, NULL);
         gmtime_r(&tv.tv_sec, &t);
 	// strftime(timebuf, 60, "%Y-%m-%d %H:%M:%S", t);
 	sprintf(buf, "%04d-%02d-%02d %02d:%02d:%02d.%03d",
@@ -650,7 +750,7 @@ void rflog(const char *portname, char direction, int discard, const char *tnc2bu
 		FILE *fp = NULL;
 		const char *p;
 		if (strcmp("-",rflogfile)==0) {
-			if (debug < 2) return;
+			if (debug < 2 && !simulate_active) return;
 			fp = stdout;
 		} else {
 			fp = fopen(rflogfile, "a");
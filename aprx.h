@@ -155,11 +155,13 @@ extern void aprxpolls_free(struct aprxpolls *app);
 extern const char *aprsis_login;
 #endif
 extern int die_now;
+extern int64_t latency_rxstamp;	// latency_now() at arrival of current frame
+extern int64_t latency_now(void);
 extern const char *mycall;
 extern const char *tocall;
-extern float myloc_lat;
-extern float myloc_coslat;
-extern float myloc_lon;
+extern int32_t myloc_lat;	/* microdegrees */
+extern int32_t myloc_coslat;	/* 16.16 fixed point */
+extern int32_t myloc_lon;
 extern const char *myloc_latstr;
 extern const char *myloc_lonstr;
 
@@ -208,6 +210,26 @@ struct netresolver {
 
 extern struct netresolver *netresolv_add(const char *hostname, const char *port);
 
+/* ringbuf.c */
+struct ringbuf {
+	uint8_t	    *data;
+	unsigned int mask;	/* size - 1, size is a power of two     */
+	unsigned int head;	/* next byte to store, free running     */
+	unsigned int tail;	/* next byte to take, free running      */
+};
+
+extern void ringbuf_init(struct ringbuf *R, uint8_t *mem, const int size);
+extern void ringbuf_reset(struct ringbuf *R);
+extern int  ringbuf_used(const struct ringbuf *R);
+extern int  ringbuf_space(const struct ringbuf *R);
+extern int  ringbuf_put(struct ringbuf *R, const void *p, const int len);
+extern int  ringbuf_getc(struct ringbuf *R);
+extern void ringbuf_skip(struct ringbuf *R, const int len);
+extern const uint8_t *ringbuf_linear(const struct ringbuf *R, const int offset, const int len, uint8_t *tmp);
+extern int  ringbuf_read(struct ringbuf *R, const int fd);
+extern int  ringbuf_write(struct ringbuf *R, const int fd);
+extern int  ringbuf_send(struct ringbuf *R, const int fd, const int flags);
+
 /* ttyreader.c */
 typedef enum {
 	LINETYPE_KISS,		/* all KISS variants without CRC on line */
@@ -265,21 +287,33 @@ struct serialport {
 	struct aprx_interface	*interface[16];
 
 
-	uint8_t rdbuf[2000];	/* buffering area for raw stream read */
-	int rdlen, rdcursor;	/* rdlen = last byte in buffer,
-				   rdcursor = next to read.
-				   When rdlen == 0, buffer is empty.    */
+	struct ringbuf rd;	/* raw stream read, over rdbuf[]        */
+	uint8_t rdbuf[2048];	/* power of two for the ring            */
 
 	time_t  rdline_time;	/* last time something was added there  */
 	uint8_t rdline[2000];	/* processed into lines/records         */
 	int rdlinelen;		/* length of this record                */
 
-	uint8_t wrbuf[4000];	/* buffering area for raw stream read */
-	int wrlen, wrcursor;	/* wrlen = last byte in buffer,
-				   wrcursor = next to write.
-				   When wrlen == 0, buffer is empty.    */
+	struct ringbuf wr;	/* raw stream write, over wrbuf[]       */
+	uint8_t wrbuf[4096];	/* power of two for the ring            */
 
 	void *dprsgw;		/* opaque DPRS GW data */
+
+#if defined(HAVE_PTHREAD_CREATE) && defined(ENABLE_PTHREAD)
+	/* "thread" mode:  a reader thread owns fd, rd, rdline, and
+	   wr output.  Deframed frames come to the core over rxq. */
+	int	  threaded;
+	pthread_t thread;
+	pthread_mutex_t wrlock;	/* wr in between core and thread        */
+	int	  wakefd[2];	/* core -> thread:  wr has data         */
+	int	  rxqfd[2];	/* thread -> core:  rxq has frames      */
+	struct ringbuf rxq;	/* single producer, single consumer     */
+	uint8_t	  rxqbuf[16384];
+	volatile long rxq_drops; /* frames not fitting in rxq, by thread */
+	long	  rxq_dropseen;	/* .. and accounted of them by core     */
+	int	  lineopen;	/* thread -> core:  fd is open, under   */
+				/* wrlock, the core never reads fd      */
+#endif
 };
 
 
@@ -296,6 +330,9 @@ extern int  ttyreader_getc(struct serialport *tty);
 // extern void               ttyreader_setkissparams(struct serialport *tty, const int tncid, const char *callsign, const int timeout);
 extern int  ttyreader_parse_ttyparams(struct configfile *cf, struct serialport *tty, char *str);
 extern void ttyreader_linewrite(struct serialport *S);
+extern int  ttyreader_queuewrite(struct serialport *S, const uint8_t *buf, const int len);
+extern void ttyreader_start(void);
+extern void ttyreader_rxqueue(struct serialport *S, const uint8_t *frame, const int len, const int crcflags);
 extern int  ttyreader_parse_nullparams(struct configfile *cf, struct serialport *tty, char *str);
 
 extern void hexdumpfp(FILE *fp, const uint8_t *buf, const int len, int axaddr);
@@ -322,6 +359,8 @@ extern int  ax25_format_to_tnc(const uint8_t *frame, const int framelen,
 			       int *is_aprs, int *ui_pid);
 extern int  parse_ax25addr(uint8_t ax25[7], const char *text,
 			   int ssidflags);
+extern int  ax25_from_tnc2(const char *tnc2, const int tnc2len,
+			   uint8_t *frame, const int framespace);
 
 
 #ifndef DISABLE_IGATE
@@ -349,6 +388,7 @@ extern int  beacon_prepoll(struct aprxpolls *app);
 extern int  beacon_postpoll(struct aprxpolls *app);
 extern int  beacon_config(struct configfile *cf);
 extern void beacon_childexit(int pid);
+extern void beacon_start(void);
 
 /* config.c */
 extern void *readconfigline(struct configfile *cf);
@@ -367,6 +407,8 @@ extern int   validate_degmin_input(const char *s, int maxdeg);
 
 /* dprsgw.c */
 extern int  dprsgw_pulldprs(struct serialport *S);
+extern int  dprsgw_config(struct serialport *S, const char *keyword, const char *value);
+extern void dprsgw_metrics(void);
 extern int  dprsgw_prepoll(struct aprxpolls *app);
 extern int  dprsgw_postpoll(struct aprxpolls *app);
 
@@ -407,6 +449,22 @@ extern int  telemetry_prepoll(struct aprxpolls *app);
 extern int  telemetry_postpoll(struct aprxpolls *app);
 extern int  telemetry_config(struct configfile *cf);
 
+/* metrics.c */
+extern int  metrics_config(const char *param1, const char *str);
+extern void metrics_start(void);
+extern int  metrics_prepoll(struct aprxpolls *app);
+extern int  metrics_postpoll(struct aprxpolls *app);
+extern void metrics_printf(const char *fmt, ...)
+	__attribute__ ((__format__ (__printf__, 1, 2)));
+extern void metrics_family(const char *name, const char *type, const char *help);
+
+/* simulate.c */
+extern int  simulate_active;
+extern int  simulate_open(const char *capture);
+extern int  simulate_prepoll(struct aprxpolls *app);
+extern void simulate_poll(struct aprxpolls *app);
+extern int  simulate_postpoll(struct aprxpolls *app);
+
 
 typedef enum {
 	ERLANG_RX,
@@ -416,6 +474,7 @@ typedef enum {
 
 extern void erlang_add(const char *portname, ErlangMode erl, int bytes, int packets);
 extern void erlang_set(const char *portname, int bytes_per_minute);
+extern float erlang_occupancy(const char *portname);
 
 extern int erlangsyslog;
 extern int erlanglog1min;
@@ -424,16 +483,75 @@ extern const char *erlang_backingstore;
 /* The   struct erlangline  is shared in between the aprx, and
    erlang reporter application: aprx-stat */
 
+/* Latency histograms of the receive to transmit path, in erlanghead */
+typedef enum {
+	LATENCY_PARSE,		// parse_aprs() at reception
+	LATENCY_FILTER,		// digipeater source filters
+	LATENCY_DUPECHECK,	// dupecheck_pbuf() in digipeater
+	LATENCY_VISCOUS,	// reception to leaving viscous delay queue
+	LATENCY_TRANSMIT,	// reception to going on air from txsched.c
+	LATENCY_APRSIS,		// reception to aprsis_queue() done
+	LATENCY_STAGES
+} LatencyStage;
+
+/* Microsecond buckets: values below 8 have their own, above that
+   there are 4 per power of two, up to 2^28 us (268 s). */
+#define LATENCY_SUBBITS  2
+#define LATENCY_BUCKETS  108
+
+struct erlang_latency {
+	long     samples;
+	long     max_us;
+	double   sum_us;
+	uint32_t bucket[LATENCY_BUCKETS];
+};
+
+extern const char *latency_names[LATENCY_STAGES];
+extern void erlang_latency(const LatencyStage stage, const int64_t usec);
+extern int  latency_bucket(const long usec);
+extern long latency_bucket_low(const int bucket);
+extern long latency_percentile(const struct erlang_latency *L, const double p);
+
 struct erlang_rxtxbytepkt {
 	long packets_rx, packets_rxdrop, packets_tx ;
 	long bytes_rx,   bytes_rxdrop,   bytes_tx ;
 	time_t update;
 };
 
+/* Rolling aggregate of the telemetry periods, since the last report */
+struct erlang_aggregate {
+	long max_bytes_rx, max_bytes_tx;
+	long packets_rx, packets_rxdrop, packets_tx;
+	int  count;		/* periods in the sums */
+};
+
+#ifdef ERLANGSTORAGE
+/* History rings in the state file are stored in page sized blocks.
+   Within a block each counter has a column of 32-bit per-period
+   counts, so storing one period dirties one page, and a series is
+   read sequentially.  Pages that have never been written stay holes
+   in the sparse state file. */
+#define ERLANG_PAGESIZE    4096
+#define ERLANG_BLOCKSLOTS  146	/* 7 columns * 146 * 4 bytes = 4088 */
+
+struct erlang_histblock {
+	uint32_t update[ERLANG_BLOCKSLOTS];	/* time_t of period end */
+	uint32_t packets_rx[ERLANG_BLOCKSLOTS];
+	uint32_t packets_rxdrop[ERLANG_BLOCKSLOTS];
+	uint32_t packets_tx[ERLANG_BLOCKSLOTS];
+	uint32_t bytes_rx[ERLANG_BLOCKSLOTS];
+	uint32_t bytes_rxdrop[ERLANG_BLOCKSLOTS];
+	uint32_t bytes_tx[ERLANG_BLOCKSLOTS];
+} __attribute__ ((aligned (ERLANG_PAGESIZE)));
+
+#define ERLANG_HISTBLOCKS(n)  (((n) + ERLANG_BLOCKSLOTS - 1) / ERLANG_BLOCKSLOTS)
+#endif
+
 
 struct erlangline {
-	const void *refp;
+	const void *refp;	/* aprx_interface of the line, in aprx only */
 	int index;
+	volatile uint32_t seq;	/* odd while aprx updates this line */
 	char name[31];
 	uint8_t __subport;
 	time_t last_update;
@@ -441,6 +559,7 @@ struct erlangline {
 	int erlang_capa;	/* bytes, 1 minute                      */
 
 	struct erlang_rxtxbytepkt SNMP;	/* SNMPish counters             */
+	struct erlang_aggregate telemetry;	/* for telemetry.c          */
 
 #ifdef ERLANGSTORAGE
 	struct erlang_rxtxbytepkt erl1m;	/*  1 minute erlang period    */
@@ -471,9 +590,9 @@ struct erlangline {
 #define APRXERL_1M_COUNT   (60*24)    // 1 day of 1 minute data
 #define APRXERL_10M_COUNT  (60*24*7)  // 1 week of 10 minute data
 #define APRXERL_60M_COUNT  (24*31*3)  // 3 months of hourly data
-	struct erlang_rxtxbytepkt e1[APRXERL_1M_COUNT];
-	struct erlang_rxtxbytepkt e10[APRXERL_10M_COUNT];
-	struct erlang_rxtxbytepkt e60[APRXERL_60M_COUNT];
+	struct erlang_histblock e1[ERLANG_HISTBLOCKS(APRXERL_1M_COUNT)];
+	struct erlang_histblock e10[ERLANG_HISTBLOCKS(APRXERL_10M_COUNT)];
+	struct erlang_histblock e60[ERLANG_HISTBLOCKS(APRXERL_60M_COUNT)];
 #else /* EMBEDDED */		/* When making very small memory footprint,
 				   like embedding on Linksys WRT54GL ... */
 
@@ -498,6 +617,9 @@ struct erlanghead {
 
 	char mycall[16];
 
+	volatile uint32_t seq;	/* odd while aprx updates latency[] */
+	struct erlang_latency latency[LATENCY_STAGES];
+
 	double align_filler;
 };
 
@@ -507,6 +629,18 @@ extern struct erlanghead *ErlangHead;
 extern struct erlangline **ErlangLines;
 extern int ErlangLinesCount;
 
+/* Period history entry k of 1, 10 or 60 minute ring */
+extern void erlang_history_get(const struct erlangline *E, const int minutes,
+			       const int k, struct erlang_rxtxbytepkt *R);
+
+/* Take the telemetry aggregate of a line, and start a new one */
+extern void erlang_aggregate_take(struct erlangline *E, struct erlang_aggregate *A);
+
+/* Consistent copy of a seq protected part of the shared erlang data,
+   returns -1 if the writer seems to have died in mid-update */
+extern int erlang_snapshot(const volatile uint32_t *seq, void *dst,
+			   const volatile void *src, const size_t len);
+
 
 /* dupecheck.c */
 
@@ -541,6 +675,7 @@ typedef struct dupe_record_t {
 
 typedef struct dupecheck_t {
 	int	storetime;
+	int	records;	/* in the table, a gauge */
 	struct dupe_record_t *dupecheck_db[DUPECHECK_DB_SIZE]; /* Hash index table */
 } dupecheck_t;
 
@@ -552,6 +687,7 @@ extern dupe_record_t *dupecheck_aprs(dupecheck_t *dp, const char *addr, const in
 extern dupe_record_t *dupecheck_pbuf(dupecheck_t *dp, struct pbuf_t *pb, const int viscous_delay); /* pbuf checker */
 extern int            dupecheck_prepoll(struct aprxpolls *app);
 extern int            dupecheck_postpoll(struct aprxpolls *app);
+extern void           dupecheck_metrics(void);
 
 
 /* crc.c */
@@ -574,9 +710,16 @@ extern int      check_crc_ccitt(const uint8_t *buf, int n);
 #define KISS_TFEND (0xDC)
 #define KISS_TFESC (0xDD)
 
+/* kiss_process() crcflags, of CRCs found valid on a received frame */
+#define KISSCRC_FLEXNET  0x01
+#define KISSCRC_SMACK    0x02
+#define KISSCRC_BPQ      0x04
+
 extern int  kissencoder(void *, int, LineType, const void *, int, int);
 extern void kiss_kisswrite(struct serialport *S, const int tncid, const uint8_t *ax25raw, const int ax25rawlen);
 extern int  kiss_pullkiss(struct serialport *S);
+extern int  kiss_process(struct serialport *S, const uint8_t *frame, int len, const int crcflags);
+extern int  kiss_txbacklog(struct serialport *S);
 extern void kiss_poll(struct serialport *S);
 
 
@@ -599,6 +742,8 @@ struct tracewide {
 	int    nkeys;
 	char **keys;
 	int   *keylens;
+	uint8_t *ax25keys; // nkeys * 6 bytes of shifted AX.25 callsigns,
+			   // NULL when some key has no such form
 };
 
 struct digipeater_source {
@@ -608,6 +753,7 @@ struct digipeater_source {
 	struct filter_t       *src_filters;
 	struct tracewide      *src_trace;
 	struct tracewide      *src_wide;
+	int		       ax25hops; // hops parseable from AX.25 header
 #ifndef DISABLE_IGATE
 	char		      *via_path; // for APRSIS only
 	char		      *msg_path; // for APRSIS only
@@ -656,18 +802,52 @@ struct digipeater {
 	const struct tracewide *trace;
 	const struct tracewide *wide;
 
+	int                    ax25aliascount; // transmitter aliases in
+	uint8_t               *ax25aliases;    // AX.25 form, 7 bytes each
+
 	int                        sourcecount;
 	struct digipeater_source **sources;
 };
 
 extern int  digipeater_prepoll(struct aprxpolls *app);
 extern int  digipeater_postpoll(struct aprxpolls *app);
+extern void digipeater_metrics(void);
 extern int  digipeater_config(struct configfile *cf);
 extern void digipeater_receive(struct digipeater_source *src, struct pbuf_t *pb);
 extern int  digipeater_receive_filter(struct digipeater_source *src, struct pbuf_t *pb);
 extern dupecheck_t *digipeater_find_dupecheck(const struct aprx_interface *aif);
 extern struct digipeater* digipeater_find_by_iface(const struct aprx_interface *aif);
 
+/* txsched.c */
+
+/* Transmit traffic classes, highest priority first */
+typedef enum {
+	TXPRIO_DIGI,		// digipeated frames
+	TXPRIO_VISCOUS,		// digipeated after viscous delay
+	TXPRIO_IGATE,		// APRS-IS to RF gated frames
+	TXPRIO_BEACON,		// beacons
+	TXPRIO_TELEMETRY,	// interface telemetry
+	TXPRIO_CLASSES
+} TxPriority;
+
+struct aprx_interface;
+struct txsched;
+
+extern const char *txprio_names[TXPRIO_CLASSES];
+extern int  txsched_config(struct aprx_interface *aif, const char *param1, const char *str);
+extern struct txsched *txsched_clone(const struct txsched *T);
+extern void txsched_attach(struct aprx_interface *aif);
+extern void txsched_submit(const struct aprx_interface *aif, const TxPriority prio, const int64_t t_arrival, uint8_t *axaddr, const int axaddrlen, const char *axdata, const int axdatalen);
+extern int  txsched_prepoll(struct aprxpolls *app);
+extern int  txsched_postpoll(struct aprxpolls *app);
+extern void txsched_metrics(void);
+
+/* slotplan.c */
+extern void   slotplan_register(const struct aprx_interface *aif, const float rate);
+extern time_t slotplan_place(const struct aprx_interface **aifs, const int aifcount, time_t t);
+extern void   slotplan_cancel(const struct aprx_interface **aifs, const int aifcount, const time_t t);
+extern int    slotplan_defer(const struct aprx_interface **aifs, const int aifcount, int *deferred);
+
 /* interface.c */
 
 typedef enum {
@@ -711,6 +891,8 @@ struct aprx_interface {
 
 	int	                   digisourcecount;
 	struct digipeater_source **digisources;
+
+	struct txsched *txs;	   // Transmit scheduler, see txsched.c
 };
 
 extern struct aprx_interface aprsis_interface;
@@ -727,9 +909,12 @@ extern int interface_is_beaconable( const struct aprx_interface *iface );
 extern int interface_is_telemetrable(const struct aprx_interface *iface );
 
 extern void interface_receive_ax25( const struct aprx_interface *aif, const char *ifaddress, const int is_aprs, const int ui_pid, const uint8_t *axbuf, const int axaddrlen, const int axlen, const char *tnc2buf, const int tnc2addrlen, const int tnc2len);
-extern void interface_transmit_ax25(const struct aprx_interface *aif, uint8_t *axaddr, const int axaddrlen, const char *axdata, const int axdatalen);
+extern void interface_transmit_ax25(const struct aprx_interface *aif, const TxPriority prio, const int64_t t_arrival, uint8_t *axaddr, const int axaddrlen, const char *axdata, const int axdatalen);
+extern void interface_transmit_now(const struct aprx_interface *aif, uint8_t *axaddr, const int axaddrlen, const char *axdata, const int axdatalen);
 extern void interface_receive_3rdparty(const struct aprx_interface *aif, char **heads, const int headscount,  const char *gwtype, const char *tnc2data, const int tnc2datalen);
-extern int  interface_transmit_beacon(const struct aprx_interface *aif, const char *src, const char *dest, const char *via, const char *tncbuf, const int tnclen);
+extern int  interface_transmit_beacon(const struct aprx_interface *aif, const TxPriority prio, const char *src, const char *dest, const char *via, const char *tncbuf, const int tnclen);
+extern int  interface_beacon_address(const char *src, const char *dest, const char *via, uint8_t *ax25addr, char *axaddrbuf, int *axaddrlenp);
+extern void interface_transmit_beaconframe(const struct aprx_interface *aif, const TxPriority prio, uint8_t *ax25addr, const int ax25addrlen, const char *axaddrbuf, const int axlen, const char *txbuf, const int txlen);
 extern int process_message_to_myself(const struct aprx_interface*const srcif, const struct pbuf_t*const pb);
 
 
@@ -742,6 +927,7 @@ extern struct pbuf_t *pbuf_new(const int is_aprs, const int digi_like_aprs, cons
 
 /* parse_aprs.c */
 extern int parse_aprs(struct pbuf_t*const pb, historydb_t*const historydb);
+extern int parse_aprs_level(struct pbuf_t*const pb, historydb_t*const historydb, const int level);
 
 struct aprs_message_t {
         const char *body;          /* message body */
@@ -769,13 +955,14 @@ extern int  filter_process(struct pbuf_t *pb, struct filter_t *f, historydb_t *h
 extern void filter_preprocess_dupefilter(struct pbuf_t *pb);
 extern void filter_postprocess_dupefilter(struct pbuf_t *pb, historydb_t *historydb);
 
-extern float filter_lat2rad(float lat);
-extern float filter_lon2rad(float lon);
+extern int32_t filter_coslat(const int32_t lat);
+extern int32_t filter_deg2micro(const double deg);
 
 #ifdef ENABLE_AGWPE
 /* agwpesocket.c */
 extern void *agwpe_addport(const char *hostname, const char *hostport, const char *agwpeport, const struct aprx_interface *interface);
 extern void agwpe_sendto(const void *_ap, const uint8_t *axaddr, const int axaddrlen, const char *axdata, const int axdatalen);
+extern int  agwpe_txbusy(const void *_ap);
 
 extern int  agwpe_prepoll(struct aprxpolls *);
 extern int  agwpe_postpoll(struct aprxpolls *);
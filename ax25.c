@@ -24,49 +24,84 @@
  * --
  */
 
-int ax25_to_tnc2_fmtaddress(char *dest, const uint8_t *src, int markflag)
+/*
+ * Shifted-ASCII callsign byte decode table.  Gives the callsign
+ * character for valid [A-Z0-9] bytes, AX25DEC_SPACE for padding
+ * (space or NUL), and AX25DEC_BAD for everything else, including
+ * bytes with the address-end bit set.
+ */
+#define AX25DEC_BAD    0
+#define AX25DEC_SPACE  1
+
+#define AX25DEC(b) (((b) & 1) ? AX25DEC_BAD :				\
+		    (((b) >> 1) == 0 || ((b) >> 1) == ' ') ? AX25DEC_SPACE : \
+		    ((('A' <= ((b) >> 1)) && (((b) >> 1) <= 'Z')) ||	\
+		     (('0' <= ((b) >> 1)) && (((b) >> 1) <= '9'))) ? ((b) >> 1) : \
+		    AX25DEC_BAD)
+#define AX25DEC4(b)   AX25DEC(b),   AX25DEC((b)+1),   AX25DEC((b)+2),   AX25DEC((b)+3)
+#define AX25DEC16(b)  AX25DEC4(b),  AX25DEC4((b)+4),  AX25DEC4((b)+8),  AX25DEC4((b)+12)
+#define AX25DEC64(b)  AX25DEC16(b), AX25DEC16((b)+16), AX25DEC16((b)+32), AX25DEC16((b)+48)
+
+static const uint8_t ax25_decode[256] = {
+	AX25DEC64(0), AX25DEC64(64), AX25DEC64(128), AX25DEC64(192)
+};
+
+/* Format one 7 byte address field into dest without the terminating NUL.
+   Returns the number of characters written, or -1 on format error.
+   *ssidbyte gets the 7th byte, or on error the same negative value
+   that ax25_to_tnc2_fmtaddress() returns.  Writes at most 10 chars. */
+
+static inline int ax25_fmtaddr(char *dest, const uint8_t *src,
+			       const int markflag, int *ssidbyte)
 {
-	int i, c;
-	int ssid;
+	char *d = dest;
+	int i, c, ssid;
 	int seen_space = 0;
 
 	/* 6 bytes of station callsigns in shifted ASCII format.. */
-	for (i = 0; i < 6; ++i, ++src) {
-		c = (*src) & 0xFF;
-		if (c & 1) {
-			*dest = 0;
-			return ~c;	/* Bad address-end flag ? */
-		}
-
-		/* Don't copy spaces or 0 bytes */
-		c = c >> 1;
-		if (c == 0 || c == 0x20) {
+	for (i = 0; i < 6; ++i) {
+		c = ax25_decode[src[i]];
+		if (c > AX25DEC_SPACE && !seen_space) {
+			*d++ = c;
+		} else if (c == AX25DEC_SPACE) {
+			/* Don't copy spaces or 0 bytes */
 			seen_space = 1;
-			continue;
-		}
-		if (!seen_space &&
-		    (('A' <= c && c <= 'Z') ||
-		     ('0' <= c && c <= '9'))) {
-			*dest++ = c;
 		} else {
-			*dest = 0;
-			return ~c; // Bad character in callsign
+			if (src[i] & 1)
+				*ssidbyte = ~src[i];	/* Bad address-end flag ? */
+			else
+				*ssidbyte = ~(src[i] >> 1); // Bad character in callsign
+			return -1;
 		}
 	}
 	/* 7th byte carries SSID et.al. bits */
-	c = (*src) & 0xFF;
+	c = src[6];
 	/* (c & 1) can be non-zero - at last address! */
 
 	ssid = (c >> 1) & 0x0F;
 	if (ssid) {	/* don't print SSID==0 value */
-		dest += sprintf(dest, "-%d", ssid);
+		*d++ = '-';
+		if (ssid >= 10) {
+			*d++ = '1';
+			ssid -= 10;
+		}
+		*d++ = '0' + ssid;
 	}
 
 	if ((c & 0x80) && markflag) {
-		*dest++ = '*';	/* Has been digipeated.. */
+		*d++ = '*';	/* Has been digipeated.. */
 	}
-	*dest = 0;
 
+	*ssidbyte = c;
+	return d - dest;
+}
+
+int ax25_to_tnc2_fmtaddress(char *dest, const uint8_t *src, int markflag)
+{
+	int c;
+	int len = ax25_fmtaddr(dest, src, markflag, &c);
+
+	dest[len < 0 ? 0 : len] = 0;
 	return c;
 }
 
@@ -129,10 +164,306 @@ int parse_ax25addr(uint8_t ax25[7], const char *text, int ssidflags)
 	return 0;
 }
 
+/* Convert TNC2 monitor format  SRC>DST,VIA,VIA*:payload  back into
+   an AX.25 UI frame with APRS PID.
+   Return frame length, or 0 on format errors. */
+
+int ax25_from_tnc2(const char *tnc2, const int tnc2len,
+		   uint8_t *frame, const int framespace)
+{
+	char call[16];
+	const char *p = tnc2;
+	const char *e = tnc2 + tnc2len;
+	const char *colon = memchr(tnc2, ':', tnc2len);
+	uint8_t *a;
+	int n = 0, len;
+
+	if (colon == NULL) return 0;
+
+	while (p < colon) {
+		const char *q = p;
+		while (q < colon && *q != '>' && *q != ',') ++q;
+		len = q - p;
+		if (len >= (int)sizeof(call) || n >= 10) return 0;
+		memcpy(call, p, len);
+		call[len] = 0;
+
+		/* Destination goes first in AX.25 */
+		if (n == 0)      a = frame + 7;
+		else if (n == 1) a = frame;
+		else             a = frame + n * 7;
+		if (parse_ax25addr(a, call, n == 1 ? 0xE0 : 0x60))
+			return 0;
+		++n;
+		p = q + 1;
+	}
+	if (n < 2) return 0;
+	len = n * 7;
+	frame[len - 1] |= 0x01;	/* end of addresses */
+
+	++colon;
+	if (len + 2 + (e - colon) > framespace) return 0;
+	frame[len++] = 0x03;
+	frame[len++] = 0xF0;
+	memcpy(frame + len, colon, e - colon);
+	return len + (e - colon);
+}
+
 int ax25_format_to_tnc(const uint8_t *frame, const int framelen,
 		       char *tnc2buf, const int tnc2buflen,
 		       int *frameaddrlen, int *tnc2addrlen,
 		       int *is_aprs, int *ui_pid)
+{
+	int i, j, len;
+	const uint8_t *s = frame;
+	const uint8_t *e = frame + framelen;
+	const uint8_t *lf;
+	char *t = tnc2buf;
+	int viacount = 0;
+
+	if (debug>1) {
+	  printf("ax25_format_to_tnc() len=%d ",framelen);
+	  hexdumpfp(stdout, frame, framelen, 1);
+	  printf("\n");
+	}
+
+	if (framelen > tnc2buflen - 80 || framelen < 14) {
+		/* Too much ! Too much! (or too little) */
+		return 0;
+	}
+
+
+	/* Phase 1: scan address fields. */
+	/* Source and Destination addresses must be printed in altered order.. */
+
+	len = ax25_fmtaddr(t, frame + 7, 0, &i);	/* source */
+	if (len < 0 /*  || ((i & 0xE0) != 0x60)*/) { // Top 3 bits should be: 011
+		/* Bad format */
+		if (debug)
+		  printf("Ax25FmtToTNC2: Bad source address; SSID-byte=0x%02x\n",i);
+		return 0;
+	}
+	t += len;
+	*t++ = '>';
+
+	len = ax25_fmtaddr(t, frame + 0, 0, &j);	/* destination */
+	if (len < 0/* || ((j & 0xE0) != 0xE0)*/) { // Top 3 bits should be: 111
+		/* Bad format */
+		if (debug)
+		  printf("Ax25FmtToTNC2: Bad destination address; SSID-byte=0x%x\n",j);
+		return 0;
+	}
+	t += len;
+
+
+	s = frame + 14;
+
+	if ((i & 1) == 0) {	/* addresses continue after the source! */
+
+		for (; s + 7 <= e;) {
+			if (viacount >= 8) {
+				if (debug)
+				  printf("Ax25FmtToTNC2: Found more than 8 via fields!\n");
+				return 0;
+			}
+			*t++ = ',';	/* separator char */
+			len = ax25_fmtaddr(t, s, 1, &i); // Top 3 bits are:  H11  ( H = "has been digipeated" )
+			if (len < 0 /* || ((i & 0x60) != 0x60) */) {
+				/* Bad format */
+			  if (debug) printf("Ax25FmtToTNC2: Bad via address; SSID-byte=0x%x\n",i);
+				return 0;
+			}
+
+			t += len;
+			s += 7;
+			++ viacount;
+			if (i & 1)
+				break;	/* last address */
+		}
+	}
+
+	*frameaddrlen = s - frame;
+	*tnc2addrlen  = t - tnc2buf;
+
+	/* Address completed */
+
+	if ((s + 2) >= e) // too short payload
+		return 0;		/* never happens ?? */
+
+	*t++ = ':';		/* end of address */
+	*t = 0;
+
+	if (s[0] != 0x03) {
+		// Not AX.25 UI frame
+		*ui_pid = -1; 
+		return t - tnc2buf;
+		/* But say that the frame is OK, and
+		   let it be possibly copied to Linux
+		   internal AX.25 network. */
+	}
+	if (s[0] == 0x03 && s[1] != 0xF0) {
+		// AX.25 UI frame, but no with APRS's PID value
+		*ui_pid = s[1];
+		return t - tnc2buf;
+	}
+
+	s += 2; // Skip over Control and PID bytes
+	*ui_pid = 0xF0; // This was previously verified
+
+	/* Copy payload - stop at first LF char, and chop off
+	   possible immediately trailing CR characters */
+	lf = memchr(s, '\n', e - s);
+	if (lf == NULL)
+		lf = e;
+	while (lf > s && lf[-1] == '\r')
+		--lf;
+	memcpy(t, s, lf - s);
+	t += lf - s;
+	*t = 0;
+
+	*is_aprs = 1;
+	return t - tnc2buf;
+}
+
+/* Convert the binary packet to TNC2 monitor text format.
+   Return 0 if conversion fails (format errors), 1 when format is OK. */
+
+int ax25_to_tnc2(const struct aprx_interface *aif, const char *portname,
+		 const int tncid, const int cmdbyte,
+		 const uint8_t *frame, const int framelen)
+{
+	int frameaddrlen = 0;
+
+	char tnc2buf[2800];
+	int tnc2len = 0, tnc2addrlen = 0, is_aprs = 0, ui_pid = 0;
+
+	latency_rxstamp = latency_now(); // all radio receptions come here
+
+	tnc2len = ax25_format_to_tnc( frame, framelen,
+				      tnc2buf, sizeof(tnc2buf),
+				      & frameaddrlen, &tnc2addrlen,
+				      & is_aprs, &ui_pid );
+
+	if (tnc2len == 0) return 0; // Bad parse result
+
+	// APRS type packets are first rx-igated (and rflog()ed)
+#ifndef DISABLE_IGATE
+	if (is_aprs) {
+	  igate_to_aprsis(portname, tncid, tnc2buf, tnc2addrlen, tnc2len, 0, 1);
+	}
+#endif
+
+	// Send to interface system to receive it..  (digipeater!)
+	// A noop if the interface is actually NULL.
+	interface_receive_ax25(aif, portname, is_aprs, ui_pid,
+			       frame, frameaddrlen, framelen,
+			       tnc2buf, tnc2addrlen, tnc2len);
+
+	return 1;
+}
+
+
+#ifdef AX25_FORMAT_BENCHMARK
+/*
+ * Micro-benchmark of ax25_format_to_tnc(), build with:
+ *     make ax25-bench
+ * and run:
+ *     ./ax25-bench [corpusfile [rounds]]
+ *
+ * The corpus file has one frame per line in hex, optionally with KISS
+ * framing around it (like the example on top of this file).  Without
+ * a file a small built-in corpus is used.  Every frame is also run
+ * through the previous byte-at-a-time formatter, and the outputs are
+ * compared.
+ */
+
+#include <time.h>
+
+int debug;
+int64_t latency_rxstamp;
+int64_t latency_now(void) { return 0; }
+void hexdumpfp(FILE *fp, const uint8_t *buf, const int len, int axaddr) { }
+void igate_to_aprsis(const char *portname, const int tncid, const char *tnc2buf, int tnc2addrlen, int tnc2len, const int discard, const int strictax25) { }
+void interface_receive_ax25(const struct aprx_interface *aif, const char *ifaddress, const int is_aprs, const int ui_pid, const uint8_t *axbuf, const int axaddrlen, const int axlen, const char *tnc2buf, const int tnc2addrlen, const int tnc2len) { }
+
+static const char *bench_corpus[] = {
+	"C0 00 82 A0 B4 9A 88 A4 60 9E 90 64 90 A0 9C 72 9E 90 64 A4 88 A6 E0 A4 8C 9E 9C 98 B2 61 03 F0 21 36 30 32 39 2E 35 30 4E 2F 30 32 35 30 35 2E 34 33 45 3E 20 47 43 53 2D 38 30 31 20 C0",
+	"82 A0 88 A4 62 64 60 9E 90 64 9A 9A 96 E2 AE 92 88 8A 62 40 E2 AE 92 88 8A 64 40 63 03 F0 3D 36 30 31 32 2E 33 34 4E 2F 30 32 34 35 37 2E 38 39 45 2D 50 48 47 32 31 36 30 2F 41 3D 30 30 30 31 32 33 0D",
+	"A6 A8 82 A8 AA A6 E0 88 9C 64 8E 90 9C 74 AE 92 88 8A 64 40 E1 03 F0 3E 32 30 31 34 30 35 7A 20 4E 65 74 20 63 6F 6E 74 72 6F 6C 20 6F 6E 20 31 34 34 2E 38 30 30 20 4D 48 7A 0D 0A",
+	"82 A0 A8 66 62 62 60 9C 6E 8E 9E 40 40 66 AE 92 88 8A 62 40 63 03 F0 60 28 5F 66 20 1C 3E 2F 5D 22 34 5D 7D 3D",
+};
+
+static int bench_hex(const char *p, uint8_t *buf, const int buflen)
+{
+	int n = 0, v;
+
+	while (*p && n < buflen) {
+		while (*p == ' ' || *p == '\t' || *p == ',') ++p;
+		if (sscanf(p, "%2x", &v) != 1) break;
+		buf[n++] = v;
+		while (*p && *p != ' ' && *p != '\t' && *p != ',') ++p;
+	}
+	// Strip KISS framing: FEND + port byte .. FEND
+	if (n > 2 && buf[0] == 0xC0) {
+		memmove(buf, buf+2, n-2);
+		n -= 2;
+	}
+	if (n > 0 && buf[n-1] == 0xC0)
+		--n;
+	return n;
+}
+
+/* The formatters as they were before the table-driven ones, verbatim */
+static int ref_fmtaddress(char *dest, const uint8_t *src, int markflag)
+{
+	int i, c;
+	int ssid;
+	int seen_space = 0;
+
+	/* 6 bytes of station callsigns in shifted ASCII format.. */
+	for (i = 0; i < 6; ++i, ++src) {
+		c = (*src) & 0xFF;
+		if (c & 1) {
+			*dest = 0;
+			return ~c;	/* Bad address-end flag ? */
+		}
+
+		/* Don't copy spaces or 0 bytes */
+		c = c >> 1;
+		if (c == 0 || c == 0x20) {
+			seen_space = 1;
+			continue;
+		}
+		if (!seen_space &&
+		    (('A' <= c && c <= 'Z') ||
+		     ('0' <= c && c <= '9'))) {
+			*dest++ = c;
+		} else {
+			*dest = 0;
+			return ~c; // Bad character in callsign
+		}
+	}
+	/* 7th byte carries SSID et.al. bits */
+	c = (*src) & 0xFF;
+	/* (c & 1) can be non-zero - at last address! */
+
+	ssid = (c >> 1) & 0x0F;
+	if (ssid) {	/* don't print SSID==0 value */
+		dest += sprintf(dest, "-%d", ssid);
+	}
+
+	if ((c & 0x80) && markflag) {
+		*dest++ = '*';	/* Has been digipeated.. */
+	}
+	*dest = 0;
+
+	return c;
+}
+
+static int ref_format_to_tnc(const uint8_t *frame, const int framelen,
+		       char *tnc2buf, const int tnc2buflen,
+		       int *frameaddrlen, int *tnc2addrlen,
+		       int *is_aprs, int *ui_pid)
 {
 	int i, j;
 	const uint8_t *s = frame;
@@ -157,12 +488,12 @@ int ax25_format_to_tnc(const uint8_t *frame, const int framelen,
 
 
 	*t = 0;
-	i = ax25_to_tnc2_fmtaddress(t, frame + 7, 0);	/* source */
+	i = ref_fmtaddress(t, frame + 7, 0);	/* source */
 	t += strlen(t);
 	*t++ = '>';
 	*t = 0; // end-string, just in case..
 
-	j = ax25_to_tnc2_fmtaddress(t, frame + 0, 0);	/* destination */
+	j = ref_fmtaddress(t, frame + 0, 0);	/* destination */
 	t += strlen(t);
 
 //	if (!((i & 0xE0) == 0x60 && (j & 0xE0) == 0xE0)) {
@@ -190,7 +521,7 @@ int ax25_format_to_tnc(const uint8_t *frame, const int framelen,
 		for (; s < e;) {
 			*t++ = ',';	/* separator char */
 			*t = 0; // end-string, just in case..
-			i = ax25_to_tnc2_fmtaddress(t, s, 1); // Top 3 bits are:  H11  ( H = "has been digipeated" )
+			i = ref_fmtaddress(t, s, 1); // Top 3 bits are:  H11  ( H = "has been digipeated" )
 			if (i < 0 /* || ((i & 0x60) != 0x60) */) {
 				/* Bad format */
 			  if (debug) printf("Ax25FmtToTNC2: Bad via address; addr='%s' SSID-byte=0x%x\n",t,i);
@@ -259,37 +590,89 @@ int ax25_format_to_tnc(const uint8_t *frame, const int framelen,
 	return t - tnc2buf;
 }
 
-/* Convert the binary packet to TNC2 monitor text format.
-   Return 0 if conversion fails (format errors), 1 when format is OK. */
-
-int ax25_to_tnc2(const struct aprx_interface *aif, const char *portname,
-		 const int tncid, const int cmdbyte,
-		 const uint8_t *frame, const int framelen)
+static double bench_now(void)
 {
-	int frameaddrlen = 0;
-
-	char tnc2buf[2800];
-	int tnc2len = 0, tnc2addrlen = 0, is_aprs = 0, ui_pid = 0;
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
 
-	tnc2len = ax25_format_to_tnc( frame, framelen,
-				      tnc2buf, sizeof(tnc2buf),
-				      & frameaddrlen, &tnc2addrlen,
-				      & is_aprs, &ui_pid );
+#define BENCH_MAXFRAMES 10000
 
-	if (tnc2len == 0) return 0; // Bad parse result
+static uint8_t *frames[BENCH_MAXFRAMES];
+static int      framelens[BENCH_MAXFRAMES];
 
-	// APRS type packets are first rx-igated (and rflog()ed)
-#ifndef DISABLE_IGATE
-	if (is_aprs) {
-	  igate_to_aprsis(portname, tncid, tnc2buf, tnc2addrlen, tnc2len, 0, 1);
+int main(int argc, char *argv[])
+{
+	char line[8000], out1[2800], out2[2800];
+	uint8_t buf[4000];
+	int nframes = 0, k, errors = 0;
+	long r, rounds = 200000, total = 0, bytes = 0;
+	volatile int sink = 0;
+	double t0, t1, t2;
+
+	if (argc > 1) {
+		FILE *fp = fopen(argv[1], "r");
+		if (!fp) { perror(argv[1]); return 2; }
+		while (nframes < BENCH_MAXFRAMES && fgets(line, sizeof(line), fp)) {
+			int n = bench_hex(line, buf, sizeof(buf));
+			if (n < 16) continue;
+			// slack, the old formatter may read a whole
+			// address field past the end
+			frames[nframes] = calloc(1, n + 7);
+			memcpy(frames[nframes], buf, n);
+			framelens[nframes++] = n;
+		}
+		fclose(fp);
+	} else {
+		for (k = 0; k < sizeof(bench_corpus)/sizeof(bench_corpus[0]); ++k) {
+			int n = bench_hex(bench_corpus[k], buf, sizeof(buf));
+			frames[nframes] = calloc(1, n + 7);
+			memcpy(frames[nframes], buf, n);
+			framelens[nframes++] = n;
+		}
+	}
+	if (argc > 2) rounds = atol(argv[2]);
+	if (nframes == 0) { printf("No frames\n"); return 2; }
+	rounds = rounds / nframes + 1;
+
+	for (k = 0; k < nframes; ++k) {
+		int a1 = 0, p1 = 0, a2 = 0, p2 = 0, fal1, tal1, fal2, tal2;
+		int l1 = ax25_format_to_tnc(frames[k], framelens[k], out1, sizeof(out1),
+					    &fal1, &tal1, &a1, &p1);
+		int l2 = ref_format_to_tnc(frames[k], framelens[k], out2, sizeof(out2),
+					   &fal2, &tal2, &a2, &p2);
+		if (l1 != l2 || a1 != a2 || (l1 > 0 && (p1 != p2 || fal1 != fal2 ||
+		    tal1 != tal2 || memcmp(out1, out2, l1) != 0))) {
+			printf("MISMATCH frame %d:\n  new: %d '%.*s'\n  old: %d '%.*s'\n",
+			       k, l1, l1, out1, l2, l2, out2);
+			++errors;
+		}
+		if (k < 4) printf("%s\n", l1 ? out1 : "(bad)");
 	}
-#endif
-
-	// Send to interface system to receive it..  (digipeater!)
-	// A noop if the interface is actually NULL.
-	interface_receive_ax25(aif, portname, is_aprs, ui_pid,
-			       frame, frameaddrlen, framelen,
-			       tnc2buf, tnc2addrlen, tnc2len);
 
-	return 1;
+	t0 = bench_now();
+	for (r = 0; r < rounds; ++r)
+		for (k = 0; k < nframes; ++k) {
+			int a = 0, p = 0, fal, tal;
+			sink += ax25_format_to_tnc(frames[k], framelens[k], out1, sizeof(out1),
+						   &fal, &tal, &a, &p);
+			bytes += framelens[k];
+		}
+	t1 = bench_now();
+	for (r = 0; r < rounds; ++r)
+		for (k = 0; k < nframes; ++k) {
+			int a = 0, p = 0, fal, tal;
+			sink += ref_format_to_tnc(frames[k], framelens[k], out2, sizeof(out2),
+						  &fal, &tal, &a, &p);
+		}
+	t2 = bench_now();
+	total = rounds * nframes;
+
+	printf("%d frames, %d mismatches, avg %ld bytes/frame\n",
+	       nframes, errors, bytes / total);
+	printf("table-driven: %7.1f ns/frame\n", (t1 - t0) * 1e9 / total);
+	printf("previous:     %7.1f ns/frame\n", (t2 - t1) * 1e9 / total);
+	return errors ? 1 : 0;
 }
+#endif
@@ -10,6 +10,25 @@
 
 #include "aprx.h"
 
+/*
+ *  Beacons are compiled at startup into one image per target interface:
+ *  the APRSIS header and the AX.25 and TNC2 address of the radio frame.
+ *  A fixed beacon text with a timestamp has its offset precompiled too,
+ *  so sending is just patching the time in place and handing out the
+ *  ready bytes.  Texts from files and programs get the same addresses.
+ */
+
+struct beaconimage {
+	const struct aprx_interface *aif;
+	const char *callsign;	/* of the interface, for debug */
+	char    *ishdr;		/* "SRC>DEST,VIA,TCPIP*", or NULL */
+	int      ishdrlen;
+	int      axaddrlen;	/* 0: not to radio */
+	int      tnc2addrlen;
+	uint8_t  axaddr[70];
+	char     tnc2addr[128];	/* "SRC>DEST,VIA" */
+};
+
 struct beaconmsg {
 	time_t nexttime;
 	int    interval;
@@ -22,7 +41,15 @@ struct beaconmsg {
 	const char *execfile;
 	int8_t	    beaconmode; // -1: net only, 0: both, +1: radio only
 	int8_t	    timefix;
+	int8_t	    coprocess;	// execfile stays running, line per beacon
 	int         timeout;
+	int         co_pid;	// < 0: exited
+	int         co_wfd;	// request lines to coprocess stdin
+	int         co_rfd;	// beacon lines from coprocess stdout
+	int         timeoffset;	// of timestamp in msg, or -1
+	struct beaconimage *images;
+	int         images_count;
+	int         deferred;	// seconds, for a busy channel
 };
 
 struct beaconset {
@@ -47,6 +74,8 @@ static struct beaconset **bsets;
 static int bsets_count;
 
 static void beacon_it(struct beaconset *bset, struct beaconmsg *bm);
+static int  beacon_timeoffset(const char *msg, const int msglen);
+static void msg_coprocess_stop(struct beaconmsg *bm);
 
 
 static void beacon_reset(struct beaconset *bset)
@@ -78,6 +107,7 @@ static void beacon_set(struct configfile *cf,
 
 	struct beaconmsg *bm = calloc(1, sizeof(*bm));
 
+	bm->timeoffset = -1;
 	*buf = 0;
 
 	if (debug) {
@@ -433,6 +463,11 @@ static void beacon_set(struct configfile *cf,
 			if (debug)
 				printf("timefix ");
 
+		} else if (strcmp(p1, "coprocess") == 0) {
+			bm->coprocess = 1;
+			if (debug)
+				printf("coprocess ");
+
 		} else {
 
 			has_fault = 1;
@@ -460,6 +495,11 @@ static void beacon_set(struct configfile *cf,
 	}
 	if (debug)
 		printf("\n");
+	if (bm->coprocess && bm->execfile == NULL) {
+		printf("%s:%d ERROR: BEACON coprocess without exec program\n",
+		       cf->name, cf->linenum);
+		has_fault = 1;
+	}
 	if (has_fault)
 		goto discard_bm;
 
@@ -565,6 +605,8 @@ static void beacon_set(struct configfile *cf,
 	  msg[0] = 0x03;  // Control byte
 	  msg[1] = 0xF0;  // PID 0xF0
 	  bm->msg = msg;
+	  if (bm->timefix)
+	    bm->timeoffset = beacon_timeoffset(msg, len+2);
 	}
 
 	beacon_reset(bset);
@@ -579,7 +621,11 @@ static void beacon_set(struct configfile *cf,
 }
 
 static void free_beaconmsg(struct beaconmsg *bmsg) {
+	int i;
 	if (bmsg == NULL) return;
+        for (i = 0; i < bmsg->images_count; ++i)
+          if (bmsg->images[i].ishdr) free(bmsg->images[i].ishdr);
+        if (bmsg->images) free(bmsg->images);
         if (bmsg->src)  free((void*)bmsg->src);
         if (bmsg->dest) free((void*)bmsg->dest);
         if (bmsg->via)  free((void*)bmsg->via);
@@ -686,7 +732,23 @@ int beacon_config(struct configfile *cf)
 	return has_fault;
 }
 
-static void fix_beacon_time(char *txt, int txtlen)
+/* Offset of the timestamp in a Control+PID+text message, or -1 */
+static int beacon_timeoffset(const char *msg, const int msglen)
+{
+	const char *txt = msg + 2; // Skip Control+PID
+	int txtlen = msglen - 2;
+
+	if (*txt == ';' && txtlen >= 36) { // Object
+
+		// ;434.775-B*111111z6044.06N/02612.79Er
+		return 2 + 11;
+	} else if ((*txt == '/' || *txt == '@') && txtlen >= 27) { // Position with timestamp
+		return 2 + 1;
+	}
+	return -1;
+}
+
+static void fix_beacon_time(char *msg, const int timeoffset)
 {
 	int hour, min, sec;
 	char hms[8];
@@ -699,15 +761,7 @@ static void fix_beacon_time(char *txt, int txtlen)
 	sec  = sec % 60;
 	sprintf(hms, "%02d%02d%02dh", hour, min, sec);
 
-	txt += 2; txtlen -= 2; // Skip Control+PID
-
-	if (*txt == ';' && txtlen >= 36) { // Object
-
-		// ;434.775-B*111111z6044.06N/02612.79Er
-		memcpy( txt+11, hms, 7 ); // Overwrite with new time
-	} else if ((*txt == '/' || *txt == '@') && txtlen >= 27) { // Position with timestamp
-		memcpy( txt+1, hms, 7 ); // Overwrite with new time
-	}
+	memcpy( msg+timeoffset, hms, 7 ); // Overwrite with new time
 }
 
 
@@ -726,6 +780,17 @@ static char *msg_read_file(const char *filename, char *buf, int buflen)
 	return buf;
 }
 
+/* Radio interfaces the beacon goes out on */
+static int beacon_rfaifs(const struct beaconmsg *bm, const struct aprx_interface **aifs)
+{
+	int i, n = 0;
+
+	for (i = 0; i < bm->images_count; ++i)
+		if (bm->images[i].axaddrlen > 0)
+			aifs[n++] = bm->images[i].aif;
+	return n;
+}
+
 static void beacon_resettimer(void *arg)
 {
 	const struct beaconset *bset = (struct beaconset *)arg;
@@ -743,8 +808,14 @@ static void beacon_resettimer(void *arg)
         for (i = 0; i < bset->beacon_msgs_count; ++i) {
         	int r = rand() % 1024;
                 int interval = (int)(beacon_increment - 0.2*beacon_increment * (r*0.001));
+                // The nexttime is when the following one is sent
+                const struct beaconmsg *bm = bset->beacon_msgs[(i+1) % bset->beacon_msgs_count];
+                const struct aprx_interface **aifs = alloca(sizeof(*aifs) * (bm->images_count+1));
+                int aifcount = beacon_rfaifs(bm, aifs);
                 if (interval < 3) interval = 3; // Minimum interval: 3 seconds
-                t += interval;
+                if (bset->beacon_msgs[i]->nexttime > tick.tv_sec)
+                	slotplan_cancel(aifs, aifcount, bset->beacon_msgs[i]->nexttime);
+                t = slotplan_place(aifs, aifcount, t + interval);
                 if (debug)
                 	printf("beacons offset: %.2f minutes\n", (t-tick.tv_sec)/60.0);
                 bset->beacon_msgs[i]->nexttime = t;
@@ -786,7 +857,12 @@ static void msg_exec_read(struct beaconset *bset)
                   bm->msg = NULL;
                   // restore the nexttime
                   bset->beacon_nexttime.tv_sec = bm->nexttime;
-                  close(bset->exec_fd);
+                  if (bm->coprocess) {
+                    // It stays for the next beacon
+                    bset->exec_pid = 0;
+                  } else {
+                    close(bset->exec_fd);
+                  }
                   bset->exec_fd = -1;
                   //bset->exec_pid = 0; 
                   return;
@@ -822,7 +898,12 @@ static void msg_exec_read(struct beaconset *bset)
                 } else {
                   aprxlog("BEACON EXEC abnormal close.");
                 }
-                close(bset->exec_fd);
+                if (bset->exec_bm->coprocess) {
+                  msg_coprocess_stop(bset->exec_bm);
+                  bset->exec_pid = 0;
+                } else {
+                  close(bset->exec_fd);
+                }
                 bset->exec_fd = -1;
                 //bset->exec_pid = 0; 
         }
@@ -884,6 +965,113 @@ static int msg_exec_file(const char *filename, int timeout, struct beaconset *bs
         return 1;
 }
 
+/*
+ *  Coprocess beacon source:  the exec program is started once with
+ *  pipes on its stdin and stdout.  For every beacon it is sent
+ *
+ *	beacon <UNIX time>\n
+ *
+ *  and it answers with one line of raw APRS message content.  The
+ *  answer is read like that of a run-once exec program, under the same
+ *  timeout.  A coprocess that exits, closes its stdout, or does not
+ *  answer in time is stopped, and started again on next beacon.
+ */
+
+static int msg_coprocess_start(struct beaconmsg *bm)
+{
+	int in[2], out[2];
+	int pid, dev_null;
+
+	if (pipe(in))
+		return -1;
+	if (pipe(out)) {
+		close(in[0]); close(in[1]);
+		return -1;
+	}
+
+	pid = fork();
+	if (pid < 0) {
+		close(in[0]);  close(in[1]);
+		close(out[0]); close(out[1]);
+		return -1;
+	}
+	if (pid == 0) { // child
+		close(in[1]);
+		close(out[0]);
+		if (out[1] != 1) {
+		  dup2(out[1], 1);
+		  close(out[1]);
+		}
+		if (in[0] != 0) {
+		  dup2(in[0], 0);
+		  close(in[0]);
+		}
+		dev_null = open("/dev/null", O_WRONLY);
+		if (dev_null >= 0 && dev_null != 2) {
+		  dup2(dev_null, 2);
+		  close(dev_null);
+		}
+
+		execl(bm->execfile, "aprx", NULL);
+		exit(255);
+	}
+
+	// parent
+	close(in[0]);
+	close(out[1]);
+	fcntl(in[1],  F_SETFD, FD_CLOEXEC);
+	fcntl(out[0], F_SETFD, FD_CLOEXEC);
+	fd_nonblockingmode(in[1]);
+	fd_nonblockingmode(out[0]);
+
+	bm->co_pid = pid;
+	bm->co_wfd = in[1];
+	bm->co_rfd = out[0];
+	if (debug) printf("Started beacon coprocess pid %d: %s\n", pid, bm->execfile);
+	return 0;
+}
+
+static void msg_coprocess_stop(struct beaconmsg *bm)
+{
+	if (bm->co_pid > 0)
+		kill(bm->co_pid, SIGKILL);
+	if (bm->co_pid != 0) {
+		close(bm->co_wfd);
+		close(bm->co_rfd);
+	}
+	bm->co_pid = 0;
+}
+
+static int msg_coprocess_request(struct beaconmsg *bm, struct beaconset *bset)
+{
+	char req[256];
+	int  len;
+
+	if (bm->co_pid < 0)	// it has exited since last beacon
+		msg_coprocess_stop(bm);
+	if (bm->co_pid == 0 && msg_coprocess_start(bm) < 0)
+		return 0;
+
+	// Discard what came late, or unasked
+	while (read(bm->co_rfd, req, sizeof(req)) > 0)
+		;
+
+	len = sprintf(req, "beacon %ld\n", (long)time(NULL));
+	if (write(bm->co_wfd, req, len) != len) {
+		// Gone, or not reading its input
+		msg_coprocess_stop(bm);
+		return 0;
+	}
+
+        bset->exec_deadline = tick.tv_sec + bm->timeout;
+        bset->exec_pid = bm->co_pid;
+        bset->exec_fd  = bm->co_rfd;
+        
+        bset->beacon_nexttime.tv_sec = bset->exec_deadline;
+
+	return 1;
+}
+
 //        int val;
 //        waitpid(pid, &val, 0);
 //        if (WIFEXITED(val) && WEXITSTATUS(val) == 0) {
@@ -893,6 +1081,8 @@ static int msg_exec_file(const char *filename, int timeout, struct beaconset *bs
 static void beacon_now(struct beaconset *bset)
 {
 	struct beaconmsg *bm;
+	const struct aprx_interface **aifs;
+	int defer;
 
         if (bset->exec_pid > 0) {
           if (debug) printf("beacon_now - still an exec under way.\n");
@@ -904,6 +1094,15 @@ static void beacon_now(struct beaconset *bset)
 	if (bset->beacon_msgs_cursor >= bset->beacon_msgs_count) // Last done..
 		bset->beacon_msgs_cursor = 0;
 
+	// Let a busy channel clear first
+	bm = bset->beacon_msgs[bset->beacon_msgs_cursor];
+	aifs = alloca(sizeof(*aifs) * (bm->images_count+1));
+	defer = slotplan_defer(aifs, beacon_rfaifs(bm, aifs), &bm->deferred);
+	if (defer > 0) {
+		bset->beacon_nexttime.tv_sec = tick.tv_sec + defer;
+		return;
+	}
+
 	if (bset->beacon_msgs_cursor == 0) {
         	beacon_resettimer(bset);
 	}
@@ -919,9 +1118,145 @@ static void beacon_now(struct beaconset *bset)
         beacon_it(bset, bm);
 }
 
+/* Add a target image, with the addressing beacon_it() used to build */
+static void beacon_compile_image(struct beaconmsg *bm, const struct aprx_interface *aif)
+{
+	const char *callsign = aif->callsign;
+	const char *src = (bm->src != NULL) ? bm->src : callsign;
+	struct beaconimage *bi;
+	char viabuf[128];
+
+	// Lets make sure the source callsign is not APRSIS !
+	if (strcmp(src,"APRSIS") == 0) {
+	  printf("CONFIGURATION ERROR: Beacon with source callsign APRSIS. Skipped!\n");
+	  return;
+	}
+
+	bm->images = realloc(bm->images, sizeof(*bm->images) * (bm->images_count+1));
+	bi = &bm->images[bm->images_count];
+	memset(bi, 0, sizeof(*bi));
+	bi->aif      = aif;
+	bi->callsign = callsign;
+
+#ifndef DISABLE_IGATE
+	if (bm->beaconmode <= 0) {
+	  int len = strlen(src) + strlen(bm->dest) + 10 +
+	    ((bm->via != NULL) ? strlen(bm->via) + 1 : 0);
+	  bi->ishdr = malloc(len);
+	  if (bm->via != NULL)
+	    bi->ishdrlen = sprintf(bi->ishdr, "%s>%s,%s,TCPIP*", src, bm->dest, bm->via);
+	  else
+	    bi->ishdrlen = sprintf(bi->ishdr, "%s>%s,TCPIP*", src, bm->dest);
+	}
+#endif
+
+	if (bm->beaconmode >= 0 && aif->tx_ok) {
+	  // viabuf collects ONLY the VIA data
+	  const char *via = viabuf;
+	  if (strcmp(src, callsign) != 0) {
+	    if (bm->via != NULL)
+	      snprintf( viabuf, sizeof(viabuf), "%s*,%s", callsign, bm->via );
+	    else
+	      snprintf( viabuf, sizeof(viabuf), "%s*", callsign );
+	  } else {
+	    via = bm->via;
+	  }
+	  bi->axaddrlen = interface_beacon_address(src, bm->dest, via,
+						   bi->axaddr, bi->tnc2addr,
+						   &bi->tnc2addrlen);
+	  if (bi->axaddrlen < 0) {
+	    printf("CONFIGURATION ERROR: Beacon address %s>%s,%s does not make an AX.25 frame\n",
+		   src, bm->dest, via ? via : "");
+	    bi->axaddrlen = 0;
+	  }
+	}
+
+	if (bi->ishdr == NULL && bi->axaddrlen == 0)
+	  return;	// Nothing goes anywhere from here
+	++bm->images_count;
+}
+
+static void beacon_compile(struct beaconmsg *bm)
+{
+	int i;
+
+	if (bm->interface != NULL) {
+	  beacon_compile_image(bm, bm->interface);
+	  return;
+	}
+
+	for ( i = 0; i < all_interfaces_count; ++i ) {
+	  const struct aprx_interface *aif = all_interfaces[i];
+
+	  if (debug>1)
+	    printf("Beacon: aif=%p callsign='%s' bm->src='%s' bm->dest='%s' bm->via='%s'\n",
+		   aif, aif->callsign, bm->src, bm->dest, bm->via);
+
+	  if (!interface_is_beaconable(aif)) {
+	    if (debug>1)
+	      printf("Not a beaconable interface, skipping\n");
+	    continue; // it is not a beaconable interface
+	  }
+
+	  if (aif->callsign == NULL) {
+	    // Probably KISS master interface, and subIF 0 has no definition.
+	    if (debug>1)
+	      printf("No callsign on interface interface, skipping\n");
+	    continue;
+	  }
+
+	  if (aif->iftype == IFTYPE_APRSIS) {
+	    // If we have no radio interfaces, we may still 
+	    // want to do beacons to APRSIS.  Ignore the
+	    // builtin APRSIS interface if there are more
+	    // interfaces available!
+	    if (all_interfaces_count > 1) {
+	      if (debug>2)
+		printf("Beaconing to APRSIS interface ignored in presence of other interfaces. Skipping.\n");
+	      continue;  // Ignore the builtin APRSIS interface
+	    }
+	  }
+
+	  beacon_compile_image(bm, aif);
+	}
+}
+
+/*
+ *  beacon_start()  --  compile the beacons, all interfaces are known now
+ */
+void beacon_start(void)
+{
+	int i, j;
+
+	for (i = 0; i < bsets_count; ++i) {
+	  struct beaconset *bset = bsets[i];
+	  for (j = 0; j < bset->beacon_msgs_count; ++j) {
+	    struct beaconmsg *bm = bset->beacon_msgs[j];
+	    int k;
+	    beacon_compile(bm);
+	    // Each is sent once per cycle
+	    for (k = 0; k < bm->images_count; ++k)
+	      if (bm->images[k].axaddrlen > 0)
+		slotplan_register(bm->images[k].aif, 1.0 / bset->beacon_cycle_size);
+	  }
+	}
+
+	// Plan the first beacons of the sets apart
+	for (i = 0; i < bsets_count; ++i) {
+	  struct beaconset *bset = bsets[i];
+	  const struct beaconmsg *bm;
+	  const struct aprx_interface **aifs;
+	  if (bset->beacon_msgs_count == 0)
+	    continue;
+	  bm = bset->beacon_msgs[0];
+	  aifs = alloca(sizeof(*aifs) * (bm->images_count+1));
+	  bset->beacon_nexttime.tv_sec = slotplan_place(aifs, beacon_rfaifs(bm, aifs),
+							bset->beacon_nexttime.tv_sec);
+	}
+}
+
 static void beacon_it(struct beaconset *bset, struct beaconmsg *bm)
 {
-	int  destlen;
 	int  txtlen, msglen;
 	int  i;
 	char const *txt;
@@ -931,8 +1266,6 @@ static void beacon_it(struct beaconset *bset, struct beaconmsg *bm)
 	  printf("BEACON: idx=%d, nexttime= +%d sec\n",
 		 bset->beacon_msgs_cursor-1, (int)(bset->beacon_nexttime.tv_sec - tick.tv_sec));
 
-	destlen = strlen(bm->dest) + ((bm->via != NULL) ? strlen(bm->via): 0) +2;
-
 	if (bm->filename != NULL) {
 		msg = alloca(256);  // This is a load-and-discard allocation
 		txt = msg+2;
@@ -955,6 +1288,14 @@ static void beacon_it(struct beaconset *bset, struct beaconmsg *bm)
                 bset->exec_buf_length = 2;
                 bset->exec_buf_space = 256;
                 bset->exec_bm = bm;
+		if (bm->coprocess) {
+			if (!msg_coprocess_request(bm, bset)) {
+				if (debug)
+				  printf("BEACON ERROR: Failed to run coprocess %s\n",bm->execfile);
+				syslog(LOG_ERR, "Failed to run coprocess %s", bm->execfile);
+			}
+			return;
+		}
 		if (!msg_exec_file(bm->execfile, bm->timeout, bset)) {
 			if (debug)
 			  printf("BEACON ERROR: Failed to exec file %s\n",bm->execfile);
@@ -970,180 +1311,49 @@ static void beacon_it(struct beaconset *bset, struct beaconmsg *bm)
 	txtlen  = strlen(txt);
 	msglen  = txtlen+2; // this includes the control+pid bytes
 
-	/* _NO_ ending CRLF, the APRSIS subsystem adds it. */
+	if (bm->timefix) {
+	  // Text of a file or program is new every time
+	  int timeoffset = (bm->filename == NULL && bm->execfile == NULL) ?
+	    bm->timeoffset : beacon_timeoffset(msg, msglen);
+	  if (timeoffset >= 0)
+	    fix_beacon_time(msg, timeoffset);
+	}
 
-	/* Send those (rf)beacons.. (a noop if interface == NULL) */
-	if (bm->interface != NULL) {
-		const char *callsign = bm->interface->callsign;
-		const char *src = (bm->src != NULL) ? bm->src : callsign;
-		int   len  = destlen + 12 + strlen(src); // destlen contains bm->via plus room for ",TCPIP*"
-		char *destbuf = alloca(len);
-
-                // Now it is time to beacon something, lets make sure
-                // the source callsign is not APRSIS !
-                if (strcmp(src,"APRSIS") == 0) {
-                  if (debug)
-                    printf("CONFIGURATION ERROR: Beacon with source callsign APRSIS. Skipped!\n");
-                  return;
-                }
+	/* _NO_ ending CRLF, the APRSIS subsystem adds it. */
 
-		if (bm->timefix)
-		  fix_beacon_time(msg, msglen);
+	for ( i = 0; i < bm->images_count; ++i ) {
+		struct beaconimage *bi = &bm->images[i];
 
 #ifndef DISABLE_IGATE
-		if (bm->beaconmode <= 0) {
-
-                  if (bm->via != NULL)
-                    sprintf(destbuf,"%s>%s,%s,TCPIP*", src, bm->dest, bm->via);
-                  else
-                    sprintf(destbuf,"%s>%s,TCPIP*", src, bm->dest);
-
+		if (bi->ishdr != NULL) {
                   if (debug) {
                     printf("%ld\tNow beaconing to APRSIS %s '%s' -> '%s',",
-                           tick.tv_sec, callsign, destbuf, txt);
+                           tick.tv_sec, bi->callsign, bi->ishdr, txt);
                     printf(" next beacon in %.2f minutes\n",
                            ((bset->beacon_nexttime.tv_sec - tick.tv_sec)/60.0));
                   }
 
 		  // Send them all also as netbeacons..
-		  aprsis_queue(destbuf, strlen(destbuf),
+		  aprsis_queue(bi->ishdr, bi->ishdrlen,
 			       qTYPE_LOCALGEN,
 			       aprsis_login, txt, txtlen);
 		}
 #endif
 
-		if (bm->beaconmode >= 0 && bm->interface->tx_ok) {
-		  // And to interfaces
-                  char *dp = destbuf; // destbuf collects ONLY the VIA data
-
-		  if (strcmp(src, callsign) != 0) {
-		    if (bm->via != NULL)
-		      dp += sprintf( dp, "%s*,%s", callsign, bm->via );
-		    else
-		      dp += sprintf( dp, "%s*", callsign );
-		  } else {
-		    if (bm->via != NULL)
-		      dp += sprintf( dp, "%s", bm->via );
-                    else
-                      *dp = 0;
-		  }
-                  
+		if (bi->axaddrlen > 0) {
                   if (debug) {
-                    printf("%ld\tNow beaconing to interface[1] %s(%s) '%s' -> '%s',",
-                           tick.tv_sec, callsign, src, destbuf, txt);
+                    printf("%ld\tNow beaconing to interface %s '%s' -> '%s',",
+                           tick.tv_sec, bi->callsign, bi->tnc2addr, txt);
                     printf(" next beacon in %.2f minutes\n",
                            ((bset->beacon_nexttime.tv_sec - tick.tv_sec)/60.0));
                   }
 
-		  interface_transmit_beacon(bm->interface,
-					    src,
-					    bm->dest,
-					    destbuf, // via data
-					    msg, msglen);
-		}
-	} 
-	else {
-	    for ( i = 0; i < all_interfaces_count; ++i ) {
-		const struct aprx_interface *aif = all_interfaces[i];
-		const char *callsign = aif->callsign;
-		const char *src = (bm->src != NULL) ? bm->src : callsign;
-		int len = destlen + 12 + (src != NULL ? strlen(src) : 0); // destlen contains bm->via, plus room for ",TCPIP*"
-		char *destbuf = alloca(len);
-
-                if (debug>1)
-                  printf("Beacon: aif=%p callsign='%s' src='%s' bm->dest='%s' bm->via='%s'\n",
-                         aif, callsign, src, bm->dest, bm->via);
-
-		if (!interface_is_beaconable(aif)) {
-                  if (debug>1)
-                    printf("Not a beaconable interface, skipping\n");
-		  continue; // it is not a beaconable interface
-                }
-
-		if (callsign == NULL) {
-		  // Probably KISS master interface, and subIF 0 has no definition.
-                  if (debug>1)
-                    printf("No callsign on interface interface, skipping\n");
-		  continue;
-		}
-
-		if (aif->iftype == IFTYPE_APRSIS) {
-		  // If we have no radio interfaces, we may still 
-		  // want to do beacons to APRSIS.  Ignore the
-		  // builtin APRSIS interface if there are more
-		  // interfaces available!
-		  if (all_interfaces_count > 1) {
-                    if (debug>2)
-                      printf("Beaconing to APRSIS interface ignored in presence of other interfaces. Skipping.\n");
-		    continue;  // Ignore the builtin APRSIS interface
-                  }
+		  interface_transmit_beaconframe(bi->aif,
+						 TXPRIO_BEACON,
+						 bi->axaddr, bi->axaddrlen,
+						 bi->tnc2addr, bi->tnc2addrlen,
+						 msg, msglen);
 		}
-
-                // Now it is time to beacon something, lets make sure
-                // the source callsign is not APRSIS !
-                if (strcmp(src,"APRSIS") == 0) {
-                  if (debug)
-                    printf("CONFIGURATION ERROR: Beaconing with source callsign APRSIS!  Skipping.\n");
-                  continue;
-                }
-
-		
-		if (bm->timefix)
-		  fix_beacon_time((char*)msg, msglen);
-		
-#ifndef DISABLE_IGATE
-		if (bm->beaconmode <= 0) {
-		  // Send them all also as netbeacons..
-
-                  if (bm->via != NULL)
-                    sprintf(destbuf,"%s>%s,%s,TCPIP*", src, bm->dest, bm->via);
-                  else
-                    sprintf(destbuf,"%s>%s,TCPIP*", src, bm->dest);
-                  
-                  if (debug) {
-                    printf("%ld\tNow beaconing to APRSIS %s(%s) '%s' -> '%s',",
-                           tick.tv_sec, callsign, src, destbuf, txt);
-                    printf(" next beacon in %.2f minutes\n",
-                           ((bset->beacon_nexttime.tv_sec - tick.tv_sec)/60.0));
-                  }
-
-		  aprsis_queue(destbuf, strlen(destbuf),
-			       qTYPE_LOCALGEN,
-			       aprsis_login, txt, txtlen);
-		}
-#endif
-
-		if (bm->beaconmode >= 0 && aif->tx_ok) {
-		  // And to transmit-capable interfaces
-                  char *dp = destbuf; // destbuf collects ONLY the VIA data
-
-		  // The 'destbuf' has a plenty of room
-		  if (strcmp(src, callsign) != 0) {
-		    if (bm->via != NULL)
-		      dp += sprintf( dp, "%s*,%s", callsign, bm->via );
-		    else
-		      dp += sprintf( dp, "%s*", callsign );
-		  } else {
-		    if (bm->via != NULL)
-		      dp += sprintf( dp, "%s", bm->via );
-                    else
-                      *dp = 0;
-		  }
-		  
-                  if (debug) {
-                    printf("%ld\tNow beaconing to interface[2] %s(%s) '%s' -> '%s',",
-                           tick.tv_sec, callsign, src, destbuf, txt);
-                    printf(" next beacon in %.2f minutes\n",
-                           ((bset->beacon_nexttime.tv_sec - tick.tv_sec)/60.0));
-                  }
-
-		  interface_transmit_beacon(aif,
-					    src,
-					    bm->dest,
-					    destbuf, // via data
-					    msg, msglen);
-		}
-	    }
 	}
 }
 
@@ -1223,6 +1433,11 @@ void beacon_childexit(int pid)
 	int i;
         for (i = 0; i < bsets_count; ++i) {
         	struct beaconset *bset = bsets[i];
+                int j;
+                for (j = 0; j < bset->beacon_msgs_count; ++j) {
+                	if (bset->beacon_msgs[j]->co_pid == pid)
+                        	bset->beacon_msgs[j]->co_pid = -pid;
+                }
                 if (pid == bset->exec_pid) {
                 	bset->exec_pid = -pid;
                         if (debug) {
@@ -19,9 +19,13 @@
 #include <string.h>
 #include <sys/mman.h>
 #include <fcntl.h>
-// #if defined(HAVE_PTHREAD_CREATE) && defined(ENABLE_PTHREAD)
-// #include <pthread.h>
-// #endif
+#ifdef HAVE_STDINT_H
+#include <stdint.h>
+#endif
+#if defined(HAVE_PTHREAD_CREATE) && defined(ENABLE_PTHREAD)
+#include <pthread.h>
+#define CELLMALLOC_THREADS
+#endif
 
 #include "cellmalloc.h"
 
@@ -35,16 +39,52 @@
 
 struct cellhead;
 
+#ifdef CELLMALLOC_THREADS
+/*
+ *  CELLMALLOC_POLICY_THREADS arenas
+ *
+ *  Each thread keeps two magazines of free cells per arena, and
+ *  normally allocates and frees without any locking.  When both are
+ *  empty (or full) a magazine is exchanged with the arena depot,
+ *  which is a pair of lock-free stacks of full and empty magazines.
+ *  Only when the depot can not help, the central free-list is used
+ *  under the arena mutex.
+ */
+
+#define CELLMAGAZINE_SIZE  32
+#define CELLMAGAZINES_MAX  64  /* per arena, fits in 8 bits of depot head */
+
+struct cellmagazine {
+	int	 count;
+	uint32_t next;		/* depot stack link, index+1 or 0 */
+	void	*cells[CELLMAGAZINE_SIZE];
+};
+
+struct cellcache {
+	struct cellmagazine *loaded;
+	struct cellmagazine *previous;
+};
+#endif
+
 struct cellarena_t {
 	int	cellsize;
 	int	alignment;
 	int	increment; /* alignment overhead applied.. */
 	int	lifo_policy;
   	int	minfree;
+	int	index;
 
 	const char *arenaname;
 
-//	pthread_mutex_t mutex;  // we have a mutex-less usage environment!
+#ifdef CELLMALLOC_THREADS
+	int	threads;
+	pthread_mutex_t mutex;  // central free-list of threaded arena
+
+	struct cellmagazine *magazines;
+	/* Depot stack heads: index+1 in low 8 bits, ABA tag above it */
+	volatile uint32_t depot_full;
+	volatile uint32_t depot_empty;
+#endif
 
   	struct cellhead *free_head;
   	struct cellhead *free_tail;
@@ -52,6 +92,12 @@ struct cellarena_t {
 	int	 freecount;
 	int	 createsize;
 
+	/* statistics */
+	long	 cellsinuse;
+	long	 cellsinuse_max;
+	int	 blocks;
+	long	 allocfailures;
+
 #ifdef MEMDEBUG
 	int	 cellblocks_count;
 #define CELLBLOCKS_MAX 40 /* track client cell allocator limit! */
@@ -59,6 +105,10 @@ struct cellarena_t {
 #endif
 };
 
+#define CELLARENAS_MAX 32
+static cellarena_t *cellarenas[CELLARENAS_MAX];
+static int cellarenas_count;
+
 #define CELLHEAD_DEBUG 0
 
 struct cellhead {
@@ -70,19 +120,91 @@ struct cellhead {
 
 
 /*
- * new_cellblock() -- must be called MUTEX PROTECTED
- *
+ *  The optional preallocated region shared by all arenas.  Carving
+ *  cell blocks out of one region (optionally on huge pages) instead
+ *  of mapping them one at a time keeps the cells on few pages, and
+ *  cuts TLB misses on big historydb and dupecheck sets.
  */
 
-int new_cellblock(cellarena_t *ca)
+static char *region_base;
+static long  region_size;
+static volatile long region_used;
+
+#define REGION_BLOCKALIGN 64 /* cache line */
+
+int cellregion(const long size, const int flags)
+{
+	long len = size;
+	char *p = MAP_FAILED;
+
+	if (region_base != NULL || size <= 0)
+		return -1;
+
+#ifndef MAP_ANONYMOUS
+#  define MAP_ANONYMOUS MAP_ANON
+#endif
+#ifdef MAP_HUGETLB
+	if (flags & CELLREGION_HUGETLB) {
+		/* Round up to a multiple of (2 MB) huge page size */
+		long hlen = (len + (2*1024*1024 - 1)) & ~(2*1024*1024L - 1);
+		p = mmap(NULL, hlen, PROT_READ|PROT_WRITE,
+			 MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
+		if (p != MAP_FAILED)
+			len = hlen;
+	}
+#endif
+	if (p == MAP_FAILED) {
+		/* Normal pages, also when no huge pages are reserved */
+		p = mmap(NULL, len, PROT_READ|PROT_WRITE,
+			 MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+		if (p == MAP_FAILED)
+			return -1;
+#ifdef MADV_HUGEPAGE
+		if (flags & (CELLREGION_HUGETLB|CELLREGION_THP))
+			madvise(p, len, MADV_HUGEPAGE);
+#endif
+	}
+
+	if (flags & CELLREGION_POPULATE) {
+		/* Touch every page now, so that they are allocated
+		   on the memory node where this process runs. */
+		long i;
+		for (i = 0; i < len; i += 4096)
+			p[i] = 0;
+	}
+
+	region_base = p;
+	region_size = len;
+	region_used = 0;
+	return 0;
+}
+
+static char *region_carve(const int size)
+{
+	long old, new;
+	long asize = (size + REGION_BLOCKALIGN-1) & ~(REGION_BLOCKALIGN-1L);
+
+	if (region_base == NULL)
+		return NULL;
+	do {
+		old = region_used;
+		new = old + asize;
+		if (new > region_size)
+			return NULL; /* Used up, back to individual blocks */
+	} while (!__sync_bool_compare_and_swap(&region_used, old, new));
+
+	return region_base + old;
+}
+
+
+static char *map_cellblock(cellarena_t *ca)
 {
-	int i;
 	char *cb;
 
 #ifdef MEMDEBUG /* External backing-store files, unique ones for each cellblock,
 		   which at Linux names memory blocks in  /proc/nnn/smaps "file"
 		   with this filename.. */
-	int fd;
+	int fd, i;
 	char name[2048];
 
 	sprintf(name, "/tmp/.-%d-%s-%d.mmap", getpid(), ca->arenaname, ca->cellblocks_count );
@@ -113,13 +235,36 @@ int new_cellblock(cellarena_t *ca)
 	cb = mmap( NULL, ca->createsize, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANON, -1, 0);
 #endif
 #endif
-	if (cb == NULL || cb == (char*)-1)
-	  return -1;
+	if (cb == (char*)-1)
+	  return NULL;
+	return cb;
+}
+
+/*
+ * new_cellblock() -- must be called MUTEX PROTECTED
+ *
+ */
+
+int new_cellblock(cellarena_t *ca)
+{
+	int i;
+	char *cb;
 
 #ifdef MEMDEBUG
+	/* Before taking any space, region space can not be handed back */
 	if (ca->cellblocks_count >= CELLBLOCKS_MAX) return -1;
+#endif
+
+	cb = region_carve(ca->createsize);
+	if (cb == NULL)
+		cb = map_cellblock(ca);
+	if (cb == NULL)
+	  return -1;
+
+#ifdef MEMDEBUG
 	ca->cellblocks[ca->cellblocks_count++] = cb;
 #endif
+	ca->blocks += 1;
 
 	for (i = 0; i <= ca->createsize-ca->increment; i += ca->increment) {
 		struct cellhead *ch = (struct cellhead *)(cb + i); /* pointer arithmentic! */
@@ -173,6 +318,24 @@ cellarena_t *cellinit( const char *arenaname, const int cellsize, const int alig
 	}
 	ca->lifo_policy =  policy & CELLMALLOC_POLICY_LIFO;
 
+#ifdef CELLMALLOC_THREADS
+	if (policy & CELLMALLOC_POLICY_THREADS) {
+		int i;
+		ca->threads = 1;
+		pthread_mutex_init(&ca->mutex, NULL);
+		ca->magazines = calloc(CELLMAGAZINES_MAX, sizeof(struct cellmagazine));
+		/* All magazines start as empty ones in the depot */
+		for (i = CELLMAGAZINES_MAX; i > 0; --i) {
+			ca->magazines[i-1].next = ca->depot_empty & 0xFF;
+			ca->depot_empty = i;
+		}
+	}
+#endif
+
+	ca->index = cellarenas_count;
+	if (cellarenas_count < CELLARENAS_MAX)
+		cellarenas[cellarenas_count++] = ca;
+
 	ca->createsize = createkb * 1024;
 #if !defined(MEMDEBUG) && defined(NO_MMAP_ON_CELLMALLOC)
 	ca->createsize -= 16;
@@ -181,8 +344,6 @@ cellarena_t *cellinit( const char *arenaname, const int cellsize, const int alig
 	// n = ca->createsize / ca->increment;
 	// hlog( LOG_DEBUG, "cellinit: %-12s block size %4d kB, cells/block: %d", arenaname, createkb, n );
 
-//	pthread_mutex_init(&ca->mutex, NULL);
-
 	new_cellblock(ca); /* First block of cells, not yet need to be mutex protected */
 	while (ca->freecount < ca->minfree)
 		new_cellblock(ca); /* more until minfree is full */
@@ -214,14 +375,32 @@ inline struct cellhead *clientptr_to_cellhead(void *v)
 }
 
 
-void *cellmalloc(cellarena_t *ca)
+static void cellstat_inuse(cellarena_t *ca, const int n)
+{
+#ifdef CELLMALLOC_THREADS
+	if (ca->threads) {
+		/* Depot exchanges update these without the mutex */
+		long inuse = __sync_add_and_fetch(&ca->cellsinuse, n);
+		long max;
+		while ((max = ca->cellsinuse_max) < inuse)
+			if (__sync_bool_compare_and_swap(&ca->cellsinuse_max, max, inuse))
+				break;
+		return;
+	}
+#endif
+	ca->cellsinuse += n;
+	if (ca->cellsinuse > ca->cellsinuse_max)
+		ca->cellsinuse_max = ca->cellsinuse;
+}
+
+static void *cellmalloc_central(cellarena_t *ca)
 {
 	void *cp;
 	struct cellhead *ch;
 
 	while (!ca->free_head  || (ca->freecount < ca->minfree))
 		if (new_cellblock(ca)) {
-//			pthread_mutex_unlock(&ca->mutex);
+			ca->allocfailures += 1;
 			return NULL;
 		}
 
@@ -234,6 +413,7 @@ void *cellmalloc(cellarena_t *ca)
 	  ca->free_tail = NULL;
 
 	ca->freecount -= 1;
+	cellstat_inuse(ca, 1);
 
 	// hlog(LOG_DEBUG, "cellmalloc(%p at %p) freecount %d", cellhead_to_clientptr(cp), ca, ca->freecount);
 	return cellhead_to_clientptr(cp);
@@ -244,7 +424,7 @@ void *cellmalloc(cellarena_t *ca)
  *
  */
 
-int   cellmallocmany(cellarena_t *ca, void **array, int numcells)
+static int cellmallocmany_central(cellarena_t *ca, void **array, int numcells)
 {
 	int count;
 	struct cellhead *ch;
@@ -259,6 +439,10 @@ int   cellmallocmany(cellarena_t *ca, void **array, int numcells)
 			  break;
 			}
 		}
+		if (ca->free_head == NULL) {
+			ca->allocfailures += 1;
+			break;
+		}
 
 		/* Pick new one off the free-head ! */
 
@@ -280,13 +464,14 @@ int   cellmallocmany(cellarena_t *ca, void **array, int numcells)
 		ca->freecount -= 1;
 
 	}
+	cellstat_inuse(ca, count);
 
 	return count;
 }
 
 
 
-void  cellfree(cellarena_t *ca, void *p)
+static void cellfree_central(cellarena_t *ca, void *p)
 {
 	struct cellhead *ch = clientptr_to_cellhead(p);
 	ch->next = NULL;
@@ -314,6 +499,7 @@ void  cellfree(cellarena_t *ca, void *p)
 	}
 
 	ca->freecount += 1;
+	cellstat_inuse(ca, -1);
 }
 
 /*
@@ -321,7 +507,7 @@ void  cellfree(cellarena_t *ca, void *p)
  *
  */
 
-void  cellfreemany(cellarena_t *ca, void **array, int numcells)
+static void cellfreemany_central(cellarena_t *ca, void **array, int numcells)
 {
 	int count;
 
@@ -354,4 +540,259 @@ void  cellfreemany(cellarena_t *ca, void **array, int numcells)
 
 	  ca->freecount += 1;
 	}
+	cellstat_inuse(ca, -numcells);
+}
+
+
+#ifdef CELLMALLOC_THREADS
+
+/*
+ *  Lock-free depot stacks of magazines.  The head carries magazine
+ *  index+1 in low 8 bits, and a modification counter above it to
+ *  keep compare-and-swap from ABA confusion.
+ */
+
+static void depot_push(cellarena_t *ca, volatile uint32_t *head,
+		       struct cellmagazine *m)
+{
+	uint32_t old, new;
+	uint32_t idx = (m - ca->magazines) + 1;
+
+	do {
+		old = *head;
+		m->next = old & 0xFF;
+		new = ((old + 0x100) & ~0xFFU) | idx;
+	} while (!__sync_bool_compare_and_swap(head, old, new));
+}
+
+static struct cellmagazine *depot_pop(cellarena_t *ca, volatile uint32_t *head)
+{
+	uint32_t old, new, idx;
+	struct cellmagazine *m;
+
+	do {
+		old = *head;
+		idx = old & 0xFF;
+		if (idx == 0)
+			return NULL;
+		m = &ca->magazines[idx-1];
+		new = ((old + 0x100) & ~0xFFU) | (m->next & 0xFF);
+	} while (!__sync_bool_compare_and_swap(head, old, new));
+
+	return m;
+}
+
+static pthread_key_t  cellcache_key;
+static pthread_once_t cellcache_once = PTHREAD_ONCE_INIT;
+
+/* Thread exit returns its cached magazines to the depots */
+static void cellcache_destroy(void *v)
+{
+	struct cellcache *caches = v;
+	int i;
+
+	for (i = 0; i < cellarenas_count; ++i) {
+		cellarena_t *ca = cellarenas[i];
+		struct cellmagazine *m[2];
+		int j;
+
+		if (!ca->threads) continue;
+		m[0] = caches[i].loaded;
+		m[1] = caches[i].previous;
+		for (j = 0; j < 2; ++j) {
+			if (m[j] == NULL) continue;
+			cellstat_inuse(ca, -m[j]->count);
+			depot_push(ca, m[j]->count > 0 ? &ca->depot_full : &ca->depot_empty, m[j]);
+		}
+	}
+	free(caches);
+}
+
+static void cellcache_keyinit(void)
+{
+	pthread_key_create(&cellcache_key, cellcache_destroy);
+}
+
+static struct cellcache *cellcache_get(cellarena_t *ca)
+{
+	struct cellcache *caches;
+
+	pthread_once(&cellcache_once, cellcache_keyinit);
+	caches = pthread_getspecific(cellcache_key);
+	if (caches == NULL) {
+		caches = calloc(CELLARENAS_MAX, sizeof(*caches));
+		if (caches == NULL)
+			return NULL;
+		pthread_setspecific(cellcache_key, caches);
+	}
+	return &caches[ca->index];
+}
+
+static void *cellmalloc_threads(cellarena_t *ca)
+{
+	struct cellcache *cc = NULL;
+	struct cellmagazine *m;
+	void *p;
+
+	if (ca->index < CELLARENAS_MAX)
+		cc = cellcache_get(ca);
+	if (cc == NULL)
+		goto central;
+
+	if (cc->loaded != NULL && cc->loaded->count > 0)
+		return cc->loaded->cells[--cc->loaded->count];
+
+	if (cc->previous != NULL && cc->previous->count > 0) {
+		m = cc->previous;
+		cc->previous = cc->loaded;
+		cc->loaded = m;
+		return m->cells[--m->count];
+	}
+
+	/* Both are empty, exchange one for a full one from the depot */
+	m = depot_pop(ca, &ca->depot_full);
+	if (m != NULL) {
+		if (cc->previous != NULL)
+			depot_push(ca, &ca->depot_empty, cc->previous);
+		cc->previous = cc->loaded;
+		cc->loaded = m;
+		cellstat_inuse(ca, m->count);
+		return m->cells[--m->count];
+	}
+
+	/* No full ones in depot, fill half a magazine from central free-list */
+	if (cc->loaded == NULL)
+		cc->loaded = depot_pop(ca, &ca->depot_empty);
+	if (cc->loaded != NULL) {
+		m = cc->loaded;
+		pthread_mutex_lock(&ca->mutex);
+		m->count = cellmallocmany_central(ca, m->cells, CELLMAGAZINE_SIZE/2);
+		pthread_mutex_unlock(&ca->mutex);
+		if (m->count == 0)
+			return NULL; /* central counted the failure */
+		return m->cells[--m->count];
+	}
+
+ central:
+	pthread_mutex_lock(&ca->mutex);
+	p = cellmalloc_central(ca);
+	pthread_mutex_unlock(&ca->mutex);
+	return p;
+}
+
+static void cellfree_threads(cellarena_t *ca, void *p)
+{
+	struct cellcache *cc = NULL;
+	struct cellmagazine *m;
+
+	if (ca->index < CELLARENAS_MAX)
+		cc = cellcache_get(ca);
+	if (cc == NULL)
+		goto central;
+
+	if (cc->loaded != NULL && cc->loaded->count < CELLMAGAZINE_SIZE) {
+		cc->loaded->cells[cc->loaded->count++] = p;
+		return;
+	}
+
+	if (cc->previous != NULL && cc->previous->count < CELLMAGAZINE_SIZE) {
+		m = cc->previous;
+		cc->previous = cc->loaded;
+		cc->loaded = m;
+		m->cells[m->count++] = p;
+		return;
+	}
+
+	/* Both are full (or missing), exchange for an empty from the depot */
+	m = depot_pop(ca, &ca->depot_empty);
+	if (m != NULL) {
+		if (cc->previous != NULL) {
+			cellstat_inuse(ca, -cc->previous->count);
+			depot_push(ca, &ca->depot_full, cc->previous);
+		}
+		cc->previous = cc->loaded;
+		cc->loaded = m;
+		m->count = 0;
+		m->cells[m->count++] = p;
+		return;
+	}
+
+ central:
+	pthread_mutex_lock(&ca->mutex);
+	cellfree_central(ca, p);
+	pthread_mutex_unlock(&ca->mutex);
+}
+#endif
+
+
+void *cellmalloc(cellarena_t *ca)
+{
+#ifdef CELLMALLOC_THREADS
+	if (ca->threads)
+		return cellmalloc_threads(ca);
+#endif
+	return cellmalloc_central(ca);
+}
+
+int   cellmallocmany(cellarena_t *ca, void **array, int numcells)
+{
+#ifdef CELLMALLOC_THREADS
+	if (ca->threads) {
+		int count;
+		for (count = 0; count < numcells; ++count) {
+			array[count] = cellmalloc_threads(ca);
+			if (array[count] == NULL)
+				break;
+		}
+		return count;
+	}
+#endif
+	return cellmallocmany_central(ca, array, numcells);
+}
+
+void  cellfree(cellarena_t *ca, void *p)
+{
+#ifdef CELLMALLOC_THREADS
+	if (ca->threads) {
+		cellfree_threads(ca, p);
+		return;
+	}
+#endif
+	cellfree_central(ca, p);
+}
+
+void  cellfreemany(cellarena_t *ca, void **array, int numcells)
+{
+#ifdef CELLMALLOC_THREADS
+	if (ca->threads) {
+		int count;
+		for (count = 0; count < numcells; ++count)
+			cellfree_threads(ca, array[count]);
+		return;
+	}
+#endif
+	cellfreemany_central(ca, array, numcells);
+}
+
+int cellstatus(const int index, struct cellstatus_t *cs)
+{
+	cellarena_t *ca;
+
+	if (index < 0 || index >= cellarenas_count)
+		return -1;
+	ca = cellarenas[index];
+
+	memset(cs, 0, sizeof(*cs));
+	cs->arenaname      = ca->arenaname;
+	cs->cellsize       = ca->cellsize;
+	cs->cellsinuse     = ca->cellsinuse;
+	cs->cellsinuse_max = ca->cellsinuse_max;
+	cs->freecount      = ca->freecount;
+	cs->blocks         = ca->blocks;
+	cs->blockbytes     = (long)ca->blocks * ca->createsize;
+	cs->allocfailures  = ca->allocfailures;
+#ifdef CELLMALLOC_THREADS
+	cs->threads        = ca->threads;
+#endif
+	return 0;
 }
@@ -22,10 +22,45 @@ extern cellarena_t *cellinit(const char *arenaname, const int cellsize, const in
 #define CELLMALLOC_POLICY_FIFO    0
 #define CELLMALLOC_POLICY_LIFO    1
 #define CELLMALLOC_POLICY_NOMUTEX 2
+#define CELLMALLOC_POLICY_THREADS 4 /* per-thread cached, usable from any thread */
 
 extern void *cellmalloc(cellarena_t *cellarena);
 extern int   cellmallocmany(cellarena_t *cellarena, void **array, const int numcells);
 extern void  cellfree(cellarena_t *cellarena, void *p);
 extern void  cellfreemany(cellarena_t *cellarena, void **array, const int numcells);
 
+/*
+ *   cellstatus() -- per-arena statistics
+ *
+ *   Arenas are numbered from 0 in cellinit() order, return value is
+ *   non-zero when there is no arena with given index.
+ *   In CELLMALLOC_POLICY_THREADS mode cells cached by threads count
+ *   as being in use.
+ */
+
+struct cellstatus_t {
+	const char *arenaname;
+	int	cellsize;
+	int	threads;	/* CELLMALLOC_POLICY_THREADS mode */
+	long	cellsinuse;
+	long	cellsinuse_max;	/* high-water mark */
+	long	freecount;
+	int	blocks;		/* blocks mapped */
+	long	blockbytes;
+	long	allocfailures;
+};
+
+extern int   cellstatus(const int index, struct cellstatus_t *cs);
+
+/*
+ *   cellregion() -- reserve a contiguous region where new cell blocks
+ *		     of all arenas are carved from, until it is used up.
+ */
+
+#define CELLREGION_HUGETLB  1 /* explicit huge pages, MAP_HUGETLB */
+#define CELLREGION_THP      2 /* transparent huge pages, MADV_HUGEPAGE */
+#define CELLREGION_POPULATE 4 /* fault all pages in at reservation */
+
+extern int   cellregion(const long size, const int flags);
+
 #endif
@@ -279,6 +279,13 @@ static int logging_config(struct configfile *cf) {
 
 			erlanglogfile = strdup(param1);
 
+		} else if (strcmp(name, "metrics-listen") == 0) {
+			if (debug)
+				printf("%s:%d: INFO: METRICS-LISTEN = '%s' '%s'\n",
+						cf->name, cf->linenum, param1, str);
+
+			metrics_config(param1, str);
+
 		} else if (strcmp(name, "erlang-log1min") == 0) {
 			if (debug)
 				printf("%s:%d: INFO: ERLANG-LOG1MIN\n",
@@ -356,6 +363,37 @@ static int cfgparam(struct configfile *cf) {
 			}
 		}
 
+	} else if (strcmp(name, "memory-region") == 0) {
+		// memory-region MB [hugetlb] [thp] [populate]
+		long mb = atol(param1);
+		int  flags = 0;
+
+		while (*str) {
+			param1 = str;
+			str = config_SKIPTEXT(str, NULL);
+			str = config_SKIPSPACE(str);
+			config_STRLOWER(param1);
+			if (strcmp(param1, "hugetlb") == 0) {
+				flags |= CELLREGION_HUGETLB;
+			} else if (strcmp(param1, "thp") == 0) {
+				flags |= CELLREGION_THP;
+			} else if (strcmp(param1, "populate") == 0) {
+				flags |= CELLREGION_POPULATE;
+			} else {
+				printf("%s:%d: ERROR: Unknown memory-region option: '%s'\n",
+						cf->name, cf->linenum, param1);
+				return 1;
+			}
+		}
+		if (mb <= 0 || cellregion(mb * 1024 * 1024, flags)) {
+			printf("%s:%d: ERROR: memory-region of %ld MB could not be reserved\n",
+					cf->name, cf->linenum, mb);
+			return 1;
+		}
+		if (debug)
+			printf("%s:%d: MEMORY-REGION %ld MB flags 0x%x\n",
+					cf->name, cf->linenum, mb, flags);
+
 	} else if (strcmp(name, "myloc") == 0) {
 		// lat xx lon yy
 		char *latp;
@@ -428,8 +466,8 @@ static int cfgparam(struct configfile *cf) {
 		myloc_latstr = strdup(latp);
 		myloc_lonstr = strdup(lonp);
 
-		myloc_lat = (float)la + lat/60.0;
-		myloc_lon = (float)lo + lng/60.0;
+		myloc_lat = filter_deg2micro(la + lat/60.0);
+		myloc_lon = filter_deg2micro(lo + lng/60.0);
 
 		if (lac == 'S' || lac == 's')
 			myloc_lat = -myloc_lat;
@@ -438,11 +476,10 @@ static int cfgparam(struct configfile *cf) {
 
 		if (debug)
 			printf("%s:%d: MYLOC LAT %8.5f degrees  LON %8.5f degrees\n",
-					cf->name, cf->linenum, myloc_lat, myloc_lon);
+					cf->name, cf->linenum,
+					myloc_lat / 1000000.0, myloc_lon / 1000000.0);
 
-		myloc_lat = filter_lat2rad(myloc_lat);
-		myloc_lon = filter_lon2rad(myloc_lon);
-		myloc_coslat = cos(myloc_lat);
+		myloc_coslat = filter_coslat(myloc_lat);
 
 
 #ifndef DISABLE_IGATE
@@ -9,6 +9,7 @@
  * **************************************************************** */
 
 #include "aprx.h"
+#include <stddef.h>
 
 static int digi_count;
 static struct digipeater **digis;
@@ -47,19 +48,37 @@ struct digistate {
 
 static char * tracewords[] = { "WIDE","TRACE","RELAY" };
 static int tracewordlens[] = { 4, 5, 5 };
+static uint8_t tracewordsax25[] = {
+	'W'<<1,'I'<<1,'D'<<1,'E'<<1,' '<<1,' '<<1,
+	'T'<<1,'R'<<1,'A'<<1,'C'<<1,'E'<<1,' '<<1,
+	'R'<<1,'E'<<1,'L'<<1,'A'<<1,'Y'<<1,' '<<1
+};
 static const struct tracewide default_trace_param = {
 	4, 4, 1, // maxreq, maxdone, is_trace
 	3, // Count of tracewords defined above
 	tracewords,
-	tracewordlens
+	tracewordlens,
+	tracewordsax25
 };
 static char * widewords[] = { "WIDE","RELAY" };
 static int widewordlens[] = { 4,5 };
+static uint8_t widewordsax25[] = {
+	'W'<<1,'I'<<1,'D'<<1,'E'<<1,' '<<1,' '<<1,
+	'R'<<1,'E'<<1,'L'<<1,'A'<<1,'Y'<<1,' '<<1
+};
 static const struct tracewide default_wide_param = {
 	4, 4, 0,
 	2,
 	widewords,
-	widewordlens
+	widewordlens,
+	widewordsax25
+};
+
+// Built-in rejected callsigns, see try_reject_filters()
+static const uint8_t nocallsax25[] = {
+	'M'<<1,'Y'<<1,'C'<<1,'A'<<1,'L'<<1,'L'<<1,
+	'N'<<1,'0'<<1,'C'<<1,'A'<<1,'L'<<1,'L'<<1,
+	'N'<<1,'O'<<1,'C'<<1,'A'<<1,'L'<<1,'L'<<1
 };
 
 static int  run_tokenbucket_timers(void);
@@ -381,6 +400,37 @@ static int try_reject_filters(const int  fieldtype,
 	return 0;
 }
 
+/* Source and destination callsign reject filters, on TNC2 text */
+static int reject_srcdst(struct digipeater_source *src,
+		struct pbuf_t *pb)
+{
+	char viafield[15]; // temp buffer for many uses
+	int len;
+
+	// Copy the SRCCALL part of  SRCALL>DSTCALL  to viafield[] buffer
+	len = pb->srccall_end - pb->data;
+	if (len >= sizeof(viafield)) len = sizeof(viafield)-1;
+	memcpy(viafield, pb->data, len);
+	viafield[len] = 0;
+	// if (debug>2)printf(" srccall='%s'",viafield);
+	if (try_reject_filters(0, viafield, src)) {
+		if (debug>1) printf(" - Src filters reject\n");
+		return 1; // Src reject filters
+	}
+
+	// Copy the DSTCALL part of  SRCALL>DSTCALL  to viafield[] buffer
+	len = pb->dstcall_end - pb->srccall_end -1;
+	if (len >= sizeof(viafield)) len = sizeof(viafield)-1;
+	memcpy(viafield, pb->srccall_end+1, len);
+	viafield[len] = 0;
+	// if (debug>2)printf(" destcall='%s'",viafield);
+	if (try_reject_filters(1, viafield, src)) {
+		if (debug>1) printf(" - Dest filters reject\n");
+		return 1; // Dest reject filters
+	}
+	return 0;
+}
+
 /* Parse executed and requested WIDEn-N/TRACEn-N info */
 static int parse_tnc2_hops(struct digistate *state,
 		struct digipeater_source *src,
@@ -408,31 +458,12 @@ static int parse_tnc2_hops(struct digistate *state,
 		return 0;
 	}
 
-	// Copy the SRCCALL part of  SRCALL>DSTCALL  to viafield[] buffer
-	len = pb->srccall_end - pb->data;
-	if (len >= sizeof(viafield)) len = sizeof(viafield)-1;
-	memcpy(viafield, pb->data, len);
-	viafield[len] = 0;
-	// if (debug>2)printf(" srccall='%s'",viafield);
-	if (try_reject_filters(0, viafield, src)) {
-		if (debug>1) printf(" - Src filters reject\n");
-		return 1; // Src reject filters
-	}
-
-	// Copy the DSTCALL part of  SRCALL>DSTCALL  to viafield[] buffer
-	len = pb->dstcall_end - pb->srccall_end -1;
-	if (len >= sizeof(viafield)) len = sizeof(viafield)-1;
-	memcpy(viafield, pb->srccall_end+1, len);
-	viafield[len] = 0;
-	// if (debug>2)printf(" destcall='%s'",viafield);
-	if (try_reject_filters(1, viafield, src)) {
-		if (debug>1) printf(" - Dest filters reject\n");
-		return 1; // Dest reject filters
-	}
+	if (reject_srcdst(src, pb))
+		return 1;
 
 	// Where is the last via-field with a star on it?
 	len = pb->info_start - p; if (len < 0) len=0;
-	lastviastar = memrchr(p, len, '*');
+	lastviastar = memrchr(p, '*', len);
 
 	// Loop over VIA fields to see if we need to digipeat anything.
 	while (p < pb->info_start && !have_fault) {
@@ -567,6 +598,407 @@ static int parse_tnc2_hops(struct digistate *state,
 	return have_fault;
 }
 
+/*
+ * The AX.25 header form of above parse_tnc2_hops() et.al.
+ *
+ * Frames received from radio have their TNC2 text produced out of
+ * the AX.25 address fields, and these functions give identical
+ * results by looking at the shifted 7-byte address fields directly.
+ * Callsign bytes are compared against precomputed shifted tables of
+ * tracewide keys and transmitter aliases.
+ */
+
+#define AX25BLANK(c) (((c) & 0xBE) == 0) // Shifted space, or NUL
+
+// Copy callsign bytes of an address field, blanks as shifted spaces
+static void ax25_normalize_call(uint8_t *dest, const uint8_t *axaddr)
+{
+	int i;
+	for (i = 0; i < AX25ADDRLEN-1; ++i)
+		dest[i] = AX25BLANK(axaddr[i]) ? (' ' << 1) : axaddr[i];
+}
+
+static int match_ax25_tracewide(const uint8_t *via, const int ssid,
+		const int hflag, const struct tracewide *twp)
+{
+	int i;
+	if (twp == NULL) return 0;
+
+	for (i = 0; i < twp->nkeys; ++i) {
+		const int keylen = twp->keylens[i];
+		if (memcmp(via, twp->ax25keys + i*(AX25ADDRLEN-1), keylen) != 0)
+			continue;
+		if (keylen == AX25ADDRLEN-1 || via[keylen] == (' ' << 1)) {
+			// Bare alias, TNC2 form has no "-N" nor "*" after it
+			if (ssid == 0 && !hflag)
+				return keylen;
+			continue;
+		}
+		// A bare "WIDEn" at or before the last H-bit is "WIDEn*"
+		// in TNC2 form, which match_tracewide() does not take, so
+		// it is neither matched nor fixed here.
+		if (via[keylen] > ('0' << 1) && via[keylen] <= ('7' << 1) &&
+		    (keylen+1 == AX25ADDRLEN-1 || via[keylen+1] == (' ' << 1)) &&
+		    (ssid != 0 || !hflag)) {
+			// Match n-N alias, either "WIDEn-..." or "WIDEn"
+			return keylen;
+		}
+		// False alarm; doesn't really match the whole alias
+	}
+	return 0;
+}
+
+static int match_ax25_aliases(const uint8_t *via, const int ssid,
+		const int hflag, const struct digipeater *digi)
+{
+	int i;
+	for (i = 0; i < digi->ax25aliascount; ++i) {
+		const uint8_t *a = digi->ax25aliases + i*AX25ADDRLEN;
+		if (memcmp(via, a, AX25ADDRLEN-1) == 0 &&
+		    ((a[AX25ADDRLEN-1] >> 1) & 0x0F) == ssid &&
+		    ((a[AX25ADDRLEN-1] & AX25HBIT) != 0) == hflag)
+			return 1;
+	}
+	return 0;
+}
+
+static int match_ax25_nocall(const uint8_t *via)
+{
+	int i;
+	for (i = 0; i < sizeof(nocallsax25); i += AX25ADDRLEN-1)
+		if (memcmp(via, nocallsax25 + i, AX25ADDRLEN-1) == 0)
+			return 1;
+	return 0;
+}
+
+// AX.25 form of count_single_tnc2_tracewide() for a field which
+// match_ax25_tracewide() has accepted.
+static int count_single_ax25_tracewide(struct viastate *state,
+		const uint8_t *via, const int ssid, const int hflag,
+		const int istrace, const int matchlen, const int viaindex)
+{
+	int req, done;
+
+	if (matchlen == AX25ADDRLEN-1 || via[matchlen] == (' ' << 1)) {
+		// Bare alias, single matcher..
+		req  = 1;
+		done = hflag;
+		if (viaindex == 2 && !hflag)
+			state->probably_heard_direct = 1;
+		goto addtostate;
+	}
+
+	req = (via[matchlen] >> 1) - '0';
+
+	if (ssid == 0) { // Bogus WIDE1 - uidigi puts these out.
+		state->fixthis = 1;
+		done = req;
+		goto addtostate;
+	}
+
+	if (hflag) {
+		// Like "WIDE2-1*", impossible/syntactically invalid
+		state->hopsreq  += 1;
+		state->hopsdone += 1;
+		if (istrace) {
+			state->tracereq  += 1;
+			state->tracedone += 1;
+		}
+		return 1;
+	}
+
+	if (ssid > 7) {
+		// The request has SSID value in range of 8 to 15
+		state->fixall = 1;
+		if (viaindex == 2)
+			state->probably_heard_direct = 1;
+		return 0;
+	}
+
+	// OK, it is "WIDEn-N"
+	done = req - ssid;
+	if (done < 0) {
+		// Something like "WIDE3-7", which is definitely bogus!
+		done = 0;
+		state->fixall = 1;
+		if (viaindex == 2)
+			state->probably_heard_direct = 1;
+		goto addtostate;
+	}
+	if (viaindex == 2) {
+		if (istrace) // A real "TRACE" in first slot?
+			state->probably_heard_direct = 1;
+
+		else if (done == 0) // WIDE1-1/2-2/3-3/etc on first slot
+			state->probably_heard_direct = 1;
+	}
+
+addtostate:;
+	state->hopsreq  += req;
+	state->hopsdone += done;
+	if (istrace) {
+		state->tracereq  += req;
+		state->tracedone += done;
+	}
+	return 0;
+}
+
+/* Parse executed and requested WIDEn-N/TRACEn-N info
+   from the AX.25 address fields */
+static int parse_ax25_hops(struct digistate *state,
+		struct digipeater_source *src,
+		struct pbuf_t *pb)
+{
+	const struct digipeater *digi = src->parent;
+	const uint8_t *txcall = digi->transmitter->ax25call;
+	const uint8_t *axaddr = pb->ax25addr + 2*AX25ADDRLEN;
+	const uint8_t *e      = pb->ax25addr + pb->ax25addrlen;
+	const uint8_t *lastviah = NULL;
+	const uint8_t *a;
+	uint8_t via[AX25ADDRLEN-1];
+	char viafield[15]; // TNC2 text for via regexps and debug
+	int have_fault = 0;
+	int viaindex = 1; // First via index will be 2..
+	int activeviacount = 0;
+	int len, ssid, hflag, txmatch;
+	int digiok;
+
+	if (src->src_relaytype == DIGIRELAY_THIRDPARTY) {
+		state->v.hopsreq = 1; // Bonus for tx-igated 3rd-party frames
+		state->v.tracereq = 1; // Bonus for tx-igated 3rd-party frames
+		state->v.hopsdone = 0;
+		state->v.tracedone = 0;
+		state->v.probably_heard_direct = 1;
+		return 0;
+	}
+
+	if (reject_srcdst(src, pb))
+		return 1;
+
+	// Where is the last via-field with H-bit on it?  All before
+	// it are treated as digipeated, like TNC2 form "*" is.
+	for (a = axaddr; a < e; a += AX25ADDRLEN)
+		if (a[AX25ADDRLEN-1] & AX25HBIT)
+			lastviah = a;
+
+	// Loop over VIA fields to see if we need to digipeat anything.
+	for (; axaddr < e && !have_fault; axaddr += AX25ADDRLEN) {
+		++viaindex;
+
+		ax25_normalize_call(via, axaddr);
+		ssid  = (axaddr[AX25ADDRLEN-1] >> 1) & 0x0F;
+		hflag = (lastviah != NULL && axaddr <= lastviah);
+
+		if (src->viaregscount > 0 || debug>1) {
+			ax25_to_tnc2_fmtaddress(viafield, axaddr, 0);
+			if (hflag) strcat(viafield, "*");
+		}
+
+		if (debug>1) printf(" - ViaField[%d]: '%s'\n", viaindex, viafield);
+
+		// VIA-field picked up, now analyze it..
+
+		if (src->viaregscount > 0) {
+			if (try_reject_filters(2, viafield, src)) {
+				if (debug>1) printf(" - Via filters reject\n");
+				return 1; // via reject filters
+			}
+		} else if (match_ax25_nocall(via)) {
+			if (debug>1) printf(" - Via filters reject\n");
+			return 1; // built-in via reject filters
+		}
+
+		txmatch = (memcmp(via, txcall, AX25ADDRLEN-1) == 0 &&
+			   ((txcall[AX25ADDRLEN-1] >> 1) & 0x0F) == ssid);
+
+		// Transmitter callsign match with H-flag set.
+		if (txmatch && hflag) {
+			if (debug>1) printf(" - Tx match reject\n");
+			// Oops, LOOP!  I have transmit this in past
+			return 1;
+		}
+
+		// If there is no H-bit meaning this has not been
+		// processed, then this is active field..
+		if (!hflag)
+			++activeviacount;
+
+		digiok = 0;
+
+		// If first active field matches transmitter or alias,
+		// then this digi is accepted regardless if it is APRS
+		// or some other protocol.
+		if (activeviacount == 1 &&
+				((txmatch && !hflag) ||
+				 match_ax25_aliases(via, ssid, hflag, digi))) {
+			if (debug>1) printf(" - Tx match accept!\n");
+			state->v.hopsreq  += 1;
+			state->v.tracereq += 1;
+			digiok = 1;
+		}
+
+		// .. otherwise following rules are applied only to APRS packets.
+		if (pb->is_aprs) {
+
+			if ((len = match_ax25_tracewide(via, ssid, hflag, src->src_trace))) {
+				have_fault = count_single_ax25_tracewide(&state->v, via, ssid, hflag, 1, len, viaindex);
+				if (!have_fault)
+					digiok = 1;
+			} else if ((len = match_ax25_tracewide(via, ssid, hflag, digi->trace))) {
+				have_fault = count_single_ax25_tracewide(&state->v, via, ssid, hflag, 1, len, viaindex);
+				if (!have_fault)
+					digiok = 1;
+			} else if ((len = match_ax25_tracewide(via, ssid, hflag, src->src_wide))) {
+				have_fault = count_single_ax25_tracewide(&state->v, via, ssid, hflag, 0, len, viaindex);
+				if (!have_fault)
+					digiok = 1;
+			} else if ((len = match_ax25_tracewide(via, ssid, hflag, digi->wide))) {
+				have_fault = count_single_ax25_tracewide(&state->v, via, ssid, hflag, 0, len, viaindex);
+				if (!have_fault)
+					digiok = 1;
+			} else {
+				// No match on trace or wide, but if there was earlier
+				// match on interface or alias, then it set "digiok" for us.
+				state->v.digidone += hflag;
+			}
+		}
+		if (state->v.fixthis || state->v.fixall) {
+			// Bogus WIDEn seen, set the missing H-bit like
+			// parse_tnc2_hops() does.
+			pb->ax25addr[ AX25ADDRLEN*viaindex + AX25ADDRLEN-1 ] |= AX25HBIT;
+			state->v.fixthis = 0;
+		}
+
+		if (digiok) {
+			if(state->v.hopsreq>state->v.hopsdone) break;
+		}
+	}
+	return have_fault;
+}
+
+#ifdef DIGIPEATER_HOPS_SELFTEST
+// Differential check of parse_ax25_hops() against parse_tnc2_hops()
+// on live traffic, build with  -DDIGIPEATER_HOPS_SELFTEST
+// or run  make hops-selftest
+static long hops_selftests, hops_mismatches;
+
+static void parse_hops_selftest_summary(void)
+{
+	printf("hops selftest: %ld frames compared, %ld mismatches\n",
+	       hops_selftests, hops_mismatches);
+}
+
+static int parse_hops_selftest(struct digistate *state,
+		struct digipeater_source *src,
+		struct pbuf_t *pb)
+{
+	struct digistate tstate;
+	uint8_t ax25addr[90], tax25addr[90];
+	int rc, trc;
+	int len = pb->ax25addrlen;
+
+	if (hops_selftests++ == 0)
+		atexit(parse_hops_selftest_summary);
+	if (len > sizeof(ax25addr)) len = sizeof(ax25addr);
+	memcpy(ax25addr, pb->ax25addr, len);
+	memset(&tstate, 0, sizeof(tstate));
+
+	trc = parse_tnc2_hops(&tstate, src, pb);
+	memcpy(tax25addr, pb->ax25addr, len);
+	memcpy(pb->ax25addr, ax25addr, len);
+
+	rc = parse_ax25_hops(state, src, pb);
+
+	if (rc != trc ||
+	    memcmp(&state->v, &tstate.v, sizeof(tstate.v)) != 0 ||
+	    memcmp(tax25addr, pb->ax25addr, len) != 0) {
+		++hops_mismatches;
+		printf("HOPS SELFTEST MISMATCH: rc=%d/%d '%.*s'\n", trc, rc,
+		       (int)(pb->info_start - pb->data), pb->data);
+	}
+	return rc;
+}
+#endif
+
+static int parse_hops(struct digistate *state,
+		struct digipeater_source *src,
+		struct pbuf_t *pb)
+{
+	if (!src->ax25hops)
+		return parse_tnc2_hops(state, src, pb);
+#ifdef DIGIPEATER_HOPS_SELFTEST
+	return parse_hops_selftest(state, src, pb);
+#else
+	return parse_ax25_hops(state, src, pb);
+#endif
+}
+
+// Can the AX.25 header hop parser be used for this source?
+// It needs every tracewide key, and the transmitter callsign,
+// to have an exact AX.25 address field form.
+static int digipeater_ax25hops_ok(const struct digipeater_source *src)
+{
+	const struct digipeater *digi = src->parent;
+	char buf[12];
+
+	if (src->src_trace != NULL && src->src_trace->ax25keys == NULL)
+		return 0;
+	if (src->src_wide  != NULL && src->src_wide->ax25keys  == NULL)
+		return 0;
+	if (digi->trace->ax25keys == NULL || digi->wide->ax25keys == NULL)
+		return 0;
+
+	ax25_to_tnc2_fmtaddress(buf, digi->transmitter->ax25call, 0);
+	return (strcmp(buf, digi->transmitter->callsign) == 0);
+}
+
+// Collect the transmitter aliases in AX.25 form.  Aliases that do not
+// print back the same in TNC2 form can never match, and are left out.
+static void digipeater_ax25aliases(struct digipeater *digi)
+{
+	const struct aprx_interface *aif = digi->transmitter;
+	char buf[12];
+	int i;
+
+	digi->ax25aliascount = 0;
+	digi->ax25aliases    = calloc(aif->aliascount+1, AX25ADDRLEN);
+	for (i = 0; i < aif->aliascount; ++i) {
+		uint8_t *a = digi->ax25aliases + digi->ax25aliascount * AX25ADDRLEN;
+		if (parse_ax25addr(a, aif->aliases[i], 0x60))
+			continue;
+		ax25_to_tnc2_fmtaddress(buf, a, 1);
+		if (strcmp(buf, aif->aliases[i]) != 0)
+			continue;
+		digi->ax25aliascount += 1;
+	}
+}
+
+// Precompute tracewide keys in shifted AX.25 callsign form,
+// or NULL if some key is not a plain [A-Z0-9]{1,6} callsign.
+static uint8_t *tracewide_ax25keys(const int nkeys, char **keys, const int *keylens)
+{
+	uint8_t *ax25keys = calloc(nkeys+1, AX25ADDRLEN-1);
+	int i, j;
+
+	for (i = 0; i < nkeys; ++i) {
+		uint8_t *k = ax25keys + i*(AX25ADDRLEN-1);
+		if (keylens[i] < 1 || keylens[i] > AX25ADDRLEN-1)
+			goto unusable;
+		for (j = 0; j < AX25ADDRLEN-1; ++j) {
+			int c = (j < keylens[i]) ? keys[i][j] : ' ';
+			if (j < keylens[i] &&
+			    !(('A' <= c && c <= 'Z') || ('0' <= c && c <= '9')))
+				goto unusable;
+			k[j] = c << 1;
+		}
+	}
+	return ax25keys;
+
+unusable:
+	free(ax25keys);
+	return NULL;
+}
+
 
 static void free_tracewide(struct tracewide *twp)
 {
@@ -580,6 +1012,8 @@ static void free_tracewide(struct tracewide *twp)
 	}
 	if (twp->keylens)
 		free((void*)(twp->keylens));
+	if (twp->ax25keys)
+		free(twp->ax25keys);
 
 	free(twp);
 }
@@ -674,6 +1108,7 @@ static struct tracewide *digipeater_config_tracewide(struct configfile *cf, int
 	tw->nkeys    = nkeys;
 	tw->keys     = keywords;
 	tw->keylens  = keylens;
+	tw->ax25keys = tracewide_ax25keys(nkeys, keywords, keylens);
 
 	return tw;
 }
@@ -1171,6 +1606,10 @@ int digipeater_config(struct configfile *cf)
 		digi->trace         = (traceparam != NULL) ? traceparam : & default_trace_param;
 		digi->wide          = (wideparam  != NULL) ? wideparam  : & default_wide_param;
 
+		digipeater_ax25aliases(digi);
+		for ( i = 0; i < sourcecount; ++i )
+			sources[i]->ax25hops = digipeater_ax25hops_ok(sources[i]);
+
 		digi->sourcecount   = sourcecount;
 		digi->sources       = sources;
 
@@ -1233,7 +1672,7 @@ static void digipeater_receive_backend(struct digipeater_source *src, struct pbu
 	//     verified)
 
 	// Parse executed and requested WIDEn-N/TRACEn-N info
-	if (parse_tnc2_hops(&state, src, pb)) {
+	if (parse_hops(&state, src, pb)) {
 		// A fault was observed! -- tests include "not this transmitter"
 		if (debug>1)
 			printf("Parse_tnc2_hops rejected this.");
@@ -1517,6 +1956,9 @@ static void digipeater_receive_backend(struct digipeater_source *src, struct pbu
 
 	// Feed to interface_transmit_ax25() with new header and body
 	interface_transmit_ax25( digi->transmitter,
+			(src->src_relaytype == DIGIRELAY_THIRDPARTY ? TXPRIO_IGATE :
+			 src->viscous_delay > 0 ? TXPRIO_VISCOUS : TXPRIO_DIGI),
+			pb->t_arrival,
 			state.ax25addr, state.ax25addrlen,
 			(const char*)pb->ax25data, pb->ax25datalen );
 	if (debug>1) printf("Done.\n");
@@ -1553,8 +1995,10 @@ void digipeater_receive( struct digipeater_source *src,
 		//    count > 1, drop it.
 
 		int jittery = src->viscous_delay > 0 ? random() % 3 + src->viscous_delay : 0;
+		int64_t t0 = latency_now();
 		dupe_record_t *dupe = dupecheck_pbuf( src->parent->dupechecker,
 				pb, jittery);
+		erlang_latency(LATENCY_DUPECHECK, latency_now() - t0);
 		if (dupe == NULL) {  // Oops.. allocation error!
 			if (debug)
 				printf("digipeater_receive() - dupecheck_pbuf() allocation error, packet discarded\n");
@@ -1798,6 +2242,7 @@ int  digipeater_postpoll(struct aprxpolls *app)
 						// We send the pbuf from viscous queue, if it still is
 						// present in the dupe record.  (For example direct sourced
 						// packets remove a packet from queued dupe record.)
+						erlang_latency(LATENCY_VISCOUS, latency_now() - dupe->pbuf->t_arrival);
 						digipeater_receive_backend(src, dupe->pbuf);
 
 						// Remove the delayed pbuf from this dupe record.
@@ -1876,6 +2321,64 @@ static void sourcecalltick(struct digipeater *digi)
 }
 #endif
 
+#ifndef DISABLE_IGATE
+static const struct {
+	const char *name;
+	const char *type;
+	const char *help;
+	size_t      offset;
+} historydb_metrics[] = {
+	{ "aprx_historydb_inserts", "counter", "HistoryDB insertions",
+	  offsetof(historydb_t, historydb_inserts) },
+	{ "aprx_historydb_lookups", "counter", "HistoryDB lookups",
+	  offsetof(historydb_t, historydb_lookups) },
+	{ "aprx_historydb_hashmatches", "counter", "HistoryDB hash chain matches",
+	  offsetof(historydb_t, historydb_hashmatches) },
+	{ "aprx_historydb_keymatches", "counter", "HistoryDB key matches",
+	  offsetof(historydb_t, historydb_keymatches) },
+	{ "aprx_historydb_nopos", "counter", "Packets without position offered to HistoryDB",
+	  offsetof(historydb_t, historydb_noposcount) },
+	{ "aprx_historydb_cells", "gauge", "HistoryDB entries",
+	  offsetof(historydb_t, historydb_cellgauge) },
+};
+#endif
+
+/* Per transmitter gauges and counters for the metrics exporter */
+void digipeater_metrics(void)
+{
+	int i, j;
+
+	metrics_family("aprx_digipeater_tokens", "gauge",
+		       "Transmitter token bucket fill");
+	for (i = 0; i < digi_count; ++i)
+		metrics_printf("aprx_digipeater_tokens{transmitter=\"%s\"} %.1f\n",
+			       digis[i]->transmitter->callsign, digis[i]->tokenbucket);
+
+	metrics_family("aprx_digipeater_dupecheck_records", "gauge",
+		       "Packets remembered by the transmitter dupechecker");
+	for (i = 0; i < digi_count; ++i) {
+		if (digis[i]->dupechecker == NULL) continue;
+		metrics_printf("aprx_digipeater_dupecheck_records{transmitter=\"%s\"} %d\n",
+			       digis[i]->transmitter->callsign, digis[i]->dupechecker->records);
+	}
+
+#ifndef DISABLE_IGATE
+	for (j = 0; j < (int)(sizeof(historydb_metrics)/sizeof(historydb_metrics[0])); ++j) {
+		int counter = historydb_metrics[j].type[0] == 'c';
+		metrics_family(historydb_metrics[j].name, historydb_metrics[j].type,
+			       historydb_metrics[j].help);
+		for (i = 0; i < digi_count; ++i) {
+			const historydb_t *db = digis[i]->historydb;
+			if (db == NULL) continue;
+			metrics_printf("%s%s{transmitter=\"%s\"} %ld\n",
+				       historydb_metrics[j].name, counter ? "_total" : "",
+				       digis[i]->transmitter->callsign,
+				       *(const long *)((const char *)db + historydb_metrics[j].offset));
+		}
+	}
+#endif
+}
+
 // An utility function that exists at GNU Libc..
 
 #if !defined(HAVE_MEMRCHR) && !defined(_FOR_VALGRIND_)
@@ -28,13 +28,27 @@
  *      http://www.aprs.org/symbols/symbolsX.txt
  */
 
+/*
+ *  Rate limit history of gated callsigns.
+ *
+ *  The entries are kept in a ring in the order they were gated, which
+ *  with one time limit is also their expiry order, so expiring is just
+ *  advancing the ring tail.  An open addressing hash of ring positions,
+ *  twice the ring size, finds a callsign.  Deletion shifts the probe
+ *  chain back, so there are no tombstones.
+ *
+ *  When the ring is full the oldest callsign is forgotten early.
+ */
 typedef struct dprsgw_history {
 	time_t gated;
 	char   callsign[10];
 } dprsgw_history_t;
 
-// Up to 30 history entries to not to send same callsign too often
-#define HISTORYSIZE 30
+// Defaults: 30 history entries, not sending the same callsign in 30 seconds
+#define HISTORYSIZE  30
+#define HISTORYLIMIT 30
+
+#define DPRS_NMEAFIELDS 20
 
 typedef struct dprs_gw {
 	char *ggaline;
@@ -42,10 +56,21 @@ typedef struct dprs_gw {
 	int ggaspace;
 	int rmcspace;
 
+	const struct serialport *S;     // for metrics
 	int              historylimit;  // Time limit in seconds
-	dprsgw_history_t history[HISTORYSIZE];
+	int              historysize;   // Ring capacity
+	int              head, count;   // Ring of gated callsigns
+	dprsgw_history_t *history;
+	int              hashmask;
+	int16_t          *hash;         // -1, or ring position
+
+	long             gated;         // Counters for metrics
+	long             suppressed;
 } dprsgw_t;
 
+static dprsgw_t **dprsgws;
+static int        dprsgw_count;
+
 
 // The dprslog() logs ONLY when '-d' mode is running.
 // .. and it will be removed soon.
@@ -76,17 +101,95 @@ static void dprsgw_flush(dprsgw_t *dp) {
 	dp->rmcline[0] = 0;
 }
 
-static void *dprsgw_new(int historylimit) {
+// Empty history of  historysize  callsigns
+static void dprsgw_history_init(dprsgw_t *dp, int historysize) {
+	int i;
+
+	for (i = 4; i < 2 * historysize; i <<= 1)
+	  ;
+	free(dp->history);
+	free(dp->hash);
+	dp->historysize = historysize;
+	dp->history     = calloc(historysize, sizeof(*dp->history));
+	dp->hashmask    = i - 1;
+	dp->hash        = malloc(i * sizeof(*dp->hash));
+	memset(dp->hash, 0xff, i * sizeof(*dp->hash));
+	dp->head = dp->count = 0;
+}
+
+static dprsgw_t *dprsgw_new(const struct serialport *S) {
 	dprsgw_t *dp = calloc(1, sizeof(*dp));
-        dp->historylimit = historylimit;
+
+	dp->S            = S;
+	dp->historylimit = HISTORYLIMIT;
+	dprsgw_history_init(dp, HISTORYSIZE);
 	dprsgw_flush(dp); // init buffers
+
+	++dprsgw_count;
+	dprsgws = realloc(dprsgws, sizeof(void*) * dprsgw_count);
+	dprsgws[dprsgw_count-1] = dp;
 	return dp;
 }
 
+/*
+ *  dprs-ratelimit <seconds>   -- same callsign is gated at most this often
+ *  dprs-history <callsigns>   -- how many callsigns are remembered
+ */
+int dprsgw_config(struct serialport *S, const char *keyword, const char *value)
+{
+	dprsgw_t *dp;
+	int i = atoi(value);
+
+	if (S->dprsgw == NULL)
+	  S->dprsgw = dprsgw_new(S);
+	dp = S->dprsgw;
+
+	if (strcmp(keyword, "dprs-ratelimit") == 0) {
+	  if (i < 0 || i > 3600)
+	    return 1;
+	  dp->historylimit = i;
+	} else {
+	  if (i < 1 || i > 10000)
+	    return 1;
+	  dprsgw_history_init(dp, i);
+	}
+	return 0;
+}
+
+static int dprsgw_hashslot(const dprsgw_t *dp, const char *callsign) {
+	return keyhash(callsign, strlen(callsign), 0) & dp->hashmask;
+}
+
+// Forget the oldest callsign
+static void dprsgw_history_pop(dprsgw_t *dp) {
+	const int pos = dp->head;
+	int i, j, k;
+
+	i = dprsgw_hashslot(dp, dp->history[pos].callsign);
+	while (dp->hash[i] != pos)
+	  i = (i + 1) & dp->hashmask;
+
+	// Shift back the entries after it in the probe chain
+	for (j = (i + 1) & dp->hashmask; dp->hash[j] >= 0; j = (j + 1) & dp->hashmask) {
+	  k = dprsgw_hashslot(dp, dp->history[dp->hash[j]].callsign);
+	  // May the entry at j move into the hole at i ?
+	  if (((j - k) & dp->hashmask) >= ((j - i) & dp->hashmask)) {
+	    dp->hash[i] = dp->hash[j];
+	    i = j;
+	  }
+	}
+	dp->hash[i] = -1;
+
+	dp->history[pos].callsign[0] = 0;
+	dp->head = (pos + 1) % dp->historysize;
+	--dp->count;
+}
+
 // Ratelimit returns 0 for "can send", 1 for "too soon"
 static int dprsgw_ratelimit( dprsgw_t *dp, const void *tnc2buf ) {
 	int i, n;
 	char callsign[10];
+	dprsgw_history_t *h;
 	time_t expiry = tick.tv_sec - dp->historylimit;
 
 	memcpy(callsign, tnc2buf, sizeof(callsign));
@@ -98,36 +201,67 @@ static int dprsgw_ratelimit( dprsgw_t *dp, const void *tnc2buf ) {
 	    break;
 	  }
 	}
-	n = -1;
-	for (i = 0; i < HISTORYSIZE; ++i) {
 
-          // Is there an entry?
-          if (dp->history[i].callsign[0] == 0)
-            continue; 
+	// Expire from the old end
+	while (dp->count > 0) {
+	  h = &dp->history[dp->head];
+	  if ((h->gated - expiry) > 0 && (h->gated - tick.tv_sec) <= 0)
+	    break; // fresh, and not from a time that jumped backwards
+	  dprsgw_history_pop(dp);
+	}
 
-          if ((dp->history[i].gated - tick.tv_sec) >  0) {
-            // system time has jumped backwards, expire it.
-            dp->history[i].gated = expiry;
-          }
-	  if ((dp->history[i].gated - expiry) > 0) {
-	    // Fresh enough to be interesting!
-	    if (strcmp(dp->history[i].callsign, callsign) == 0) {
-	      // This callsign!
+	for (i = dprsgw_hashslot(dp, callsign); dp->hash[i] >= 0; i = (i + 1) & dp->hashmask) {
+	  h = &dp->history[dp->hash[i]];
+	  if (strcmp(h->callsign, callsign) == 0) {
+	    if ((h->gated - tick.tv_sec) > 0) {
+	      // system time has jumped backwards, restart it.
+	      h->gated = tick.tv_sec;
+	    } else if ((h->gated - expiry) > 0) {
+	      // This callsign, fresh enough!
+	      ++dp->suppressed;
 	      return 1;
 	    }
-	  } else {
-	    dp->history[i].callsign[0] = 0; // discard it..
-	    if (n < 0) 
-	      n = i; // save first free slot's index
+	    h->gated = tick.tv_sec;
+	    ++dp->gated;
+	    return 0;
 	  }
 	}
-	if (n >= 0) {
-	  memcpy(dp->history[n].callsign, callsign, sizeof(callsign));
-	  dp->history[n].gated = tick.tv_sec;
+
+	if (dp->count == dp->historysize) {
+	  dprsgw_history_pop(dp);
+	  // Find the insertion point again, the chain may have moved
+	  for (i = dprsgw_hashslot(dp, callsign); dp->hash[i] >= 0; i = (i + 1) & dp->hashmask)
+	    ;
 	}
+	n = (dp->head + dp->count) % dp->historysize;
+	memcpy(dp->history[n].callsign, callsign, sizeof(callsign));
+	dp->history[n].gated = tick.tv_sec;
+	dp->hash[i] = n;
+	++dp->count;
+	++dp->gated;
 	return 0;
 }
 
+#ifndef DPRSGW_DEBUG_MAIN
+void dprsgw_metrics(void)
+{
+	int i;
+
+	metrics_family("aprx_dprsgw_gated", "counter", "DPRS positions gated");
+	for (i = 0; i < dprsgw_count; ++i)
+	  metrics_printf("aprx_dprsgw_gated_total{interface=\"%s\"} %ld\n",
+			 dprsgws[i]->S->ttycallsign[0], dprsgws[i]->gated);
+	metrics_family("aprx_dprsgw_suppressed", "counter", "DPRS positions suppressed by rate limit");
+	for (i = 0; i < dprsgw_count; ++i)
+	  metrics_printf("aprx_dprsgw_suppressed_total{interface=\"%s\"} %ld\n",
+			 dprsgws[i]->S->ttycallsign[0], dprsgws[i]->suppressed);
+	metrics_family("aprx_dprsgw_history", "gauge", "Callsigns in DPRS rate limit history");
+	for (i = 0; i < dprsgw_count; ++i)
+	  metrics_printf("aprx_dprsgw_history{interface=\"%s\"} %d\n",
+			 dprsgws[i]->S->ttycallsign[0], dprsgws[i]->count);
+}
+#endif
+
 typedef struct gps2apr_syms {
 	const char gps[3];
 	const char aprs[3];
@@ -503,8 +637,8 @@ static int dprsgw_nmea_split(char *nmea, char *fields[], int n) {
 static void dprsgw_nmea_igate( const struct aprx_interface *aif,
 			       const uint8_t *ident, dprsgw_t *dp ) {
 	int i;
-	char *gga[20];
-	char *rmc[20];
+	char *gga[DPRS_NMEAFIELDS];
+	char *rmc[DPRS_NMEAFIELDS];
 	char tnc2buf[2000];
 	int  tnc2addrlen;
 	int  tnc2buflen;
@@ -532,9 +666,9 @@ static void dprsgw_nmea_igate( const struct aprx_interface *aif,
 	//    ,S, = Status:  'A' = Valid, 'V' = Invalid
 
 	if (dp->ggaline[0] != 0)
-	  dprsgw_nmea_split(dp->ggaline, gga, 20);
+	  dprsgw_nmea_split(dp->ggaline, gga, DPRS_NMEAFIELDS);
 	if (dp->rmcline[0] != 0)
-	  dprsgw_nmea_split(dp->rmcline, rmc, 20);
+	  dprsgw_nmea_split(dp->rmcline, rmc, DPRS_NMEAFIELDS);
 
 	if (rmc[2] != NULL && strcmp(rmc[2],"A") != 0) {
 	  if (debug) printf("Invalid DPRS $GPRMC packet (validity='%s')\n",
@@ -640,7 +774,7 @@ static void dprsgw_nmea_igate( const struct aprx_interface *aif,
 	if (gga[2] != NULL) {
 	  if (gga[9] != NULL && gga[9][0] != 0)
 	    alt_feet = strtol(gga[9], NULL, 10);
-	  if (strcmp(gga[10],"M") == 0) {
+	  if (gga[10] != NULL && strcmp(gga[10],"M") == 0) {
 	    // Meters!  Convert to feet..
 	    alt_feet = (10000 * alt_feet) / 3048;
 	  } else {
@@ -840,7 +974,7 @@ static void dprsgw_receive( struct serialport *S )
 	    if (i <= 0)
 	      break; // exhausted!
 	    S->rdlinelen = i;
-	    memcpy(S->rdline, p, S->rdlinelen);
+	    memmove(S->rdline, p, S->rdlinelen);
 	    S->rdline[i] = 0;
 	    continue;
 	  }
@@ -864,7 +998,7 @@ int dprsgw_pulldprs( struct serialport *S )
 
 
 	if (S->dprsgw == NULL)
-	  S->dprsgw = dprsgw_new(30);   // FIXME: hard-coded 30 second delay for DPRS repeats
+	  S->dprsgw = dprsgw_new(S);
 
 	if ((rdtime+2 - tick.tv_sec) < 0) {
 		// A timeout has happen? (2 seconds!) Either data is added constantly,
@@ -932,7 +1066,7 @@ int dprsgw_pulldprs( struct serialport *S )
 		      S->rdlinelen = 0;
 		      break; // exhausted
 		    }
-		    memcpy(S->rdline, p, len);
+		    memmove(S->rdline, p, len);
 		    S->rdline[len] = 0;
 		    S->rdlinelen = len;
 		    if (len >= 3) {
@@ -1005,16 +1139,7 @@ int freadln(FILE *fp, char *p, int buflen) // DPRSGW_DEBUG_MAIN
 
 int ttyreader_getc(struct serialport *S)  // DPRSGW_DEBUG_MAIN
 {
-	if (S->rdcursor >= S->rdlen) {	/* Out of data ? */
-		if (S->rdcursor)
-			S->rdcursor = S->rdlen = 0;
-		/* printf("-\n"); */
-		return -1;
-	}
-
-	/* printf(" %02X", 0xFF & S->rdbuf[S->rdcursor++]); */
-
-	return (0xFF & S->rdbuf[S->rdcursor++]);
+	return ringbuf_getc(&S->rd);
 }
 void igate_to_aprsis(const char *portname, const int tncid, const char *tnc2buf, int tnc2addrlen, int tnc2len, const int discard, const int strictax25_) // DPRSGW_DEBUG_MAIN
 {
@@ -1032,6 +1157,7 @@ struct timeval tick;
 int main(int argc, char *argv[]) {
   struct serialport S;
   memset(&S, 0, sizeof(S));
+  ringbuf_init(&S.rd, S.rdbuf, sizeof(S.rdbuf));
 
 #if 0
   // A test where string has initially some incomplete data, then finally a real data
@@ -1078,11 +1204,9 @@ int main(int argc, char *argv[]) {
     tick.tv_sec = strtol(buf1, &ep, 10); // test code time init
     if (*ep == '\t') ++ep;
     int len = n - (ep - buf1);
-    if (len > 0) {
-      memcpy(S.rdbuf+S.rdlen, ep, len);
-      S.rdlen += len;
-    }
-    if (S.rdlen > 0)
+    if (len > 0)
+      ringbuf_put(&S.rd, ep, len);
+    if (ringbuf_used(&S.rd) > 0)
       dprsgw_pulldprs(&S);
 
   }
@@ -1091,4 +1215,185 @@ int main(int argc, char *argv[]) {
   return 0;
 }
 #endif
+
+#if defined(DPRSGW_BENCHMARK) || defined(DPRSGW_FUZZ)
+/*
+ * Benchmark and fuzz target of the DPRS line reader, build with:
+ *     make dprsgw-bench
+ * and run:
+ *     ./dprsgw-bench [corpusfile [rounds]]
+ * or with clang and libFuzzer:
+ *     make dprsgw-fuzz
+ *     ./dprsgw-fuzz [corpusdir]
+ *
+ * The corpus is the raw byte stream of a DPRS serial port.  Without
+ * a file a small built-in corpus is used.  Every line is validated
+ * and its $GP fields split, and the whole stream is run through
+ * dprsgw_pulldprs().  The benchmark also runs randomly mutated lines
+ * through the validator, and times the reader per byte.
+ */
+
+#include <time.h>
+
+int debug;
+struct timeval tick;
+static long bench_gated;
+
+void erlang_add(const char *portname, ErlangMode erl, int bytes, int packets) { }
+void metrics_family(const char *name, const char *type, const char *help) { }
+void metrics_printf(const char *fmt, ...) { }
+int ttyreader_getc(struct serialport *S) { return ringbuf_getc(&S->rd); }
+void igate_to_aprsis(const char *portname, const int tncid, const char *tnc2buf, int tnc2addrlen, int tnc2len, const int discard, const int strictax25_) { ++bench_gated; }
+void interface_receive_3rdparty(const struct aprx_interface *aif, char **heads, int headscount, const char *gwtype, const char *tnc2data, const int tnc2datalen) { }
+
+static struct aprx_interface bench_aif = { .callsign = "N0CALL-DR" };
+static long bench_lines, bench_valid;
+
+/* Validate a line as dprsgw_receive() does, and split a $GP line */
+static void bench_checkline(struct serialport *S, const uint8_t *line, int len)
+{
+	char *fields[DPRS_NMEAFIELDS];
+
+	if (len > (int)sizeof(S->rdline) - 3)
+	  len = sizeof(S->rdline) - 3;
+	memcpy(S->rdline, line, len);
+	S->rdline[len] = 0;
+	S->rdlinelen = len;
+
+	++bench_lines;
+	if (dprsgw_isvalid(S)) {
+	  ++bench_valid;
+	  if (S->rdline[0] == '$' && S->rdline[1] == 'G')
+	    dprsgw_nmea_split((char *)S->rdline, fields, DPRS_NMEAFIELDS);
+	}
+}
+
+static void bench_serialport(struct serialport *S)
+{
+	memset(S, 0, sizeof(*S));
+	ringbuf_init(&S->rd, S->rdbuf, sizeof(S->rdbuf));
+	S->ttycallsign[0] = bench_aif.callsign;
+	S->interface[0]   = &bench_aif;
+	S->dprsgw         = dprsgw_new(S);
+}
+
+/* The whole input through the real reader */
+static void bench_pull(struct serialport *S, const uint8_t *data, size_t size)
+{
+	size_t i, j;
+
+	S->rdlinelen = 0;
+	dprsgw_flush(S->dprsgw);
+	for (i = 0; i < size; i += j) {
+	  j = ringbuf_space(&S->rd);
+	  if (j > size - i)
+	    j = size - i;
+	  ringbuf_put(&S->rd, data+i, j);
+	  dprsgw_pulldprs(S);
+	}
+}
+
+/* Every line of the input through the validator, then the whole
+   input through the real reader */
+static void bench_check(const uint8_t *data, size_t size)
+{
+	static struct serialport S;
+	size_t i, j;
+
+	if (S.dprsgw == NULL)
+	  bench_serialport(&S);
+
+	for (i = j = 0; i <= size; ++i) {
+	  if (i == size || data[i] == '\r' || data[i] == '\n') {
+	    if (i > j)
+	      bench_checkline(&S, data+j, i-j);
+	    j = i+1;
+	  }
+	}
+	bench_pull(&S, data, size);
+}
+
+#ifdef DPRSGW_FUZZ
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+	bench_check(data, size);
+	return 0;
+}
+#else
+
+static const char bench_corpus[] =
+	"$$CRCB727,OH3BK-D>APRATS,DSTAR*:@165340h6128.23N/02353.52E-D-RATS (GPS-A) /A=000377\r"
+	"\304\3559\202\333$$CRCC3F5,OH3KGR-M>API282,DSTAR*:/123035h6131.29N/02340.45E>/IC-E2820\r"
+	"$GPGGA,164829.02,6131.6572,N,02339.1567,E,1,08,1.1,111.3,M,19.0,M,,*61\r\n"
+	"$GPRMC,170130.02,A,6131.6583,N,02339.1552,E,0.00,154.8,290510,6.5,E,A*02\r\n"
+	"OH3BK  D,BN  *59             \r"
+	"$GPGGA,204805,6128.230,N,2353.520,E,1,3,0,115,M,0,M,,*6d\r\n"
+	"OH3BK  D,                    \r";
+
+static long long nanotime(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+int main(int argc, char *argv[])
+{
+	static struct serialport S;
+	uint8_t *corpus = (uint8_t *)bench_corpus;
+	size_t size = sizeof(bench_corpus)-1;
+	int rounds = 1000, r;
+	long long t0, t1;
+	uint8_t line[200];
+
+	if (argc > 1) {
+	  FILE *fp = fopen(argv[1], "r");
+	  if (fp == NULL) { perror(argv[1]); return 1; }
+	  fseek(fp, 0, SEEK_END);
+	  size = ftell(fp);
+	  rewind(fp);
+	  corpus = malloc(size);
+	  if (fread(corpus, 1, size, fp) != size) { perror(argv[1]); return 1; }
+	  fclose(fp);
+	  rounds = 10;
+	}
+	if (argc > 2)
+	  rounds = atoi(argv[2]);
+	keyhash_init();
+	bench_serialport(&S);
+
+	bench_check(corpus, size);
+	printf("%ld lines, %ld valid, %ld gated\n",
+	       bench_lines, bench_valid, bench_gated);
+
+	/* Random single byte mutations of the corpus lines */
+	srandom(1);
+	bench_lines = bench_valid = 0;
+	for (r = 0; r < 100000; ++r) {
+	  size_t at = random() % size, len;
+	  while (at > 0 && corpus[at-1] != '\r' && corpus[at-1] != '\n')
+	    --at;
+	  for (len = 0; at+len < size && len < sizeof(line) &&
+		 corpus[at+len] != '\r' && corpus[at+len] != '\n'; ++len)
+	    line[len] = corpus[at+len];
+	  if (len == 0)
+	    continue;
+	  line[random() % len] = (random() & 1) ? random() : "0123456789ABCDEFabcdef*$, "[random() % 26];
+	  bench_checkline(&S, line, len);
+	}
+	printf("%ld mutated lines checked, %ld still valid\n",
+	       bench_lines, bench_valid);
+
+	/* Timing of the reader, bytes to validated and gated lines */
+	t0 = nanotime();
+	for (r = 0; r < rounds; ++r) {
+	  bench_pull(&S, corpus, size);
+	}
+	t1 = nanotime();
+	printf("dprsgw_pulldprs %.2f ns/byte over %zu bytes x %d\n",
+	       (double)(t1-t0) / ((double)size * rounds), size, rounds);
+	return 0;
+}
+#endif
+#endif
 #endif
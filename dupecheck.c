@@ -159,6 +159,7 @@ static void dupecheck_cleanup(void)
 		/* Old..  discard. */
 		*dpp = dp->next;
 		dp->next = NULL;
+		--dpc->records;
 		dupecheck_put(dp);
 		++cleancount;
 		continue;
@@ -238,6 +239,7 @@ dupe_record_t *dupecheck_aprs(dupecheck_t *dpc,
 			// Old ones are discarded when seen
 			*dpp = dp->next;
 			dp->next = NULL;
+			--dpc->records;
 			dupecheck_put(dp);
 			continue;
 		}
@@ -262,6 +264,7 @@ dupe_record_t *dupecheck_aprs(dupecheck_t *dpc,
 	dp = dupecheck_db_alloc(addrlen, datalen);
 	if (dp == NULL) return NULL; // alloc error!
 	*dpp = dp; // Put it on tail of existing chain
+	++dpc->records;
 
 
 	memcpy(dp->addresses, addr, addrlen);
@@ -391,6 +394,7 @@ dupe_record_t *dupecheck_pbuf(dupecheck_t *dpc, struct pbuf_t *pb, const int vis
 			// Old ones are discarded when seen
 			*dpp = dp->next;
 			dp->next = NULL;
+			--dpc->records;
 			dupecheck_put(dp);
 			continue;
 		}
@@ -421,6 +425,7 @@ dupe_record_t *dupecheck_pbuf(dupecheck_t *dpc, struct pbuf_t *pb, const int vis
 	  return NULL; // alloc error!
 	}
 	*dpp = dp; // Put it on tail of existing chain
+	++dpc->records;
 
 	memcpy(dp->addresses, addr, addrlen);
 	memcpy(dp->packet,    data, datalen);
@@ -470,6 +475,14 @@ int dupecheck_prepoll(struct aprxpolls *app)
 }
 
 
+void dupecheck_metrics(void)
+{
+	metrics_family("aprx_dupecheck_records", "gauge",
+		       "Packets remembered by all dupecheckers");
+	metrics_printf("aprx_dupecheck_records %d\n", dupecheck_cellgauge);
+}
+
+
 int dupecheck_postpoll(struct aprxpolls *app)
 {
         if (tv_timercmp(&dupecheck_cleanup_nexttime, &tick) > 0)
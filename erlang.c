@@ -14,6 +14,7 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <sys/mman.h>
+#include <stddef.h>
 
 
 /* The erlang module accounts data reception per 1m/10m/60m
@@ -56,13 +57,148 @@ struct erlangline **ErlangLines;
 int ErlangLinesCount;
 int erlang_data_is_nonshared;	/* In embedded target.. */
 
+
+/*
+ *  The shared data has one writer, this program, and any number of
+ *  readers (aprx-stat) that must not see half updated counters.
+ *  Each erlangline, and the latency part of erlanghead, have a
+ *  sequence number that is odd while an update is in progress.
+ *  A reader copies the data, and retries if the sequence number
+ *  was odd or changed meanwhile.  The writer never waits.
+ */
+static inline void erlang_write_begin(volatile uint32_t *seq)
+{
+	++*seq;
+	__sync_synchronize();
+}
+
+static inline void erlang_write_end(volatile uint32_t *seq)
+{
+	__sync_synchronize();
+	++*seq;
+}
+
+int erlang_snapshot(const volatile uint32_t *seq, void *dst,
+		    const volatile void *src, const size_t len)
+{
+	uint32_t s1, s2;
+	int tries;
+
+	for (tries = 0; tries < 100000; ++tries) {
+		s1 = *seq;
+		__sync_synchronize();
+		if (s1 & 1)
+			continue;	/* update in progress */
+		memcpy(dst, (const void *)src, len);
+		__sync_synchronize();
+		s2 = *seq;
+		if (s1 == s2)
+			return 0;
+	}
+	memcpy(dst, (const void *)src, len);
+	return -1;
+}
+
 struct erlang_file {
 	struct erlanghead head;
 	struct erlangline lines[1];
 };
 
+/*
+ *  Period history rings.  With ERLANGSTORAGE they are columnar
+ *  blocks, see  struct erlang_histblock.  The per-period counts are
+ *  the deltas of the running counters, and fit in 32 bits even for
+ *  an hour of busy APRS-IS traffic.
+ */
+#ifdef ERLANGSTORAGE
+static struct erlang_histblock *erlang_history_block(const struct erlangline *E,
+						     const int minutes)
+{
+	if (minutes == 1)  return (struct erlang_histblock *)E->e1;
+	if (minutes == 10) return (struct erlang_histblock *)E->e10;
+	return (struct erlang_histblock *)E->e60;
+}
+#endif
+
+void erlang_history_get(const struct erlangline *E, const int minutes,
+			const int k, struct erlang_rxtxbytepkt *R)
+{
+#ifdef ERLANGSTORAGE
+	const struct erlang_histblock *B = erlang_history_block(E, minutes) + k / ERLANG_BLOCKSLOTS;
+	const int j = k % ERLANG_BLOCKSLOTS;
+
+	R->update         = B->update[j];
+	R->packets_rx     = B->packets_rx[j];
+	R->packets_rxdrop = B->packets_rxdrop[j];
+	R->packets_tx     = B->packets_tx[j];
+	R->bytes_rx       = B->bytes_rx[j];
+	R->bytes_rxdrop   = B->bytes_rxdrop[j];
+	R->bytes_tx       = B->bytes_tx[j];
+#else
+	(void)minutes;	/* the embedded build keeps just one ring */
+#if (USE_ONE_MINUTE_DATA == 1)
+	*R = E->e1[k];
+#else
+	*R = E->e10[k];
+#endif
+#endif
+}
+
+static void erlang_history_put(struct erlangline *E, const int minutes,
+			       const int k, const struct erlang_rxtxbytepkt *R)
+{
+#ifdef ERLANGSTORAGE
+	struct erlang_histblock *B = erlang_history_block(E, minutes) + k / ERLANG_BLOCKSLOTS;
+	const int j = k % ERLANG_BLOCKSLOTS;
+
+	B->update[j]         = R->update;
+	B->packets_rx[j]     = R->packets_rx;
+	B->packets_rxdrop[j] = R->packets_rxdrop;
+	B->packets_tx[j]     = R->packets_tx;
+	B->bytes_rx[j]       = R->bytes_rx;
+	B->bytes_rxdrop[j]   = R->bytes_rxdrop;
+	B->bytes_tx[j]       = R->bytes_tx;
+#else
+	(void)minutes;
+#if (USE_ONE_MINUTE_DATA == 1)
+	E->e1[k] = *R;
+#else
+	E->e10[k] = *R;
+#endif
+#endif
+}
+
+/*
+ *  The telemetry aggregate is kept up at the end of each period, so
+ *  telemetry.c does not need to read the history rings back.
+ */
+static void erlang_aggregate_add(struct erlangline *E,
+				 const struct erlang_rxtxbytepkt *R)
+{
+	struct erlang_aggregate *A = &E->telemetry;
+
+	if (R->bytes_rx > A->max_bytes_rx)
+		A->max_bytes_rx = R->bytes_rx;
+	if (R->bytes_tx > A->max_bytes_tx)
+		A->max_bytes_tx = R->bytes_tx;
+	A->packets_rx     += R->packets_rx;
+	A->packets_rxdrop += R->packets_rxdrop;
+	A->packets_tx     += R->packets_tx;
+	++A->count;
+}
+
+void erlang_aggregate_take(struct erlangline *E, struct erlang_aggregate *A)
+{
+	erlang_write_begin(&E->seq);
+	*A = E->telemetry;
+	memset(&E->telemetry, 0, sizeof(E->telemetry));
+	erlang_write_end(&E->seq);
+}
+
 static void erlang_backingstore_startops(void)
 {
+	int i;
+
 	ErlangHead->server_pid = getpid();
 	ErlangHead->start_time = time(NULL);
 
@@ -73,6 +209,16 @@ static void erlang_backingstore_startops(void)
 		strncpy(ErlangHead->mycall, mycall,
 			sizeof(ErlangHead->mycall));
 	ErlangHead->mycall[sizeof(ErlangHead->mycall) - 1] = 0;	/* NUL terminate */
+
+	/* Pointers cached by the previous server are not ours, and
+	   neither is the telemetry it had gathered but not sent */
+	for (i = 0; i < ErlangLinesCount; ++i) {
+		struct erlangline *E = ErlangLines[i];
+		E->refp = NULL;
+		erlang_write_begin(&E->seq);
+		memset(&E->telemetry, 0, sizeof(E->telemetry));
+		erlang_write_end(&E->seq);
+	}
 }
 
 static int erlang_backingstore_grow(int do_create, int add_count)
@@ -81,7 +227,6 @@ static int erlang_backingstore_grow(int do_create, int add_count)
 	int i;
 #ifdef ERLANGSTORAGE
 	struct stat st;
-	char buf[256];
 	int new_size, pagesize = sysconf(_SC_PAGE_SIZE);
 	int doing_init = 0;
 
@@ -112,22 +257,11 @@ static int erlang_backingstore_grow(int do_create, int add_count)
 	   .. and at least one page size (e.g. 4 kB) .. */
 
 	if (new_size > st.st_size) {
-		/* .. then we fill in the file to given size.  */
-		int i, rc, l;
-		i = st.st_size;
-		memset(buf, 0, sizeof(buf));
-		lseek(erlang_file_fd, 0, SEEK_END);
-		while (i < new_size) {
-			l = sizeof(buf);
-			if (new_size - i < l)
-				l = new_size - i;
-			rc = write(erlang_file_fd, buf, l);
-			if (rc < 0 && errno == EINTR)
-				continue;
-			if (rc != l)
-				break;
-			i += rc;
-		}
+		/* .. then we extend the file to given size.  The new
+		   space is a hole, pages get allocated when written. */
+		if (ftruncate(erlang_file_fd, new_size) < 0)
+			syslog(LOG_ERR, "Erlang-file extend failed: %s",
+			       strerror(errno));
 	}
 
       redo_open:;
@@ -157,7 +291,6 @@ static int erlang_backingstore_grow(int do_create, int add_count)
 	}
 	if (erlang_mmap) {
 
-		int rc, l;
 		EF = erlang_mmap;
 
 		ErlangHead = &EF->head;
@@ -203,22 +336,8 @@ static int erlang_backingstore_grow(int do_create, int add_count)
 				new_size *= pagesize;
 			}
 
-			i = st.st_size;
-			memset(buf, 0, sizeof(buf));
-			lseek(erlang_file_fd, 0, SEEK_END);	/* append on the file.. */
-			while (i < new_size) {
-				l = sizeof(buf);
-				if (new_size - i < l)
-					l = new_size - i;
-				rc = write(erlang_file_fd, buf, l);
-				if (rc < 0 && errno == EINTR)
-					continue;
-				if (rc != l)
-					break;
-				i += rc;
-			}
-
-			if (i < new_size) {
+			if (new_size > st.st_size &&
+			    ftruncate(erlang_file_fd, new_size) < 0) {
 				munmap(erlang_mmap, erlang_mmap_size);
 				erlang_mmap = NULL;
 
@@ -254,10 +373,21 @@ static int erlang_backingstore_grow(int do_create, int add_count)
 	erlang_data_is_nonshared = 1;
 
 	if (add_count > 0 || !erlang_mmap) {
+		/* Like realloc(), but keeping the page alignment of
+		   the history blocks */
+		void *old = erlang_mmap;
+		size_t oldsize = sizeof(*EF) + ErlangLinesCount * sizeof(struct erlangline);
 		ErlangLinesCount += add_count;
-		erlang_mmap = realloc(erlang_mmap, sizeof(*EF) +
-				      (ErlangLinesCount +
-				       1) * sizeof(struct erlangline));
+		if (posix_memalign(&erlang_mmap, __alignof__(struct erlang_file),
+				   sizeof(*EF) + ErlangLinesCount * sizeof(struct erlangline)) != 0)
+			erlang_mmap = NULL;
+		if (erlang_mmap == NULL)
+			return -1;
+		if (old) {
+			memcpy(erlang_mmap, old, oldsize);
+			free(old);
+		} else	/* head counters start from zero */
+			memset(erlang_mmap, 0, sizeof(struct erlanghead));
 	}
 
 	EF = erlang_mmap;
@@ -278,11 +408,20 @@ static int erlang_backingstore_grow(int do_create, int add_count)
 static int erlang_backingstore_open(int do_create)
 {
 #ifdef ERLANGSTORAGE
+	/* The history block layout presumes this page size.  Any other
+	   works too, only a stored period may then dirty two pages, or
+	   share one with its neighbours. */
+	if (sysconf(_SC_PAGE_SIZE) != ERLANG_PAGESIZE)
+		syslog(LOG_WARNING,
+		       "erlang history blocks are %d bytes, system pages %ld bytes",
+		       ERLANG_PAGESIZE, sysconf(_SC_PAGE_SIZE));
+
 	if (!erlang_backingstore) {
-		syslog(LOG_ERR, "erlang_backingstore not defined!");
+		/* Private in-memory data, e.g. in simulation runs */
 		erlang_data_is_nonshared = 1;
+		return erlang_backingstore_grow(do_create, 0);
 	}
-	if (erlang_file_fd < 0 && erlang_backingstore) {
+	if (erlang_file_fd < 0) {
 		erlang_file_fd = open(erlang_backingstore, do_create ? O_RDWR : O_RDONLY, 0644);	/* Presume: it exists! */
 		if ((erlang_file_fd < 0) && do_create && (errno == ENOENT)) {
 			erlang_file_fd =
@@ -338,7 +477,16 @@ static struct erlangline *erlang_findline(const char *portname,
 
 		E = ErlangLines[ErlangLinesCount - 1];	/* Last one is the lattest.. */
 
+#ifdef ERLANGSTORAGE
+		/* A new line in the file is a hole full of zeros already,
+		   writing the history blocks would allocate them all */
+		if (erlang_data_is_nonshared)
+			memset(E, 0, sizeof(*E));
+		else
+			memset(E, 0, offsetof(struct erlangline, e1));
+#else
 		memset(E, 0, sizeof(*E));
+#endif
 		strncpy(E->name, portname, sizeof(E->name) - 1);
 		E->name[sizeof(E->name) - 1] = 0;
 
@@ -389,6 +537,76 @@ static void erlang_timer_init(void *dummy)
 }
 
 
+/*
+ *  Latency histograms, log-bucketed like HDR histograms:
+ *  values below 8 us have buckets of their own, and above that every
+ *  power of two is split in 4, so a bucket is at most 25% wide.
+ */
+
+const char *latency_names[LATENCY_STAGES] = {
+	"parse", "filter", "dupecheck", "viscous", "transmit", "aprsis"
+};
+
+int latency_bucket(const long usec)
+{
+	int msb = 0, shift, b;
+
+	if (usec < (2 << LATENCY_SUBBITS))
+		return usec < 0 ? 0 : usec;
+	while ((usec >> msb) > 1)
+		++msb;
+	shift = msb - LATENCY_SUBBITS;
+	b = (shift << LATENCY_SUBBITS) + (usec >> shift);
+	if (b >= LATENCY_BUCKETS)
+		b = LATENCY_BUCKETS - 1;
+	return b;
+}
+
+/* Smallest value in the bucket */
+long latency_bucket_low(const int b)
+{
+	int shift;
+
+	if (b < (2 << LATENCY_SUBBITS))
+		return b;
+	shift = (b >> LATENCY_SUBBITS) - 1;
+	return (long)((b & ((1 << LATENCY_SUBBITS) - 1)) + (1 << LATENCY_SUBBITS)) << shift;
+}
+
+/* Upper bound of the bucket where fraction p (0..1) of samples is reached */
+long latency_percentile(const struct erlang_latency *L, const double p)
+{
+	long want = (long)(p * L->samples + 0.5);
+	long sum = 0;
+	int b;
+
+	if (want < 1) want = 1;
+	for (b = 0; b < LATENCY_BUCKETS; ++b) {
+		sum += L->bucket[b];
+		if (sum >= want) {
+			long hi = latency_bucket_low(b + 1) - 1;
+			return (hi < L->max_us) ? hi : L->max_us;
+		}
+	}
+	return L->max_us;
+}
+
+void erlang_latency(const LatencyStage stage, const int64_t usec)
+{
+	struct erlang_latency *L;
+
+	if (ErlangHead == NULL || usec < 0)
+		return;
+	L = &ErlangHead->latency[stage];
+	erlang_write_begin(&ErlangHead->seq);
+	++L->samples;
+	L->sum_us += usec;
+	if (usec > L->max_us)
+		L->max_us = usec;
+	++L->bucket[latency_bucket(usec)];
+	erlang_write_end(&ErlangHead->seq);
+}
+
 /*
  *  erlang_set()
  */
@@ -397,6 +615,51 @@ void erlang_set(const char *portname, int bytes_per_minute)
 	erlang_findline(portname, bytes_per_minute);
 }
 
+/*
+ *  erlang_occupancy()  -- channel busy fraction of a port over the last
+ *			   full and the running erlang periods
+ */
+float erlang_occupancy(const char *portname)
+{
+	struct erlangline *E = NULL;
+	struct erlang_rxtxbytepkt R;
+	long bytes;
+	int i, k, elapsed, minutes;
+
+	for (i = 0; i < ErlangLinesCount; ++i) {
+		if (strcmp(portname, ErlangLines[i]->name) == 0) {
+			E = ErlangLines[i];
+			break;
+		}
+	}
+	if (E == NULL || E->erlang_capa <= 0)
+		return 0.0;
+
+#if (defined(ERLANGSTORAGE) || (USE_ONE_MINUTE_DATA == 1))
+	minutes = 1;
+	elapsed = 60 - (erlang_time_end_1min.tv_sec - tick.tv_sec);
+	bytes   = E->erl1m.bytes_rx + E->erl1m.bytes_tx;
+	k = (E->e1_cursor > 0 ? E->e1_cursor : E->e1_max) - 1;
+#else
+	minutes = 10;
+	elapsed = 600 - (erlang_time_end_10min.tv_sec - tick.tv_sec);
+	bytes   = E->erl10m.bytes_rx + E->erl10m.bytes_tx;
+	k = (E->e10_cursor > 0 ? E->e10_cursor : E->e10_max) - 1;
+#endif
+	if (elapsed < 0) elapsed = 0;
+	if (elapsed > minutes*60) elapsed = minutes*60;
+
+	/* The previous period, unless it is stale */
+	erlang_history_get(E, minutes, k, &R);
+	if (R.update != 0 && R.update >= tick.tv_sec - 2*60*minutes) {
+		bytes   += R.bytes_rx + R.bytes_tx;
+		elapsed += 60*minutes;
+	}
+	if (elapsed <= 0)
+		return 0.0;
+	return (float)bytes / (E->erlang_capa * elapsed / 60.0);
+}
+
 /*
  *  erlang_add()
  */
@@ -415,6 +678,8 @@ void erlang_add(const char *portname, ErlangMode erl, int bytes, int packets)
 	if (!E)
 		return;
 
+	erlang_write_begin(&E->seq);
+
 	if (erl == ERLANG_RX) {
 		E->SNMP.bytes_rx += bytes;
 		E->SNMP.packets_rx += packets;
@@ -505,6 +770,8 @@ void erlang_add(const char *portname, ErlangMode erl, int bytes, int packets)
 #endif
 #endif
 	}
+
+	erlang_write_end(&E->seq);
 }
 
 
@@ -561,14 +828,19 @@ static void erlang_time_end(void)
 					       msgbuf);
 			}
 
+			erlang_write_begin(&E->seq);
 			E->erl1m.update = tick.tv_sec;
-			E->e1[E->e1_cursor] = E->erl1m;
+			erlang_history_put(E, 1, E->e1_cursor, &E->erl1m);
+#if (USE_ONE_MINUTE_DATA == 1)
+			erlang_aggregate_add(E, &E->erl1m);
+#endif
 			++E->e1_cursor;
 			if (E->e1_cursor >= E->e1_max)
 				E->e1_cursor = 0;
 
 			memset(&E->erl1m, 0, sizeof(E->erl1m));
 			E->erl1m.update = tick.tv_sec;
+			erlang_write_end(&E->seq);
 		}
 		erlang_time_ival_1min = 1.0;
 #endif
@@ -603,13 +875,18 @@ static void erlang_time_end(void)
 			if (erlangsyslog)
 				syslog(LOG_INFO, "%ld %s", tick.tv_sec, msgbuf);
 
+			erlang_write_begin(&E->seq);
 			E->erl10m.update = tick.tv_sec;
-			E->e10[E->e10_cursor] = E->erl10m;
+			erlang_history_put(E, 10, E->e10_cursor, &E->erl10m);
+#if (USE_ONE_MINUTE_DATA != 1)
+			erlang_aggregate_add(E, &E->erl10m);
+#endif
 			++E->e10_cursor;
 			if (E->e10_cursor >= E->e10_max)
 				E->e10_cursor = 0;
 			memset(&E->erl10m, 0, sizeof(E->erl10m));
 			E->erl10m.update = tick.tv_sec;
+			erlang_write_end(&E->seq);
 		}
 		erlang_time_ival_10min = 1.0;
 #endif
@@ -644,14 +921,16 @@ static void erlang_time_end(void)
 			if (erlangsyslog)
 				syslog(LOG_INFO, "%ld %s", tick.tv_sec, msgbuf);
 
+			erlang_write_begin(&E->seq);
 			E->erl60m.update = tick.tv_sec;
-			E->e60[E->e60_cursor] = E->erl60m;
+			erlang_history_put(E, 60, E->e60_cursor, &E->erl60m);
 			++E->e60_cursor;
 			if (E->e60_cursor >= E->e60_max)
 				E->e60_cursor = 0;
 
 			memset(&E->erl60m, 0, sizeof(E->erl60m));
 			E->erl60m.update = tick.tv_sec;
+			erlang_write_end(&E->seq);
 		}
 		erlang_time_ival_60min = 1.0;
 	}
@@ -117,14 +117,14 @@ struct filter_refcallsign_t {
 struct filter_head_t {
 	struct filter_t *next;
 	const char *text; /* filter text as is		*/
-	float   f_latN, f_lonE;
+	int32_t latN, lonE;  /* microdegrees */
 	union {
-	  float   f_latS;   /* for A filter */
-	  float   f_coslat; /* for R filter */
+	  int32_t latS;   /* for A filter */
+	  int32_t coslat; /* for R filter, 16.16 fixed point */
 	} u1;
 	union {
-	  float   f_lonW; /* for A filter */
-	  float   f_dist; /* for R filter */
+	  int32_t lonW; /* for A filter */
+	  int32_t dist; /* for R filter, microdegrees of arc */
 	} u2;
 	time_t  hist_age;
 
@@ -224,14 +224,50 @@ int hist_lookup_interval = 20; /* FIXME: Configurable: Cache historydb
 				  each filter entry referring to some
 				  fixed callsign (f,m,t) */
 
-float filter_lat2rad(float lat)
+/*
+ *  Positions are carried around as integer microdegrees, and
+ *  cos(lat) as a 16.16 fixed point value from a lookup table, so
+ *  that parsing and filtering do not need floating point on routers
+ *  without FPU.
+ */
+
+/* cos() of 0..91 degrees, 16.16 fixed point */
+static const int32_t filter_costable[92] = {
+	65536, 65526, 65496, 65446, 65376, 65287, 65177, 65048, 64898, 64729,
+	64540, 64332, 64104, 63856, 63589, 63303, 62997, 62672, 62328, 61966,
+	61584, 61183, 60764, 60326, 59870, 59396, 58903, 58393, 57865, 57319,
+	56756, 56175, 55578, 54963, 54332, 53684, 53020, 52339, 51643, 50931,
+	50203, 49461, 48703, 47930, 47143, 46341, 45525, 44695, 43852, 42995,
+	42126, 41243, 40348, 39441, 38521, 37590, 36647, 35693, 34729, 33754,
+	32768, 31772, 30767, 29753, 28729, 27697, 26656, 25607, 24550, 23486,
+	22415, 21336, 20252, 19161, 18064, 16962, 15855, 14742, 13626, 12505,
+	11380, 10252,  9121,  7987,  6850,  5712,  4572,  3430,  2287,  1144,
+	    0, -1144
+};
+
+/* cos(lat) by linear interpolation in the table, error is below 4E-5 */
+int32_t filter_coslat(const int32_t lat)
 {
-	return (lat * (M_PI / 180.0));
+	uint32_t a = (lat < 0) ? -lat : lat;
+	uint32_t i = a / 1000000;
+	uint32_t frac = a % 1000000;
+	int32_t c0, c1;
+
+	if (i > 90) return 0;
+	c0 = filter_costable[i];
+	c1 = filter_costable[i+1];
+	return c0 - (int32_t)(((int64_t)(c0 - c1) * frac) / 1000000);
 }
 
-float filter_lon2rad(float lon)
+int32_t filter_deg2micro(const double deg)
 {
-	return (lon * (M_PI / 180.0));
+	return (int32_t)(deg * 1000000.0 + ((deg < 0.0) ? -0.5 : 0.5));
+}
+
+/* Kilometers to microdegrees of great circle arc, 111.2 km per degree */
+static int32_t filter_km2micro(const double km)
+{
+	return (int32_t)(km * (1000000.0 / 111.2) + ((km < 0.0) ? -0.5 : 0.5));
 }
 
 
@@ -988,6 +1024,7 @@ int filter_parse(struct filter_t **ffp, const char *filt)
 	const char *filt0 = filt;
 	const char *s;
 	char dummyc, dummy2;
+	double latN, lonE, latS, lonW, dist;
 	struct filter_t *ff, *f;
 
 	ff = *ffp;
@@ -1018,9 +1055,8 @@ int filter_parse(struct filter_t **ffp, const char *filt)
 
 		f0.h.type = 'a'; // inside area
 
-		i = sscanf(filt+1, "/%f/%f/%f/%f%c%c",
-			   &f0.h.f_latN, &f0.h.u2.f_lonW,
-			   &f0.h.u1.f_latS, &f0.h.f_lonE, &dummyc, &dummy2);
+		i = sscanf(filt+1, "/%lf/%lf/%lf/%lf%c%c",
+			   &latN, &lonW, &latS, &lonE, &dummyc, &dummy2);
 
 		if (i == 6 && dummyc == '/' && dummy2 == '-') {
 			i = 4;
@@ -1041,52 +1077,51 @@ int filter_parse(struct filter_t **ffp, const char *filt)
 		  return -1;
 		}
 
-		if (!( -90.01 < f0.h.f_latN && f0.h.f_latN <  90.01)) {
+		if (!( -90.01 < latN && latN <  90.01)) {
 		  // hlog(LOG_DEBUG, "Bad filter latN value: %s", filt0);
 		  if (debug)
 		    printf("Bad filter latN value: %s", filt0);
 		  return -2;
 		}
-		if (!(-180.01 < f0.h.u2.f_lonW && f0.h.u2.f_lonW < 180.01)) {
+		if (!(-180.01 < lonW && lonW < 180.01)) {
 		  // hlog(LOG_DEBUG, "Bad filter lonW value: %s", filt0);
 		  if (debug)
 		    printf("Bad filter lonW value: %s", filt0);
 		  return -2;
 		}
-		if (!( -90.01 < f0.h.u1.f_latS && f0.h.u1.f_latS <  90.01)) {
+		if (!( -90.01 < latS && latS <  90.01)) {
 		  // hlog(LOG_DEBUG, "Bad filter latS value: %s", filt0);
 		  if (debug)
 		    printf("Bad filter latS value: %s", filt0);
 		  return -2;
 		}
-		if (!(-180.01 < f0.h.f_lonE && f0.h.f_lonE < 180.01)) {
+		if (!(-180.01 < lonE && lonE < 180.01)) {
 		  // hlog(LOG_DEBUG, "Bad filter lonE value: %s", filt0);
 		  if (debug)
 		    printf("Bad filter lonE value: %s", filt0);
 		  return -2;
 		}
 
-		if (f0.h.u2.f_lonW > f0.h.f_lonE) {
+		// hlog(LOG_DEBUG, "Filter: %s -> A %.3f %.3f %.3f %.3f", filt0, latN, lonW, latS, lonE);
+
+		f0.h.latN    = filter_deg2micro(latN);
+		f0.h.u2.lonW = filter_deg2micro(lonW);
+		f0.h.u1.latS = filter_deg2micro(latS);
+		f0.h.lonE    = filter_deg2micro(lonE);
+
+		if (f0.h.u2.lonW > f0.h.lonE) {
 		  // wrong way, swap longitudes
-		  float t = f0.h.u2.f_lonW;
-		  f0.h.u2.f_lonW = f0.h.f_lonE;
-		  f0.h.f_lonE = t;
+		  int32_t t = f0.h.u2.lonW;
+		  f0.h.u2.lonW = f0.h.lonE;
+		  f0.h.lonE = t;
 		}
-		if (f0.h.u1.f_latS > f0.h.f_latN) {
+		if (f0.h.u1.latS > f0.h.latN) {
 		  // wrong way, swap latitudes
-		  float t = f0.h.u1.f_latS;
-		  f0.h.u1.f_latS = f0.h.f_latN;
-		  f0.h.f_latN = t;
+		  int32_t t = f0.h.u1.latS;
+		  f0.h.u1.latS = f0.h.latN;
+		  f0.h.latN = t;
 		}
 
-		// hlog(LOG_DEBUG, "Filter: %s -> A %.3f %.3f %.3f %.3f", filt0, f0.h.f_latN, f0.h.f_lonW, f0.h.f_latS, f0.h.f_lonE);
-		
-		f0.h.f_latN    = filter_lat2rad(f0.h.f_latN);
-		f0.h.u2.f_lonW = filter_lon2rad(f0.h.u2.f_lonW);
-		
-		f0.h.u1.f_latS = filter_lat2rad(f0.h.u1.f_latS);
-		f0.h.f_lonE    = filter_lon2rad(f0.h.f_lonE);
-
 		break;
 
 	case 'b':
@@ -1129,10 +1164,10 @@ int filter_parse(struct filter_t **ffp, const char *filt)
 	case 'F':
 		/*  f/call/dist         Friend's range filter  */
 
-		i = sscanf(filt+1, "/%9[^/]/%f", f0.h.u5.refcallsign.callsign, &f0.h.u2.f_dist);
+		i = sscanf(filt+1, "/%9[^/]/%lf", f0.h.u5.refcallsign.callsign, &dist);
 		// negative distance means "outside this range."
 		// and makes most sense with overall negative filter!
-		if (i != 2 || (-0.1 < f0.h.u2.f_dist && f0.h.u2.f_dist < 0.1)) {
+		if (i != 2 || (-0.1 < dist && dist < 0.1)) {
 		  // hlog(LOG_DEBUG, "Bad filter parse: %s", filt0);
 		  if (debug)
 		    printf("Bad filter parse: %s", filt0);
@@ -1141,9 +1176,10 @@ int filter_parse(struct filter_t **ffp, const char *filt)
 
 		f0.h.u5.refcallsign.callsign[CALLSIGNLEN_MAX] = 0;
 		f0.h.u5.refcallsign.reflen = strlen(f0.h.u5.refcallsign.callsign);
+		f0.h.u2.dist = filter_km2micro(dist);
 		f0.h.u3.numnames = 0; /* reusing this as "position-cache valid" flag */
 
-		// hlog(LOG_DEBUG, "Filter: %s -> F xxx %.3f", filt0, f0.h.u2.f_dist);
+		// hlog(LOG_DEBUG, "Filter: %s -> F xxx %.3f", filt0, dist);
 
 		/* NOTE: Could do static location resolving at connect time, 
 		** and then use the same way as 'r' range does.  The friends
@@ -1172,20 +1208,21 @@ int filter_parse(struct filter_t **ffp, const char *filt)
                 }
                 
                 f0.h.type = 'r'; // internal implementation at Aprx is a RANGE filter.
-                f0.h.f_latN      = myloc_lat; // radians
-                f0.h.f_lonE      = myloc_lon; // radians
-                f0.h.u1.f_coslat = myloc_coslat;
+                f0.h.latN      = myloc_lat; // microdegrees
+                f0.h.lonE      = myloc_lon;
+                f0.h.u1.coslat = myloc_coslat;
 
-		i = sscanf(filt+1, "/%f", &f0.h.u2.f_dist);
-		if (i != 1 || f0.h.u2.f_dist < 0.1) {
+		i = sscanf(filt+1, "/%lf", &dist);
+		if (i != 1 || dist < 0.1) {
 		  // hlog(LOG_DEBUG, "Bad filter parse: %s", filt0);
 		  if (debug)
 		    printf("Bad filter parse: %s", filt0);
 		  return -1;
 		}
+		f0.h.u2.dist = filter_km2micro(dist);
 		f0.h.u3.numnames = 0; /* reusing this as "position-cache valid" flag */
 
-		// hlog(LOG_DEBUG, "Filter: %s -> M %.3f", filt0, f0.h.u2.f_dist);
+		// hlog(LOG_DEBUG, "Filter: %s -> M %.3f", filt0, dist);
 		break;
 
 	case 'o':
@@ -1285,36 +1322,36 @@ int filter_parse(struct filter_t **ffp, const char *filt)
 	case 'R':
 		/*  r/lat/lon/dist            Range filter  */
 
-		i = sscanf(filt+1, "/%f/%f/%f",
-			 &f0.h.f_latN, &f0.h.f_lonE, &f0.h.u2.f_dist);
+		i = sscanf(filt+1, "/%lf/%lf/%lf", &latN, &lonE, &dist);
 		// negative distance means "outside this range."
 		// and makes most sense with overall negative filter!
-		if (i != 3 || (-0.1 < f0.h.u2.f_dist && f0.h.u2.f_dist < 0.1)) {
+		if (i != 3 || (-0.1 < dist && dist < 0.1)) {
 		  // hlog(LOG_DEBUG, "Bad filter parse: %s", filt0);
 		  if (debug)
 		    printf("Bad filter parse: %s", filt0);
 		  return -1;
 		}
 
-		if (!( -90.01 < f0.h.f_latN && f0.h.f_latN <  90.01)) {
+		if (!( -90.01 < latN && latN <  90.01)) {
 		  // hlog(LOG_DEBUG, "Bad filter lat value: %s", filt0);
 		  if (debug)
 		    printf("Bad filter lat value: %s", filt0);
 		  return -2;
 		}
-		if (!(-180.01 < f0.h.f_lonE && f0.h.f_lonE < 180.01)) {
+		if (!(-180.01 < lonE && lonE < 180.01)) {
 		  // hlog(LOG_DEBUG, "Bad filter lon value: %s", filt0);
 		  if (debug)
 		    printf("Bad filter lon value: %s", filt0);
 		  return -2;
 		}
 
-		// hlog(LOG_DEBUG, "Filter: %s -> R %.3f %.3f %.3f", filt0, f0.h.f_latN, f0.h.f_lonE, f0.h.u2.f_dist);
+		// hlog(LOG_DEBUG, "Filter: %s -> R %.3f %.3f %.3f", filt0, latN, lonE, dist);
 
-		f0.h.f_latN = filter_lat2rad(f0.h.f_latN);
-		f0.h.f_lonE = filter_lon2rad(f0.h.f_lonE);
+		f0.h.latN = filter_deg2micro(latN);
+		f0.h.lonE = filter_deg2micro(lonE);
+		f0.h.u2.dist = filter_km2micro(dist);
 
-		f0.h.u1.f_coslat = cosf( f0.h.f_latN ); /* Store pre-calculated COS of LAT */
+		f0.h.u1.coslat = filter_coslat(f0.h.latN); /* Store pre-calculated COS of LAT */
 		break;
 
 	case 's':
@@ -1397,10 +1434,10 @@ int filter_parse(struct filter_t **ffp, const char *filt)
 			}
 		}
 		if (*s == '/' && s[1] != 0) { /* second format */
-			i = sscanf(s, "/%9[^/]/%f%c", f0.h.u5.refcallsign.callsign, &f0.h.u2.f_dist, &dummyc);
+			i = sscanf(s, "/%9[^/]/%lf%c", f0.h.u5.refcallsign.callsign, &dist, &dummyc);
 			// negative distance means "outside this range."
 			// and makes most sense with overall negative filter!
-			if ( i != 2 || (-0.1 < f0.h.u2.f_dist && f0.h.u2.f_dist < 0.1) || /* 0.1 km minimum radius */
+			if ( i != 2 || (-0.1 < dist && dist < 0.1) || /* 0.1 km minimum radius */
 			     strlen(f0.h.u5.refcallsign.callsign) < CALLSIGNLEN_MIN ) {
 			  // hlog(LOG_DEBUG, "Bad filter parse: %s", filt0);
 			  if (debug)
@@ -1409,6 +1446,7 @@ int filter_parse(struct filter_t **ffp, const char *filt)
 			}
 			f0.h.u5.refcallsign.callsign[CALLSIGNLEN_MAX] = 0;
 			f0.h.u5.refcallsign.reflen = strlen(f0.h.u5.refcallsign.callsign);
+			f0.h.u2.dist = filter_km2micro(dist);
 			f0.h.type = 'T'; /* two variants... */
 		}
 
@@ -1538,6 +1576,68 @@ static float maidenhead_km_distance(float lat1, float coslat1, float lon1, float
 	return ((111.2 * 180.0 / M_PI) * c);
 }
 
+#define MICRO2RAD(x) ((float)(x) * (float)(M_PI / 180000000.0))
+
+/*
+ *  Compare distance between two positions against a range, all in
+ *  microdegrees.  Returns <0 when the distance is less than the range,
+ *  >0 when it is more.
+ *
+ *  Up to 1000 km the flat-earth approximation with mean cos(lat) is
+ *  within 0.01 + 0.08*range_degrees^2 percent of the great circle
+ *  distance, and only positions falling into that margin around
+ *  the range need the floating point haversine formula.
+ */
+
+static int filter_range_cmp(const int32_t lat1, const int32_t coslat1, const int32_t lon1,
+			    const int32_t lat2, const int32_t coslat2, const int32_t lon2,
+			    const int32_t range)
+{
+	int64_t dlat, dlon, x, d2, r2, slack;
+	float r;
+
+	if (range <= 9000000 &&
+	    lat1 > -80000000 && lat1 < 80000000 &&
+	    lat2 > -80000000 && lat2 < 80000000) {
+
+		dlat = lat2 - lat1;
+		dlon = lon2 - lon1;
+		if (dlon >  180000000) dlon -= 360000000;
+		if (dlon < -180000000) dlon += 360000000;
+		x = (dlon * (coslat1 + coslat2)) >> 17; /* mean of two 16.16 */
+
+		d2 = x * x + dlat * dlat;
+		r2 = (int64_t)range * range;
+		slack = r2 / 5000 + ((r2 / 1000000) * (r2 / 1000000) * 16) / 10000;
+
+		if (d2 < r2 - slack) return -1;
+		if (d2 > r2 + slack) return  1;
+	}
+
+	r = maidenhead_km_distance(MICRO2RAD(lat1), coslat1 / 65536.0F, MICRO2RAD(lon1),
+				   MICRO2RAD(lat2), coslat2 / 65536.0F, MICRO2RAD(lon2));
+	r = r * (1000000.0F / 111.2F);
+	if (debug) printf("filter_range_cmp: haversine %.0f vs range %d\n", r, range);
+	return (r < range) ? -1 : (r > range) ? 1 : 0;
+}
+
+/* Range filter match on a position, negative range means "outside of" */
+static int filter_range_match(const struct filter_t *f,
+			      const int32_t lat1, const int32_t coslat1, const int32_t lon1,
+			      const struct pbuf_t *pb)
+{
+	const int32_t range = f->h.u2.dist;
+
+	if (range < 0) {
+		// Test for _outside_ the range
+		return filter_range_cmp(lat1, coslat1, lon1,
+					pb->lat, pb->cos_lat, pb->lng, -range) > 0;
+	}
+	// Test for _inside_ the range
+	return filter_range_cmp(lat1, coslat1, lon1,
+				pb->lat, pb->cos_lat, pb->lng, range) < 0;
+}
+
 
 /*
  *
@@ -1566,10 +1666,10 @@ static int filter_process_one_a(struct pbuf_t *pb, struct filter_t *f)
 	if (!(pb->flags & F_HASPOS)) /* packet with a position.. (msgs with RECEIVER's position) */
 		return 0;
 
-	if ((pb->lat <= f->h.f_latN) &&
-	    (pb->lat >= f->h.u1.f_latS) &&
-	    (pb->lng <= f->h.f_lonE) && /* East POSITIVE ! */
-	    (pb->lng >= f->h.u2.f_lonW)) {
+	if ((pb->lat <= f->h.latN) &&
+	    (pb->lat >= f->h.u1.latS) &&
+	    (pb->lng <= f->h.lonE) && /* East POSITIVE ! */
+	    (pb->lng >= f->h.u2.lonW)) {
 		/* Inside the box */
 		return f->h.negation ? 2 : 1;
 	} else if (f->h.type == 'A') {
@@ -1706,10 +1806,6 @@ static int filter_process_one_f(struct pbuf_t *pb, struct filter_t *f, historydb
 
 	history_cell_t *history;
 
-	float r;
-	float lat1, lon1, coslat1;
-	float lat2, lon2, coslat2;
-
 	const char *callsign = f->h.u5.refcallsign.callsign;
 	int i                = f->h.u5.refcallsign.reflen;
 
@@ -1727,35 +1823,17 @@ static int filter_process_one_f(struct pbuf_t *pb, struct filter_t *f, historydb
 		  return 0; /* no lookup result.. */
 		}
 		f->h.u3.numnames = 1;
-		f->h.f_latN   = history->lat;
-		f->h.f_lonE   = history->lon;
-		f->h.u1.f_coslat = history->coslat;
+		f->h.latN      = history->lat;
+		f->h.lonE      = history->lon;
+		f->h.u1.coslat = history->coslat;
 	}
 	if (!f->h.u3.numnames) {
 	  if (debug) printf("f-filter: no history lookup result (numnames == 0) -> return 0\n");
 	  return 0; /* histdb lookup cache invalid */
 	}
 
-	lat1    = f->h.f_latN;
-	lon1    = f->h.f_lonE;
-	coslat1 = f->h.u1.f_coslat;
-
-	lat2    = pb->lat;
-	lon2    = pb->lng;
-	coslat2 = pb->cos_lat;
-
-	r = maidenhead_km_distance(lat1, coslat1, lon1, lat2, coslat2, lon2);
-	if (debug) printf("f-filter: r=%.1f km\n", r);
-
-	if (f->h.u2.f_dist < 0.0) {
-		// Test for _outside_ the range
-		if (r > -f->h.u2.f_dist)  /* Range is more than given limit */
-			return (f->h.negation) ? 2 : 1;
-	} else {
-		// Test for _inside_ the range
-		if (r < f->h.u2.f_dist)  /* Range is less than given limit */
-			return (f->h.negation) ? 2 : 1;
-	}
+	if (filter_range_match(f, f->h.latN, f->h.u1.coslat, f->h.lonE, pb))
+		return (f->h.negation) ? 2 : 1;
 
 	return 0;
 }
@@ -1807,26 +1885,11 @@ static int filter_process_one_m(struct pbuf_t *pb, struct filter_t *f)
            At Aprx: Implemented using Range filter, and prepared at parse time..
 	*/
 
-	float lat2, lon2, coslat2;
-	float r;
-
 	if (!(pb->flags & F_HASPOS)) /* packet with a position.. (msgs with RECEIVER's position) */
 		return 0;
 
-	lat2    = pb->lat;
-	lon2    = pb->lng;
-	coslat2 = pb->cos_lat;
-
-	r = maidenhead_km_distance(myloc_lat, myloc_coslat, myloc_lon, lat2, coslat2, lon2);
-	if (f->h.u2.f_dist < 0.0) {
-		// Test for _outside_ the range
-		if (r > -f->h.u2.f_dist)  /* Range is more than given limit */
-			return (f->h.negation) ? 2 : 1;
-	} else {
-		// Test for _inside_ the range
-		if (r < f->h.u2.f_dist)  /* Range is less than given limit */
-			return (f->h.negation) ? 2 : 1;
-	}
+	if (filter_range_match(f, myloc_lat, myloc_coslat, myloc_lon, pb))
+		return (f->h.negation) ? 2 : 1;
 
 	return 0;
 }
@@ -1986,34 +2049,14 @@ static int filter_process_one_r(struct pbuf_t *pb, struct filter_t *f)
 	   Up to 5200 invocations per second at peak.
 	*/
 
-	float lat1    = f->h.f_latN;
-	float lon1    = f->h.f_lonE;
-	float coslat1 = f->h.u1.f_coslat;
-	float r;
-
-	float lat2, lon2, coslat2;
-
 	if (!(pb->flags & F_HASPOS)) {
 	  /* packet with a position..
 	     (msgs with RECEIVER's position) */
 		return 0;
 	}
 
-	lat2    = pb->lat;
-	lon2    = pb->lng;
-	coslat2 = pb->cos_lat;
-
-	r = maidenhead_km_distance(lat1, coslat1, lon1, lat2, coslat2, lon2);
-
-	if (f->h.u2.f_dist < 0.0) {
-		// Test for _outside_ the range
-		if (r > -f->h.u2.f_dist)  /* Range is more than given limit */
-			return (f->h.negation) ? 2 : 1;
-	} else {
-		// Test for _inside_ the range
-		if (r < f->h.u2.f_dist)  /* Range is less than given limit */
-			return (f->h.negation) ? 2 : 1;
-	}
+	if (filter_range_match(f, f->h.latN, f->h.u1.coslat, f->h.lonE, pb))
+		return (f->h.negation) ? 2 : 1;
 
 	return 0;
 }
@@ -2132,9 +2175,6 @@ static int filter_process_one_t(struct pbuf_t *pb, struct filter_t *f, historydb
 	if (rc && f->h.type == 'T') { /* Within a range of callsign ?
 				       * Rather rare..  perhaps 2-3 in APRS-IS.
 				       */
-		float range, r;
-		float lat1, lon1, coslat1;
-		float lat2, lon2, coslat2;
 #ifndef DISABLE_IGATE
 		const char *callsign    = f->h.u5.refcallsign.callsign;
 		const int   callsignlen = f->h.u5.refcallsign.reflen;
@@ -2146,8 +2186,6 @@ static int filter_process_one_t(struct pbuf_t *pb, struct filter_t *f, historydb
 		if (!(pb->flags & F_HASPOS)) /* packet with a position.. (msgs with RECEIVER's position) */
 			return 0; /* No positional data.. */
 
-		range = f->h.u2.f_dist;
-
 		/* So..  Now we have a callsign, and we have range.
 		   Lets find callsign's location, and range to that item..
 		   .. 60-100 lookups per second. */
@@ -2164,32 +2202,15 @@ static int filter_process_one_t(struct pbuf_t *pb, struct filter_t *f, historydb
 			if (!history) return 0; /* no lookup result.. */
 			f->h.u3.numnames = 1;
 			f->h.hist_age = tick.tv_sec + hist_lookup_interval;
-			f->h.f_latN   = history->lat;
-			f->h.f_lonE   = history->lon;
-			f->h.u1.f_coslat = history->coslat;
+			f->h.latN      = history->lat;
+			f->h.lonE      = history->lon;
+			f->h.u1.coslat = history->coslat;
 		}
 #endif
 		if (!f->h.u3.numnames) return 0; /* No valid data at range center position cache */
 
-		lat1    = f->h.f_latN;
-		lon1    = f->h.f_lonE;
-		coslat1 = f->h.u1.f_coslat;
-
-		lat2    = pb->lat;
-		lon2    = pb->lng;
-		coslat2 = pb->cos_lat;
-
-		r = maidenhead_km_distance(lat1, coslat1, lon1, lat2, coslat2, lon2);
-
-		if (range < 0.0) {
-			// Test for _outside_ the range
-			if (r > -range)  /* Range is more than given limit */
-				return (f->h.negation) ? 2 : 1;
-		} else {
-			// Test for _inside_ the range
-			if (r < range)  /* Range is less than given limit */
-				return (f->h.negation) ? 2 : 1;
-		}
+		if (filter_range_match(f, f->h.latN, f->h.u1.coslat, f->h.lonE, pb))
+			return (f->h.negation) ? 2 : 1;
 
 		return 0; /* unimplemented! */
 	}
@@ -2321,6 +2342,9 @@ int filter_process(struct pbuf_t *pb, struct filter_t *f, historydb_t *historydb
 {
 	int seen_accept = 0;
 
+	if (f != NULL && pb->is_aprs)
+		parse_aprs_level(pb, historydb, PARSE_POSITION);
+
 	for ( ; f; f = f->h.next ) {
 		int rc = filter_process_one(pb, f, historydb);
 		/* no reports to user about bad filters.. */
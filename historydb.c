@@ -116,7 +116,7 @@ void historydb_dump_entry(FILE *fp, const struct history_cell_t *hp)
 	(void)fwrite(hp->key, hp->keylen, 1, fp);
 	fprintf(fp, "\t");
 	fprintf(fp, "%d\t%d\t", hp->packettype, hp->flags);
-	fprintf(fp, "%f\t%f\t", hp->lat, hp->lon);
+	fprintf(fp, "%.6f\t%.6f\t", hp->lat / 1000000.0, hp->lon / 1000000.0);
 	fprintf(fp, "%d\t", hp->packetlen);
 	(void)fwrite(hp->packet, hp->packetlen, 1, fp);
 	fprintf(fp, "\n"); /* newline */
@@ -147,12 +147,12 @@ static int foldhash( const unsigned int h1 )
 
 /* insert... */
 
-history_cell_t *historydb_insert(historydb_t *db, const struct pbuf_t *pb)
+history_cell_t *historydb_insert(historydb_t *db, struct pbuf_t *pb)
 {
 	return historydb_insert_(db, pb, 0);
 }
 
-history_cell_t *historydb_insert_(historydb_t *db, const struct pbuf_t *pb, const int insertall)
+history_cell_t *historydb_insert_(historydb_t *db, struct pbuf_t *pb, const int insertall)
 {
 	int i;
 	unsigned int h1;
@@ -169,6 +169,9 @@ history_cell_t *historydb_insert_(historydb_t *db, const struct pbuf_t *pb, cons
 	//                            a position information was supplemented
 	//                            to it via historydb lookup
 
+	// Only the type may have been parsed so far
+	parse_aprs_level(pb, db, PARSE_TYPE);
+
 	if (!insertall && !(pb->packettype & T_POSITION)) {  // <-- packet has position data
 		++db->historydb_noposcount;
 		historydb_nopos(); /* debug thing -- profiling counter */
@@ -247,6 +250,10 @@ history_cell_t *historydb_insert_(historydb_t *db, const struct pbuf_t *pb, cons
 	}
 	keylen = strlen(keybuf);
 
+	// Now the position data is needed, when the packet has any
+	if (pb->packettype & (T_POSITION|T_OBJECT|T_ITEM|T_MESSAGE))
+		parse_aprs_level(pb, db, PARSE_POSITION);
+
 	++db->historydb_inserts;
 
 	h1 = keyhash(keybuf, keylen, 0);
@@ -357,7 +364,7 @@ history_cell_t *historydb_insert_(historydb_t *db, const struct pbuf_t *pb, cons
 	return *hp;
 }
 
-history_cell_t *historydb_insert_heard(historydb_t *db, const struct pbuf_t *pb)
+history_cell_t *historydb_insert_heard(historydb_t *db, struct pbuf_t *pb)
 {
 	int i;
 	unsigned int h1;
@@ -382,6 +389,9 @@ history_cell_t *historydb_insert_heard(historydb_t *db, const struct pbuf_t *pb)
 
 	keybuf[CALLSIGNLEN_MAX+1] = 0;
 
+	// Only the type may have been parsed so far
+	parse_aprs_level(pb, db, PARSE_TYPE);
+
 	if (pb->packettype & T_OBJECT) {
 	  historydb_nointerest(); // debug thing -- a profiling counter
 	  if (debug > 1) printf(" .. objects not interested\n");
@@ -415,6 +425,9 @@ history_cell_t *historydb_insert_heard(historydb_t *db, const struct pbuf_t *pb)
 	}
 	keylen = strlen(keybuf);
 
+	// Now the position data is needed
+	parse_aprs_level(pb, db, PARSE_POSITION);
+
 	++db->historydb_inserts;
 
 	h1 = keyhash(keybuf, keylen, 0);
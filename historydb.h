@@ -60,7 +60,7 @@ typedef struct history_cell_t {
 	uint8_t	     keylen;
 	char         key[CALLSIGNLEN_MAX+2];
 
-	float	lat, coslat, lon;
+	int32_t	lat, coslat, lon; /* microdegrees, cos(lat) 16.16 */
 	uint32_t hash1;
 
 	char *packet;
@@ -93,9 +93,9 @@ extern int  historydb_prepoll(struct aprxpolls *app);
 extern int  historydb_postpoll(struct aprxpolls *app);
 
 /* insert and lookup... */
-extern history_cell_t *historydb_insert(historydb_t *db, const struct pbuf_t*);
-extern history_cell_t *historydb_insert_(historydb_t *, const struct pbuf_t *, const int);
-extern history_cell_t *historydb_insert_heard(historydb_t *db, const struct pbuf_t*);
+extern history_cell_t *historydb_insert(historydb_t *db, struct pbuf_t*);
+extern history_cell_t *historydb_insert_(historydb_t *, struct pbuf_t *, const int);
+extern history_cell_t *historydb_insert_heard(historydb_t *db, struct pbuf_t*);
 extern history_cell_t *historydb_lookup(historydb_t *db, const char *keybuf, const int keylen);
 
 #endif
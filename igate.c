@@ -296,6 +296,8 @@ redo_frame_filter:;
 	/* _NO_ ending CRLF, the APRSIS subsystem adds it. */
 
 	discard = aprsis_queue(tp, tnc2addrlen, qTYPE_IGATED, portname, t0, e - t0); /* Send it.. */
+	if (discard == 0)
+		erlang_latency(LATENCY_APRSIS, latency_now() - latency_rxstamp);
 	/* DEBUG OUTPUT TO STDOUT ! */
 	verblog(portname, 0, tp, tnc2len);
 
@@ -465,6 +467,8 @@ void igate_from_aprsis(const char *ax25, int ax25len)
 	  return;
         }
 
+	latency_rxstamp = latency_now();
+
 	if (ax25len > 520) {
 	  /* Way too large a frame... */
 	  if (debug)printf("APRSIS dataframe length is too large! (%d)\n",ax25len);
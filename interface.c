@@ -74,7 +74,8 @@ struct aprx_interface aprsis_interface = {
 	NULL,
 #endif
 	NULL,
-	0, NULL
+	0, NULL,
+	NULL
 };
 
 int interface_is_beaconable(const struct aprx_interface *aif)
@@ -166,6 +167,7 @@ static void interface_store(struct aprx_interface *aif)
 
 	// Init the interface specific Erlang accounting
 	erlang_add(aif->callsign, ERLANG_RX, 0, 0);
+	txsched_attach(aif);
 
 	all_interfaces_count += 1;
 	all_interfaces = realloc(all_interfaces,
@@ -412,6 +414,7 @@ static int config_kiss_subif(struct configfile *cf, struct aprx_interface *aifp,
         // aif->telemeter_newformat = ...
 	aif->ifindex  = -1; // system sets automatically at store time
 	aif->ifgroup  = ifgroup; // either user sets, or system sets at store time
+	aif->txs      = NULL; // parent's tx-budget is cloned at store time
 
         aifp->tty->interface  [subif] = aif;
         aifp->tty->ttycallsign[subif] = callsign;
@@ -773,6 +776,14 @@ int interface_config(struct configfile *cf)
 		    }
 		  }
 
+		} else if (strcmp(name, "tx-budget") == 0) {
+		  if (txsched_config(aif, param1, str)) {
+		    printf("%s:%d ERROR: Bad TX-BUDGET parameters: '%s %s' accepted: 1 to 100 percent [of 300 bps or more]\n",
+			   cf->name, cf->linenum, param1, str);
+		    have_fault = 1;
+		    continue;
+		  }
+
 		} else if (strcmp(name, "telem-to-is") == 0) {
                   int bool;
 		  if (!config_parse_boolean(param1, &bool)) {
@@ -932,6 +943,9 @@ int interface_config(struct configfile *cf)
 		  for (i = 0; i < maxsubif; ++i) {
 		    if (aif->tty->interface[i] != NULL) {
                       if (debug) printf(" .. store interface[%d] callsign='%s'\n",i, aif->tty->interface[i]->callsign);
+		      // tx-budget may be anywhere in the <interface> block
+		      if (aif->tty->interface[i] != aif)
+		        aif->tty->interface[i]->txs = txsched_clone(aif->txs);
 		      interface_store(aif->tty->interface[i]);
 		    }
 		  }
@@ -1018,7 +1032,7 @@ void interface_receive_ax25(const struct aprx_interface *aif,
 				axaddrlen, axbuf, axlen);
 		if (pb == NULL) return;
 		pb->source_if_group = aif->ifgroup;
-		parse_aprs(pb, historydb);
+		parse_aprs_level(pb, historydb, PARSE_TYPE); // historydb parses further if needed
 		historydb_insert_heard(historydb, pb);
 		pbuf_put(pb);
 		return; // No receivers for this source
@@ -1058,13 +1072,17 @@ void interface_receive_ax25(const struct aprx_interface *aif,
 
 		// If APRS packet, then parse for APRS meaning ...
 		if (is_aprs) {
-			int rc = parse_aprs(pb,
+			int64_t t0 = latency_now();
+			// Just the type now, filters and historydb ask for more
+			int rc = parse_aprs_level(pb,
 #ifndef DISABLE_IGATE
 					historydb
 #else
 					NULL
 #endif
-					); // don't look inside 3rd party
+					, PARSE_TYPE); // don't look inside 3rd party
+			int64_t t1 = latency_now();
+			erlang_latency(LATENCY_PARSE, t1 - t0);
 			char *srcif = aif->callsign;
 			if (debug)
 				printf(".. parse_aprs() rc=%s  type=0x%02x  srcif=%s  tnc2addr='%s'  info_start='%s'\n",
@@ -1081,6 +1099,7 @@ void interface_receive_ax25(const struct aprx_interface *aif,
 							NULL
 #endif
 							);
+				erlang_latency(LATENCY_FILTER, latency_now() - t1);
 				// filter_discard > 0: accept
 				// filter_discard = 0: indifferent (not reject, not accept), tx-igate rules as is.
 				// filter_discard < 0: reject
@@ -1119,24 +1138,42 @@ void interface_receive_ax25(const struct aprx_interface *aif,
  * Process AX.25 packet transmit; beacons, digi output, igate output...
  *
  *   - aif:    output interface
+ *   - prio:   traffic class for the transmit scheduler
+ *   - t_arrival: latency_now() at reception of a relayed frame, or 0
  *   - axaddr: ax.25 address
  *   - axdata: payload content, with control and PID bytes prefixing them
  */
 
-void interface_transmit_ax25(const struct aprx_interface *aif, uint8_t *axaddr, const int axaddrlen, const char *axdata, const int axdatalen)
+void interface_transmit_ax25(const struct aprx_interface *aif, const TxPriority prio, const int64_t t_arrival, uint8_t *axaddr, const int axaddrlen, const char *axdata, const int axdatalen)
 {
 	int axlen = axaddrlen + axdatalen;
-	uint8_t *axbuf;
 
 	if (debug) {
 	  const char *callsign = "";
 	  if (aif != NULL) callsign=aif->callsign;
-	  printf("interface_transmit_ax25(aif=%p[%s], .., axlen=%d)\n",
-		 aif, callsign, axlen);
+	  printf("interface_transmit_ax25(aif=%p[%s], %s, .., axlen=%d)\n",
+		 aif, callsign, txprio_names[prio], axlen);
 	}
 	if (axlen == 0) return;
 	if (aif == NULL) return;
 
+	txsched_submit(aif, prio, t_arrival, axaddr, axaddrlen, axdata, axdatalen);
+}
+
+/*
+ * Put AX.25 packet on air right away, called by the transmit scheduler.
+ */
+
+void interface_transmit_now(const struct aprx_interface *aif, uint8_t *axaddr, const int axaddrlen, const char *axdata, const int axdatalen)
+{
+	int axlen = axaddrlen + axdatalen;
+	uint8_t *axbuf;
+
+	if (simulate_active) {
+		// Nothing goes on air, but the channel time is accounted
+		erlang_add(aif->callsign, ERLANG_TX, axlen + 10, 1);
+		return;
+	}
 
 	switch (aif->iftype) {
 	case IFTYPE_SERIAL:
@@ -1337,7 +1374,7 @@ void interface_receive_3rdparty( const struct aprx_interface *aif,
 
 
         // This is APRS packet, parse for APRS meaning ...
-        rc = parse_aprs(pb, NULL); // look inside 3rd party -- historydb is looked up again below
+        rc = parse_aprs_level(pb, NULL, PARSE_TYPE); // look inside 3rd party -- historydb is looked up again below
         if (debug) {
           const char *srcif = aif->callsign ? aif->callsign : "??";
           printf(".. parse_aprs() rc=%s  type=0x%02x srcif=%s tnc2addr='%s'  info_start='%s'\n",
@@ -1804,34 +1841,21 @@ int process_message_to_myself(const struct aprx_interface*const srcif, const str
 #endif
 
 /*
- * Process transmit of APRS beacons
- *
- * Note:  txbuf  starts if AX.25 Control+PID bytes!
+ * Compile the address part of a beacon:  AX.25 address field into
+ * ax25addr[70], TNC2 form "SRC>DEST,VIA" into axaddrbuf[128].
+ * Returns AX.25 address length, or -1 on bad inputs.
  */
 
-int interface_transmit_beacon(const struct aprx_interface *aif, const char *src, const char *dest, const char *via, const char *txbuf, const int txlen)
+int interface_beacon_address(const char *src, const char *dest, const char *via, uint8_t *ax25addr, char *axaddrbuf, int *axaddrlenp)
 {
-	uint8_t ax25addr[90];
 	int     ax25addrlen;
-	int	have_fault = 0;
 	int	viaindex   = 1; // First via field will be index 2
-	char    axaddrbuf[128];
 	char    *a = axaddrbuf;
-	dupecheck_t *dupechecker;
         int     axlen;
 
-	if (debug)
-	  printf("interface_transmit_beacon() aif=%p, aif->txok=%d aif->callsign='%s'\n",
-		 aif, aif && aif->tx_ok ? 1 : 0, aif ? aif->callsign : "<nil>");
-
-	if (aif == NULL)    return 0;
-	if (!aif->tx_ok) return 0; // Sorry, no Tx
-
-	dupechecker = digipeater_find_dupecheck(aif);
-
 	// _FOR_VALGRIND_  -- and just in case for normal use
-	memset(ax25addr, 0, sizeof(ax25addr));
-	memset(axaddrbuf, 0, sizeof(axaddrbuf));
+	memset(ax25addr, 0, 70);
+	memset(axaddrbuf, 0, 128);
 	
 	if (parse_ax25addr(ax25addr +  7, src,  0x60)) {
 	  if (debug) printf("parse_ax25addr('%s') failed. [1]\n", src);
@@ -1855,8 +1879,8 @@ int interface_transmit_beacon(const struct aprx_interface *aif, const char *src,
 
 	  *a++ = ',';
           axlen = a - axaddrbuf;
-          if (vialen > (sizeof(axaddrbuf)-axlen-3))
-            vialen = (sizeof(axaddrbuf)-axlen-3);
+          if (vialen > (128-axlen-3))
+            vialen = (128-axlen-3);
           if (vialen > 0) {
             memcpy(a, via, vialen);
             a += vialen;
@@ -1874,9 +1898,10 @@ int interface_transmit_beacon(const struct aprx_interface *aif, const char *src,
 	    }
 	    // [p..s] is now one VIA field.
 	    if (s == p) {  // BAD!
-	      have_fault = 1;
-	      if (debug>1) printf(" S==P ");
-	      break;
+	      if (debug) {
+	        printf("observed a fault in inputs of interface_beacon_address()\n");
+	      }
+	      return -1;
 	    }
 	    ++viaindex;
 	    if (viaindex >= 10) {
@@ -1901,15 +1926,31 @@ int interface_transmit_beacon(const struct aprx_interface *aif, const char *src,
 	  }
 	}
 
-	if (have_fault) {
-	  if (debug) {
-	    printf("observed a fault in inputs of interface_transmit_beacon()\n");
-	  }
-	  return 1;
-	}
-
 	ax25addr[ax25addrlen-1] |= 0x01; // set address field end bit
 
+	*axaddrlenp = axlen;
+	return ax25addrlen;
+}
+
+/*
+ * Transmit a beacon of compiled address
+ *
+ * Note:  txbuf  starts if AX.25 Control+PID bytes!
+ */
+
+void interface_transmit_beaconframe(const struct aprx_interface *aif, const TxPriority prio, uint8_t *ax25addr, const int ax25addrlen, const char *axaddrbuf, const int axlen, const char *txbuf, const int txlen)
+{
+	dupecheck_t *dupechecker;
+	char    *a;
+
+	if (debug)
+	  printf("interface_transmit_beacon() aif=%p, aif->txok=%d aif->callsign='%s'\n",
+		 aif, aif && aif->tx_ok ? 1 : 0, aif ? aif->callsign : "<nil>");
+
+	if (aif == NULL)    return;
+	if (!aif->tx_ok) return; // Sorry, no Tx
+
+	dupechecker = digipeater_find_dupecheck(aif);
 
 	// Feed to dupe-filter (transmitter specific)
 	// this means we have already seen it, and when 
@@ -1918,12 +1959,12 @@ int interface_transmit_beacon(const struct aprx_interface *aif, const char *src,
 
 	if (dupechecker != NULL)
 	  dupecheck_aprs( dupechecker,
-			  axaddrbuf, strlen(axaddrbuf),
+			  axaddrbuf, axlen,
 			  txbuf+2, txlen-2  ); // ignore Ctrl+PID
 
 	// Transmit it to actual radio interface
 
-	interface_transmit_ax25( aif,
+	interface_transmit_ax25( aif, prio, 0,
 				 ax25addr, ax25addrlen,
 				 txbuf, txlen);
 
@@ -1940,6 +1981,29 @@ int interface_transmit_beacon(const struct aprx_interface *aif, const char *src,
 
 	  rflog(aif->callsign, 'T', 0, axbuf, a - axbuf); // beacon
 	}
+}
+
+/*
+ * Process transmit of APRS beacons
+ *
+ * Note:  txbuf  starts if AX.25 Control+PID bytes!
+ */
+
+int interface_transmit_beacon(const struct aprx_interface *aif, const TxPriority prio, const char *src, const char *dest, const char *via, const char *txbuf, const int txlen)
+{
+	uint8_t ax25addr[70];
+	int     ax25addrlen;
+	char    axaddrbuf[128];
+        int     axlen;
+
+	if (aif == NULL)    return 0;
+	if (!aif->tx_ok) return 0; // Sorry, no Tx
+
+	ax25addrlen = interface_beacon_address(src, dest, via, ax25addr, axaddrbuf, &axlen);
+	if (ax25addrlen < 0)
+	  return -1;
 
+	interface_transmit_beaconframe(aif, prio, ax25addr, ax25addrlen,
+				       axaddrbuf, axlen, txbuf, txlen);
 	return 0;
 }
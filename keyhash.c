@@ -19,11 +19,31 @@
  *   http://www.ibiblio.org/pub/Linux/devel/lang/c/mph-1.2.tar.gz
  *   http://www.concentric.net/~Ttwang/tech/inthash.htm
  *   http://isthe.com/chongo/tech/comp/fnv/
+ *   https://github.com/Cyan4973/xxHash
  *
- * Currently using FNV-1a
+ * Currently using a word-at-a-time hash in the style of xxHash,
+ * eating 8 bytes per multiply.  The byte-at-a-time FNV-1a can be
+ * selected at compile time with  -DKEYHASH_FNV.
+ *
+ * Both hashes have the same calling convention: hash value 0 means
+ * "start a new hash", and feeding the result of one call as hash
+ * value of next continues it (dupecheck does so).  Also with both:
+ *     keyhashuc(key)  ==  keyhash(uppercase(key))
+ * which the filter code depends on.
+ *
+ * Running  make keyhash-bench  compares the two.
  *
  */
 
+#include <stdint.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "keyhash.h"
+
+void keyhash_init(void) { }
+
+
 /*
 //  FNV-1a  hash from   http://isthe.com/chongo/tech/comp/fnv/
 //
@@ -32,19 +52,13 @@
 //  fixed shifts and additions.
 */
 
-#include <stdint.h>
-#include <sys/types.h>
-
-#include "keyhash.h"
-
-void keyhash_init(void) { }
+#define FNV_32_PRIME     16777619U
+#define FNV_32_OFFSET  2166136261U
 
-uint32_t __attribute__((pure)) keyhash(const void const *p, int len, uint32_t hash)
+static inline uint32_t keyhash_fnv(const void *p, int len, uint32_t hash)
 {
 	const uint8_t *u = p;
 	int i;
-#define FNV_32_PRIME     16777619U
-#define FNV_32_OFFSET  2166136261U
 
 	if (hash == 0)
         	hash = (uint32_t)FNV_32_OFFSET;
@@ -61,10 +75,7 @@ uint32_t __attribute__((pure)) keyhash(const void const *p, int len, uint32_t ha
 	return hash;
 }
 
-/* The data material is known to contain ASCII, and if any value in there
- * is a lower case letter, it is first converted to upper case one.
-*/
-uint32_t __attribute__((pure)) keyhashuc(const void const *p, int len, uint32_t hash)
+static inline uint32_t keyhashuc_fnv(const void *p, int len, uint32_t hash)
 {
 	const uint8_t *u = p;
 	int i;
@@ -89,3 +100,287 @@ uint32_t __attribute__((pure)) keyhashuc(const void const *p, int len, uint32_t
 	}
 	return hash;
 }
+
+
+/*
+//  Word-at-a-time hash.
+//
+//  Input is read 8 bytes at the time with memcpy(), which compilers
+//  turn into a single unaligned load where the CPU allows it.  The
+//  1..7 byte tail is gathered into one more word (see kh_tail()),
+//  and the length is mixed in at the end.  The multipliers are the
+//  xxHash64 primes.
+//
+//  Result is in same byte order on every host: words are assembled
+//  as little-endian also on big-endian machines.
+*/
+
+#define KH_PRIME1  0x9E3779B185EBCA87ULL
+#define KH_PRIME2  0xC2B2AE3D27D4EB4FULL
+#define KH_PRIME3  0x165667B19E3779F9ULL
+
+#define KH_ONES    0x0101010101010101ULL
+#define KH_HIGHS   0x8080808080808080ULL
+
+static inline uint64_t kh_rotl(const uint64_t x, const int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t kh_load8(const uint8_t *u)
+{
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+	uint64_t w;
+	memcpy(&w, u, 8);
+	return w;
+#else
+	return ((uint64_t)u[0]      ) | ((uint64_t)u[1] <<  8) |
+	       ((uint64_t)u[2] << 16) | ((uint64_t)u[3] << 24) |
+	       ((uint64_t)u[4] << 32) | ((uint64_t)u[5] << 40) |
+	       ((uint64_t)u[6] << 48) | ((uint64_t)u[7] << 56);
+#endif
+}
+
+static inline uint64_t kh_load4(const uint8_t *u)
+{
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+	uint32_t w;
+	memcpy(&w, u, 4);
+	return w;
+#else
+	return ((uint64_t)u[0]      ) | ((uint64_t)u[1] <<  8) |
+	       ((uint64_t)u[2] << 16) | ((uint64_t)u[3] << 24);
+#endif
+}
+
+/* Last 1..7 bytes into one word without a variable length copy:
+   4..7 bytes as two overlapping 32-bit loads, 1..3 bytes as
+   first, middle and last byte.  The length is mixed in later. */
+static inline uint64_t kh_tail(const uint8_t *u, const int n)
+{
+	if (n >= 4)
+		return kh_load4(u) | (kh_load4(u + n - 4) << 32);
+	return ((uint64_t)u[0]) | ((uint64_t)u[n >> 1] << 8) |
+	       ((uint64_t)u[n - 1] << 16);
+}
+
+/* Upper-case all ASCII 'a'..'z' in the word, eight bytes in parallel.
+   Bytes with high bit set are left alone. */
+static inline uint64_t kh_upcase(const uint64_t w)
+{
+	const uint64_t heptets = w & ~KH_HIGHS;
+	const uint64_t ge_a    = heptets + (0x80 - 'a')   * KH_ONES;
+	const uint64_t gt_z    = heptets + (0x80 - 'z'-1) * KH_ONES;
+	const uint64_t lower   = ge_a & ~gt_z & ~w & KH_HIGHS;
+	return w ^ (lower >> 2);  /* 0x80 >> 2 == 0x20 */
+}
+
+static inline uint64_t kh_round(uint64_t acc, const uint64_t w)
+{
+	acc ^= w * KH_PRIME2;
+	acc  = kh_rotl(acc, 31) * KH_PRIME1;
+	return acc;
+}
+
+static inline uint32_t kh_final(uint64_t acc, const int len)
+{
+	acc ^= (uint64_t)len * KH_PRIME3;
+	acc ^= acc >> 33;
+	acc *= KH_PRIME2;
+	acc ^= acc >> 29;
+	acc *= KH_PRIME3;
+	acc ^= acc >> 32;
+	return (uint32_t)acc;
+}
+
+static inline uint32_t keyhash_word(const void *p, int len, uint32_t hash, const int uc)
+{
+	const uint8_t *u = p;
+	uint64_t acc, w;
+	int n = len;
+
+	acc = KH_PRIME3 ^ ((uint64_t)hash * KH_PRIME1);
+
+	for ( ; n >= 8; n -= 8, u += 8) {
+		w = kh_load8(u);
+		if (uc) w = kh_upcase(w);
+		acc = kh_round(acc, w);
+	}
+	if (n > 0) {
+		w = kh_tail(u, n);
+		if (uc) w = kh_upcase(w);
+		acc = kh_round(acc, w);
+	}
+	return kh_final(acc, len);
+}
+
+
+uint32_t __attribute__((pure)) keyhash(const void const *p, int len, uint32_t hash)
+{
+#ifdef KEYHASH_FNV
+	return keyhash_fnv(p, len, hash);
+#else
+	return keyhash_word(p, len, hash, 0);
+#endif
+}
+
+/* The data material is known to contain ASCII, and if any value in there
+ * is a lower case letter, it is first converted to upper case one.
+*/
+uint32_t __attribute__((pure)) keyhashuc(const void const *p, int len, uint32_t hash)
+{
+#ifdef KEYHASH_FNV
+	return keyhashuc_fnv(p, len, hash);
+#else
+	return keyhash_word(p, len, hash, 1);
+#endif
+}
+
+
+#ifdef KEYHASH_BENCHMARK
+/*
+ * Build with:  make keyhash-bench
+ *
+ * Checks the word hash against a byte-at-a-time reference of it,
+ * that the case-folding variants agree with hashing of an upper-cased
+ * copy, and times both hashes on callsign sized and on 100 byte keys.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <time.h>
+
+#define BENCH_KEYS 4096
+
+static double bench_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void bench(const char *name, uint32_t (*fn)(const void *, int, uint32_t),
+		  char keys[][128], const int keylen, const long rounds)
+{
+	volatile uint32_t sink = 0;
+	double t0, t1;
+	long r;
+	int k;
+
+	t0 = bench_now();
+	for (r = 0; r < rounds; ++r)
+		for (k = 0; k < BENCH_KEYS; ++k)
+			sink += fn(keys[k], keylen, 0);
+	t1 = bench_now();
+
+	printf("%-12s %3d bytes: %6.2f ns/key  %6.3f GB/s\n", name, keylen,
+	       (t1 - t0) * 1e9 / (rounds * BENCH_KEYS),
+	       (double)rounds * BENCH_KEYS * keylen / (t1 - t0) / 1e9);
+}
+
+static uint32_t fnv(const void *p, int len, uint32_t h)   { return keyhash_fnv(p, len, h); }
+static uint32_t fnvuc(const void *p, int len, uint32_t h) { return keyhashuc_fnv(p, len, h); }
+static uint32_t word(const void *p, int len, uint32_t h)  { return keyhash_word(p, len, h, 0); }
+static uint32_t worduc(const void *p, int len, uint32_t h){ return keyhash_word(p, len, h, 1); }
+
+/* keyhash_word() one byte at a time, without the word loads, the
+   SWAR upper-casing and the overlapping tail loads */
+static uint32_t word_ref(const void *p, int len, uint32_t hash, const int uc)
+{
+	const uint8_t *u = p;
+	uint64_t acc, w;
+	int i, j, n;
+
+	acc = KH_PRIME3 ^ ((uint64_t)hash * KH_PRIME1);
+	for (i = 0; i < len; i += 8) {
+		uint8_t b[8];
+		n = len - i;
+		if (n >= 8) {
+			for (j = 0; j < 8; ++j) b[j] = u[i+j];
+		} else if (n >= 4) {
+			for (j = 0; j < 4; ++j) {
+				b[j]   = u[i+j];
+				b[j+4] = u[i+n-4+j];
+			}
+		} else {
+			memset(b, 0, sizeof(b));
+			b[0] = u[i];
+			b[1] = u[i + (n >> 1)];
+			b[2] = u[i + n-1];
+		}
+		w = 0;
+		for (j = 7; j >= 0; --j) {
+			uint8_t c = b[j];
+			if (uc && 'a' <= c && c <= 'z')
+				c -= 'a' - 'A';
+			w = (w << 8) | c;
+		}
+		acc ^= w * KH_PRIME2;
+		acc  = ((acc << 31) | (acc >> 33)) * KH_PRIME1;
+	}
+	acc ^= (uint64_t)len * KH_PRIME3;
+	acc ^= acc >> 33;
+	acc *= KH_PRIME2;
+	acc ^= acc >> 29;
+	acc *= KH_PRIME3;
+	acc ^= acc >> 32;
+	return (uint32_t)acc;
+}
+
+static char keys[BENCH_KEYS][128];
+
+int main(int argc, char *argv[])
+{
+	long rounds = (argc > 1) ? atol(argv[1]) : 2000;
+	int k, i, len, errors = 0, referrors;
+	char up[128];
+
+	srand(1);
+	for (k = 0; k < BENCH_KEYS; ++k)
+		for (i = 0; i < 128; ++i)
+			keys[k][i] = 1 + rand() % 255;
+
+	for (k = 0; k < BENCH_KEYS; ++k) {
+		/* every length and alignment, plain and continued */
+		const char *key = keys[k] + k % 8;
+		uint32_t seed = (k & 8) ? rand() : 0;
+		len = (k / 8) % 121;
+		if (keyhash_word(key, len, seed, 0) != word_ref(key, len, seed, 0) ||
+		    keyhash_word(key, len, seed, 1) != word_ref(key, len, seed, 1))
+			++errors;
+	}
+	printf("word hash reference check: %d errors\n", errors);
+	referrors = errors;
+
+	for (k = 0; k < BENCH_KEYS; ++k) {
+		len = k % 128;
+		for (i = 0; i < len; ++i) {
+			unsigned char c = keys[k][i];
+			up[i] = (c >= 'a' && c <= 'z') ? c - ('a'-'A') : c;
+		}
+		if (worduc(keys[k], len, 0) != word(up, len, 0) ||
+		    fnvuc(keys[k], len, 0)  != fnv(up, len, 0))
+			++errors;
+	}
+	printf("case-folding check: %d errors\n", errors - referrors);
+
+	for (k = 0; k < BENCH_KEYS; ++k) {
+		snprintf(keys[k], 10, "OH%dAB-%d", k % 10, k % 16);
+	}
+	bench("fnv",       fnv,    keys, 9, rounds);
+	bench("fnv-uc",    fnvuc,  keys, 9, rounds);
+	bench("word",      word,   keys, 9, rounds);
+	bench("word-uc",   worduc, keys, 9, rounds);
+
+	for (k = 0; k < BENCH_KEYS; ++k)
+		for (i = 0; i < 100; ++i)
+			keys[k][i] = ' ' + rand() % 95;
+	bench("fnv",       fnv,    keys, 100, rounds / 10);
+	bench("fnv-uc",    fnvuc,  keys, 100, rounds / 10);
+	bench("word",      word,   keys, 100, rounds / 10);
+	bench("word-uc",   worduc, keys, 100, rounds / 10);
+
+	return errors ? 1 : 0;
+}
+#endif
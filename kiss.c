@@ -12,10 +12,10 @@
 
 
 /*
- *  kissprocess()  --  the S->rdline[]  array has a KISS frame after
+ *  kiss_process()  --  the frame[]  array has a KISS frame after
  *  KISS escape decode.  The frame begins with KISS command byte, then
  *  AX25 headers and payload, and possibly a CRC-checksum.
- *  Frame length is in S->rdlinelen variable.
+ *  Frame length is in len, and CRC check results in crcflags.
  */
 
 /* KA9Q describes the KISS frame format as follows:
@@ -168,10 +168,37 @@ int kissencoder( void *kissbuf, int kissspace, LineType linetype,
 }
 
 
-static int kissprocess(struct serialport *S)
+/*
+ *  kiss_crcflags()  --  check the CRCs a KISS frame may carry
+ *
+ *  Done when the frame is deframed, which may be in the port's own
+ *  reader thread, so that kiss_process() only looks at the result.
+ */
+static int kiss_crcflags(const struct serialport *S, const uint8_t *frame, const int len)
 {
-	int i;
-	int cmdbyte = S->rdline[0];
+	int cmdbyte = frame[0];
+	int flags = 0;
+	int i, xorsum = 0;
+
+	if ((S->linetype == LINETYPE_KISS || S->linetype == LINETYPE_KISSFLEXNET) &&
+	    (cmdbyte & 0x20) && calc_crc_flex(frame, len) == 0x7070)
+		flags |= KISSCRC_FLEXNET;
+	if ((S->linetype == LINETYPE_KISS || S->linetype == LINETYPE_KISSSMACK) &&
+	    (cmdbyte & 0x80) && check_crc_16(frame, len) == 0)
+		flags |= KISSCRC_SMACK;
+	if (S->linetype == LINETYPE_KISSBPQCRC) {
+		for (i = 1; i < len; ++i)
+			xorsum ^= frame[i];
+		if ((xorsum & 0xFF) == 0)
+			flags |= KISSCRC_BPQ;
+	}
+	return flags;
+}
+
+
+int kiss_process(struct serialport *S, const uint8_t *frame, int len, const int crcflags)
+{
+	int cmdbyte = frame[0];
 	int tncid = (cmdbyte >> 4) & 0x0F;
 
 	/* --
@@ -186,7 +213,7 @@ static int kissprocess(struct serialport *S)
 	 * --
 	 */
 
-	/* printf("kissprocess()  cmdbyte=%02X len=%d ",cmdbyte,S->rdlinelen); */
+	/* printf("kissprocess()  cmdbyte=%02X len=%d ",cmdbyte,len); */
 
 	/* Ok, cmdbyte tells us something, and we should ignore the
 	   frame if we don't know it... */
@@ -197,26 +224,24 @@ static int kissprocess(struct serialport *S)
 		/* printf(" ..bad CMD byte\n"); */
 		if (debug) {
 			printf("%ld\tTTY %s: Bad CMD byte on KISS frame: ", tick.tv_sec, S->ttyname);
-			hexdumpfp(stdout, S->rdline, S->rdlinelen, 1);
+			hexdumpfp(stdout, frame, len, 1);
 			printf("\n");
 		}
-		rfloghex(S->ttyname, 'D', 1, S->rdline, S->rdlinelen);
-		erlang_add(S->ttycallsign[tncid], ERLANG_DROP, S->rdlinelen, 1);	/* Account one packet */
+		rfloghex(S->ttyname, 'D', 1, frame, len);
+		erlang_add(S->ttycallsign[tncid], ERLANG_DROP, len, 1);	/* Account one packet */
 		return -1;
 	}
 
 	if (S->linetype == LINETYPE_KISS && (cmdbyte & 0x20)) {
 		// Huh?  Perhaps a FLEXNET packet?
-		int crcflex = calc_crc_flex(S->rdline, S->rdlinelen);
-		if (crcflex == 0x7070) {
+		if (crcflags & KISSCRC_FLEXNET) {
 			if (debug) printf("ALERT: Looks like received KISS frame is a FLEXNET with CRC!\n");
 			S->linetype = LINETYPE_KISSFLEXNET;
 		}
 	}
 	if (S->linetype == LINETYPE_KISS && (cmdbyte & 0x80)) {
 		// Huh?  Perhaps a SMACK packet?
-		int smack_ok = check_crc_16(S->rdline, S->rdlinelen);
-		if (smack_ok == 0) {
+		if (crcflags & KISSCRC_SMACK) {
 			if (debug) printf("ALERT: Looks like received KISS frame is a SMACK with CRC!\n");
 			S->linetype = LINETYPE_KISSSMACK;
 		}
@@ -224,7 +249,6 @@ static int kissprocess(struct serialport *S)
 
 	/* Are we expecting FLEXNET KISS ? */
 	if (S->linetype == LINETYPE_KISSFLEXNET && (cmdbyte & 0x20)) {
-		int crc;
 		tncid &= ~0x20; // FlexNet puts 0x20 as indication of CRC presence..
 
 		if (S->ttycallsign[tncid] == NULL) {
@@ -232,61 +256,56 @@ static int kissprocess(struct serialport *S)
 			   callsign definition!  We discard this packet! */
 			if (debug > 0) {
 				printf("%ld\tTTY %s: Bad TNCID on CMD byte on a KISS frame: %02x  No interface configured for it! ", tick.tv_sec, S->ttyname, cmdbyte);
-				hexdumpfp(stdout, S->rdline, S->rdlinelen, 1);
+				hexdumpfp(stdout, frame, len, 1);
 				printf("\n");
 			}
-			rfloghex(S->ttyname, 'D', 1, S->rdline, S->rdlinelen);
-			erlang_add(S->ttycallsign[tncid], ERLANG_DROP, S->rdlinelen, 1);	/* Account one packet */
+			rfloghex(S->ttyname, 'D', 1, frame, len);
+			erlang_add(S->ttycallsign[tncid], ERLANG_DROP, len, 1);	/* Account one packet */
 			return -1;
 		}
-		crc = calc_crc_flex(S->rdline, S->rdlinelen);
-		if (crc != 0x7070) {
+		if (!(crcflags & KISSCRC_FLEXNET)) {
 			aprxlog("Received FLEXNET frame with invalid CRC TTY=%s tncid=%d",S->ttyname,tncid);
 			if (debug) {
-				printf("%ld\tTTY %s tncid %d: Received FLEXNET frame with invalid CRC %04x: ",
-						tick.tv_sec, S->ttyname, tncid, crc);
-				hexdumpfp(stdout, S->rdline, S->rdlinelen, 1);
+				printf("%ld\tTTY %s tncid %d: Received FLEXNET frame with invalid CRC: ",
+						tick.tv_sec, S->ttyname, tncid);
+				hexdumpfp(stdout, frame, len, 1);
 				printf("\n");
 			}
-			rfloghex(S->ttyname, 'D', 1, S->rdline, S->rdlinelen);
-			erlang_add(S->ttycallsign[tncid], ERLANG_DROP, S->rdlinelen, 1);  // Account one packet
+			rfloghex(S->ttyname, 'D', 1, frame, len);
+			erlang_add(S->ttycallsign[tncid], ERLANG_DROP, len, 1);  // Account one packet
 			return -1;	// The CRC was invalid..
 		}
-		S->rdlinelen -= 2; // remove 2 bytes!
+		len -= 2; // remove 2 bytes!
 	}
 
 	/* Are we excepting BPQ "CRC" (XOR-sum of data) */
 	if (S->linetype == LINETYPE_KISSBPQCRC) {
 		/* TODO: in what conditions the "CRC" is calculated and when not ? */
-		int xorsum = 0;
 
 		if (S->ttycallsign[tncid] == NULL) {
 			/* D'OH!  received packet on multiplexer tncid without
 			   callsign definition!  We discard this packet! */
 			if (debug > 0) {
 				printf("%ld\tTTY %s: Bad TNCID on CMD byte on a KISS frame: %02x  No interface configured for it! ", tick.tv_sec, S->ttyname, cmdbyte);
-				hexdumpfp(stdout, S->rdline, S->rdlinelen, 1);
+				hexdumpfp(stdout, frame, len, 1);
 				printf("\n");
 			}
-			rfloghex(S->ttyname, 'D', 1, S->rdline, S->rdlinelen);
-			erlang_add(S->ttycallsign[tncid], ERLANG_DROP, S->rdlinelen, 1);	/* Account one packet */
+			rfloghex(S->ttyname, 'D', 1, frame, len);
+			erlang_add(S->ttycallsign[tncid], ERLANG_DROP, len, 1);	/* Account one packet */
 			return -1;
 		}
 
-		for (i = 1; i < S->rdlinelen; ++i)
-			xorsum ^= S->rdline[i];
-		xorsum &= 0xFF;
-		if (xorsum != 0) {
+		if (!(crcflags & KISSCRC_BPQ)) {
 			if (debug) {
-				printf("%ld\tTTY %s tncid %d: Received bad BPQCRC: %02x: ", tick.tv_sec, S->ttyname, tncid, xorsum);
-				hexdumpfp(stdout, S->rdline, S->rdlinelen, 1);
+				printf("%ld\tTTY %s tncid %d: Received bad BPQCRC: ", tick.tv_sec, S->ttyname, tncid);
+				hexdumpfp(stdout, frame, len, 1);
 				printf("\n");
 			}
-			rfloghex(S->ttyname, 'D', 1, S->rdline, S->rdlinelen);
-			erlang_add(S->ttycallsign[tncid], ERLANG_DROP, S->rdlinelen, 1);	/* Account one packet */
+			rfloghex(S->ttyname, 'D', 1, frame, len);
+			erlang_add(S->ttycallsign[tncid], ERLANG_DROP, len, 1);	/* Account one packet */
 			return -1;
 		}
-		S->rdlinelen -= 1;	/* remove the sum-byte from tail */
+		len -= 1;	/* remove the sum-byte from tail */
 		if (debug > 2)
 			printf("%ld\tTTY %s tncid %d: Received OK BPQCRC frame\n", tick.tv_sec, S->ttyname, tncid);
 	}
@@ -300,11 +319,11 @@ static int kissprocess(struct serialport *S)
 			   callsign definition!  We discard this packet! */
 			if (debug > 0) {
 				printf("%ld\tTTY %s: Bad TNCID on CMD byte on a KISS frame: %02x  No interface configured for it! ", tick.tv_sec, S->ttyname, cmdbyte);
-				hexdumpfp(stdout, S->rdline, S->rdlinelen, 1);
+				hexdumpfp(stdout, frame, len, 1);
 				printf("\n");
 			}
-			rfloghex(S->ttyname, 'D', 1, S->rdline, S->rdlinelen);
-			erlang_add(S->ttycallsign[tncid], ERLANG_DROP, S->rdlinelen, 1);	/* Account one packet */
+			rfloghex(S->ttyname, 'D', 1, frame, len);
+			erlang_add(S->ttycallsign[tncid], ERLANG_DROP, len, 1);	/* Account one packet */
 			return -1;
 		}
 
@@ -326,20 +345,20 @@ static int kissprocess(struct serialport *S)
 			   Verify the CRC.. */
 
 			// Whole buffer including CMD-byte!
-			if (check_crc_16(S->rdline, S->rdlinelen) != 0) {
+			if (!(crcflags & KISSCRC_SMACK)) {
 				aprxlog("Received SMACK frame with invalid CTC TTY=%s tncid=%d",S->ttyname,tncid);
 				if (debug) {
 					printf("%ld\tTTY %s tncid %d: Received SMACK frame with invalid CRC: ",
 							tick.tv_sec, S->ttyname, tncid);
-					hexdumpfp(stdout, S->rdline, S->rdlinelen, 1);
+					hexdumpfp(stdout, frame, len, 1);
 					printf("\n");
 				}
-				rfloghex(S->ttyname, 'D', 1, S->rdline, S->rdlinelen);
-				erlang_add(S->ttycallsign[tncid], ERLANG_DROP, S->rdlinelen, 1);  // Account one packet
+				rfloghex(S->ttyname, 'D', 1, frame, len);
+				erlang_add(S->ttycallsign[tncid], ERLANG_DROP, len, 1);  // Account one packet
 				return -1;	/* The CRC was invalid.. */
 			}
 
-			S->rdlinelen -= 2;	/* Chop off the two CRC bytes */
+			len -= 2;	/* Chop off the two CRC bytes */
 
 		} else if ((cmdbyte & 0x8F) == 0x00) {
 			/*
@@ -367,14 +386,8 @@ static int kissprocess(struct serialport *S)
 						&(probe[1]), 1, probe[0] );
 
 				/* Send probe message..  */
-				if (S->wrlen + kisslen < sizeof(S->wrbuf)) {
-					/* There is enough space in writebuf! */
-
-					memcpy(S->wrbuf + S->wrlen, kissbuf, kisslen);
-					S->wrlen += kisslen;
-					/* Flush it out..  and if not successfull,
-					   poll(2) will take care of it soon enough.. */
-					ttyreader_linewrite(S);
+				if (ttyreader_queuewrite(S, kissbuf, kisslen) == 0) {
+					/* There was enough space in writebuf! */
 
 					S->smack_probe[tncid] = tick.tv_sec + 1800; /* 30 minutes */
 
@@ -389,12 +402,12 @@ static int kissprocess(struct serialport *S)
 			// Else...  there should be no other kind data frames
 			if (debug) {
 				printf("%ld\tTTY %s: Bad CMD byte on expected SMACK frame: %02x, len=%d: ",
-						tick.tv_sec, S->ttyname, cmdbyte, S->rdlinelen);
-				hexdumpfp(stdout, S->rdline, S->rdlinelen, 1);
+						tick.tv_sec, S->ttyname, cmdbyte, len);
+				hexdumpfp(stdout, frame, len, 1);
 				printf("\n");
 			}
-			rfloghex(S->ttyname, 'D', 1, S->rdline, S->rdlinelen);
-			erlang_add(S->ttycallsign[tncid], ERLANG_DROP, S->rdlinelen, 1);	/* Account one packet */
+			rfloghex(S->ttyname, 'D', 1, frame, len);
+			erlang_add(S->ttycallsign[tncid], ERLANG_DROP, len, 1);	/* Account one packet */
 			return -1;
 		}
 	}
@@ -406,28 +419,28 @@ static int kissprocess(struct serialport *S)
 			   callsign definition!  We discard this packet! */
 			if (debug > 0) {
 				printf("%ld\tTTY %s: Bad TNCID on CMD byte on a KISS frame: %02x  No interface configured for it! ", tick.tv_sec, S->ttyname, cmdbyte);
-				hexdumpfp(stdout, S->rdline, S->rdlinelen, 1);
+				hexdumpfp(stdout, frame, len, 1);
 				printf("\n");
 			}
-			rfloghex(S->ttyname, 'D', 1, S->rdline, S->rdlinelen);
-			erlang_add(S->ttycallsign[tncid], ERLANG_DROP, S->rdlinelen, 1);	/* Account one packet */
+			rfloghex(S->ttyname, 'D', 1, frame, len);
+			erlang_add(S->ttycallsign[tncid], ERLANG_DROP, len, 1);	/* Account one packet */
 			return -1;
 		}
 	}
 
 
-	if (S->rdlinelen < 17) {
+	if (len < 17) {
 		/* 7+7+2 bytes of minimal AX.25 frame + 1 for KISS CMD byte */
 
 		/* Too short frame.. */
 		/* printf(" ..too short a frame for anything\n");  */
-		rfloghex(S->ttyname, 'D', 1, S->rdline, S->rdlinelen);
-		erlang_add(S->ttycallsign[tncid], ERLANG_DROP, S->rdlinelen, 1);	/* Account one packet */
+		rfloghex(S->ttyname, 'D', 1, frame, len);
+		erlang_add(S->ttycallsign[tncid], ERLANG_DROP, len, 1);	/* Account one packet */
 		return -1;
 	}
 
 	/* Valid AX.25 HDLC frame byte sequence is now at
-	   S->rdline[1..S->rdlinelen-1]
+	   frame[1..len-1]
 	   */
 
 	/* Send the frame to APRS-IS, return 1 if valid AX.25 UI message, must not
@@ -438,22 +451,22 @@ static int kissprocess(struct serialport *S)
 	// Rx-IGate functionality.  Returns non-zero only when
 	// AX.25 header is OK, and packet is sane.
 
-	erlang_add(S->ttycallsign[tncid], ERLANG_RX, S->rdlinelen, 1);	/* Account one packet */
+	erlang_add(S->ttycallsign[tncid], ERLANG_RX, len, 1);	/* Account one packet */
 
 	if (ax25_to_tnc2(S->interface[tncid], S->ttycallsign[tncid], tncid,
-				cmdbyte, S->rdline + 1, S->rdlinelen - 1)) {
+				cmdbyte, frame + 1, len - 1)) {
 		// The packet is valid per AX.25 header bit rules.
 
 #ifdef PF_AX25	/* PF_AX25 exists -- highly likely a Linux system ! */
 		/* Send the frame without cmdbyte to internal AX.25 network */
 		if (S->netax25[tncid] != NULL)
-			netax25_sendax25(S->netax25[tncid], S->rdline + 1, S->rdlinelen - 1);
+			netax25_sendax25(S->netax25[tncid], frame + 1, len - 1);
 #endif
 
 	} else {
 		// The packet is not valid per AX.25 header bit rules
-		rfloghex(S->ttyname, 'D', 1, S->rdline, S->rdlinelen);
-		erlang_add(S->ttycallsign[tncid], ERLANG_DROP, S->rdlinelen, 1);	/* Account one packet */
+		rfloghex(S->ttyname, 'D', 1, frame, len);
+		erlang_add(S->ttycallsign[tncid], ERLANG_DROP, len, 1);	/* Account one packet */
 
 		if (aprxlogfile) {
 			// NOT replaced with aprxlog() -- because this is a bit more complicated..
@@ -463,8 +476,8 @@ static int kissprocess(struct serialport *S)
 				printtime(timebuf, sizeof(timebuf));
 				setlinebuf(fp);
 
-				fprintf(fp, "%s ax25_to_tnc2(%s,len=%d) rejected the message: ", timebuf, S->ttycallsign[tncid], S->rdlinelen-1);
-				hexdumpfp(fp, S->rdline, S->rdlinelen, 1);
+				fprintf(fp, "%s ax25_to_tnc2(%s,len=%d) rejected the message: ", timebuf, S->ttycallsign[tncid], len-1);
+				hexdumpfp(fp, frame, len, 1);
 				fprintf(fp, "\n");
 				fclose(fp);
 			}
@@ -481,11 +494,10 @@ static int kissprocess(struct serialport *S)
 
 int kiss_pullkiss(struct serialport *S)
 {
-	/* printf("ttyreader_pullkiss()  rdlen=%d rdcursor=%d, state=%d\n",
-	   S->rdlen, S->rdcursor, S->kissstate); fflush(stdout); */
+	/* printf("ttyreader_pullkiss()  rdlen=%d, state=%d\n",
+	   ringbuf_used(&S->rd), S->kissstate); fflush(stdout); */
 
-	/* At incoming call there is at least one byte in between
-	   S->rdcursor and S->rdlen  */
+	/* At incoming call there is at least one byte in S->rd */
 
 	/* Phases:
 	   kissstate == 0: hunt for KISS_FEND, discard everything before it.
@@ -532,7 +544,13 @@ int kiss_pullkiss(struct serialport *S)
 
 				if (S->rdlinelen > 0) {
 					/* Non-zero sized frame  Process it away ! */
-					kissprocess(S);
+					int crcflags = kiss_crcflags(S, S->rdline, S->rdlinelen);
+#if defined(HAVE_PTHREAD_CREATE) && defined(ENABLE_PTHREAD)
+					if (S->threaded)
+						ttyreader_rxqueue(S, S->rdline, S->rdlinelen, crcflags);
+					else
+#endif
+					kiss_process(S, S->rdline, S->rdlinelen, crcflags);
 					S->kissstate =
 						KISSSTATE_COLLECTING;
 					S->rdlinelen = 0;
@@ -592,18 +610,34 @@ int kiss_pullkiss(struct serialport *S)
 }
 
 
+/* Is the line open?  The reader thread of a threaded port owns S->fd */
+static int kiss_lineopen(struct serialport *S)
+{
+#if defined(HAVE_PTHREAD_CREATE) && defined(ENABLE_PTHREAD)
+	int lineopen;
+
+	if (S->threaded) {
+		pthread_mutex_lock(&S->wrlock);
+		lineopen = S->lineopen;
+		pthread_mutex_unlock(&S->wrlock);
+		return lineopen;
+	}
+#endif
+	return S->fd >= 0;
+}
+
 /*
  *  kiss_kisswrite()  -- write out buffered data
  */
 void kiss_kisswrite(struct serialport *S, const int tncid, const uint8_t *ax25raw, const int ax25rawlen)
 {
-	int i, len, ssid;
+	int len, ssid;
 	uint8_t kissbuf[2300];
 
 	if (debug) {
 	  printf("kiss_kisswrite(->%s, axlen=%d)\n", S->ttycallsign[tncid], ax25rawlen);
 	}
-	if (S->fd < 0) {
+	if (!kiss_lineopen(S)) {
 	  if (debug)
 	    printf("NOTE: Write to non-open serial port discarded.");
 	  return;
@@ -618,29 +652,6 @@ void kiss_kisswrite(struct serialport *S, const int tncid, const uint8_t *ax25ra
 	}
 
 
-	if ((S->wrlen == 0) || (S->wrlen > 0 && S->wrcursor >= S->wrlen)) {
-		S->wrlen = S->wrcursor = 0;
-	} else {
-	  /* There is some data in between wrcursor and wrlen */
-	  len = S->wrlen - S->wrcursor;
-	  if (len > 0) {
-	    i = write(S->fd, S->wrbuf + S->wrcursor, len);
-	  } else
-	    i = 0;
-	  if (i > 0) {		/* wrote something */
-	    S->wrcursor += i;
-	    len = S->wrlen - S->wrcursor;
-	    if (len == 0) {
-	      S->wrcursor = S->wrlen = 0;	/* wrote all ! */
-	    } else {
-	      /* compact the buffer a bit */
-	      memcpy(S->wrbuf, S->wrbuf + S->wrcursor, len);
-	      S->wrcursor = 0;
-	      S->wrlen = len;
-	    }
-	  }
-	}
-
 	ssid = (tncid << 4);
 	switch (S->linetype) {
 	case LINETYPE_KISSFLEXNET:
@@ -665,9 +676,8 @@ void kiss_kisswrite(struct serialport *S, const int tncid, const uint8_t *ax25ra
 	}
 
 	// Will the KISS encoded frame fit in the link buffer?
-	if ((S->wrlen + len) < sizeof(S->wrbuf)) {
-		memcpy(S->wrbuf + S->wrlen, kissbuf, len);
-		S->wrlen += len;
+	// (It is written out immediately, if the line takes it.)
+	if (ttyreader_queuewrite(S, kissbuf, len) == 0) {
 		erlang_add(S->ttycallsign[tncid], ERLANG_TX, ax25rawlen, 1);
 
 		if (debug)
@@ -676,27 +686,28 @@ void kiss_kisswrite(struct serialport *S, const int tncid, const uint8_t *ax25ra
 		// No fit!
 		if (debug)
 		  printf(" .. %d bytes of KISS frame did not fit on IO buffer\n",len);
-		return;
 	}
+}
 
-	// Try to write it immediately
-	len = S->wrlen - S->wrcursor;
-	if (len > 0)
-	  i = write(S->fd, S->wrbuf + S->wrcursor, len);
-	else
-	  i = 0;
-	if (i > 0) {		/* wrote something */
-		S->wrcursor += i;
-		len = S->wrlen - S->wrcursor; /* all done? */
-		if (len == 0) {
-			S->wrcursor = S->wrlen = 0;	/* wrote all ! */
-		} else {
-			/* compact the buffer a bit */
-			memcpy(S->wrbuf, S->wrbuf + S->wrcursor, len);
-			S->wrcursor = 0;
-			S->wrlen = len;
-		}
+/*
+ *  kiss_txbacklog()  -- bytes still waiting to be written out
+ */
+int kiss_txbacklog(struct serialport *S)
+{
+#if defined(HAVE_PTHREAD_CREATE) && defined(ENABLE_PTHREAD)
+	int len = 0;
+
+	if (S->threaded) {
+		pthread_mutex_lock(&S->wrlock);
+		if (S->lineopen)
+			len = ringbuf_used(&S->wr);
+		pthread_mutex_unlock(&S->wrlock);
+		return len;
 	}
+#endif
+	if (S->fd < 0)
+		return 0;
+	return ringbuf_used(&S->wr);
 }
 
 
@@ -707,6 +718,9 @@ void kiss_poll(struct serialport *S)
         int kisslen;
         int tncid;
 
+	if (!kiss_lineopen(S))
+		return;
+
         for (tncid = 0; tncid < 16; ++tncid) {
 
 		if (S->interface[tncid] == NULL) {
@@ -721,15 +735,9 @@ void kiss_poll(struct serialport *S)
                                        &(probe[0]), 0, probe[0] );
                 
                 /* Send probe message..  */
-                if (S->wrlen + kisslen < sizeof(S->wrbuf)) {
-                	/* There is enough space in writebuf! */
-          
-	        	memcpy(S->wrbuf + S->wrlen, kissbuf, kisslen);
-                        S->wrlen += kisslen;
-                        /* Flush it out..  and if not successfull,
-                           poll(2) will take care of it soon enough.. */
-                        ttyreader_linewrite(S);
-          
+                /* Queue it and flush it out..  and if not successfull,
+                   poll(2) will take care of it soon enough.. */
+                if (ttyreader_queuewrite(S, kissbuf, kisslen) == 0) {
                         if (debug)
                           printf("%ld.%06d\tTTY %s tncid %d: Sending KISS POLL\n", (long)tick.tv_sec, (int)tick.tv_usec, S->ttyname, tncid);
 		}
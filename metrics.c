@@ -0,0 +1,473 @@
+/* **************************************************************** *
+ *                                                                  *
+ *  APRX -- 2nd generation APRS iGate and digi with                 *
+ *          minimal requirement of esoteric facilities or           *
+ *          libraries of any kind beyond UNIX system libc.          *
+ *                                                                  *
+ * (c) Matti Aarnio - OH2MQK,  2007-2014                            *
+ *                                                                  *
+ * **************************************************************** */
+
+/*
+ *  Live counters in OpenMetrics (Prometheus) text format over HTTP.
+ *
+ *  <logging>
+ *    metrics-listen  127.0.0.1  9273
+ *  </logging>
+ *
+ *  A GET of any path answers with interface erlang counters and rates,
+ *  latency histograms, historydb and dupecheck counters and cellmalloc
+ *  arena gauges.  All of them are only read at scrape time, so the
+ *  packet path is not touched at all.
+ *
+ *  The listener and its few clients are non-blocking sockets in the
+ *  main poll loop.  A client gets one response, and is closed.
+ */
+
+#include "aprx.h"
+#include <stddef.h>
+
+#define METRICS_CLIENTS   4
+#define METRICS_REQMAX    2048
+#define METRICS_TIMEOUT   10	/* seconds for whole exchange */
+#define METRICS_HDRSPACE  256	/* room for HTTP header in front of body */
+
+struct metrics_client {
+	int     fd;
+	time_t  t_start;
+	int     reqlen;
+	char    req[METRICS_REQMAX];
+	char   *out;		/* kept over connections */
+	int     outsize;
+	int     outstart;	/* HTTP header starts here */
+	int     outlen;
+	int     outcur;
+	int     outfail;	/* response did not fit in memory */
+};
+
+static const char *metrics_address;
+static const char *metrics_port;
+static int metrics_fd = -1;
+static struct metrics_client metrics_clients[METRICS_CLIENTS];
+static struct metrics_client *metrics_cur;	/* being rendered */
+
+
+int metrics_config(const char *param1, const char *str)
+{
+	if (*str) {
+		metrics_address = strdup(param1);
+		metrics_port    = strdup(str);
+	} else {
+		metrics_address = "127.0.0.1";
+		metrics_port    = strdup(param1);
+	}
+	return 0;
+}
+
+void metrics_start(void)
+{
+	struct addrinfo req, *ai = NULL;
+	int i, on = 1;
+
+	for (i = 0; i < METRICS_CLIENTS; ++i)
+		metrics_clients[i].fd = -1;
+
+	if (metrics_port == NULL)
+		return;
+
+	memset(&req, 0, sizeof(req));
+	req.ai_socktype = SOCK_STREAM;
+	req.ai_protocol = IPPROTO_TCP;
+	req.ai_flags    = AI_PASSIVE;
+	i = getaddrinfo(metrics_address, metrics_port, &req, &ai);
+	if (i != 0 || ai == NULL) {
+		aprxlog("metrics-listen %s %s: address lookup failed: %s",
+			metrics_address, metrics_port, gai_strerror(i));
+		return;
+	}
+
+	metrics_fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+	if (metrics_fd >= 0) {
+		setsockopt(metrics_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+		if (bind(metrics_fd, ai->ai_addr, ai->ai_addrlen) < 0 ||
+		    listen(metrics_fd, 8) < 0) {
+			aprxlog("metrics-listen %s %s: %s",
+				metrics_address, metrics_port, strerror(errno));
+			close(metrics_fd);
+			metrics_fd = -1;
+		} else {
+			fd_nonblockingmode(metrics_fd);
+			if (debug)
+				printf("metrics listening on %s port %s\n",
+				       metrics_address, metrics_port);
+		}
+	}
+	freeaddrinfo(ai);
+}
+
+
+/* Append to the response being rendered, growing it as needed.
+   When it can not grow, the rest is dropped and so is the client. */
+void metrics_printf(const char *fmt, ...)
+{
+	struct metrics_client *C = metrics_cur;
+	va_list ap;
+	char *p;
+	int n, size;
+
+	if (C->outfail)
+		return;
+	for (;;) {
+		va_start(ap, fmt);
+		n = vsnprintf(C->out + C->outlen, C->outsize - C->outlen, fmt, ap);
+		va_end(ap);
+		if (n < C->outsize - C->outlen)
+			break;
+		size = C->outsize * 2 + n;
+		p = realloc(C->out, size);
+		if (p == NULL) {
+			C->outfail = 1;
+			return;
+		}
+		C->out     = p;
+		C->outsize = size;
+	}
+	C->outlen += n;
+}
+
+void metrics_family(const char *name, const char *type, const char *help)
+{
+	metrics_printf("# TYPE %s %s\n# HELP %s %s\n", name, type, name, help);
+}
+
+/* Label value, with  \  "  and newline escaped, into caller's buffer */
+static const char *metrics_label_(const char *s, char *buf, int buflen)
+{
+	char *p = buf, *e = buf + buflen - 2;
+
+	for (; *s && p < e; ++s) {
+		if (*s == '\\' || *s == '"') {
+			*p++ = '\\'; *p++ = *s;
+		} else if (*s == '\n') {
+			*p++ = '\\'; *p++ = 'n';
+		} else
+			*p++ = *s;
+	}
+	*p = 0;
+	return buf;
+}
+#define metrics_label(s)  metrics_label_((s), lbuf, sizeof(lbuf))
+
+
+static const struct {
+	const char *name;
+	const char *help;
+	size_t      offset;
+} metrics_erlangcounters[] = {
+	{ "aprx_interface_received_bytes",     "Bytes received from radio or APRS-IS",
+	  offsetof(struct erlang_rxtxbytepkt, bytes_rx) },
+	{ "aprx_interface_received_packets",   "Packets received from radio or APRS-IS",
+	  offsetof(struct erlang_rxtxbytepkt, packets_rx) },
+	{ "aprx_interface_dropped_bytes",      "Received bytes that were dropped",
+	  offsetof(struct erlang_rxtxbytepkt, bytes_rxdrop) },
+	{ "aprx_interface_dropped_packets",    "Received packets that were dropped",
+	  offsetof(struct erlang_rxtxbytepkt, packets_rxdrop) },
+	{ "aprx_interface_transmitted_bytes",  "Bytes transmitted",
+	  offsetof(struct erlang_rxtxbytepkt, bytes_tx) },
+	{ "aprx_interface_transmitted_packets", "Packets transmitted",
+	  offsetof(struct erlang_rxtxbytepkt, packets_tx) },
+};
+
+static void metrics_erlang_rate(const struct erlangline *E,
+				const struct erlang_rxtxbytepkt *R,
+				const char *period, const int minutes)
+{
+	char lbuf[64];
+	double capa = (double)E->erlang_capa * minutes;
+
+	if (R->update == 0 || capa <= 0)
+		return;
+	metrics_label(E->name);
+	metrics_printf("aprx_interface_erlang{interface=\"%s\",direction=\"rx\",period=\"%s\"} %.4f\n",
+		       lbuf, period, R->bytes_rx / capa);
+	metrics_printf("aprx_interface_erlang{interface=\"%s\",direction=\"rxdrop\",period=\"%s\"} %.4f\n",
+		       lbuf, period, R->bytes_rxdrop / capa);
+	metrics_printf("aprx_interface_erlang{interface=\"%s\",direction=\"tx\",period=\"%s\"} %.4f\n",
+		       lbuf, period, R->bytes_tx / capa);
+}
+
+static void metrics_erlang(void)
+{
+	char lbuf[64];
+	int i, j;
+
+	for (j = 0; j < (int)(sizeof(metrics_erlangcounters)/sizeof(metrics_erlangcounters[0])); ++j) {
+		metrics_family(metrics_erlangcounters[j].name, "counter",
+			       metrics_erlangcounters[j].help);
+		for (i = 0; i < ErlangLinesCount; ++i) {
+			const struct erlangline *E = ErlangLines[i];
+			const long *v = (const long *)((const char *)&E->SNMP +
+						       metrics_erlangcounters[j].offset);
+			metrics_printf("%s_total{interface=\"%s\"} %ld\n",
+				       metrics_erlangcounters[j].name,
+				       metrics_label(E->name), *v);
+		}
+	}
+
+	metrics_family("aprx_interface_erlang", "gauge",
+		       "Channel occupancy of last completed period, 1.0 = full");
+	for (i = 0; i < ErlangLinesCount; ++i) {
+		const struct erlangline *E = ErlangLines[i];
+		struct erlang_rxtxbytepkt R;
+#if (defined(ERLANGSTORAGE) || (USE_ONE_MINUTE_DATA == 1))
+		erlang_history_get(E, 1, (E->e1_cursor + E->e1_max - 1) % E->e1_max, &R);
+		metrics_erlang_rate(E, &R, "1m", 1);
+#endif
+#if (defined(ERLANGSTORAGE) || (USE_ONE_MINUTE_DATA == 0))
+		erlang_history_get(E, 10, (E->e10_cursor + E->e10_max - 1) % E->e10_max, &R);
+		metrics_erlang_rate(E, &R, "10m", 10);
+#endif
+	}
+}
+
+static void metrics_latency(void)
+{
+	int i, b;
+
+	metrics_family("aprx_latency_seconds", "histogram",
+		       "Packet processing time from reception, by stage");
+	for (i = 0; i < LATENCY_STAGES; ++i) {
+		const struct erlang_latency *L = &ErlangHead->latency[i];
+		long cum = 0;
+
+		// Bucket bounds at powers of two, from 8 microseconds up
+		for (b = 0; b < LATENCY_BUCKETS; ++b) {
+			cum += L->bucket[b];
+			if (((b + 1) & ((1 << LATENCY_SUBBITS) - 1)) == 0 &&
+			    b + 1 >= (2 << LATENCY_SUBBITS))
+				metrics_printf("aprx_latency_seconds_bucket{stage=\"%s\",le=\"%g\"} %ld\n",
+					       latency_names[i],
+					       latency_bucket_low(b + 1) / 1000000.0, cum);
+		}
+		metrics_printf("aprx_latency_seconds_bucket{stage=\"%s\",le=\"+Inf\"} %ld\n",
+			       latency_names[i], L->samples);
+		metrics_printf("aprx_latency_seconds_count{stage=\"%s\"} %ld\n",
+			       latency_names[i], L->samples);
+		metrics_printf("aprx_latency_seconds_sum{stage=\"%s\"} %.6f\n",
+			       latency_names[i], L->sum_us / 1000000.0);
+	}
+}
+
+static void metrics_cellmalloc(void)
+{
+	struct cellstatus_t cs;
+	int i;
+
+	metrics_family("aprx_cellmalloc_cells", "gauge", "Cells in use in allocation arena");
+	for (i = 0; cellstatus(i, &cs) == 0; ++i)
+		metrics_printf("aprx_cellmalloc_cells{arena=\"%s\"} %ld\n",
+			       cs.arenaname, cs.cellsinuse);
+	metrics_family("aprx_cellmalloc_bytes", "gauge", "Bytes in allocation arena blocks");
+	for (i = 0; cellstatus(i, &cs) == 0; ++i)
+		metrics_printf("aprx_cellmalloc_bytes{arena=\"%s\"} %ld\n",
+			       cs.arenaname, cs.blockbytes);
+	metrics_family("aprx_cellmalloc_failures", "counter", "Failed cell allocations");
+	for (i = 0; cellstatus(i, &cs) == 0; ++i)
+		metrics_printf("aprx_cellmalloc_failures_total{arena=\"%s\"} %ld\n",
+			       cs.arenaname, cs.allocfailures);
+}
+
+static void metrics_close(struct metrics_client *C)
+{
+	close(C->fd);
+	C->fd = -1;
+	C->outlen = C->outcur = C->reqlen = 0;
+}
+
+static void metrics_render(struct metrics_client *C)
+{
+	char lbuf[64], hdr[METRICS_HDRSPACE];
+	int hlen;
+
+	metrics_cur = C;
+	C->outlen  = METRICS_HDRSPACE;
+	C->outfail = 0;
+
+	metrics_family("aprx", "info", "Program version and callsign");
+	metrics_printf("aprx_info{version=\"%s\",mycall=\"%s\"} 1\n",
+		       swversion, metrics_label(mycall ? mycall : ""));
+	metrics_family("aprx_start_time_seconds", "gauge", "Program start time");
+	metrics_printf("aprx_start_time_seconds %ld\n",
+		       (long)(ErlangHead ? ErlangHead->start_time : 0));
+
+	if (ErlangHead != NULL) {
+		metrics_erlang();
+		metrics_latency();
+	}
+	dupecheck_metrics();
+	digipeater_metrics();
+	txsched_metrics();
+#ifndef DISABLE_IGATE
+	dprsgw_metrics();
+#endif
+	metrics_cellmalloc();
+	metrics_printf("# EOF\n");
+	metrics_cur = NULL;
+
+	if (C->outfail) {
+		if (debug)
+			printf("metrics: out of memory for the response\n");
+		metrics_close(C);
+		return;
+	}
+
+	hlen = snprintf(hdr, sizeof(hdr),
+			"HTTP/1.0 200 OK\r\n"
+			"Content-Type: application/openmetrics-text; version=1.0.0; charset=utf-8\r\n"
+			"Content-Length: %d\r\n"
+			"Connection: close\r\n\r\n",
+			C->outlen - METRICS_HDRSPACE);
+	C->outstart = METRICS_HDRSPACE - hlen;
+	memcpy(C->out + C->outstart, hdr, hlen);
+	C->outcur = C->outstart;
+}
+
+static void metrics_reply_error(struct metrics_client *C, const char *status)
+{
+	C->outlen = snprintf(C->out, C->outsize,
+			     "HTTP/1.0 %s\r\nContent-Length: 0\r\nConnection: close\r\n\r\n",
+			     status);
+	C->outstart = C->outcur = 0;
+}
+
+static void metrics_accept(void)
+{
+	struct metrics_client *C;
+	int fd, i;
+
+	while ((fd = accept(metrics_fd, NULL, NULL)) >= 0) {
+		C = NULL;
+		for (i = 0; i < METRICS_CLIENTS; ++i)
+			if (metrics_clients[i].fd < 0) {
+				C = &metrics_clients[i];
+				break;
+			}
+		if (C == NULL) {	// all busy
+			close(fd);
+			continue;
+		}
+		if (C->out == NULL) {
+			C->out = malloc(16384);
+			if (C->out == NULL) {
+				close(fd);
+				continue;
+			}
+			C->outsize = 16384;
+		}
+		fd_nonblockingmode(fd);
+		C->fd      = fd;
+		C->t_start = tick.tv_sec;
+		C->reqlen  = C->outlen = C->outcur = 0;
+	}
+}
+
+static void metrics_read(struct metrics_client *C)
+{
+	int i = read(C->fd, C->req + C->reqlen, sizeof(C->req) - 1 - C->reqlen);
+
+	if (i == 0 || (i < 0 && errno != EAGAIN && errno != EINTR)) {
+		metrics_close(C);
+		return;
+	}
+	if (i < 0)
+		return;
+	C->reqlen += i;
+	C->req[C->reqlen] = 0;
+
+	if (strstr(C->req, "\r\n\r\n") == NULL && strstr(C->req, "\n\n") == NULL) {
+		if (C->reqlen >= (int)sizeof(C->req) - 1)
+			metrics_reply_error(C, "413 Request Entity Too Large");
+		return;
+	}
+	if (memcmp(C->req, "GET ", 4) != 0)
+		metrics_reply_error(C, "405 Method Not Allowed");
+	else
+		metrics_render(C);
+}
+
+static void metrics_write(struct metrics_client *C)
+{
+	int i = write(C->fd, C->out + C->outcur, C->outlen - C->outcur);
+
+	if (i < 0 && (errno == EAGAIN || errno == EINTR))
+		return;
+	if (i <= 0) {
+		metrics_close(C);
+		return;
+	}
+	C->outcur += i;
+	if (C->outcur >= C->outlen)
+		metrics_close(C);
+}
+
+int metrics_prepoll(struct aprxpolls *app)
+{
+	struct pollfd *pfd;
+	int i;
+
+	if (metrics_fd < 0)
+		return 0;
+
+	pfd = aprxpolls_new(app);
+	pfd->fd = metrics_fd;
+	pfd->events = POLLIN | POLLPRI;
+	pfd->revents = 0;
+
+	for (i = 0; i < METRICS_CLIENTS; ++i) {
+		struct metrics_client *C = &metrics_clients[i];
+		if (C->fd < 0)
+			continue;
+		if (time_reset)
+			C->t_start = tick.tv_sec;
+		if (C->t_start + METRICS_TIMEOUT < tick.tv_sec) {
+			metrics_close(C);
+			continue;
+		}
+		pfd = aprxpolls_new(app);
+		pfd->fd = C->fd;
+		pfd->events = (C->outlen > 0) ? POLLOUT : (POLLIN | POLLPRI);
+		pfd->revents = 0;
+	}
+	return 0;
+}
+
+int metrics_postpoll(struct aprxpolls *app)
+{
+	struct pollfd *pfd = app->polls;
+	int i, j;
+
+	if (metrics_fd < 0)
+		return 0;
+
+	for (i = 0; i < app->pollcount; ++i, ++pfd) {
+		if (pfd->fd < 0 || pfd->revents == 0)
+			continue;
+		if (pfd->fd == metrics_fd) {
+			metrics_accept();
+			continue;
+		}
+		for (j = 0; j < METRICS_CLIENTS; ++j) {
+			struct metrics_client *C = &metrics_clients[j];
+			if (C->fd != pfd->fd)
+				continue;
+			if (pfd->revents & (POLLERR | POLLHUP | POLLNVAL))
+				metrics_close(C);
+			else if (C->outlen > 0)
+				metrics_write(C);
+			else
+				metrics_read(C);
+			break;
+		}
+	}
+	return 0;
+}
@@ -53,13 +53,24 @@ static int valid_sym_table_uncompressed(char c)
 		    || (c >= 0x30 && c <= 0x39)); /* [\/\\A-Z0-9] */
 }
 
+/*
+ *	Degrees and hundredths of minutes to microdegrees
+ */
+
+static inline int32_t dm100_to_micro(const int deg, const int min100)
+{
+	return deg * 1000000 + (min100 * 1000 + 3) / 6;
+}
+
 /*
  *	Fill the pbuf_t structure with a parsed position and
  *	symbol table & code. Also does range checking for lat/lng
- *	and pre-calculates cosf(lat) for range filters.
+ *	and pre-calculates cos(lat) for range filters.
+ *
+ *	Positions are in integer microdegrees, see filter.c
  */
 
-static int pbuf_fill_pos(struct pbuf_t *pb, const float lat, const float lng, const char sym_table, const char sym_code)
+static int pbuf_fill_pos(struct pbuf_t *pb, const int32_t lat, const int32_t lng, const char sym_table, const char sym_code)
 {
 	int bad = 0;
 	/* symbol table and code */
@@ -73,30 +84,30 @@ static int pbuf_fill_pos(struct pbuf_t *pb, const float lat, const float lng, co
 	if (sym_code == '@' && (sym_table == '/' || sym_table == '\\')) 
 		pb->packettype |= T_WX;	/* Hurricane */
 
-	bad |= (lat < -89.9 && -0.0001 <= lng && lng <= 0.0001);
-	bad |= (lat >  89.9 && -0.0001 <= lng && lng <= 0.0001);
+	bad |= (lat < -89900000 && -100 <= lng && lng <= 100);
+	bad |= (lat >  89900000 && -100 <= lng && lng <= 100);
 
-	if (-0.0001 <= lat && lat <= 0.0001) {
-	  bad |= ( -0.0001 <= lng && lng <= 0.0001);
-	  bad |= ( -90.01  <= lng && lng <= -89.99);
-	  bad |= (  89.99  <= lng && lng <=  90.01);
+	if (-100 <= lat && lat <= 100) {
+	  bad |= (      -100 <= lng && lng <=      100);
+	  bad |= ( -90010000 <= lng && lng <= -89990000);
+	  bad |= (  89990000 <= lng && lng <=  90010000);
 	}
 
 
-	if (bad || lat < -90.0 || lat > 90.0 || lng < -180.0 || lng > 180.0) {
+	if (bad || lat < -90000000 || lat > 90000000 || lng < -180000000 || lng > 180000000) {
 		if (debug)
-			printf("\tposition out of range: lat %.3f lng %.3f", lat, lng);
+			printf("\tposition out of range: lat %.3f lng %.3f", lat / 1000000.0, lng / 1000000.0);
 
 		return 0; /* out of range */
 	}
 	
 	if (debug)
-		printf("\tposition ok: lat %.3f lng %.3f", lat, lng);
+		printf("\tposition ok: lat %.3f lng %.3f", lat / 1000000.0, lng / 1000000.0);
 
 	/* Pre-calculations for A/R/F/M-filter tests */
-	pb->lat     = filter_lat2rad(lat);  /* deg-to-radians */
-	pb->cos_lat = cosf(pb->lat);        /* used in range filters */
-	pb->lng     = filter_lon2rad(lng);  /* deg-to-radians */
+	pb->lat     = lat;
+	pb->cos_lat = filter_coslat(lat);   /* used in range filters */
+	pb->lng     = lng;
 	
 	pb->flags |= F_HASPOS;	/* the packet has positional data */
 
@@ -314,6 +325,7 @@ static int get_symbol_from_dstcall(struct pbuf_t *pb, char *sym_table, char *sym
 static int parse_aprs_nmea(struct pbuf_t *pb, const char *body, const char *body_end)
 {
 	float lat, lng;
+	int32_t ilat, ilng;
 	const char *latp, *lngp;
 	int i, la, lo;
 	char lac, loc;
@@ -536,13 +548,13 @@ static int parse_aprs_nmea(struct pbuf_t *pb, const char *body, const char *body
 	// hlog(LOG_DEBUG, "   lat: %c %2d %7.4f   lng: %c %2d %7.4f",
 	//                 lac, la, lat, loc, lo, lng);
 
-	lat = (float)la + lat/60.0;
-	lng = (float)lo + lng/60.0;
+	ilat = filter_deg2micro(la + lat/60.0);
+	ilng = filter_deg2micro(lo + lng/60.0);
 	
 	if (lac == 'S' || lac == 's')
-		lat = -lat;
+		ilat = -ilat;
 	if (loc == 'W' || loc == 'w')
-		lng = -lng;
+		ilng = -ilng;
 	
 	pb->packettype |= T_POSITION;
 	
@@ -555,7 +567,7 @@ static int parse_aprs_nmea(struct pbuf_t *pb, const char *body, const char *body
 	}
 #endif
 
-	return pbuf_fill_pos(pb, lat, lng, sym_table, sym_code);
+	return pbuf_fill_pos(pb, ilat, ilng, sym_table, sym_code);
 }
 
 static int parse_aprs_telem(struct pbuf_t *pb, const char *body, const char *body_end)
@@ -577,7 +589,7 @@ static int parse_aprs_telem(struct pbuf_t *pb, const char *body, const char *bod
 
 static int parse_aprs_mice(struct pbuf_t *pb, const unsigned char *body, const unsigned char *body_end)
 {
-	float lat = 0.0, lng = 0.0;
+	int32_t lat = 0, lng = 0;
 	unsigned int lat_deg = 0, lat_min = 0, lat_min_frag = 0, lng_deg = 0, lng_min = 0, lng_min_frag = 0;
 	const char *d_start;
 	char dstcall[7];
@@ -698,14 +710,14 @@ static int parse_aprs_mice(struct pbuf_t *pb, const unsigned char *body, const u
 	} // cannot use posamb here
 	
 	// convert to degrees, minutes and decimal degrees,
-	//  and then to a float lat
+	//  and then to microdegrees
 
 	if (sscanf(dstcall, "%2u%2u%2u",
 	    &lat_deg, &lat_min, &lat_min_frag) != 3) {
 		DEBUG_LOG("\tsscanf failed");
 		return 0;
 	}
-	lat = (float)lat_deg + (float)lat_min / 60.0 + (float)lat_min_frag / 6000.0;
+	lat = dm100_to_micro(lat_deg, lat_min * 100 + lat_min_frag);
 	
 	// check the north/south direction and correct the latitude if necessary
 	if (d_start[3] <= 0x4c)
@@ -735,25 +747,24 @@ static int parse_aprs_mice(struct pbuf_t *pb, const unsigned char *body, const u
 	switch (posambiguity) {
 	case 0:
 		/* use everything */
-		lng = (float)lng_deg + (float)lng_min / 60.0
-			+ (float)lng_min_frag / 6000.0;
+		lng = dm100_to_micro(lng_deg, lng_min * 100 + lng_min_frag);
 		break;
 	case 1:
 		/* ignore last number of lng_min_frag */
-		lng = (float)lng_deg + (float)lng_min / 60.0
-			+ (float)(lng_min_frag - lng_min_frag % 10 + 5) / 6000.0;
+		lng = dm100_to_micro(lng_deg, lng_min * 100
+				     + lng_min_frag - lng_min_frag % 10 + 5);
 		break;
 	case 2:
 		/* ignore lng_min_frag */
-		lng = (float)lng_deg + ((float)lng_min + 0.5) / 60.0;
+		lng = dm100_to_micro(lng_deg, lng_min * 100 + 50);
 		break;
 	case 3:
 		/* ignore lng_min_frag and last number of lng_min */
-		lng = (float)lng_deg + (float)(lng_min - lng_min % 10 + 5) / 60.0;
+		lng = dm100_to_micro(lng_deg, (lng_min - lng_min % 10 + 5) * 100);
 		break;
 	case 4:
 		/* minute is unused -> add 0.5 degrees to longitude */
-		lng = (float)lng_deg + 0.5;
+		lng = dm100_to_micro(lng_deg, 30 * 100);
 		break;
 	default:
 		DEBUG_LOG(".. posambiguity code BUG!");
@@ -792,7 +803,7 @@ static int parse_aprs_compressed(struct pbuf_t *pb, const char *body, const char
 	int i;
 	int lat1, lat2, lat3, lat4;
 	int lng1, lng2, lng3, lng4;
-	float lat, lng;
+	int32_t lat, lng;
 	
 	DEBUG_LOG("parse_aprs_compressed");
 	
@@ -833,8 +844,8 @@ static int parse_aprs_compressed(struct pbuf_t *pb, const char *body, const char
 	
 	/* calculate latitude and longitude */
 	
-	lat =   90.0F - ((float)(lat1) / 380926.0F);
-	lng = -180.0F + ((float)(lng1) / 190463.0F);
+	lat =   90000000 - (int32_t)(((int64_t)lat1 * 1000000 + 190463) / 380926);
+	lng = -180000000 + (int32_t)(((int64_t)lng1 * 1000000 +  95231) / 190463);
 	
 	return pbuf_fill_pos(pb, lat, lng, sym_table, sym_code);
 }
@@ -850,7 +861,7 @@ static int parse_aprs_uncompressed(struct pbuf_t *pb, const char *body, const ch
 {
 	char posbuf[20];
 	unsigned int lat_deg = 0, lat_min = 0, lat_min_frag = 0, lng_deg = 0, lng_min = 0, lng_min_frag = 0;
-	float lat, lng;
+	int32_t lat, lng;
 	char lat_hemi, lng_hemi;
 	char sym_table, sym_code;
 	int issouth = 0;
@@ -907,14 +918,14 @@ static int parse_aprs_uncompressed(struct pbuf_t *pb, const char *body, const ch
 	if (lat_deg > 89 || lng_deg > 179)
 		return 0; /* too large values for lat/lng degrees */
 	
-	lat = (float)lat_deg + (float)lat_min / 60.0 + (float)lat_min_frag / 6000.0;
-	lng = (float)lng_deg + (float)lng_min / 60.0 + (float)lng_min_frag / 6000.0;
+	lat = dm100_to_micro(lat_deg, lat_min * 100 + lat_min_frag);
+	lng = dm100_to_micro(lng_deg, lng_min * 100 + lng_min_frag);
 	
 	/* Finally apply south/west indicators */
 	if (issouth)
-		lat = 0.0 - lat;
+		lat = -lat;
 	if (iswest)
-		lng = 0.0 - lng;
+		lng = -lng;
 	
 	// fprintf(stderr, "\tlat %u %u.%u %c (%.3f) lng %u %u.%u %c (%.3f)\n",
 	// 	lat_deg, lat_min, lat_min_frag, (int)lat_hemi, lat,
@@ -1070,12 +1081,18 @@ int parse_aprs_txgate(struct pbuf_t *pb, int look_inside_3rd_party, historydb_t
  *	Does also front-end part of the output filter's
  *	packet type classification job.
  *
+ *	With level PARSE_TYPE only the packet type is classified
+ *	(and message recipient picked up), position decoding and
+ *	the recipient's historydb lookup are skipped, and position
+ *	types return 1.  NMEA and "!"-anywhere packets are always
+ *	fully parsed, their type is not known without it.
+ *
  * TODO: Recognize TELEM packets in !/=@ packets too!
  *
  *	Return 0 for parse failures, 1 for OK.
  */
 
-int parse_aprs(struct pbuf_t*const pb, historydb_t*const historydb)
+static int parse_aprs_(struct pbuf_t*const pb, historydb_t*const historydb, const int level)
 {
 	char packettype, poschar;
 	int paclen;
@@ -1084,6 +1101,7 @@ int parse_aprs(struct pbuf_t*const pb, historydb_t*const historydb)
 	const char *body_end;
 	const char *pos_start;
 	const char *info_start = pb->info_start;
+	const int typeonly = (level < PARSE_POSITION);
 
 	int look_inside_3rd_party = 1; // Look there once..
 
@@ -1163,6 +1181,7 @@ int parse_aprs(struct pbuf_t*const pb, historydb_t*const historydb)
 		/* could be mic-e, minimum body length 9 chars */
 		if (paclen >= 9) {
 			pb->packettype |= T_POSITION;
+			if (typeonly) return 1;
 			rc = parse_aprs_mice(pb,
                                              (const unsigned char*)body,
                                              (const unsigned char*)body_end);
@@ -1192,6 +1211,7 @@ int parse_aprs(struct pbuf_t*const pb, historydb_t*const historydb)
 			/* With a prepended timestamp, jump over it. */
 			body += 7;
 		}
+		if (typeonly) return 1;
 		poschar = *body;
 		if (valid_sym_table_compressed(poschar)) { /* [\/\\A-Za-j] */
 		    	/* compressed position packet */
@@ -1270,7 +1290,7 @@ int parse_aprs(struct pbuf_t*const pb, historydb_t*const historydb)
 			}
 			pb->dstname_len = p - body;
 #ifndef DISABLE_IGATE
-                        if (historydb != NULL) {
+                        if (historydb != NULL && !typeonly) {
                         	history = historydb_lookup( historydb, pb->dstname, i );
                                 if (history != NULL) {
 					pb->lat     = history->lat;
@@ -1286,6 +1306,10 @@ int parse_aprs(struct pbuf_t*const pb, historydb_t*const historydb)
 
 	case ';':
 		if (body_end - body > 29) {
+		  if (typeonly) {
+		    pb->packettype |= T_OBJECT;
+		    return 1;
+		  }
 		  rc = parse_aprs_object(pb, body, body_end);
 		  DEBUG_LOG("\n");
 		  return rc;
@@ -1306,6 +1330,10 @@ int parse_aprs(struct pbuf_t*const pb, historydb_t*const historydb)
 
 	case ')':
 		if (body_end - body > 18) {
+		  if (typeonly) {
+		    pb->packettype |= T_ITEM;
+		    return 1;
+		  }
 		  rc = parse_aprs_item(pb, body, body_end);
 		  DEBUG_LOG("\n");
 		  return rc;
@@ -1368,6 +1396,34 @@ int parse_aprs(struct pbuf_t*const pb, historydb_t*const historydb)
 	return 0; // bad
 }
 
+int parse_aprs(struct pbuf_t*const pb, historydb_t*const historydb)
+{
+	pb->parse_rc = parse_aprs_(pb, historydb, PARSE_POSITION);
+	pb->parsed   = PARSE_POSITION;
+	return pb->parse_rc;
+}
+
+/*
+ *	Parse the packet only as far as the caller needs, and
+ *	remember how far it has been parsed.  Unlike parse_aprs(),
+ *	does no work when the packet has already been parsed to
+ *	the requested level.
+ */
+
+int parse_aprs_level(struct pbuf_t*const pb, historydb_t*const historydb, const int level)
+{
+	if (pb->parsed >= level)
+		return pb->parse_rc;
+	if (!pb->is_aprs)
+		return 0; /* Not an APRS frame, nothing to parse */
+	if (level < PARSE_TYPE)
+		return 1; /* pbuf_new() did the header */
+
+	pb->parse_rc = parse_aprs_(pb, historydb, level);
+	pb->parsed   = level;
+	return pb->parse_rc;
+}
+
 /*
  *      Parse an aprs text message (optional, only done to messages addressed to
  *      SERVER
@@ -19,38 +19,67 @@
  */
 
 #ifndef _FOR_VALGRIND_
-static cellarena_t *pbuf_cells;
+static cellarena_t *pbuf_cells[3]; // indexed by PBUF_SMALL/MEDIUM/LARGE
 #endif
 
 // int pbuf_size = sizeof(struct pbuf_t); // 152 bytes on i386
 // int pbuf_alignment = __alignof__(struct pbuf_t); // 8 on i386
 
-// 2150 byte pbuf takes in an AX.25 packet of about 1kB in size,
-// and in APRS use there never should be larger than about 512 bytes.
-// A 16 kB arena fits in 7 of these humongous pbufs.
+// Most packets fit in the small cells, about 99.5% in medium ones.
+// The 2150 byte large pbuf takes in an AX.25 packet of about 1kB in
+// size, and in APRS use there never should be larger than about 512
+// bytes.
 
-const int pbufcell_size  = sizeof(struct pbuf_t) + 2150;
 const int pbufcell_align = __alignof__(struct pbuf_t);
 
+// With threads, pbufs come from per-thread magazines, and may be
+// allocated and freed off the main thread.
+#if defined(HAVE_PTHREAD_CREATE) && defined(ENABLE_PTHREAD)
+#define PBUF_CELLPOLICY CELLMALLOC_POLICY_THREADS
+#else
+#define PBUF_CELLPOLICY 0
+#endif
+
+#ifndef _FOR_VALGRIND_
+static const int pbufcell_datalen[3] = {
+	PBUF_DATALEN_SMALL,
+	PBUF_DATALEN_MEDIUM,
+	PBUF_DATALEN_LARGE
+};
+
+static cellarena_t *pbuf_cellinit(const char *name, const int cellclass,
+				  const int bunch)
+{
+	const int cellsize = sizeof(struct pbuf_t) + pbufcell_datalen[cellclass];
+
+	return cellinit( name,
+			 cellsize,
+			 pbufcell_align,
+			 CELLMALLOC_POLICY_LIFO | PBUF_CELLPOLICY,
+			 (bunch * cellsize + 1023) / 1024, // kB at the time
+			 0   // minfree
+			 );
+}
+#endif
+
 void pbuf_init(void)
 {
 #ifndef _FOR_VALGRIND_
 	/* A _few_... */
 
-	pbuf_cells = cellinit( "filter",
-			       pbufcell_size,
-			       pbufcell_align,
-			       CELLMALLOC_POLICY_LIFO,
-			       16, // 16 kB at the time
-			       0   // minfree
-			       );
+	pbuf_cells[PBUF_SMALL]  = pbuf_cellinit( "pbuf-small", PBUF_SMALL,
+						 PBUF_ALLOCATE_BUNCH_SMALL );
+	pbuf_cells[PBUF_MEDIUM] = pbuf_cellinit( "pbuf-medium", PBUF_MEDIUM,
+						 PBUF_ALLOCATE_BUNCH_MEDIUM );
+	pbuf_cells[PBUF_LARGE]  = pbuf_cellinit( "pbuf-large", PBUF_LARGE,
+						 PBUF_ALLOCATE_BUNCH_LARGE );
 #endif
 }
 
 static void pbuf_free(struct pbuf_t *pb)
 {
 #ifndef _FOR_VALGRIND_
-	cellfree(pbuf_cells, pb);
+	cellfree(pbuf_cells[pb->cellclass], pb);
 #else
 	free(pb);
 #endif
@@ -60,19 +89,30 @@ static void pbuf_free(struct pbuf_t *pb)
 static struct pbuf_t *pbuf_alloc( const int axlen,
                                   const int tnc2len )
 {
-	int pblen = sizeof(struct pbuf_t) + axlen + tnc2len + 2;
+	int datalen = axlen + tnc2len + 2;
+	int pblen = sizeof(struct pbuf_t) + datalen;
 
 #ifndef _FOR_VALGRIND_
 	// Picks suitably sized pbuf, and pre-cleans it
 	// before passing to user
 
 	struct pbuf_t *pb;
-	if (pblen > 2150) {
+	int cellclass;
+	if (datalen <= PBUF_DATALEN_SMALL) {
+	  cellclass = PBUF_SMALL;
+	} else if (datalen <= PBUF_DATALEN_MEDIUM) {
+	  cellclass = PBUF_MEDIUM;
+	} else if (datalen <= PBUF_DATALEN_LARGE) {
+	  cellclass = PBUF_LARGE;
+	} else {
 	  // Outch!
 	  return NULL;
 	}
-	pb = cellmalloc(pbuf_cells);
+	pb = cellmalloc(pbuf_cells[cellclass]);
+	if (pb == NULL)
+	  return NULL;
 	memset(pb, 0, pblen );
+	pb->cellclass = cellclass;
 #else
 	// No size limits with valgrind..
 	struct pbuf_t *pb = calloc( 1, pblen );
@@ -116,6 +156,7 @@ static struct pbuf_t *_pbuf_new(const int is_aprs, const int digi_like_aprs, con
 	pb->is_aprs        = is_aprs;
 	pb->digi_like_aprs = digi_like_aprs;
 	pb->t              = tick.tv_sec;      // Arrival time
+	pb->t_arrival      = latency_rxstamp;
 
 	return pb;
 }
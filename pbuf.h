@@ -51,10 +51,23 @@
 #define PACKETLEN_MAX_MEDIUM 180 /* about 99.5% are smaller than this */
 #define PACKETLEN_MAX_LARGE  PACKETLEN_MAX
 
-/* number of pbuf_t structures to allocate at a time */
-#define PBUF_ALLOCATE_BUNCH_SMALL  2000 /* grow to 2000 in production use */
-#define PBUF_ALLOCATE_BUNCH_MEDIUM 2000 /* grow to 2000 in production use */
-#define PBUF_ALLOCATE_BUNCH_LARGE    50 /* grow to 50 in production use */
+/* pbuf_t data[] carries both TNC2 and AX.25 forms of the packet,
+ * which are about equally long.  The large one takes in an AX.25
+ * packet of about 1 kB in size.
+ */
+#define PBUF_DATALEN_SMALL  (2*PACKETLEN_MAX_SMALL)
+#define PBUF_DATALEN_MEDIUM (2*PACKETLEN_MAX_MEDIUM)
+#define PBUF_DATALEN_LARGE  2150
+
+/* number of pbuf_t structures to allocate at a time,
+ * each bunch is about 16 kB */
+#define PBUF_ALLOCATE_BUNCH_SMALL  48
+#define PBUF_ALLOCATE_BUNCH_MEDIUM 32
+#define PBUF_ALLOCATE_BUNCH_LARGE   7
+
+#define PBUF_SMALL  0	/* pbuf_t cellclass values */
+#define PBUF_MEDIUM 1
+#define PBUF_LARGE  2
 
 /* a packet buffer */
 /* Type flags -- some can happen in combinations: T_CWOP + T_WX / T_CWOP + T_POSITION ... */
@@ -77,6 +90,12 @@
 #define F_HASPOS  	(1 << 1) // This packet has valid parsed position
 #define F_HAS_TCPIP	(1 << 2) // There is a TCPIP* in the path
 
+/* How far parse_aprs_level() has parsed the packet, see pb->parsed */
+#define PARSE_HEADER    0 // Addresses and info_start, pbuf_new() does it
+#define PARSE_TYPE      1 // packettype bits and message recipient,
+			  // but T_WX from position symbols is missing
+#define PARSE_POSITION  2 // Everything: position, symbol, object name..
+
 struct pbuf_t {
 	struct pbuf_t *next;
 
@@ -85,11 +104,15 @@ struct pbuf_t {
 	int16_t  source_if_group;
 
 	int16_t  refcount;
+	int16_t  cellclass;	// PBUF_SMALL/MEDIUM/LARGE cell arena
 
 	int16_t	 reqcount;      // How many digipeat hops are requested?
 	int16_t	 donecount;	// How many digipeat hops are already done?
+	int16_t  parsed;	// PARSE_HEADER/TYPE/POSITION
+	int16_t  parse_rc;	// parse_aprs() result at that level
 
 	time_t   t;		/* when the packet was received */
+	int64_t  t_arrival;	/* latency_now() at reception */
 	uint32_t seqnum;	/* ever increasing counter, dupecheck sets */
 	uint16_t packettype;	/* bitmask: one or more of T_* */
 	uint16_t flags;		/* bitmask: one or more of F_* */
@@ -109,9 +132,9 @@ struct pbuf_t {
 	const char *srcname;       /* source's name (either srccall or object/item name) */
 	const char *dstname;       /* message destination callsign */
 	
-	float lat;	/* if the packet is PT_POSITION, latitude and longitude go here */
-	float lng;	/* .. in RADIAN */
-	float cos_lat;	/* cache of COS of LATitude for radial distance filter    */
+	int32_t lat;	/* if the packet is PT_POSITION, latitude and longitude go here */
+	int32_t lng;	/* .. in MICRODEGREES */
+	int32_t cos_lat; /* cache of COS of LATitude for radial distance filter, 16.16 fixed point */
 
 	char symbol[3]; /* 2(+1) chars of symbol, if any, NUL for not found */
 
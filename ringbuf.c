@@ -0,0 +1,177 @@
+/* **************************************************************** *
+ *                                                                  *
+ *  APRX -- 2nd generation APRS iGate and digi with                 *
+ *          minimal requirement of esoteric facilities or           *
+ *          libraries of any kind beyond UNIX system libc.          *
+ *                                                                  *
+ * (c) Matti Aarnio - OH2MQK,  2007-2014                            *
+ *                                                                  *
+ * **************************************************************** */
+
+/*
+ *  Byte ring buffers for the serial port and AGWPE socket I/O.
+ *
+ *  The size is a power of two, and the head and tail counters run
+ *  freely, wrapping around only in the unsigned arithmetic.  They are
+ *  masked at access, so  head - tail  is always the amount of data.
+ *
+ *  Partial reads and writes only move the counters.  The data that
+ *  wraps over the end of the buffer is moved with readv(2)/writev(2)
+ *  of two segments, so nothing is ever compacted.
+ */
+
+#include "aprx.h"
+#include <sys/uio.h>
+#include <sys/socket.h>
+
+void ringbuf_init(struct ringbuf *R, uint8_t *mem, const int size)
+{
+	R->data = mem;
+	R->mask = size - 1;
+	R->head = R->tail = 0;
+}
+
+void ringbuf_reset(struct ringbuf *R)
+{
+	R->head = R->tail = 0;
+}
+
+int ringbuf_used(const struct ringbuf *R)
+{
+	return R->head - R->tail;
+}
+
+int ringbuf_space(const struct ringbuf *R)
+{
+	return R->mask + 1 - (R->head - R->tail);
+}
+
+/* Store all of it, or nothing when it does not fit */
+int ringbuf_put(struct ringbuf *R, const void *p, const int len)
+{
+	unsigned int at = R->head & R->mask;
+	int first = R->mask + 1 - at;
+
+	if (len > ringbuf_space(R))
+		return -1;
+	if (first > len)
+		first = len;
+	memcpy(R->data + at, p, first);
+	memcpy(R->data, (const uint8_t *)p + first, len - first);
+	R->head += len;
+	return 0;
+}
+
+int ringbuf_getc(struct ringbuf *R)
+{
+	if (R->head == R->tail)
+		return -1;
+	return R->data[R->tail++ & R->mask];
+}
+
+void ringbuf_skip(struct ringbuf *R, const int len)
+{
+	R->tail += len;
+	if (R->tail == R->head)
+		R->head = R->tail = 0;	/* next I/O in one segment */
+}
+
+/*
+ * Contiguous view of len bytes at offset from the tail:  a pointer
+ * into the ring, or when they wrap, into tmp where they are copied.
+ */
+const uint8_t *ringbuf_linear(const struct ringbuf *R, const int offset, const int len, uint8_t *tmp)
+{
+	unsigned int at = (R->tail + offset) & R->mask;
+	int first = R->mask + 1 - at;
+
+	if (first >= len)
+		return R->data + at;
+	memcpy(tmp, R->data + at, first);
+	memcpy(tmp + first, R->data, len - first);
+	return tmp;
+}
+
+/* The data, as one or two segments */
+static int ringbuf_datav(const struct ringbuf *R, struct iovec *iov)
+{
+	unsigned int at = R->tail & R->mask;
+	int len   = ringbuf_used(R);
+	int first = R->mask + 1 - at;
+
+	iov[0].iov_base = R->data + at;
+	if (first >= len) {
+		iov[0].iov_len = len;
+		return 1;
+	}
+	iov[0].iov_len  = first;
+	iov[1].iov_base = R->data;
+	iov[1].iov_len  = len - first;
+	return 2;
+}
+
+/* The free space, as one or two segments */
+static int ringbuf_spacev(const struct ringbuf *R, struct iovec *iov)
+{
+	unsigned int at = R->head & R->mask;
+	int len   = ringbuf_space(R);
+	int first = R->mask + 1 - at;
+
+	iov[0].iov_base = R->data + at;
+	if (first >= len) {
+		iov[0].iov_len = len;
+		return 1;
+	}
+	iov[0].iov_len  = first;
+	iov[1].iov_base = R->data;
+	iov[1].iov_len  = len - first;
+	return 2;
+}
+
+/* read(2) into the free space, with its return value */
+int ringbuf_read(struct ringbuf *R, const int fd)
+{
+	struct iovec iov[2];
+	int i;
+
+	if (ringbuf_space(R) == 0) {
+		errno = EAGAIN;	/* not an EOF */
+		return -1;
+	}
+	i = readv(fd, iov, ringbuf_spacev(R, iov));
+	if (i > 0)
+		R->head += i;
+	return i;
+}
+
+/* write(2) out the data, with its return value */
+int ringbuf_write(struct ringbuf *R, const int fd)
+{
+	struct iovec iov[2];
+	int i;
+
+	if (R->head == R->tail)
+		return 0;
+	i = writev(fd, iov, ringbuf_datav(R, iov));
+	if (i > 0)
+		ringbuf_skip(R, i);
+	return i;
+}
+
+/* send(2) out the data with flags, with its return value */
+int ringbuf_send(struct ringbuf *R, const int fd, const int flags)
+{
+	struct iovec iov[2];
+	struct msghdr msg;
+	int i;
+
+	if (R->head == R->tail)
+		return 0;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov    = iov;
+	msg.msg_iovlen = ringbuf_datav(R, iov);
+	i = sendmsg(fd, &msg, flags);
+	if (i > 0)
+		ringbuf_skip(R, i);
+	return i;
+}
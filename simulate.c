@@ -0,0 +1,258 @@
+/* **************************************************************** *
+ *                                                                  *
+ *  APRX -- 2nd generation APRS iGate and digi with                 *
+ *          minimal requirement of esoteric facilities or           *
+ *          libraries of any kind beyond UNIX system libc.          *
+ *                                                                  *
+ * (c) Matti Aarnio - OH2MQK,  2007-2014                            *
+ *                                                                  *
+ * **************************************************************** */
+
+/*
+ *  Simulated time mode:   aprx -S capturefile
+ *
+ *  The capture is an rflog file as written by aprx itself:
+ *
+ *     2014-05-04 12:34:56.789 OH2MQK-1  R OH2XYZ>APRS,WIDE2-1:...
+ *     2014-05-04 12:34:57.010 APRSIS    R OH2ABC>APRS,TCPIP*,qAC,T2FI:...
+ *
+ *  Received ('R' and 'd') lines are fed in at their own timestamps,
+ *  radio ports through ax25_to_tnc2() like a KISS port would, and
+ *  APRSIS lines to igate_from_aprsis().  Transmissions ('T') in the
+ *  capture are ignored, our own are written to STDOUT in the same
+ *  rflog format.
+ *
+ *  Instead of sleeping in poll(2), the main loop moves the clock
+ *  directly to the next timer or capture event.  All time dependent
+ *  processing (digipeater viscous queues and token buckets, dupecheck
+ *  expiry, historydb, beacons, telemetry) runs off that clock, so a
+ *  day of recorded traffic passes in seconds.
+ *
+ *  No serial ports, network connections or AX.25 sockets are opened,
+ *  and nothing is transmitted, transmissions are only accounted in
+ *  erlang statistics.
+ */
+
+#include "aprx.h"
+
+int simulate_active;
+
+static char *simbuf;		/* the whole capture */
+static char *simcursor;
+static char *simend;
+static struct timeval simnext;	/* timestamp of line at simcursor */
+static struct timeval simstop;	/* end of simulation */
+static long simframes;
+static long simbadlines;
+static long simlate;		/* lines fed after their timestamp */
+static struct timeval simstart;
+static time_t realstart;
+
+#define SIM_DRAIN_SECONDS 60	/* run timers this long after last line */
+
+
+/* Days since 1970-01-01 of a proleptic Gregorian date */
+static long days_from_civil(int y, int m, int d)
+{
+	long era;
+	int yoe, doy, doe;
+
+	y -= m <= 2;
+	era = (y >= 0 ? y : y - 399) / 400;
+	yoe = y - era * 400;
+	doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+	doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+	return era * 146097L + doe - 719468L;
+}
+
+/* "2014-05-04 12:34:56.789" (UTC) */
+static int parse_rflogtime(const char *p, const char *e, struct timeval *tv)
+{
+	int Y, M, D, h, m, s, ms;
+
+	if (e - p < 23) return -1;
+	if (sscanf(p, "%4d-%2d-%2d %2d:%2d:%2d.%3d",
+		   &Y, &M, &D, &h, &m, &s, &ms) != 7)
+		return -1;
+	tv->tv_sec  = days_from_civil(Y, M, D) * 86400L + h * 3600 + m * 60 + s;
+	tv->tv_usec = ms * 1000;
+	return 0;
+}
+
+/* Find next line with a valid timestamp, and set simnext */
+static void sim_seek(void)
+{
+	while (simcursor < simend) {
+		if (parse_rflogtime(simcursor, simend, &simnext) == 0)
+			return;
+		++simbadlines;
+		simcursor = memchr(simcursor, '\n', simend - simcursor);
+		if (simcursor == NULL)
+			simcursor = simend;
+		else
+			++simcursor;
+	}
+}
+
+/* Undo rflog's  <0xNN>  escapes of non-printable bytes, in place */
+static int sim_unescape(char *p, int len)
+{
+	char *s = p, *t = p, *e = p + len;
+	unsigned int c;
+
+	while (s < e) {
+		if (*s == '<' && e - s >= 6 && s[1] == '0' && s[2] == 'x' &&
+		    s[5] == '>' && sscanf(s + 3, "%2x", &c) == 1) {
+			*t++ = c;
+			s += 6;
+		} else
+			*t++ = *s++;
+	}
+	return t - p;
+}
+
+/* Feed one capture line:  DATE TIME PORT DIR [*#]TNC2 */
+static void sim_feed(char *line, char *eol)
+{
+	char *p = line + 23;
+	char *port, *data;
+	char dir;
+	int len;
+
+	if (eol - line < 24) goto bad;
+	while (p < eol && *p == ' ') ++p;
+	port = p;
+	while (p < eol && *p != ' ') ++p;
+	if (p >= eol) goto bad;
+	*p++ = 0;
+	while (p < eol && *p == ' ') ++p;
+	if (p + 2 >= eol) goto bad;
+	dir  = *p;
+	data = p + 2;
+	if (*data == '*' || *data == '#') ++data;
+
+	if (dir != 'R' && dir != 'd')
+		return;		/* transmissions, and unknowns */
+
+	len = sim_unescape(data, eol - data);
+	++simframes;
+
+	if (strcmp(port, "APRSIS") == 0) {
+#ifndef DISABLE_IGATE
+		igate_from_aprsis(data, len);
+#endif
+	} else {
+		uint8_t frame[2100];
+		int framelen = ax25_from_tnc2(data, len, frame, sizeof(frame));
+		if (framelen == 0) {
+			if (debug)
+				printf("simulate: not convertible to AX.25: %.*s\n", len, data);
+			return;
+		}
+		erlang_add(port, ERLANG_RX, framelen + 10, 1);
+		ax25_to_tnc2(find_interface_by_callsign(port), port, 0, 0,
+			     frame, framelen);
+	}
+	return;
+
+ bad:
+	++simbadlines;
+}
+
+int simulate_open(const char *capture)
+{
+	struct stat st;
+	int fd = open(capture, O_RDONLY, 0);
+
+	if (fd < 0 || fstat(fd, &st) < 0) {
+		fprintf(stderr, "Can not open simulation capture '%s': %s\n",
+			capture, strerror(errno));
+		return -1;
+	}
+	simbuf = malloc(st.st_size + 1);
+	if (simbuf == NULL || read(fd, simbuf, st.st_size) != st.st_size) {
+		fprintf(stderr, "Can not read simulation capture '%s'\n", capture);
+		close(fd);
+		return -1;
+	}
+	close(fd);
+	simbuf[st.st_size] = 0;
+	simcursor = simbuf;
+	simend    = simbuf + st.st_size;
+
+	sim_seek();
+	if (simcursor >= simend) {
+		fprintf(stderr, "No rflog timestamped lines in '%s'\n", capture);
+		return -1;
+	}
+
+	simulate_active = 1;
+	tick      = simnext;
+	simstart  = simnext;
+	realstart = time(NULL);
+	srand(tick.tv_sec);	// same run, same random delays
+	return 0;
+}
+
+int simulate_prepoll(struct aprxpolls *app)
+{
+	if (simcursor < simend &&
+	    tv_timercmp(&simnext, &app->next_timeout) < 0)
+		app->next_timeout = simnext;
+	return 0;
+}
+
+/* Where a real main loop sleeps in poll(2), jump the clock instead.
+   Without a due capture line the clock moves at least 10 ms, like
+   the main loop does, but never past the next capture line:  the
+   prepolls after ours may have moved app->next_timeout later. */
+void simulate_poll(struct aprxpolls *app)
+{
+	struct timeval mintick;
+
+	if (simcursor < simend && tv_timercmp(&simnext, &tick) <= 0)
+		return;
+	tv_timeradd_millis(&mintick, &tick, 10);
+	if (tv_timercmp(&app->next_timeout, &mintick) > 0)
+		tick = app->next_timeout;
+	else
+		tick = mintick;
+	if (simcursor < simend && tv_timercmp(&simnext, &tick) < 0)
+		tick = simnext;
+}
+
+int simulate_postpoll(struct aprxpolls *app)
+{
+	(void)app;
+
+	while (simcursor < simend && tv_timercmp(&simnext, &tick) <= 0) {
+		char *line = simcursor;
+		char *eol  = memchr(line, '\n', simend - line);
+		if (eol == NULL) eol = simend;
+		simcursor = eol + 1;
+		if (eol > line && eol[-1] == '\r') --eol;
+		*eol = 0;
+
+		if (tv_timercmp(&simnext, &tick) != 0) {
+			++simlate;
+			if (debug)
+				printf("simulate: fed %d ms late: %s\n",
+				       tv_timerdelta_millis(&simnext, &tick), line);
+		}
+		sim_feed(line, eol);
+		if (simcursor > simend)
+			simcursor = simend;
+		sim_seek();
+
+		if (simcursor >= simend)
+			tv_timeradd_seconds(&simstop, &tick, SIM_DRAIN_SECONDS);
+	}
+
+	if (simcursor >= simend && tv_timercmp(&simstop, &tick) <= 0) {
+		fprintf(stderr, "simulate: %ld frames over %.1f hours of capture in %ld seconds, %ld bad lines, %ld late\n",
+		       simframes, (tick.tv_sec - simstart.tv_sec) / 3600.0,
+		       (long)(time(NULL) - realstart), simbadlines, simlate);
+		die_now = 1;
+	}
+	return 0;
+}
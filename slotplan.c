@@ -0,0 +1,209 @@
+/* **************************************************************** *
+ *                                                                  *
+ *  APRX -- 2nd generation APRS iGate and digi with                 *
+ *          minimal requirement of esoteric facilities or           *
+ *          libraries of any kind beyond UNIX system libc.          *
+ *                                                                  *
+ * (c) Matti Aarnio - OH2MQK,  2007-2014                            *
+ *                                                                  *
+ * **************************************************************** */
+
+/*
+ *  Slot planner for periodic self-generated transmissions.
+ *
+ *  Beacon sets and radio telemetry are timed each on their own, and
+ *  left alone they can land on top of each other.  Here their send
+ *  times are planned together, per transmitting interface.
+ *
+ *  At startup every periodic source registers its rate of frames on
+ *  its interfaces.  The sum of the rates gives the interface a gap,
+ *  which spreads them evenly:  three quarters of the average spacing,
+ *  and between SLOTPLAN_MINGAP and SLOTPLAN_MAXGAP seconds.
+ *
+ *  A source asks for a send time, and gets the first one at or after
+ *  it that is at least the gap away from everything already planned
+ *  on all of its interfaces.  When it plans again, it cancels first.
+ *
+ *  At send time a source may still defer in SLOTPLAN_DEFERSECS steps
+ *  while its channel erlang occupancy is over SLOTPLAN_BUSY, but for
+ *  at most SLOTPLAN_MAXDEFER seconds.
+ */
+
+#include "aprx.h"
+
+#define SLOTPLAN_MINGAP      3	/* seconds */
+#define SLOTPLAN_MAXGAP     60
+#define SLOTPLAN_BUSY      0.5	/* erlang */
+#define SLOTPLAN_DEFERSECS   5
+#define SLOTPLAN_MAXDEFER   60
+
+struct slotplan {
+	const struct aprx_interface *aif;
+	float   rate;		/* frames per second */
+	int     gap;		/* seconds */
+	int     count;
+	int     space;
+	time_t *planned;	/* ascending */
+};
+
+static struct slotplan *slotplans;
+static int slotplans_count;
+
+
+static struct slotplan *slotplan_find(const struct aprx_interface *aif, const int create)
+{
+	struct slotplan *P;
+	int i;
+
+	for (i = 0; i < slotplans_count; ++i)
+		if (slotplans[i].aif == aif)
+			return &slotplans[i];
+	if (!create)
+		return NULL;
+
+	slotplans = realloc(slotplans, sizeof(*slotplans) * (slotplans_count+1));
+	P = &slotplans[slotplans_count++];
+	memset(P, 0, sizeof(*P));
+	P->aif = aif;
+	P->gap = SLOTPLAN_MINGAP;
+	return P;
+}
+
+/*
+ *  slotplan_register()  -- a periodic source sends  rate  frames per
+ *			    second on this interface
+ */
+void slotplan_register(const struct aprx_interface *aif, const float rate)
+{
+	struct slotplan *P;
+
+	if (aif == NULL || rate <= 0.0)
+		return;
+	P = slotplan_find(aif, 1);
+	P->rate += rate;
+	P->gap = (int)(0.75 / P->rate);
+	if (P->gap < SLOTPLAN_MINGAP) P->gap = SLOTPLAN_MINGAP;
+	if (P->gap > SLOTPLAN_MAXGAP) P->gap = SLOTPLAN_MAXGAP;
+
+	if (debug)
+		printf("slotplan %s: %.4f frames/s, gap %d s\n",
+		       aif->callsign, P->rate, P->gap);
+}
+
+/* Forget what is past, or after a time jump, far in the future */
+static void slotplan_expire(struct slotplan *P)
+{
+	int i, j;
+
+	for (i = j = 0; i < P->count; ++i) {
+		if (P->planned[i] < tick.tv_sec - P->gap ||
+		    P->planned[i] > tick.tv_sec + 86400)
+			continue;
+		P->planned[j++] = P->planned[i];
+	}
+	P->count = j;
+}
+
+/* First time at or after t that keeps the gap on this interface */
+static time_t slotplan_free(const struct slotplan *P, time_t t)
+{
+	int i;
+
+	for (i = 0; i < P->count; ++i) {
+		if (P->planned[i] <= t - P->gap)
+			continue;
+		if (P->planned[i] >= t + P->gap)
+			break;
+		t = P->planned[i] + P->gap;
+	}
+	return t;
+}
+
+static void slotplan_insert(struct slotplan *P, const time_t t)
+{
+	int i;
+
+	if (P->count >= P->space) {
+		P->space += 16;
+		P->planned = realloc(P->planned, sizeof(time_t) * P->space);
+	}
+	for (i = P->count; i > 0 && P->planned[i-1] > t; --i)
+		P->planned[i] = P->planned[i-1];
+	P->planned[i] = t;
+	++P->count;
+}
+
+/*
+ *  slotplan_place()  -- plan a send on these interfaces at or after  t
+ */
+time_t slotplan_place(const struct aprx_interface **aifs, const int aifcount, time_t t)
+{
+	struct slotplan *P;
+	time_t t0;
+	int i;
+
+	for (i = 0; i < aifcount; ++i)
+		if ((P = slotplan_find(aifs[i], 0)) != NULL)
+			slotplan_expire(P);
+
+	/* Move later until it fits them all */
+	do {
+		t0 = t;
+		for (i = 0; i < aifcount; ++i)
+			if ((P = slotplan_find(aifs[i], 0)) != NULL)
+				t = slotplan_free(P, t);
+	} while (t != t0);
+
+	for (i = 0; i < aifcount; ++i)
+		if ((P = slotplan_find(aifs[i], 0)) != NULL)
+			slotplan_insert(P, t);
+	return t;
+}
+
+/*
+ *  slotplan_cancel()  -- drop a planned send of slotplan_place()
+ */
+void slotplan_cancel(const struct aprx_interface **aifs, const int aifcount, const time_t t)
+{
+	struct slotplan *P;
+	int i, j;
+
+	for (i = 0; i < aifcount; ++i) {
+		if ((P = slotplan_find(aifs[i], 0)) == NULL)
+			continue;
+		for (j = 0; j < P->count; ++j) {
+			if (P->planned[j] == t) {
+				memmove(&P->planned[j], &P->planned[j+1],
+					sizeof(time_t) * (P->count - j - 1));
+				--P->count;
+				break;
+			}
+		}
+	}
+}
+
+/*
+ *  slotplan_defer()  -- seconds to wait before sending on these
+ *			 interfaces for a busy channel, or 0 to go.
+ *			 *deferred  keeps count of waiting already.
+ */
+int slotplan_defer(const struct aprx_interface **aifs, const int aifcount, int *deferred)
+{
+	float occupancy;
+	int i;
+
+	if (*deferred + SLOTPLAN_DEFERSECS <= SLOTPLAN_MAXDEFER) {
+		for (i = 0; i < aifcount; ++i) {
+			occupancy = erlang_occupancy(aifs[i]->callsign);
+			if (occupancy > SLOTPLAN_BUSY) {
+				if (debug)
+					printf("slotplan %s: channel busy %.2f erlang, deferring %d s\n",
+					       aifs[i]->callsign, occupancy, SLOTPLAN_DEFERSECS);
+				*deferred += SLOTPLAN_DEFERSECS;
+				return SLOTPLAN_DEFERSECS;
+			}
+		}
+	}
+	*deferred = 0;
+	return 0;
+}
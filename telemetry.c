@@ -10,21 +10,14 @@
 
 #include "aprx.h"
 
-#define  telemetry_timescaler 2              // scale to 10 minute sums
-
 static int telemetry_interval = 20 * 60;     // every 20 minutes
 static int telemetry_labelinterval = 120*60; // every 2 hours
 static int telemetry_labelindex = 0;
 
-#if (defined(ERLANGSTORAGE) || (USE_ONE_MINUTE_STORAGE == 1))
-static int telemetry_1min_steps = 20;
-#endif
-#if (defined(ERLANGSTORAGE) || (USE_ONE_MINUTE_STORAGE == 0))
-static int telemetry_10min_steps = 2;
-#endif
-
 static struct timeval telemetry_time;
 static struct timeval telemetry_labeltime;
+static time_t telemetry_planned;      // the slots as planned, before
+static time_t telemetry_labelplanned; // any deferrals
 static int telemetry_seq;
 
 
@@ -38,20 +31,35 @@ struct rftelemetry {
 static int                  rftelemetrycount;
 static struct rftelemetry **rftelemetry;
 
+// Radio telemetry transmitters, for the slot planner
+static const struct aprx_interface **telemetry_aifs;
+static int                  telemetry_aifcount;
+static int                  telemetry_deferred;
+static int                  telemetry_labeldeferred;
+
 static void rf_telemetry(
 		const struct aprx_interface *sourceaif,
 		const char *beaconaddr,
 		const const char *buf,
 		const int buflen);
 
-static void telemetry_resettime(void *arg) {
-	struct timeval *tv = (struct timeval*)arg;
-	tv_timeradd_seconds( tv, &tick, telemetry_interval );
+// Plan a send at or after  t  on the transmitters
+static void telemetry_plantime(struct timeval *tv, time_t *planned, time_t t) {
+	if (*planned > tick.tv_sec)	// planned again
+		slotplan_cancel(telemetry_aifs, telemetry_aifcount, *planned);
+	*planned    = slotplan_place(telemetry_aifs, telemetry_aifcount, t);
+	tv->tv_sec  = *planned;
+	tv->tv_usec = 0;
+}
+
+static void telemetry_resettime(void) {
+	telemetry_plantime( &telemetry_time, &telemetry_planned,
+			    tick.tv_sec + telemetry_interval );
 }
 
-static void telemetry_resetlabeltime(void *arg) {
-	struct timeval *tv = (struct timeval*)arg;
-	tv_timeradd_seconds( tv, &tick, 120 );  // first label 2 minutes from now
+static void telemetry_resetlabeltime(void) {
+	telemetry_plantime( &telemetry_labeltime, &telemetry_labelplanned,
+			    tick.tv_sec + 120 );  // first label 2 minutes from now
 }
 
 
@@ -62,11 +70,29 @@ void telemetry_start() {
 	 * be in some persistent database, but this is reasonable
 	 * compromise.
 	 */
+	int i, j;
+
 	telemetry_seq = (time(NULL)) & 255;
 
+	// All data reports go out in one slot on each transmitter,
+	// and so do all labels: register one slot per send
+	for (i = 0; i < rftelemetrycount; ++i) {
+		struct rftelemetry *rftlm = rftelemetry[i];
+		for (j = 0; j < telemetry_aifcount; ++j)
+			if (telemetry_aifs[j] == rftlm->transmitter)
+				break;
+		if (j < telemetry_aifcount)
+			continue;
+		slotplan_register(rftlm->transmitter,
+				  1.0f / telemetry_interval +
+				  1.0f / telemetry_labelinterval);
+		telemetry_aifs = realloc(telemetry_aifs, sizeof(*telemetry_aifs) * (telemetry_aifcount+1));
+		telemetry_aifs[telemetry_aifcount++] = rftlm->transmitter;
+	}
+
 	// "tick" is supposedly current time..
-	telemetry_resettime( &telemetry_time );
-	telemetry_resetlabeltime( &telemetry_labeltime );
+	telemetry_resettime();
+	telemetry_resetlabeltime();
 
 	if (debug) printf("telemetry_start()\n");
 }
@@ -74,8 +100,8 @@ void telemetry_start() {
 int telemetry_prepoll(struct aprxpolls *app) {
 	// Check that time has not jumped too far ahead/back (1.5 telemetry intervals)
 	if (time_reset) {
-		telemetry_resettime(&telemetry_time);
-		telemetry_resetlabeltime(&telemetry_labeltime);
+		telemetry_resettime();
+		telemetry_resetlabeltime();
 	}
 
 	// Normal operational step
@@ -96,33 +122,62 @@ static void telemetry_datatx(void);
 static void telemetry_labeltx(void);
 
 int telemetry_postpoll(struct aprxpolls *app) {
+	int defer;
+
 	if (debug>1) {
 		printf("telemetry_postpoll()  telemetrytime=%ds  labeltime=%ds\n",
 				tv_timerdelta_millis(&tick, &telemetry_time)/1000,
 				tv_timerdelta_millis(&tick, &telemetry_labeltime)/1000);
 	}
 	if (tv_timercmp(&telemetry_time, &tick) <= 0) {
-		tv_timeradd_seconds(&telemetry_time, &telemetry_time, telemetry_interval);
-		telemetry_datatx();
+		// Let a busy channel clear first
+		defer = slotplan_defer(telemetry_aifs, telemetry_aifcount, &telemetry_deferred);
+		if (defer > 0) {
+			tv_timeradd_seconds(&telemetry_time, &tick, defer);
+		} else {
+			// next one from the planned slot, not the deferred one
+			telemetry_plantime(&telemetry_time, &telemetry_planned,
+					   telemetry_planned + telemetry_interval);
+			telemetry_datatx();
+		}
 	}
 
 	if (tv_timercmp(&telemetry_labeltime, &tick) <= 0) {
-		tv_timeradd_seconds(&telemetry_labeltime, &telemetry_labeltime, telemetry_labelinterval);
-		telemetry_labeltx();
+		defer = slotplan_defer(telemetry_aifs, telemetry_aifcount, &telemetry_labeldeferred);
+		if (defer > 0) {
+			tv_timeradd_seconds(&telemetry_labeltime, &tick, defer);
+		} else {
+			telemetry_plantime(&telemetry_labeltime, &telemetry_labelplanned,
+					   telemetry_labelplanned + telemetry_labelinterval);
+			telemetry_labeltx();
+		}
 	}
 
 	return 0;
 }
 
+// The interface of an erlang line, looked up once
+static struct aprx_interface *telemetry_source(struct erlangline *E) {
+	static const int unknown;
+
+	if (E->refp == NULL) {
+		struct aprx_interface *aif = find_interface_by_callsign(E->name);
+		E->refp = aif ? (const void *)aif : (const void *)&unknown;
+	}
+	if (E->refp == &unknown)
+		return NULL;
+	return (struct aprx_interface *)E->refp;
+}
+
 static void telemetry_datatx(void) {
-	int  i, j, k, t;
+	int  i;
 	char buf[200], *s;
 	int  buflen;
 	char beaconaddr[60];
 	int  beaconaddrlen;
-	long erlmax;
-	float erlcapa;
+	float erlcapa, scale;
 	float f;
+	struct erlang_aggregate A;
 
 
 	if (debug) {
@@ -136,170 +191,42 @@ static void telemetry_datatx(void) {
 	telemetry_seq = (telemetry_seq + 1) % 1000;
 	for (i = 0; i < ErlangLinesCount; ++i) {
 		struct erlangline *E = ErlangLines[i];
-		struct aprx_interface *sourceaif = find_interface_by_callsign(E->name);
+		struct aprx_interface *sourceaif = telemetry_source(E);
 		if (!sourceaif || !interface_is_telemetrable(sourceaif))
 			continue;
 
+		// Periods ended since the previous report
+		erlang_aggregate_take(E, &A);
+
 		beaconaddrlen = sprintf(beaconaddr, "%s>%s,TCPIP*", E->name, tocall);
 		// First two bytes of BUF are for AX.25 control+PID fields
 		s = buf+2;
 		s += sprintf(s, "T#%03d,", telemetry_seq);
 
-
-		// Raw Rx Erlang - plotting scale factor: 1/200
-		erlmax = 0;
 #if (USE_ONE_MINUTE_DATA == 1)
-		// Find busiest 1 minute
-		k = E->e1_cursor;
-		t = E->e1_max;
-		if (t > telemetry_1min_steps)
-			t = telemetry_1min_steps;	// Up to 10 of 1 minute samples
 		erlcapa = 1.0 / E->erlang_capa; // 1/capa of 1 minute
-		for (j = 0; j < t; ++j) {
-			--k;
-			if (k < 0)
-				k = E->e1_max - 1;
-			if (E->e1[k].bytes_rx > erlmax)
-				erlmax = E->e1[k].bytes_rx;
-		}
+		scale   = A.count ? 10.0 / A.count : 0.0;
 #else
-		// Find busiest 10 minute
-		k = E->e10_cursor;
-		t = E->e10_max;
-		if (t > telemetry_10min_steps)
-			t = telemetry_10min_steps;	// Up to 1 of 10 minute samples
-		erlcapa = 0.1 / E->erlang_capa; // 1/capa of 10 minute 
-		for (j = 0; j < t; ++j) {
-			--k;
-			if (k < 0)
-				k = E->e10_max - 1;
-			if (E->e10[k].bytes_rx > erlmax)
-				erlmax = E->e10[k].bytes_rx;
-		}
+		erlcapa = 0.1 / E->erlang_capa; // 1/capa of 10 minute
+		scale   = A.count ? 1.0 / A.count : 0.0;
 #endif
-		f = (200.0 * erlcapa * erlmax);
+
+		// Raw Rx Erlang of the busiest period - plotting scale factor: 1/200
+		f = (200.0 * erlcapa * A.max_bytes_rx);
 		s += sprintf(s, "%.1f,", f);
 
-		// Raw Tx Erlang - plotting scale factor: 1/200
-		erlmax = 0;
-#if (USE_ONE_MINUTE_DATA == 1)
-		// Find busiest 1 minute
-		k = E->e1_cursor;
-		t = E->e1_max;
-		if (t > telemetry_1min_steps)
-			t = telemetry_1min_steps;	// Up to 10 of 1 minute samples
-		erlcapa = 1.0 / E->erlang_capa; // 1/capa of 1 minute
-		for (j = 0; j < t; ++j) {
-			--k;
-			if (k < 0)
-				k = E->e1_max - 1;
-			if (E->e1[k].bytes_tx > erlmax)
-				erlmax = E->e1[k].bytes_tx;
-		}
-#else
-		// Find busiest 10 minute
-		k = E->e10_cursor;
-		t = E->e10_max;
-		if (t > telemetry_10min_steps)
-			t = telemetry_10min_steps;	// Up to 1 of 10 minute samples
-		erlcapa = 0.1 / E->erlang_capa; // 1/capa of 10  minute
-		for (j = 0; j < t; ++j) {
-			--k;
-			if (k < 0)
-				k = E->e10_max - 1;
-			if (E->e10[k].bytes_tx > erlmax)
-				erlmax = E->e10[k].bytes_tx;
-		}
-#endif
-		f = (200.0 * erlcapa * erlmax);
+		// Raw Tx Erlang of the busiest period - plotting scale factor: 1/200
+		f = (200.0 * erlcapa * A.max_bytes_tx);
 		s += sprintf(s, "%.1f,", f);
 
-		erlmax = 0;
-#if (USE_ONE_MINUTE_DATA == 1)
-		// Sum of 1 minute packet counts
-		k = E->e1_cursor;
-		t = E->e1_max;
-		if (t > telemetry_1min_steps)
-			t = telemetry_1min_steps;	/* Up to 10 of 1 minute samples */
-		for (j = 0; j < t; ++j) {
-			--k;
-			if (k < 0)
-				k = E->e1_max - 1;
-			erlmax += E->e1[k].packets_rx;
-		}
-#else
-		// Sum of 10 minute packet counts
-		erlmax = 0;
-		k = E->e10_cursor;
-		t = E->e10_max;
-		if (t > telemetry_10min_steps)
-			t = telemetry_10min_steps;	// Up to 1 of 10 minute samples
-		for (j = 0; j < t; ++j) {
-			--k;
-			if (k < 0)
-				k = E->e10_max - 1;
-			erlmax += E->e10[k].packets_rx;
-		}
-#endif
-		f = erlmax / telemetry_timescaler;
+		// Packet counts, per 10 minutes
+		f = A.packets_rx * scale;
 		s += sprintf(s, "%.1f,", f);
 
-		erlmax = 0;
-#if (USE_ONE_MINUTE_DATA == 1)
-		// Sum of 1 minute packet drop counts
-		k = E->e1_cursor;
-		t = E->e1_max;
-		if (t > telemetry_1min_steps)
-			t = telemetry_1min_steps;	/* Up to 10 of 1 minute samples */
-		for (j = 0; j < t; ++j) {
-			--k;
-			if (k < 0)
-				k = E->e1_max - 1;
-			erlmax += E->e1[k].packets_rxdrop;
-		}
-#else
-		// Sum of 10 minute packet drop counts
-		k = E->e10_cursor;
-		t = E->e10_max;
-		if (t > telemetry_10min_steps)
-			t = telemetry_10min_steps;	// Up to 1 of 10 minute samples
-		for (j = 0; j < t; ++j) {
-			--k;
-			if (k < 0)
-				k = E->e10_max - 1;
-			erlmax += E->e10[k].packets_rxdrop;
-		}
-#endif
-		f = erlmax / telemetry_timescaler;
+		f = A.packets_rxdrop * scale;
 		s += sprintf(s, "%.1f,", f);
 
-		erlmax = 0;
-#if (USE_ONE_MINUTE_DATA == 1)
-		// Sum of 1 minute packet tx counts
-		k = E->e1_cursor;
-		t = E->e1_max;
-		if (t > telemetry_1min_steps)
-			t = telemetry_1min_steps;	/* Up to 10 of 1 minute samples */
-		for (j = 0; j < t; ++j) {
-			--k;
-			if (k < 0)
-				k = E->e1_max - 1;
-			erlmax += E->e1[k].packets_tx;
-		}
-#else
-		// Sum of 10 minute packet tx counts
-		k = E->e10_cursor;
-		t = E->e10_max;
-		if (t > telemetry_10min_steps)
-			t = telemetry_10min_steps;	// Up to 1 of 10 minute samples
-		for (j = 0; j < t; ++j) {
-			--k;
-			if (k < 0)
-				k = E->e10_max - 1;
-			erlmax += E->e10[k].packets_tx;
-		}
-#endif
-		f = erlmax / telemetry_timescaler;
+		f = A.packets_tx * scale;
 		s += sprintf(s, "%.1f,", f);
 
 		/* Tail filler */
@@ -343,7 +270,7 @@ static void telemetry_labeltx()
 
 	for (i = 0; i < ErlangLinesCount; ++i) {
 		struct erlangline *E = ErlangLines[i];
-		struct aprx_interface *sourceaif = find_interface_by_callsign(E->name);
+		struct aprx_interface *sourceaif = telemetry_source(E);
 		if (!sourceaif || !interface_is_telemetrable(sourceaif))
 			continue;
 		beaconaddrlen = sprintf(beaconaddr, "%s>%s,TCPIP*", E->name, tocall);
@@ -435,6 +362,7 @@ static void rf_telemetry(const struct aprx_interface *sourceaif,
 				// Found telemetry transmitter which wants this source
 
 				interface_transmit_beacon(rftlm->transmitter,
+						TXPRIO_TELEMETRY,
 						beaconaddr,
 						dest,
 						rftlm->viapath,
@@ -14,6 +14,9 @@
 #include <sys/socket.h>
 #include <netdb.h>
 #include <netinet/in.h>
+#if defined(HAVE_PTHREAD_CREATE) && defined(ENABLE_PTHREAD) && defined(__linux__)
+#include <sys/eventfd.h>
+#endif
 
 
 /* The ttyreader does read TTY ports into a big buffer, and then from there
@@ -75,16 +78,7 @@ void hexdumpfp(FILE *fp, const uint8_t *buf, const int len, int axaddr)
  */
 int ttyreader_getc(struct serialport *S)
 {
-	if (S->rdcursor >= S->rdlen) {	/* Out of data ? */
-		if (S->rdcursor)
-			S->rdcursor = S->rdlen = 0;
-		/* printf("-\n"); */
-		return -1;
-	}
-
-	/* printf(" %02X", 0xFF & S->rdbuf[S->rdcursor++]); */
-
-	return (0xFF & S->rdbuf[S->rdcursor++]);
+	return ringbuf_getc(&S->rd);
 }
 
 
@@ -234,37 +228,66 @@ static int ttyreader_pulltext(struct serialport *S)
 
 
 
+#if defined(HAVE_PTHREAD_CREATE) && defined(ENABLE_PTHREAD)
+/* Wake up the other end of an eventfd, or of a pipe */
+static void ttyreader_wake(const int fd)
+{
+	uint64_t one = 1;
+
+	if (write(fd, &one, sizeof(one)) < 0) {
+		/* Pipe full, it is awake already */
+	}
+}
+
+static void ttyreader_wakedrain(const int fd)
+{
+	uint64_t buf[16];
+
+	while (read(fd, buf, sizeof(buf)) > 0)
+		;
+}
+#endif
+
 /*
  *  ttyreader_linewrite()  -- write out buffered data
  */
 void ttyreader_linewrite(struct serialport *S)
 {
-	int i, len;
-
-	if ((S->wrlen == 0) || (S->wrlen > 0 && S->wrcursor >= S->wrlen)) {
-		S->wrlen = S->wrcursor = 0;	/* already all written */
+#if defined(HAVE_PTHREAD_CREATE) && defined(ENABLE_PTHREAD)
+	if (S->threaded) {
+		pthread_mutex_lock(&S->wrlock);
+		ringbuf_write(&S->wr, S->fd);
+		pthread_mutex_unlock(&S->wrlock);
 		return;
 	}
+#endif
+	ringbuf_write(&S->wr, S->fd);
+}
 
-	/* Now there is some data in between wrcursor and wrlen */
-
-	len = S->wrlen - S->wrcursor;
-	if (len > 0)
-	  i = write(S->fd, S->wrbuf + S->wrcursor, len);
-	else
-	  i = 0;
-	if (i > 0) {		/* wrote something */
-		S->wrcursor += i;
-		len = S->wrlen - S->wrcursor;
-		if (len == 0) {
-			S->wrcursor = S->wrlen = 0;	/* wrote all ! */
-		} else {
-			/* compact the buffer a bit */
-			memcpy(S->wrbuf, S->wrbuf + S->wrcursor, len);
-			S->wrcursor = 0;
-			S->wrlen = len;
-		}
+/*
+ *  ttyreader_queuewrite()  -- buffer data for writing, and write it out
+ *			       or have port's reader thread to do it.
+ *			       Returns -1 when it does not fit.
+ */
+int ttyreader_queuewrite(struct serialport *S, const uint8_t *buf, const int len)
+{
+	int rc;
+
+#if defined(HAVE_PTHREAD_CREATE) && defined(ENABLE_PTHREAD)
+	if (S->threaded) {
+		pthread_mutex_lock(&S->wrlock);
+		rc = ringbuf_put(&S->wr, buf, len);
+		pthread_mutex_unlock(&S->wrlock);
+		if (rc == 0)
+			ttyreader_wake(S->wakefd[1]);
+		return rc;
 	}
+#endif
+	ttyreader_linewrite(S);	/* make room, if any can be */
+	rc = ringbuf_put(&S->wr, buf, len);
+	if (rc == 0)
+		ttyreader_linewrite(S);
+	return rc;
 }
 
 
@@ -277,28 +300,8 @@ static void ttyreader_lineread(struct serialport *S)
 {
 	int i;
 
-	int rdspace = sizeof(S->rdbuf) - S->rdlen;
-
-	if (S->rdcursor > 0) {
-		/* Read-out cursor is not at block beginning,
-		   is there unread data too ?  */
-		if (S->rdlen > S->rdcursor) {
-			/* Uh..  lets move buffer down a bit,
-			   to make room for more to the end.. */
-			memcpy(S->rdbuf, S->rdbuf + S->rdcursor,
-			       S->rdlen - S->rdcursor);
-			S->rdlen = S->rdlen - S->rdcursor;
-		} else
-			S->rdlen = 0;	/* all processed, mark its size zero */
-		/* Cursor to zero, rdspace recalculated */
-		S->rdcursor = 0;
-
-		/* recalculate */
-		rdspace = sizeof(S->rdbuf) - S->rdlen;
-	}
-
-	if (rdspace > 0) {	/* We have room to read into.. */
-		i = read(S->fd, S->rdbuf + S->rdlen, rdspace);
+	if (ringbuf_space(&S->rd) > 0) {	/* We have room to read into.. */
+		i = ringbuf_read(&S->rd, S->fd);
 		if (i == 0) {	/* EOF ?  USB unplugged ? */
 			close(S->fd);
 			S->fd = -1;
@@ -311,12 +314,12 @@ static void ttyreader_lineread(struct serialport *S)
 
 		/* Some data has been accumulated ! */
 		if (debug > 2) {
+		  uint8_t tmp[sizeof(S->rdbuf)];
 		  printf("%ld\tTTY %s: read() frame: ", tick.tv_sec, S->ttyname);
-		  hexdumpfp(stdout, S->rdbuf+S->rdlen, i, 1);
+		  hexdumpfp(stdout, ringbuf_linear(&S->rd, ringbuf_used(&S->rd) - i, i, tmp), i, 1);
 		  printf("\n");
 		}
                 
-		S->rdlen += i;
 		S->last_read_something = tick.tv_sec;
 	}
 
@@ -355,15 +358,6 @@ static void ttyreader_lineread(struct serialport *S)
                 tv_timeradd_seconds(&S->wait_until, &tick, TTY_OPEN_RETRY_DELAY_SECS);
                 aprxlog("TTY %s Unsupported linetype - CLOSED, WAITING %d SECS\n", S->ttyname, TTY_OPEN_RETRY_DELAY_SECS);
 	}
-
-	/* Consumed something, and our read cursor is not in the beginning ? */
-	if (S->rdcursor > 0 && S->rdcursor < S->rdlen) {
-		/* Compact the input buffer! */
-		memcpy(S->rdbuf, S->rdbuf + S->rdcursor,
-		       S->rdlen - S->rdcursor);
-	}
-	S->rdlen -= S->rdcursor;
-	S->rdcursor = 0;
 }
 
 
@@ -378,7 +372,15 @@ static void ttyreader_linesetup(struct serialport *S)
 	S->wait_until.tv_sec = 0;	// Zero it just to be safe
 	S->wait_until.tv_usec = 0;	// Zero it just to be safe
 
-	S->wrlen = S->wrcursor = 0;	// init them at first
+#if defined(HAVE_PTHREAD_CREATE) && defined(ENABLE_PTHREAD)
+	if (S->threaded)
+		pthread_mutex_lock(&S->wrlock);
+	ringbuf_reset(&S->wr);	// init them at first
+	if (S->threaded)
+		pthread_mutex_unlock(&S->wrlock);
+#else
+	ringbuf_reset(&S->wr);	// init them at first
+#endif
 
         // If NOT tcp! type socket, it is presumably openable with
         // open(2) instead of something else, like socket(2)...
@@ -433,15 +435,12 @@ static void ttyreader_linesetup(struct serialport *S)
 
 		for (i = 0; i < 16; ++i) {
 		  if (S->initstring[i] != NULL) {
-		    memcpy(S->wrbuf + S->wrlen, S->initstring[i], S->initlen[i]);
-		    S->wrlen += S->initlen[i];
+		    /* Flushed out as it goes..  and if not successfull,
+		       poll(2) will take care of it soon enough.. */
+		    ttyreader_queuewrite(S, (const uint8_t *)S->initstring[i], S->initlen[i]);
 		  }
 		}
 
-		/* Flush it out..  and if not successfull,
-		   poll(2) will take care of it soon enough.. */
-		ttyreader_linewrite(S);
-
 	} else {		/* socket connection to remote TTY.. */
 		/*   "tcp!hostname-or-ip!port!opt-parameters" */
 		char *par = strdup(S->ttyname);
@@ -512,7 +511,8 @@ static void ttyreader_linesetup(struct serialport *S)
 
 	S->last_read_something = tick.tv_sec;	/* mark the timeout for future.. */
 
-	S->rdlen = S->rdcursor = S->rdlinelen = 0;
+	ringbuf_reset(&S->rd);
+	S->rdlinelen = 0;
 	S->kissstate = KISSSTATE_SYNCHUNT;
 
 	memset( S->smack_probe, 0, sizeof(S->smack_probe) );
@@ -530,6 +530,268 @@ void ttyreader_init(void)
 
 
 
+/*
+ *  ttyreader_linecheck()  --  open a closed line when it is time,
+ *			       close one that has been silent too long.
+ *			       Returns 1 when the line is open, and
+ *			       pulls *next_timeout to a pending reopen.
+ */
+
+static int ttyreader_linecheck(struct serialport *S, struct timeval *next_timeout)
+{
+	if (S->fd < 0) {
+		if (time_reset && (S->wait_until.tv_sec != 0)) {
+			// System time jumped, reset it to NOW.
+			S->wait_until = tick;
+		}
+
+		/* Not an open TTY, but perhaps waiting ? */
+		if ((S->wait_until.tv_sec != 0) && tv_timercmp( &S->wait_until, &tick) > 0) {
+			/* .. waiting for future! */
+			if (tv_timercmp( next_timeout, &S->wait_until ) > 0) {
+				*next_timeout = S->wait_until;
+			}
+			/* .. but only until our timeout,
+			   if it is sooner than global one. */
+			return 0;	/* Waiting on this one.. */
+		}
+
+		/* Waiting or not, FD is not open, and deadline is past.
+		   Lets try to open! */
+
+		ttyreader_linesetup(S);
+
+	}
+	/* .. No open FD */
+	/* Still no open FD ? */
+	if (S->fd < 0)
+		return 0;
+
+	// FD is open, check read/idle timeout ...
+	if (time_reset) {
+		// System time has jumped, Reset the read time to NOW.
+		S->last_read_something = tick.tv_sec;
+	}
+
+	// FD is open, check read/idle timeout ...
+	if ((S->read_timeout > 0) &&
+	    timecmp(tick.tv_sec, (S->last_read_something + S->read_timeout)) > 0) {
+		if (debug)
+		  printf("%ld\tRead timeout on %s; %d seconds w/o input. fd=%d\n",
+			 tick.tv_sec, S->ttyname, S->read_timeout, S->fd);
+		close(S->fd);	/* Close and mark for re-open */
+		S->fd = -1;
+		tv_timeradd_seconds( &S->wait_until, &tick, TTY_OPEN_RETRY_DELAY_SECS);
+		aprxlog("TTY %s read timeout. Closing TTY for later re-open.\n", S->ttyname);
+		return 0;
+	}
+	return 1;
+}
+
+
+#if defined(HAVE_PTHREAD_CREATE) && defined(ENABLE_PTHREAD)
+/*
+ *  Threaded line mode:  the port's own thread opens the line, reads,
+ *  deframes and checks CRCs of KISS frames, and writes out what the
+ *  core has queued on S->wr.  Valid frames are passed to the core
+ *  over S->rxq, a lock-free single producer, single consumer ring of
+ *
+ *	[ len:2 | crcflags:1 | 0 | frame: len bytes ]
+ *
+ *  records, with a wakeup on S->rxqfd.  The core picks them up in
+ *  ttyreader_postpoll() in port order, so the processing order does
+ *  not depend on thread scheduling.
+ */
+
+#define RXQ_HDRLEN 4
+
+/* Reader thread: put a frame on the queue, or count it as dropped */
+void ttyreader_rxqueue(struct serialport *S, const uint8_t *frame, const int len, const int crcflags)
+{
+	struct ringbuf *Q = &S->rxq;
+	unsigned int head = Q->head;
+	unsigned int at, first;
+	uint8_t hdr[RXQ_HDRLEN];
+	int i;
+
+	__sync_synchronize();	/* see the tail as the core left it */
+	if (Q->mask + 1 - (head - *(volatile unsigned int *)&Q->tail) < len + RXQ_HDRLEN) {
+		++S->rxq_drops;
+		return;
+	}
+
+	hdr[0] = len & 0xFF;
+	hdr[1] = len >> 8;
+	hdr[2] = crcflags;
+	hdr[3] = 0;
+	for (i = 0; i < RXQ_HDRLEN; ++i)
+		Q->data[(head + i) & Q->mask] = hdr[i];
+	at = (head + RXQ_HDRLEN) & Q->mask;
+	first = Q->mask + 1 - at;
+	if (first > len)
+		first = len;
+	memcpy(Q->data + at, frame, first);
+	memcpy(Q->data, frame + first, len - first);
+
+	__sync_synchronize();	/* the record before the head */
+	Q->head = head + RXQ_HDRLEN + len;
+	ttyreader_wake(S->rxqfd[1]);
+}
+
+/* Core: process what the reader thread has queued */
+static void ttyreader_rxdrain(struct serialport *S)
+{
+	struct ringbuf *Q = &S->rxq;
+	uint8_t tmp[sizeof(S->rdline)];
+	const uint8_t *p;
+	unsigned int head;
+	long drops;
+	int len, crcflags;
+
+	ttyreader_wakedrain(S->rxqfd[0]);
+	for (;;) {
+		head = *(volatile unsigned int *)&Q->head;
+		__sync_synchronize();	/* the record after the head */
+		if (head == Q->tail)
+			break;
+		p = ringbuf_linear(Q, 0, RXQ_HDRLEN, tmp);
+		len = p[0] | (p[1] << 8);
+		crcflags = p[2];
+		p = ringbuf_linear(Q, RXQ_HDRLEN, len, tmp);
+
+		kiss_process(S, p, len, crcflags);
+
+		__sync_synchronize();	/* done with it before the tail */
+		Q->tail += RXQ_HDRLEN + len;
+	}
+
+	drops = S->rxq_drops;
+	if (drops != S->rxq_dropseen) {
+		erlang_add(S->ttycallsign[0], ERLANG_DROP, 0, drops - S->rxq_dropseen);
+		S->rxq_dropseen = drops;
+	}
+}
+
+static void *ttyreader_runthread(void *arg)
+{
+	struct serialport *S = arg;
+	struct pollfd pfd[2];
+	struct timeval next;
+	sigset_t sigs_to_block;
+	int n, millis, lineopen;
+
+	sigemptyset(&sigs_to_block);
+	sigaddset(&sigs_to_block, SIGALRM);
+	sigaddset(&sigs_to_block, SIGINT);
+	sigaddset(&sigs_to_block, SIGTERM);
+	sigaddset(&sigs_to_block, SIGQUIT);
+	sigaddset(&sigs_to_block, SIGHUP);
+	sigaddset(&sigs_to_block, SIGURG);
+	sigaddset(&sigs_to_block, SIGPIPE);
+	sigaddset(&sigs_to_block, SIGUSR1);
+	sigaddset(&sigs_to_block, SIGCHLD);
+	pthread_sigmask(SIG_BLOCK, &sigs_to_block, NULL);
+
+	if (debug) printf("ttyreader_runthread(%s)\n", S->ttyname);
+
+	/* The main loop keeps the  tick  current, this only reads it */
+	while (!die_now) {
+		tv_timeradd_seconds(&next, &tick, 1);
+
+		n = 0;
+		pfd[n].fd = S->wakefd[0];
+		pfd[n].events = POLLIN;
+		pfd[n].revents = 0;
+		++n;
+		lineopen = ttyreader_linecheck(S, &next);
+		pthread_mutex_lock(&S->wrlock);
+		S->lineopen = lineopen;	/* the core decides on this and wr */
+		if (lineopen) {
+			pfd[n].fd = S->fd;
+			pfd[n].events = POLLIN | POLLPRI;
+			pfd[n].revents = 0;
+			if (ringbuf_used(&S->wr) > 0)
+				pfd[n].events |= POLLOUT;
+			++n;
+		}
+		pthread_mutex_unlock(&S->wrlock);
+
+		millis = tv_timerdelta_millis(&tick, &next);
+		if (millis < 10)   millis = 10;
+		if (millis > 1000) millis = 1000;
+		if (poll(pfd, n, millis) <= 0)
+			continue;
+
+		if (pfd[0].revents)
+			ttyreader_wakedrain(S->wakefd[0]);
+		if (n > 1) {
+			if (pfd[1].revents & POLLOUT)
+				ttyreader_linewrite(S);
+			if (pfd[1].revents & (POLLIN | POLLPRI | POLLERR | POLLHUP))
+				ttyreader_lineread(S);
+		}
+	}
+	return NULL;
+}
+
+static int ttyreader_pipe(int fds[2])
+{
+#ifdef __linux__
+	fds[0] = fds[1] = eventfd(0, EFD_NONBLOCK);
+	return fds[0] < 0 ? -1 : 0;
+#else
+	if (pipe(fds) < 0)
+		return -1;
+	fd_nonblockingmode(fds[0]);
+	fd_nonblockingmode(fds[1]);
+	return 0;
+#endif
+}
+
+/*
+ *  ttyreader_start()  --  start reader threads of "thread" mode ports
+ */
+void ttyreader_start(void)
+{
+	pthread_attr_t attrs;
+	struct serialport *S;
+	int i;
+
+	pthread_attr_init(&attrs);
+	/* 64 kB stack is plenty, see aprsis_start() */
+	pthread_attr_setstacksize(&attrs, 64*1024);
+
+	for (i = 0; i < ttycount; ++i) {
+		S = ttys[i];
+		if (!S->threaded || !S->ttyname)
+			continue;
+		if (!(S->linetype == LINETYPE_KISS ||
+		      S->linetype == LINETYPE_KISSFLEXNET ||
+		      S->linetype == LINETYPE_KISSBPQCRC ||
+		      S->linetype == LINETYPE_KISSSMACK)) {
+			aprxlog("TTY %s: thread mode is for KISS lines only, not used", S->ttyname);
+			S->threaded = 0;
+			continue;
+		}
+
+		ringbuf_init(&S->rxq, S->rxqbuf, sizeof(S->rxqbuf));
+		pthread_mutex_init(&S->wrlock, NULL);
+		if (ttyreader_pipe(S->wakefd) < 0 || ttyreader_pipe(S->rxqfd) < 0 ||
+		    pthread_create(&S->thread, &attrs, ttyreader_runthread, S) != 0) {
+			aprxlog("TTY %s: can not start reader thread, running without", S->ttyname);
+			S->threaded = 0;
+		}
+	}
+	pthread_attr_destroy(&attrs);
+}
+#else
+void ttyreader_start(void)
+{
+	/* no threads, ports are all run by the main loop */
+}
+#endif
+
+
 /*
  *  ttyreader_prepoll()  --  prepare system for next round of polling
  */
@@ -560,53 +822,19 @@ int ttyreader_prepoll(struct aprxpolls *app)
                 }
 #endif
 
-		if (S->fd < 0) {
-                	if (time_reset && (S->wait_until.tv_sec != 0)) {
-                        	// System time jumped, reset it to NOW.
-                        	S->wait_until = tick;
-                        }
-
-			/* Not an open TTY, but perhaps waiting ? */
-			if ((S->wait_until.tv_sec != 0) && tv_timercmp( &S->wait_until, &tick) > 0) {
-				/* .. waiting for future! */
-                        	if (tv_timercmp( &app->next_timeout, &S->wait_until ) > 0) {
-                                	app->next_timeout = S->wait_until;
-                                }
-				/* .. but only until our timeout,
-				   if it is sooner than global one. */
-				continue;	/* Waiting on this one.. */
-			}
-
-			/* Waiting or not, FD is not open, and deadline is past.
-			   Lets try to open! */
-
-			ttyreader_linesetup(S);
-
-		}
-		/* .. No open FD */
-		/* Still no open FD ? */
-		if (S->fd < 0)
-			continue;
-
-		// FD is open, check read/idle timeout ...
-                if (time_reset) {
-                  // System time has jumped, Reset the read time to NOW.
-                  S->last_read_something = tick.tv_sec;
-                }
-
-		// FD is open, check read/idle timeout ...
-		if ((S->read_timeout > 0) &&
-		    timecmp(tick.tv_sec, (S->last_read_something + S->read_timeout)) > 0) {
-			if (debug)
-			  printf("%ld\tRead timeout on %s; %d seconds w/o input. fd=%d\n",
-				 tick.tv_sec, S->ttyname, S->read_timeout, S->fd);
-			close(S->fd);	/* Close and mark for re-open */
-			S->fd = -1;
-                        tv_timeradd_seconds( &S->wait_until, &tick, TTY_OPEN_RETRY_DELAY_SECS);
-                        aprxlog("TTY %s read timeout. Closing TTY for later re-open.\n", S->ttyname);
+#if defined(HAVE_PTHREAD_CREATE) && defined(ENABLE_PTHREAD)
+		if (S->threaded) {
+			/* Reader thread does the line, wait for its frames */
+			pfd = aprxpolls_new(app);
+			pfd->fd = S->rxqfd[0];
+			pfd->events = POLLIN;
+			pfd->revents = 0;
+			++idx;
 			continue;
 		}
-
+#endif
+		if (!ttyreader_linecheck(S, &app->next_timeout))
+			continue;
 
                 if (poll_millis > 0) {
                         int margin  = poll_millis*2;
@@ -624,7 +852,7 @@ int ttyreader_prepoll(struct aprxpolls *app)
 		pfd->fd = S->fd;
 		pfd->events = POLLIN | POLLPRI;
 		pfd->revents = 0;
-		if (S->wrlen > 0 && S->wrlen > S->wrcursor)
+		if (ringbuf_used(&S->wr) > 0)
 			pfd->events |= POLLOUT;
 
 		++idx;
@@ -652,6 +880,10 @@ int ttyreader_postpoll(struct aprxpolls *app)
         	if (poll_millis > 0) {
 			for (i = 0; i < ttycount; ++i) {
                                	S = ttys[i];
+#if defined(HAVE_PTHREAD_CREATE) && defined(ENABLE_PTHREAD)
+				if (S->threaded)
+					continue;	/* thread owns S->fd */
+#endif
 
 #if 0  // occasional debug mode without real hardware at hand
                                 if (tv_timercmp(&poll_millis_tv, &tick) <= 0) {
@@ -683,6 +915,10 @@ int ttyreader_postpoll(struct aprxpolls *app)
 
 		for (i = 0; i < ttycount; ++i) {
 			S = ttys[i];
+#if defined(HAVE_PTHREAD_CREATE) && defined(ENABLE_PTHREAD)
+			if (S->threaded)
+				continue;	/* thread owns S->fd */
+#endif
 			if (S->fd != P->fd)
 				continue;	/* Not this one ? */
 			/* It is this one! */
@@ -695,6 +931,22 @@ int ttyreader_postpoll(struct aprxpolls *app)
 		}
 	}
 
+#if defined(HAVE_PTHREAD_CREATE) && defined(ENABLE_PTHREAD)
+	/* Frames from reader threads, in port order */
+	for (i = 0; i < ttycount; ++i) {
+		S = ttys[i];
+		if (!S->threaded)
+			continue;
+		ttyreader_rxdrain(S);
+
+		if (poll_millis > 0 &&
+		    tv_timercmp(&poll_millis_tv, &tick) <= 0) {
+			kiss_poll(S);	/* if the thread has the line open */
+			tv_timeradd_millis(&poll_millis_tv, &poll_millis_tv, poll_millis);
+		}
+	}
+#endif
+
 	return 0;
 }
 
@@ -730,6 +982,8 @@ struct serialport *ttyreader_new(void)
 	int baud = B1200;
 
 	tty->fd = -1;
+	ringbuf_init(&tty->rd, tty->rdbuf, sizeof(tty->rdbuf));
+	ringbuf_init(&tty->wr, tty->wrbuf, sizeof(tty->wrbuf));
         tv_timeradd_seconds( &tty->wait_until, &tick, -1); /* begin opening immediately */
 	tty->last_read_something = tick.tv_sec;	/* well, not really.. */
 	tty->linetype  = LINETYPE_KISS;	/* default */
@@ -975,12 +1229,31 @@ int ttyreader_parse_ttyparams(struct configfile *cf, struct serialport *tty, cha
                             printf(" .. pollmillis %d  -- polling interval\n", tty->poll_millis);
                         }
 
+		} else if (strcmp(param1, "thread") == 0) {
+#if defined(HAVE_PTHREAD_CREATE) && defined(ENABLE_PTHREAD)
+			tty->threaded = 1;
+#else
+			printf("%s:%d WARNING: No thread support, THREAD ignored\n", cf->name, cf->linenum);
+#endif
+
 #ifndef DISABLE_IGATE
 		} else if (strcmp(param1, "tnc2") == 0) {
 			tty->linetype = LINETYPE_TNC2;	/* TNC2 monitor */
 
 		} else if (strcmp(param1, "dprs") == 0) {
 			tty->linetype = LINETYPE_DPRSGW;
+
+		} else if (strcmp(param1, "dprs-ratelimit") == 0 ||
+			   strcmp(param1, "dprs-history") == 0) {
+			const char *keyword = param1;
+			param1 = str;
+			str = config_SKIPTEXT(str, NULL);
+			str = config_SKIPSPACE(str);
+			if (dprsgw_config(tty, keyword, param1)) {
+				printf("%s:%d ERROR: Bad %s value: '%s'\n",
+				       cf->name, cf->linenum, keyword, param1);
+				has_fault = 1;
+			}
 #endif
 
 		} else if (strcmp(param1, "initstring") == 0) {
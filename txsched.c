@@ -0,0 +1,342 @@
+/* **************************************************************** *
+ *                                                                  *
+ *  APRX -- 2nd generation APRS iGate and digi with                 *
+ *          minimal requirement of esoteric facilities or           *
+ *          libraries of any kind beyond UNIX system libc.          *
+ *                                                                  *
+ * (c) Matti Aarnio - OH2MQK,  2007-2014                            *
+ *                                                                  *
+ * **************************************************************** */
+
+/*
+ *  Per-interface transmit scheduler.
+ *
+ *  Everything going on air passes through here, tagged with a traffic
+ *  class:  digipeated frames first, then viscous digipeats, Tx-iGated
+ *  frames, beacons and telemetry last.
+ *
+ *  A frame goes out at once when nothing is waiting on the interface,
+ *  the airtime budget has room, and the KISS line is not backed up.
+ *  Otherwise it is copied to the FIFO of its class, and the queues
+ *  are drained highest class first as room opens up.
+ *
+ *  <interface>
+ *     tx-budget  50  [1200]
+ *  </interface>
+ *
+ *  allows the interface to use 50 % of a 1200 bps channel, accounted
+ *  like erlang statistics do:  frame length + 10 bytes at 8.2 bits
+ *  per byte.  Without  tx-budget  there is no airtime limit, and only
+ *  a backed up serial or TCP line holds frames.
+ *
+ *  The queues are bounded.  When full, the oldest frame of the lowest
+ *  class at or below the new one is shed, or the new frame itself.
+ *  Frames older than their class maximum age are expired, a late
+ *  digipeat is worse than none.
+ */
+
+#include "aprx.h"
+
+#define TXSCHED_MAXQUEUE     32	/* frames over all classes */
+#define TXSCHED_BUCKETSECS   10	/* budget bucket depth */
+#define TXSCHED_RETRYMILLIS 100	/* recheck of a backed up KISS line */
+
+struct txframe {
+	struct txframe *next;
+	struct timeval  queued;
+	int64_t         t_arrival;	/* for the latency histogram */
+	int             axaddrlen;
+	int             axdatalen;
+	uint8_t         buf[1];	/* address, then control+pid+data */
+};
+
+struct txsched {
+	float  rate;		/* bytes per second, 0 = no budget */
+	float  tokens;
+	float  depth;
+	struct timeval last;	/* of token refill */
+
+	int    queued;		/* frames in all classes */
+	struct txframe  *head[TXPRIO_CLASSES];
+	struct txframe **tail[TXPRIO_CLASSES];
+
+	long   sent[TXPRIO_CLASSES];
+	long   shed[TXPRIO_CLASSES];
+	long   expired[TXPRIO_CLASSES];
+};
+
+const char *txprio_names[TXPRIO_CLASSES] = {
+	"digi", "viscous", "igate", "beacon", "telemetry"
+};
+
+/* seconds a frame of a class may wait */
+static const int txprio_maxage[TXPRIO_CLASSES] = {
+	10, 10, 30, 60, 120
+};
+
+
+static struct txsched *txsched_new(float rate)
+{
+	struct txsched *T = calloc(1, sizeof(*T));
+	int i;
+
+	T->rate   = rate;
+	T->depth  = rate * TXSCHED_BUCKETSECS;
+	T->tokens = T->depth;
+	T->last   = tick;
+	for (i = 0; i < TXPRIO_CLASSES; ++i)
+		T->tail[i] = &T->head[i];
+	return T;
+}
+
+/*
+ *  tx-budget <percent> [<baud>]
+ */
+int txsched_config(struct aprx_interface *aif, const char *param1, const char *str)
+{
+	int percent = atoi(param1);
+	int baud    = 1200;
+
+	if (*str)
+		baud = atoi(str);
+	if (percent < 1 || percent > 100 || baud < 300) {
+		return 1;
+	}
+	aif->txs = txsched_new(percent / 100.0 * baud / 8.2);
+	return 0;
+}
+
+/* Every interface that may transmit gets a scheduler when it is
+   stored, without airtime budget unless  tx-budget  gave it one */
+void txsched_attach(struct aprx_interface *aif)
+{
+	if (aif->tx_ok && aif->txs == NULL)
+		aif->txs = txsched_new(0.0);
+}
+
+/* A KISS sub-interface gets its own scheduler with parent's budget */
+struct txsched *txsched_clone(const struct txsched *T)
+{
+	if (T == NULL || T->rate == 0.0)
+		return NULL;
+	return txsched_new(T->rate);
+}
+
+static void txsched_refill(struct txsched *T)
+{
+	int millis;
+
+	if (T->rate == 0.0)
+		return;
+	millis = tv_timerdelta_millis(&T->last, &tick);
+	if (millis <= 0 && !time_reset)
+		return;
+	T->last = tick;
+	if (millis > 0)
+		T->tokens += T->rate * millis / 1000.0;
+	if (T->tokens > T->depth)
+		T->tokens = T->depth;
+}
+
+/* May a frame go on air now?  The budget may go into debt by one
+   frame, so no frame is ever too big for it. */
+static int txsched_clear(const struct aprx_interface *aif, const struct txsched *T)
+{
+	if (T->rate != 0.0 && T->tokens <= 0.0)
+		return 0;
+	if ((aif->iftype == IFTYPE_SERIAL || aif->iftype == IFTYPE_TCPIP) &&
+	    aif->tty != NULL &&
+	    kiss_txbacklog(aif->tty) > (int)sizeof(aif->tty->wrbuf) / 2)
+		return 0;
+#ifdef ENABLE_AGWPE
+	if (aif->iftype == IFTYPE_AGWPE && aif->agwpe != NULL &&
+	    agwpe_txbusy(aif->agwpe))
+		return 0;
+#endif
+	return 1;
+}
+
+static void txsched_send(const struct aprx_interface *aif, struct txsched *T, const TxPriority prio, const int64_t t_arrival, uint8_t *axaddr, const int axaddrlen, const char *axdata, const int axdatalen)
+{
+	T->tokens -= axaddrlen + axdatalen + 10;
+	++T->sent[prio];
+	if (t_arrival != 0)
+		erlang_latency(LATENCY_TRANSMIT, latency_now() - t_arrival);
+	interface_transmit_now(aif, axaddr, axaddrlen, axdata, axdatalen);
+}
+
+static void txsched_unlink(struct txsched *T, const int prio)
+{
+	struct txframe *F = T->head[prio];
+
+	T->head[prio] = F->next;
+	if (F->next == NULL)
+		T->tail[prio] = &T->head[prio];
+	--T->queued;
+	free(F);
+}
+
+/* Send what fits from the queues, highest class first */
+static void txsched_drain(const struct aprx_interface *aif, struct txsched *T)
+{
+	struct txframe *F;
+	int prio;
+
+	for (prio = 0; prio < TXPRIO_CLASSES; ++prio) {
+		while ((F = T->head[prio]) != NULL) {
+			if (tv_timerdelta_millis(&F->queued, &tick) > txprio_maxage[prio] * 1000) {
+				++T->expired[prio];
+				if (debug)
+					printf("txsched %s: expired a %s frame\n",
+					       aif->callsign, txprio_names[prio]);
+				txsched_unlink(T, prio);
+				continue;
+			}
+			if (!txsched_clear(aif, T))
+				return;
+			txsched_send(aif, T, prio, F->t_arrival, F->buf, F->axaddrlen,
+				     (const char *)F->buf + F->axaddrlen, F->axdatalen);
+			txsched_unlink(T, prio);
+		}
+	}
+}
+
+void txsched_submit(const struct aprx_interface *aif, const TxPriority prio, const int64_t t_arrival, uint8_t *axaddr, const int axaddrlen, const char *axdata, const int axdatalen)
+{
+	struct txsched *T = aif->txs;
+	struct txframe *F;
+	int victim;
+
+	if (T == NULL) {
+		/* Not a tx-ok interface, nothing to schedule on */
+		if (debug)
+			printf("txsched %s: no scheduler, frame dropped\n", aif->callsign);
+		return;
+	}
+	txsched_refill(T);
+
+	if (T->queued == 0 && txsched_clear(aif, T)) {
+		txsched_send(aif, T, prio, t_arrival, axaddr, axaddrlen, axdata, axdatalen);
+		return;
+	}
+
+	if (T->queued >= TXSCHED_MAXQUEUE) {
+		for (victim = TXPRIO_CLASSES-1; victim >= (int)prio; --victim)
+			if (T->head[victim] != NULL)
+				break;
+		if (debug)
+			printf("txsched %s: queue full, shed a %s frame\n", aif->callsign,
+			       txprio_names[victim < (int)prio ? (int)prio : victim]);
+		if (victim < (int)prio) {
+			++T->shed[prio];
+			return;
+		}
+		++T->shed[victim];
+		txsched_unlink(T, victim);
+	}
+
+	F = malloc(sizeof(*F) + axaddrlen + axdatalen);
+	if (F == NULL) {
+		++T->shed[prio];
+		if (debug)
+			printf("txsched %s: out of memory, shed a %s frame\n",
+			       aif->callsign, txprio_names[prio]);
+		return;
+	}
+	F->next      = NULL;
+	F->queued    = tick;
+	F->t_arrival = t_arrival;
+	F->axaddrlen = axaddrlen;
+	F->axdatalen = axdatalen;
+	memcpy(F->buf, axaddr, axaddrlen);
+	memcpy(F->buf + axaddrlen, axdata, axdatalen);
+	*T->tail[prio] = F;
+	T->tail[prio]  = &F->next;
+	++T->queued;
+
+	txsched_drain(aif, T);
+}
+
+int txsched_prepoll(struct aprxpolls *app)
+{
+	struct timeval when;
+	int i, millis;
+
+	for (i = 0; i < all_interfaces_count; ++i) {
+		struct txsched *T = all_interfaces[i]->txs;
+		if (T == NULL)
+			continue;
+		if (time_reset)
+			T->last = tick;
+		if (T->queued == 0)
+			continue;
+		millis = TXSCHED_RETRYMILLIS;
+		if (T->rate != 0.0 && T->tokens <= 0.0) {
+			millis = 1 + (int)(-T->tokens * 1000.0 / T->rate);
+		}
+		tv_timeradd_millis(&when, &tick, millis);
+		if (tv_timercmp(&when, &app->next_timeout) < 0)
+			app->next_timeout = when;
+	}
+	return 0;
+}
+
+int txsched_postpoll(struct aprxpolls *app)
+{
+	int i;
+
+	(void)app;
+
+	for (i = 0; i < all_interfaces_count; ++i) {
+		struct txsched *T = all_interfaces[i]->txs;
+		if (T == NULL || T->queued == 0)
+			continue;
+		txsched_refill(T);
+		txsched_drain(all_interfaces[i], T);
+	}
+	return 0;
+}
+
+void txsched_metrics(void)
+{
+	static const struct {
+		const char *name;
+		const char *help;
+	} counters[] = {
+		{ "aprx_tx_sent",    "Frames sent by traffic class" },
+		{ "aprx_tx_shed",    "Frames shed on full transmit queue" },
+		{ "aprx_tx_expired", "Frames expired in transmit queue" },
+	};
+	int i, j, k;
+
+	for (k = 0; k < 3; ++k) {
+		metrics_family(counters[k].name, "counter", counters[k].help);
+		for (i = 0; i < all_interfaces_count; ++i) {
+			const struct txsched *T = all_interfaces[i]->txs;
+			if (T == NULL) continue;
+			for (j = 0; j < TXPRIO_CLASSES; ++j) {
+				const long *v = (k == 0 ? T->sent :
+						 k == 1 ? T->shed : T->expired);
+				metrics_printf("%s_total{interface=\"%s\",class=\"%s\"} %ld\n",
+					       counters[k].name, all_interfaces[i]->callsign,
+					       txprio_names[j], v[j]);
+			}
+		}
+	}
+
+	metrics_family("aprx_tx_queued", "gauge", "Frames waiting in transmit queue");
+	for (i = 0; i < all_interfaces_count; ++i) {
+		const struct txsched *T = all_interfaces[i]->txs;
+		if (T == NULL) continue;
+		metrics_printf("aprx_tx_queued{interface=\"%s\"} %d\n",
+			       all_interfaces[i]->callsign, T->queued);
+	}
+
+	metrics_family("aprx_tx_budget_bytes", "gauge", "Airtime budget bucket fill");
+	for (i = 0; i < all_interfaces_count; ++i) {
+		const struct txsched *T = all_interfaces[i]->txs;
+		if (T == NULL || T->rate == 0.0) continue;
+		metrics_printf("aprx_tx_budget_bytes{interface=\"%s\"} %.0f\n",
+			       all_interfaces[i]->callsign, T->tokens);
+	}
+}